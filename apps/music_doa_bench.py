@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  music_doa_bench.py
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+#
+#
+
+# Compares the MUSIC DOA block's full eigendecomposition against OPAST subspace tracking
+# on a synthetic uniform circular array (or against root-MUSIC on a uniform linear array)
+
+import time, math
+import numpy
+from optparse import OptionParser
+from gnuradio import gr, blocks
+import baz
+from baz import music_doa_helper
+
+def main():
+	parser = OptionParser(usage="%prog: [options]")
+
+	parser.add_option("-m", "--antennas", type="int", default=8, help="number of antennas [default=%default]")
+	parser.add_option("-s", "--snapshots", type="int", default=64, help="snapshots per vector [default=%default]")
+	parser.add_option("-v", "--vectors", type="int", default=2000, help="number of vectors [default=%default]")
+	parser.add_option("-r", "--resolution", type="int", default=360, help="angular resolution [default=%default]")
+	parser.add_option("-R", "--radius", type="float", default=0.6, help="array radius in wavelengths [default=%default]")
+	parser.add_option("-f", "--forgetting-factor", type="float", default=0.99, help="forgetting factor [default=%default]")
+	parser.add_option("-N", "--noise", type="float", default=0.3, help="noise amplitude [default=%default]")
+	parser.add_option("-U", "--ula", action="store_true", default=False, help="half-wavelength uniform linear array, and add root-MUSIC [default=%default]")
+	parser.add_option("-d", "--doas", type="string", default="40,135", help="source angles [default=%default]")
+
+	(options, args) = parser.parse_args()
+
+	m = options.antennas
+	doas = [float(x) for x in options.doas.split(',')]
+	n = len(doas)
+	nsamples = m * options.snapshots
+
+	if options.ula:
+		antenna_array = [[0.5 * i, 0.0] for i in range(m)]
+	else:
+		antenna_array = [[options.radius * math.cos(2.0 * math.pi * i / m), options.radius * math.sin(2.0 * math.pi * i / m)] for i in range(m)]
+	array_response = music_doa_helper.calculate_antenna_array_response(antenna_array, options.resolution, 1.0)
+
+	source_response = music_doa_helper.calculate_antenna_array_response(antenna_array, 360, 1.0)
+	steering = numpy.array([source_response[int(round(d)) % 360] for d in doas])	# (n, m)
+	count = options.vectors * options.snapshots
+	amplitudes = (numpy.random.randn(count, n) + 1j * numpy.random.randn(count, n)) / math.sqrt(2.0)
+	noise = options.noise * (numpy.random.randn(count, m) + 1j * numpy.random.randn(count, m)) / math.sqrt(2.0)
+	data = (numpy.dot(amplitudes, steering) + noise).astype(numpy.complex64).flatten()
+
+	print "M: %d, N: %d, %d snapshots x %d vectors, resolution: %d, DOAs: %s" % (m, n, options.snapshots, options.vectors, options.resolution, doas)
+
+	configs = [
+		("eigendecomposition, per vector", 0.0, False, 0.0),
+		("eigendecomposition, ff %.3f" % (options.forgetting_factor), options.forgetting_factor, False, 0.0),
+		("OPAST, ff %.3f" % (options.forgetting_factor), options.forgetting_factor, True, 0.0),
+	]
+	if options.ula:
+		configs += [
+			("root-MUSIC, per vector", 0.0, False, 0.5),
+			("root-MUSIC, OPAST, ff %.3f" % (options.forgetting_factor), options.forgetting_factor, True, 0.5),
+		]
+
+	for (name, forgetting_factor, subspace_tracking, ula_spacing) in configs:
+		tb = gr.top_block()
+		src = blocks.vector_source_c(data.tolist(), False, nsamples)
+		doa = baz.music_doa(m, n, nsamples, array_response, options.resolution, forgetting_factor, subspace_tracking, ula_spacing)
+		ang = blocks.vector_sink_f(n)
+		lvl = blocks.vector_sink_f(n)
+		tb.connect(src, doa)
+		tb.connect((doa, 0), ang)
+		tb.connect((doa, 1), lvl)
+
+		start = time.time()
+		tb.run()
+		elapsed = time.time() - start
+
+		angles = numpy.array(ang.data()).reshape(-1, n)
+		if options.ula:	# Mirror images about the array axis are indistinguishable
+			angles = numpy.where(angles > 180.0, 360.0 - angles, angles)
+		settled = numpy.sort(angles[len(angles)/2:], axis=1)
+		hits = numpy.sum(numpy.all(numpy.abs(settled - numpy.sort(doas)) <= (360.0 / options.resolution), axis=1))
+
+		print "%-40s %8.1f us/vector, %d/%d settled estimates on target" % (name, 1e6 * elapsed / options.vectors, hits, len(settled))
+
+	return 0
+
+if __name__ == '__main__':
+	main()
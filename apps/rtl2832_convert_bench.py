@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  rtl2832_convert_bench.py
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+#
+#
+
+# Compares the RTL2832 source's u8 I/Q conversion kernels (generic look-up table, SSE2, AVX2, NEON: whichever
+# this CPU supports) by replaying random samples from a file, unpaced, and checks they agree with the generic one
+
+import os, time, tempfile
+from optparse import OptionParser
+from gnuradio import gr, blocks
+import baz
+
+def make_source(path, conversion, options):
+	output_size = gr.sizeof_short if options.short else gr.sizeof_gr_complex
+	source = baz.rtl_source_c(defer_creation=True, output_size=output_size)
+	source.set_verbose(False)
+	source.set_replay(path, True)
+	source.set_replay_pacing(False)
+	source.set_remove_dc(options.remove_dc)
+	if not source.set_conversion(conversion):
+		raise Exception("Conversion not supported: %s" % (conversion))
+	if not source.create():
+		raise Exception("Failed to create source")
+	return source
+
+def run(path, conversion, nsamples, options, keep=False):
+	tb = gr.top_block()
+	source = make_source(path, conversion, options)
+	if options.short:
+		head = blocks.head(gr.sizeof_short, 2 * nsamples)	# I & Q are separate items
+		sink = blocks.vector_sink_s() if keep else blocks.null_sink(gr.sizeof_short)
+	else:
+		head = blocks.head(gr.sizeof_gr_complex, nsamples)
+		sink = blocks.vector_sink_c() if keep else blocks.null_sink(gr.sizeof_gr_complex)
+	tb.connect(source, head, sink)
+	start = time.time()
+	tb.run()
+	elapsed = time.time() - start
+	return (elapsed, (sink.data() if keep else None))
+
+def main():
+	parser = OptionParser(usage="%prog: [options]")
+
+	parser.add_option("-n", "--samples", type="int", default=50000000, help="samples to convert per run [default=%default]")
+	parser.add_option("-r", "--runs", type="int", default=3, help="runs per kernel (the fastest is reported) [default=%default]")
+	parser.add_option("-c", "--check-samples", type="int", default=1000000, help="samples compared against the generic kernel [default=%default]")
+	parser.add_option("-F", "--file-size", type="int", default=16*1024*1024, help="bytes of random samples to replay (looped) [default=%default]")
+	parser.add_option("-s", "--short", action="store_true", default=False, help="short output instead of complex float [default=%default]")
+	parser.add_option("-d", "--remove-dc", action="store_true", default=False, help="remove DC [default=%default]")
+	parser.add_option("-k", "--kernels", type="string", default="", help="comma-separated kernels [default=all supported]")
+
+	(options, args) = parser.parse_args()
+
+	if options.kernels:
+		kernels = options.kernels.split(',')
+	else:
+		kernels = list(baz.rtl_source_c(defer_creation=True).conversions())
+
+	(fd, path) = tempfile.mkstemp(suffix=".u8")
+	try:
+		os.write(fd, os.urandom(options.file_size & ~1))
+		os.close(fd)
+
+		(_, reference) = run(path, "generic", options.check_samples, options, True)
+
+		print "%-10s %12s %10s  %s" % ("kernel", "Msamples/s", "speed-up", "vs generic")
+		generic_rate = None
+		for kernel in kernels:
+			best = min([run(path, kernel, options.samples, options)[0] for i in range(options.runs)])
+			rate = options.samples / best
+			if kernel == "generic":
+				generic_rate = rate
+
+			(_, data) = run(path, kernel, options.check_samples, options, True)
+			diff = max([abs(a - b) for (a, b) in zip(data, reference)] + [0])
+			agreement = "identical" if (diff == 0 and len(data) == len(reference)) else ("max difference %g" % (diff))
+
+			speed_up = ("%9.2fx" % (rate / generic_rate)) if generic_rate else "%10s" % ("-")
+			print "%-10s %12.1f %s  %s" % (kernel, rate / 1e6, speed_up, agreement)
+	finally:
+		os.unlink(path)
+
+	return 0
+
+if __name__ == '__main__':
+	main()
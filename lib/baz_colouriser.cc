@@ -33,10 +33,100 @@
 
 #include <cstdio>
 #include "stdio.h"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define COLOURISER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(COLOURISER_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || defined(__clang__))
+#define COLOURISER_AVX2 // Built with a function target attribute and selected at run-time
+#include <immintrin.h>
+#endif
 
 namespace gr {
   namespace baz {
 
+    // Index is (x - lo) * size / dyn_rng, clamped in float so NaN and overflow land on the ends of the table
+    typedef void (*colourise_kernel)(const float* in, char* out, int count, float lo, float size, float dyn_rng, const uint32_t* lut);
+
+    static void colourise_generic(const float* in, char* out, int count, float lo, float size, float dyn_rng, const uint32_t* lut)
+    {
+      const float top = size - 1.0f;
+
+      for (int i = 0; i < count; ++i)
+      {
+        float f = (in[i] - lo) * size / dyn_rng;
+        f = std::min(std::max(0.0f, f), top);  // In this order NaN becomes 0
+
+        memcpy(out + (i * sizeof(uint32_t)), &lut[(int)f], sizeof(uint32_t));
+      }
+    }
+
+#ifdef COLOURISER_SSE2
+    static void colourise_sse2(const float* in, char* out, int count, float lo, float size, float dyn_rng, const uint32_t* lut)
+    {
+      const __m128 _lo = _mm_set1_ps(lo), _size = _mm_set1_ps(size), _dyn_rng = _mm_set1_ps(dyn_rng);
+      const __m128 zero = _mm_setzero_ps(), top = _mm_set1_ps(size - 1.0f);
+
+      int i = 0;
+      for (; i < (count & ~3); i += 4)
+      {
+        __m128 f = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in + i), _lo), _size), _dyn_rng);
+        f = _mm_min_ps(_mm_max_ps(f, zero), top); // maxps returns the second operand for NaN
+
+        int32_t idx[4];
+        _mm_storeu_si128((__m128i*)idx, _mm_cvttps_epi32(f));
+        _mm_storeu_si128((__m128i*)(out + (i * sizeof(uint32_t))), _mm_setr_epi32(lut[idx[0]], lut[idx[1]], lut[idx[2]], lut[idx[3]]));
+      }
+
+      colourise_generic(in + i, out + (i * sizeof(uint32_t)), count - i, lo, size, dyn_rng, lut);
+    }
+#endif // COLOURISER_SSE2
+
+#ifdef COLOURISER_AVX2
+    __attribute__((target("avx2")))
+    static void colourise_avx2(const float* in, char* out, int count, float lo, float size, float dyn_rng, const uint32_t* lut)
+    {
+      const __m256 _lo = _mm256_set1_ps(lo), _size = _mm256_set1_ps(size), _dyn_rng = _mm256_set1_ps(dyn_rng);
+      const __m256 zero = _mm256_setzero_ps(), top = _mm256_set1_ps(size - 1.0f);
+
+      int i = 0;
+      for (; i < (count & ~7); i += 8)
+      {
+        __m256 f = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in + i), _lo), _size), _dyn_rng);
+        f = _mm256_min_ps(_mm256_max_ps(f, zero), top);
+
+        __m256i colours = _mm256_i32gather_epi32((const int*)lut, _mm256_cvttps_epi32(f), sizeof(uint32_t));
+        _mm256_storeu_si256((__m256i*)(out + (i * sizeof(uint32_t))), colours);
+      }
+
+      colourise_generic(in + i, out + (i * sizeof(uint32_t)), count - i, lo, size, dyn_rng, lut);
+    }
+#endif // COLOURISER_AVX2
+
+    static colourise_kernel select_colourise_kernel(const char** name)
+    {
+#ifdef COLOURISER_AVX2
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+      {
+        *name = "avx2";
+        return colourise_avx2;
+      }
+#endif // COLOURISER_AVX2
+#ifdef COLOURISER_SSE2
+      *name = "sse2";
+      return colourise_sse2;
+#else
+      *name = "generic";
+      return colourise_generic;
+#endif
+    }
+
     class colouriser_impl : public colouriser
     {
     private:
@@ -44,15 +134,23 @@ namespace gr {
       float d_ref_lvl, d_dyn_rng;
       std::vector<uint32_t> d_lut;
       int d_vlen_in;
+      int d_vlen_out;
+      int d_reduce;
+      std::vector<int> d_bin_edges;  // Input bins [d_bin_edges[p], d_bin_edges[p+1]) make pixel p
+      std::vector<float> d_row;
+      colourise_kernel d_colourise;
       static const int BPP = 4;
 
+      void reduce_row(const float* in, float* out);
+
     public:
-      colouriser_impl(float ref_lvl = 1.0, float dyn_rng = 1.0, int vlen_in = 1, bool verbose = false);
+      colouriser_impl(float ref_lvl = 1.0, float dyn_rng = 1.0, int vlen_in = 1, bool verbose = false, int vlen_out = 0, int reduce = REDUCE_MAX);
       ~colouriser_impl();
 
       // FIXME: If verbose, print values on change
       void set_dyn_rng(float dyn_rng) { d_dyn_rng = dyn_rng; }
       void set_ref_lvl(float ref_lvl) { d_ref_lvl = ref_lvl; }
+      void set_reduce(int reduce) { d_reduce = reduce; }
 
       //float gain() const { return d_gain; }
 
@@ -68,21 +166,37 @@ namespace gr {
     };
 
     colouriser::sptr
-    colouriser::make(float ref_lvl, float dyn_rng, int vlen_in, bool verbose)
+    colouriser::make(float ref_lvl, float dyn_rng, int vlen_in, bool verbose, int vlen_out, int reduce)
     {
-      return gnuradio::get_initial_sptr(new colouriser_impl(ref_lvl, dyn_rng, vlen_in, verbose));
+      return gnuradio::get_initial_sptr(new colouriser_impl(ref_lvl, dyn_rng, vlen_in, verbose, vlen_out, reduce));
     }
 
-    colouriser_impl::colouriser_impl(float ref_lvl, float dyn_rng, int vlen_in, bool verbose)
+    colouriser_impl::colouriser_impl(float ref_lvl, float dyn_rng, int vlen_in, bool verbose, int vlen_out, int reduce)
       : block("colouriser",
               io_signature::make(1, 1, (sizeof(float) * vlen_in)),
               io_signature::make(1, 1, sizeof(char)))
     , d_ref_lvl(ref_lvl)
     , d_dyn_rng(dyn_rng)
     , d_vlen_in(vlen_in)
+    , d_vlen_out((vlen_out > 0) ? vlen_out : vlen_in)
+    , d_reduce(reduce)
     , d_verbose(verbose)
     {
-      set_output_multiple(BPP);
+      if (d_vlen_out > d_vlen_in)
+        throw std::invalid_argument("colouriser: vlen_out must not exceed vlen_in");
+
+      set_output_multiple(BPP * d_vlen_out);  // Whole rows only
+
+      if (d_vlen_out != d_vlen_in)
+      {
+        for (int p = 0; p <= d_vlen_out; ++p)
+          d_bin_edges.push_back((int)(((int64_t)p * d_vlen_in) / d_vlen_out));
+
+        d_row.resize(d_vlen_out);
+      }
+
+      const char* kernel_name = NULL;
+      d_colourise = select_colourise_kernel(&kernel_name);
 
       size_t gradient_len = sizeof(gradient) / sizeof(gradient[0]);
 
@@ -125,9 +239,9 @@ namespace gr {
         d_lut.push_back(c);
       }
 
-      fprintf(stderr, "[%s<%ld>] ref level: %f, dyn range: %f, vlen_in: %d, verbose: %s, gradient size: %lu\n", name().c_str(), unique_id(), ref_lvl, dyn_rng, vlen_in, (verbose ? "yes" : "no"), d_lut.size());
+      fprintf(stderr, "[%s<%ld>] ref level: %f, dyn range: %f, vlen_in: %d, vlen_out: %d, reduce: %s, verbose: %s, gradient size: %lu, kernel: %s\n", name().c_str(), unique_id(), ref_lvl, dyn_rng, vlen_in, d_vlen_out, (reduce == REDUCE_AVERAGE ? "average" : "max"), (verbose ? "yes" : "no"), d_lut.size(), kernel_name);
 
-      set_relative_rate((double)(BPP * vlen_in));
+      set_relative_rate((double)(BPP * d_vlen_out));
     }
 
     colouriser_impl::~colouriser_impl()
@@ -155,40 +269,70 @@ namespace gr {
 
       //assert(noutput_items <= (ninput_items[0] * BPP));
 
-      if (((ninput_items[0] * d_vlen_in) * BPP) < noutput_items)
+      if (((ninput_items[0] * d_vlen_out) * BPP) < noutput_items)
       {
         fprintf(stderr, "[%s<%ld>] Too few items!\n", name().c_str(), unique_id());
 
         return -1;
       }
 
-      int rounded_noutput_items = ((noutput_items / BPP) / d_vlen_in) * d_vlen_in * BPP;
+      int rows = noutput_items / (d_vlen_out * BPP);
 
-      if (rounded_noutput_items == 0) // FIXME: This is happening all the time?!
+      if (rows == 0)
+        return 0;
+
+      ///*if (d_verbose) */fprintf(stderr, "[%s<%ld>] Work: out %d, in %d\n", name().c_str(), unique_id(), noutput_items, ninput_items[0]);
+
+      const float lo = d_ref_lvl - d_dyn_rng;
+      const float size = (float)d_lut.size();
+
+      if (d_vlen_out == d_vlen_in)
       {
-        //fprintf(stderr, "[%s<%ld>] Too few input vectors!\n", name().c_str(), unique_id());
+        d_colourise(iptr, optr, rows * d_vlen_in, lo, size, d_dyn_rng, &d_lut[0]);
+      }
+      else
+      {
+        for (int r = 0; r < rows; ++r)
+        {
+          reduce_row(iptr + (r * d_vlen_in), &d_row[0]);
 
-        return 0;
+          d_colourise(&d_row[0], optr + (r * d_vlen_out * BPP), d_vlen_out, lo, size, d_dyn_rng, &d_lut[0]);
+        }
       }
 
-      ///*if (d_verbose) */fprintf(stderr, "[%s<%ld>] Work: out %d, in %d\n", name().c_str(), unique_id(), noutput_items, ninput_items[0]);
+      consume(0, rows);
 
-      int i = 0;
-      for (; i < (rounded_noutput_items / BPP); i++)
+      return (rows * d_vlen_out * BPP);
+    }
+
+    void colouriser_impl::reduce_row(const float* in, float* out)
+    {
+      if (d_reduce == REDUCE_AVERAGE)
       {
-        int idx = (int)((iptr[i] - (d_ref_lvl - d_dyn_rng)) * (float)d_lut.size() / d_dyn_rng);
+        for (int p = 0; p < d_vlen_out; ++p)
+        {
+          const int first = d_bin_edges[p], last = d_bin_edges[p + 1];
 
-        if (idx < 0)
-          idx = 0;
-        else if (idx >= d_lut.size())
-          idx = d_lut.size() - 1;
+          float sum = 0.0f;
+          for (int b = first; b < last; ++b)
+            sum += in[b];
 
-        memcpy(optr + (i * BPP), &d_lut[idx], BPP);
+          out[p] = sum / (float)(last - first);
+        }
       }
+      else
+      {
+        for (int p = 0; p < d_vlen_out; ++p)
+        {
+          const int first = d_bin_edges[p], last = d_bin_edges[p + 1];
 
-      consume(0, i / d_vlen_in);  // Will divide due to rounding above
+          float peak = in[first];
+          for (int b = first + 1; b < last; ++b)
+            peak = std::max(peak, in[b]);
 
-      return rounded_noutput_items;
+          out[p] = peak;
+        }
+      }
     }
 
   } /* namespace baz */
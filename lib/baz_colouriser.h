@@ -42,10 +42,18 @@ namespace gr {
       // gr::baz::colouriser::sptr
       typedef boost::shared_ptr<colouriser> sptr;
 
-      static sptr make(float ref_lvl = 1.0, float dyn_rng = 1.0, int vlen_in = 1, bool verbose = false);
+      // How bins are combined when vlen_out < vlen_in
+      enum reduce_mode {
+        REDUCE_MAX = 0,     // Max-hold
+        REDUCE_AVERAGE = 1  // Mean of the input values (e.g. dB)
+      };
+
+      // vlen_out: pixels per row (0: vlen_in)
+      static sptr make(float ref_lvl = 1.0, float dyn_rng = 1.0, int vlen_in = 1, bool verbose = false, int vlen_out = 0, int reduce = REDUCE_MAX);
 
       virtual void set_dyn_rng(float dyn_rng) = 0;
       virtual void set_ref_lvl(float ref_lvl) = 0;
+      virtual void set_reduce(int reduce) = 0;
 
       //virtual float gain() const = 0;
     };
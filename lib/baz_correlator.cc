@@ -40,6 +40,8 @@
 #include <volk/volk.h>
 
 #include <fstream>
+#include <string.h>
+#include <math.h>
 
 /*
  * Create a new instance of baz_correlator and return
@@ -56,7 +58,8 @@ baz_make_correlator(
     int sync_length,
     int sync_offset,
     //sync_dtype='c8',
-    int sync_window_length
+    int sync_window_length,
+    int fft_threshold
 )
 {
   return baz_correlator_sptr(new baz_correlator(
@@ -65,11 +68,43 @@ baz_make_correlator(
     window_length,
     threshold,
     width,
-    sync_path,
+    std::vector<std::string>(1, sync_path),
     sync_length,
     sync_offset,
     //sync_dtype='c8',
-    sync_window_length
+    sync_window_length,
+    std::vector<float>(),
+    fft_threshold
+));
+}
+
+baz_correlator_sptr
+baz_make_correlator_bank(
+    float samp_rate,
+    float symbol_rate,
+    int window_length,
+    float threshold,
+    int width,
+    const std::vector<std::string>& sync_paths,
+    int sync_length,
+    int sync_offset,
+    int sync_window_length,
+    const std::vector<float>& freq_offsets,
+    int fft_threshold
+)
+{
+  return baz_correlator_sptr(new baz_correlator(
+    samp_rate,
+    symbol_rate,
+    window_length,
+    threshold,
+    width,
+    sync_paths,
+    sync_length,
+    sync_offset,
+    sync_window_length,
+    freq_offsets,
+    fft_threshold
 ));
 }
 
@@ -87,6 +122,11 @@ static const int MAX_IN = 1;	// maximum number of input streams
 static const int MIN_OUT = 1;	// minimum number of output streams
 static const int MAX_OUT = 2;	// maximum number of output streams
 
+static int count_templates(const std::vector<std::string>& sync_paths, const std::vector<float>& freq_offsets)
+{
+    return (sync_paths.size() * std::max((size_t)1, freq_offsets.size()));
+}
+
 /*
  * The private constructor
  */
@@ -96,15 +136,17 @@ baz_correlator::baz_correlator(
     int window_length,
     float threshold,
     int width,
-    const char* sync_path,
+    const std::vector<std::string>& sync_paths,
     int sync_length,
     int sync_offset,
     //sync_dtype='c8',
-    int sync_window_length
+    int sync_window_length,
+    const std::vector<float>& freq_offsets,
+    int fft_threshold
 )
 	: gr::block("correlator",
 		gr::io_signature::make(MIN_IN,  MAX_IN,  sizeof(std::complex<float>)),
-		gr::io_signature::make2(MIN_OUT, MAX_OUT, sizeof(float) * width, sizeof(float))),
+		gr::io_signature::make2(MIN_OUT, MAX_OUT, sizeof(float) * width, sizeof(float) * std::max(1, count_templates(sync_paths, freq_offsets)))),
 	d_samp_rate(samp_rate),
     d_symbol_rate(symbol_rate),
     d_window_length(window_length),
@@ -112,13 +154,25 @@ baz_correlator::baz_correlator(
     d_width(width),
     d_sync_window_length(sync_window_length),
 
+    d_sync_length(sync_length),
+    d_sync_template(0),
     d_synced(false),
     d_current_idx(0),
     d_next_window_idx(0),
     d_max_peak(0),
     d_max_peak_idx(-1),
+    d_max_peak_template(-1),
+    d_max_peak_corr_idx(0),
+    d_corr_tag_pending(false),
+    d_srcid(pmt::string_to_symbol(alias())),
     d_sync_window_idx(-1),
-    d_current_item_idx(0)
+    d_current_item_idx(0),
+    d_fft_threshold(fft_threshold),
+    d_use_fft(false),
+    d_fft_size(0),
+    d_fft_step(0),
+    d_fwd_fft(NULL),
+    d_inv_fft(NULL)
 {
 	const int alignment_multiple = volk_get_alignment() / sizeof(gr_complex);
     set_alignment(std::max(1, alignment_multiple));
@@ -126,13 +180,14 @@ baz_correlator::baz_correlator(
   	float relative_rate = /*(float)width*/1.0f / (samp_rate / symbol_rate * (float)window_length);
 	set_relative_rate(relative_rate);
 
-	fprintf(stderr, "[%s<%ld>] sample rate: %f, symbole rate: %f, window length: %d, threshold: %f, width: %d, sync path: \"%s\", sync length: %d, sync offset: %d, sync window length: %d, relative rate: %f\n", name().c_str(), unique_id(),
+	fprintf(stderr, "[%s<%ld>] sample rate: %f, symbole rate: %f, window length: %d, threshold: %f, width: %d, sync paths: %d, frequency offsets: %d, sync length: %d, sync offset: %d, sync window length: %d, relative rate: %f\n", name().c_str(), unique_id(),
 		samp_rate,
 	    symbol_rate,
 	    window_length,
 	    threshold,
 	    width,
-	    sync_path,
+	    (int)sync_paths.size(),
+	    (int)freq_offsets.size(),
 	    sync_length,
 	    sync_offset,
 	    sync_window_length,
@@ -143,26 +198,86 @@ baz_correlator::baz_correlator(
 	int res = 0;
 
 	const int item_size = sizeof(std::complex<float>);
-	d_sync.resize(sync_length);
-
-	std::ifstream f(sync_path, std::ifstream::in | std::ifstream::binary);
-	if (f.is_open() == false)
-		throw std::runtime_error(boost::str(boost::format("failed to open: \"%s\"") % sync_path));
-	f.seekg(sync_offset * item_size);
-	std::istream::streampos posStart = f.tellg();
-    // FIXME: Read into buffer from volk_malloc
-	f.read((char*)&d_sync[0], sync_length * item_size);
-	std::istream::streampos posEnd = f.tellg();
-	int samples_read = (posEnd - posStart) / item_size;
-	fprintf(stderr, "[%s<%ld>] read %d sync samples\n", name().c_str(), unique_id(), samples_read);
-
-    if (samples_read < sync_length)
-        throw std::runtime_error("not able to read all sync samples");
+
+    if (sync_paths.empty())
+        throw std::runtime_error("no sync paths");
+
+    std::vector<float> offsets(freq_offsets);
+    if (offsets.empty())
+        offsets.push_back(0.0f);
+
+    std::vector<std::complex<float> > sync(sync_length);
+
+    for (size_t i = 0; i < sync_paths.size(); ++i)
+    {
+        const char* sync_path = sync_paths[i].c_str();
+
+    	std::ifstream f(sync_path, std::ifstream::in | std::ifstream::binary);
+    	if (f.is_open() == false)
+    		throw std::runtime_error(boost::str(boost::format("failed to open: \"%s\"") % sync_path));
+    	f.seekg(sync_offset * item_size);
+    	std::istream::streampos posStart = f.tellg();
+        // FIXME: Read into buffer from volk_malloc
+    	f.read((char*)&sync[0], sync_length * item_size);
+    	std::istream::streampos posEnd = f.tellg();
+    	int samples_read = (posEnd - posStart) / item_size;
+    	fprintf(stderr, "[%s<%ld>] read %d sync samples from \"%s\"\n", name().c_str(), unique_id(), samples_read, sync_path);
+
+        if (samples_read < sync_length)
+            throw std::runtime_error("not able to read all sync samples");
+
+        for (size_t j = 0; j < offsets.size(); ++j)
+        {
+            std::vector<std::complex<float> > t(sync);
+
+            if (offsets[j] != 0.0f)
+            {
+                const double phase_inc = 2.0 * M_PI * (double)offsets[j] / (double)samp_rate;
+                for (int n = 0; n < sync_length; ++n)
+                    t[n] *= std::polar(1.0f, (float)fmod(phase_inc * n, 2.0 * M_PI));
+            }
+
+            d_templates.push_back(t);
+        }
+    }
 
     // FIXME: volk_malloc
 	d_conjmul_result.resize(sync_length);
     //d_abs_result.resize(sync_length);
 
+    d_use_fft = ((d_fft_threshold > 0) && (sync_length >= d_fft_threshold));
+
+    if (d_use_fft)
+    {
+        d_fft_size = 1;
+        while (d_fft_size < (4 * sync_length))  // Overlap-save: 4x keeps ~3/4 of each block as valid lags
+            d_fft_size <<= 1;
+        d_fft_step = d_fft_size - sync_length + 1;
+
+        d_fwd_fft = new gr::fft::fft_complex(d_fft_size, true);
+        d_inv_fft = new gr::fft::fft_complex(d_fft_size, false);
+
+        const float scale = 1.0f / (float)d_fft_size;   // Inverse FFT is not normalised
+        d_template_spectra.resize(d_templates.size());
+
+        for (size_t t = 0; t < d_templates.size(); ++t)
+        {
+            std::complex<float>* fft_in = d_fwd_fft->get_inbuf();
+            memset(fft_in, 0x00, d_fft_size * item_size);
+            memcpy(fft_in, &d_templates[t][0], sync_length * item_size);
+            d_fwd_fft->execute();
+
+            const std::complex<float>* fft_out = d_fwd_fft->get_outbuf();
+            d_template_spectra[t].resize(d_fft_size);
+            for (int i = 0; i < d_fft_size; ++i)
+                d_template_spectra[t][i] = std::conj(fft_out[i]) * scale;
+        }
+
+        d_fft_magnitudes.resize(d_fft_step);
+
+        fprintf(stderr, "[%s<%ld>] using FFT correlation: size: %d, step: %d, templates: %d\n", name().c_str(), unique_id(), d_fft_size, d_fft_step, (int)d_templates.size());
+    }
+
     // FIXME: Msg port to restart search
 }
 
@@ -171,6 +286,10 @@ baz_correlator::baz_correlator(
  */
 baz_correlator::~baz_correlator()
 {
+    if (d_fwd_fft)
+        delete d_fwd_fft;
+    if (d_inv_fft)
+        delete d_inv_fft;
 }
 
 std::complex<float> baz_correlator::correlate(const std::complex<float>* in, const std::complex<float>* sync)
@@ -178,7 +297,7 @@ std::complex<float> baz_correlator::correlate(const std::complex<float>* in, con
   	//volk_32fc_x2_multiply_conjugate_32fc(&d_conjmul_result[0], in, sync, d_conjmul_result.size());
 
     std::complex<float> c(0,0);
-    for (size_t n = 0; n < d_sync.size(); ++n)
+    for (int n = 0; n < d_sync_length; ++n)
     {
         //d_conjmul_result[n] = in[n] * std::conj(sync[n]);   // FIXME: Pre-compute conj
         //d_abs_result[n] = std::abs(d_conjmul_result[n]);
@@ -198,6 +317,95 @@ std::complex<float> baz_correlator::correlate(const std::complex<float>* in, con
     return c;
 }
 
+void baz_correlator::correlate_fft(const std::complex<float>* in, int count, float* out, int template_idx)
+{
+    const int item_size = sizeof(std::complex<float>);
+    const int first = ((template_idx < 0) ? 0 : template_idx);
+    const int last = ((template_idx < 0) ? (int)d_templates.size() : (template_idx + 1));
+    const int stride = last - first;
+
+    while (count > 0)
+    {
+        int lags = std::min(count, d_fft_step);
+        int avail = lags + (d_sync_length - 1);
+
+        std::complex<float>* fft_in = d_fwd_fft->get_inbuf();
+        memcpy(fft_in, in, avail * item_size);
+        if (avail < d_fft_size)
+            memset(fft_in + avail, 0x00, (d_fft_size - avail) * item_size);
+
+        d_fwd_fft->execute();   // Once per block, shared by every template
+
+        for (int t = first; t < last; ++t)
+        {
+            volk_32fc_x2_multiply_32fc(d_inv_fft->get_inbuf(), d_fwd_fft->get_outbuf(), &d_template_spectra[t][0], d_fft_size);
+
+            d_inv_fft->execute();
+
+            // The first 'lags' outputs of the circular correlation are free of wrap-around
+            if (stride == 1)
+            {
+                volk_32fc_magnitude_32f(out, d_inv_fft->get_outbuf(), lags);
+            }
+            else
+            {
+                volk_32fc_magnitude_32f(&d_fft_magnitudes[0], d_inv_fft->get_outbuf(), lags);
+                for (int i = 0; i < lags; ++i)
+                    out[(i * stride) + (t - first)] = d_fft_magnitudes[i];
+            }
+        }
+
+        in += lags;
+        out += (lags * stride);
+        count -= lags;
+    }
+}
+
+// Releases held-back output 1 rows once synced, tagging the peak's row as it goes out
+int baz_correlator::flush_corr(float* out_corr, int space, uint64_t corr_idx)
+{
+    static const pmt::pmt_t template_key = pmt::string_to_symbol("sync_template");
+
+    if (d_synced == false)  // Window still open
+        return 0;
+
+    const int template_count = d_templates.size();
+    const int count = std::min(space, (int)(d_corr_pending.size() / template_count));
+    if (count <= 0)
+        return 0;
+
+    memcpy(out_corr, &d_corr_pending[0], count * template_count * sizeof(float));
+    d_corr_pending.erase(d_corr_pending.begin(), d_corr_pending.begin() + (count * template_count));
+
+    if ((d_corr_tag_pending) && (d_max_peak_corr_idx < (corr_idx + count)))
+    {
+        add_item_tag(1, d_max_peak_corr_idx, template_key, pmt::from_long(d_sync_template), d_srcid);
+        d_corr_tag_pending = false;
+    }
+
+    return count;
+}
+
+void baz_correlator::correlate_magnitudes(const std::complex<float>* in, int count, float* out, int template_idx /*= -1*/)
+{
+    // FFT magnitudes match the time-domain loop to within float rounding, not bit for bit: a lag that is that close
+    // to the threshold, or to a rival lag or template, can be decided differently by the two paths
+    if (d_use_fft)
+    {
+        correlate_fft(in, count, out, template_idx);
+        return;
+    }
+
+    const int first = ((template_idx < 0) ? 0 : template_idx);
+    const int last = ((template_idx < 0) ? (int)d_templates.size() : (template_idx + 1));
+
+    for (int n = 0; n < count; ++n)
+    {
+        for (int t = first; t < last; ++t)
+            *out++ = std::abs(correlate(in + n, &d_templates[t][0]));
+    }
+}
+
 int baz_correlator::general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 {
   	const std::complex<float>* in = (const std::complex<float> *)input_items[0];
@@ -208,65 +416,121 @@ int baz_correlator::general_work(int noutput_items, gr_vector_int &ninput_items,
 
   	uint64_t read = nitems_read(0);
   	int in_items = ninput_items[0];
+    const int template_count = d_templates.size();
+
+    static const pmt::pmt_t template_key = pmt::string_to_symbol("sync_template");
 
   	int out_corr_produced = 0;
 
+    if ((out_corr) && (d_corr_pending.empty() == false))  // Left over from the call that synced
+    {
+        out_corr_produced = flush_corr(out_corr, noutput_items, nitems_written(1));
+        if (out_corr_produced > 0)
+        {
+            produce(1, out_corr_produced);
+            return WORK_CALLED_PRODUCE;
+        }
+    }
+
   	if (d_synced == false)
   	{
-        if (in_items < d_sync.size())
+        if (in_items < d_sync_length)
             return 0;   // Need more inputs FIXME: forcast?
 
-        int64_t sync_limit = (in_items - (d_sync.size() - 1));  // [0, limit)
+        int64_t sync_limit = (in_items - (d_sync_length - 1));  // [0, limit)
 
         size_t n = 0;
+        bool found = false;
 
-  		for (; n < sync_limit; n++)
+        const int chunk_length = (d_use_fft ? d_fft_step : 1024);
+        if (d_magnitudes.size() < (chunk_length * template_count))
+            d_magnitudes.resize(chunk_length * template_count);
+
+  		while ((n < sync_limit) && (found == false))
   		{
-			std::complex<float> c = correlate(in + n, &d_sync[0]);
+            int chunk = std::min((int64_t)chunk_length, (int64_t)(sync_limit - n));
 
-			float f = std::abs(c);
+            if ((out_corr) && (d_sync_window_idx == -1))    // Rows outside a sync window go straight out
+            {
+                chunk = std::min(chunk, (noutput_items - out_corr_produced));
+                if (chunk <= 0)
+                    break;
+            }
 
-			if (out_corr)
-			{
-				out_corr[out_corr_produced] = f;
-				++out_corr_produced;
-			}
+            correlate_magnitudes(in + n, chunk, &d_magnitudes[0]);
 
-			if (f > d_threshold)
+            for (int i = 0; i < chunk; ++i, ++n)
             {
-                if (d_sync_window_idx == -1)
+                const float* mags = &d_magnitudes[i * template_count];
+
+                int t = 0;
+                for (int j = 1; j < template_count; ++j)
                 {
-                    d_sync_window_idx = d_sync_window_length;
-                    d_max_peak = 0;
-                    d_max_peak_idx = -1;
+                    if (mags[j] > mags[t])
+                        t = j;
                 }
-            }
 
-            if (d_sync_window_idx > -1)
-            {
-                if (f > d_max_peak)
+                float f = mags[t];
+
+                if (f > d_threshold)
                 {
-                    d_max_peak = f;
-                    d_max_peak_idx = read + n;
+                    if (d_sync_window_idx == -1)
+                    {
+                        d_sync_window_idx = d_sync_window_length;
+                        d_max_peak = 0;
+                        d_max_peak_idx = -1;
+                    }
                 }
 
-                --d_sync_window_idx;
-            }
-            
-            if ((d_sync_window_idx == -1) && (d_max_peak_idx > -1))
-            {
-                d_synced = true;
-                d_current_idx = d_max_peak_idx;
-                d_next_window_idx = d_max_peak_idx + d_window_length + (d_width / 2);
-                d_current_item_idx = 0;
-                d_max_peak_idx = -1;
+                uint64_t corr_idx = nitems_written(1) + out_corr_produced + (d_corr_pending.size() / template_count);
+
+                if (out_corr)
+                {
+                    if (d_sync_window_idx > -1) // The peak may be any row until the window closes
+                        d_corr_pending.insert(d_corr_pending.end(), mags, mags + template_count);
+                    else
+                    {
+                        memcpy(out_corr + (out_corr_produced * template_count), mags, template_count * sizeof(float));
+                        ++out_corr_produced;
+                    }
+                }
+
+                if (d_sync_window_idx > -1)
+                {
+                    if (f > d_max_peak)
+                    {
+                        d_max_peak = f;
+                        d_max_peak_idx = read + n;
+                        d_max_peak_template = t;
+                        d_max_peak_corr_idx = corr_idx;
+                    }
+
+                    --d_sync_window_idx;
+                }
+
+                if ((d_sync_window_idx == -1) && (d_max_peak_idx > -1))
+                {
+                    d_synced = true;
+                    d_sync_template = d_max_peak_template;
+
+                    d_corr_tag_pending = (out_corr != NULL);
+
+                    d_current_idx = d_max_peak_idx;
+                    d_next_window_idx = d_max_peak_idx + d_window_length + (d_width / 2);
+                    d_current_item_idx = 0;
+                    d_max_peak_idx = -1;
 
-                ++n;
-                break;
+                    ++n;
+                    found = true;
+                    break;
+                }
             }
 		}
 
         consume(0, n);
+
+        if (out_corr)
+            out_corr_produced += flush_corr(out_corr + (out_corr_produced * template_count), (noutput_items - out_corr_produced), (nitems_written(1) + out_corr_produced));
   	}
   	else
   	{
@@ -274,22 +538,27 @@ int baz_correlator::general_work(int noutput_items, gr_vector_int &ninput_items,
 
         if (offset <= 0)
         {
-            if (in_items < d_sync.size())
+            if (in_items < d_sync_length)
                 return 0;   // Need more input FIXME: forcast?
 
-            int64_t sync_limit = (in_items - (d_sync.size() - 1));  // [0, limit)
-            int64_t width_limit = offset + (d_width - 1) + d_sync.size();
+            int64_t sync_limit = (in_items - (d_sync_length - 1));  // [0, limit)
+            int64_t width_limit = offset + (d_width - 1) + d_sync_length;
 
             int64_t n = 0;
 
             d_current_item_idx = -offset;
 
-            for (; n < std::min(std::min(sync_limit, width_limit), (int64_t)noutput_items); n++)
+            int64_t limit = std::min(std::min(sync_limit, width_limit), (int64_t)noutput_items);
+            if (limit > 0)
             {
-                std::complex<float> c = correlate(in + n, &d_sync[0]);
+                correlate_magnitudes(in, limit, out, d_sync_template);
 
-                out[n] = std::abs(c);
+                if (offset == 0)    // Start of window
+                    add_item_tag(0, nitems_written(0), template_key, pmt::from_long(d_sync_template), d_srcid);
+            }
 
+            for (; n < limit; n++)
+            {
                 if (-offset == ((d_width / 2) - (d_sync_window_length / 2)))
                 {
                     d_sync_window_idx = d_sync_window_length;
@@ -29,6 +29,7 @@
 #define INCLUDED_BAZ_CORRELATOR_H
 
 #include <gnuradio/sync_block.h>
+#include <gnuradio/fft/fft.h>
 
 class BAZ_API baz_correlator;
 
@@ -62,7 +63,32 @@ BAZ_API baz_correlator_sptr baz_make_correlator (
     int sync_length=511,
     int sync_offset=50,
     //sync_dtype='c8',
-    int sync_window_length=500
+    int sync_window_length=500,
+    int fft_threshold=64    // Use overlap-save FFT correlation when sync_length >= this (<= 0 disables)
+);
+
+/*!
+ * \brief Return a correlator that searches for several sync words at once.
+ *
+ * Each file in sync_paths is shifted by every entry in freq_offsets (Hz, none = 0 Hz),
+ * giving (files x offsets) templates indexed file-major. The second output is a vector
+ * of one correlation magnitude per template, and the peak it syncs on is tagged
+ * 'sync_template' with the index of the strongest template. Output 1 is held back
+ * (at most sync_window_length items) while a sync window is open, so the tag can
+ * go on the peak itself.
+ */
+BAZ_API baz_correlator_sptr baz_make_correlator_bank (
+    float samp_rate,
+    float symbol_rate,
+    int window_length,
+    float threshold,
+    int width,
+    const std::vector<std::string>& sync_paths,
+    int sync_length=511,
+    int sync_offset=50,
+    int sync_window_length=500,
+    const std::vector<float>& freq_offsets=std::vector<float>(),
+    int fft_threshold=64
 );
 
 /*!
@@ -87,7 +113,22 @@ private:
         int sync_length,
         int sync_offset,
         //sync_dtype='c8',
-        int sync_window_length
+        int sync_window_length,
+        int fft_threshold
+    );
+
+    friend BAZ_API baz_correlator_sptr baz_make_correlator_bank(
+        float samp_rate,
+        float symbol_rate,
+        int window_length,
+        float threshold,
+        int width,
+        const std::vector<std::string>& sync_paths,
+        int sync_length,
+        int sync_offset,
+        int sync_window_length,
+        const std::vector<float>& freq_offsets,
+        int fft_threshold
     );
 
     baz_correlator(
@@ -96,11 +137,13 @@ private:
         int window_length,
         float threshold,
         int width,
-        const char* sync_path,
+        const std::vector<std::string>& sync_paths,
         int sync_length,
         int sync_offset,
         //sync_dtype='c8',
-        int sync_window_length
+        int sync_window_length,
+        const std::vector<float>& freq_offsets,
+        int fft_threshold
 );  	// private constructor
 
     float d_samp_rate;
@@ -114,18 +157,39 @@ private:
     //sync_dtype='c8',
     int d_sync_window_length;
 
-    std::vector<std::complex<float> > d_sync;
+    int d_sync_length;
+    std::vector<std::vector<std::complex<float> > > d_templates;    // [file * offsets + offset][sync_length]
+    int d_sync_template;    // Template locked onto in the synced state
     bool d_synced;
     int64_t d_next_window_idx;
     int64_t d_current_idx;
     std::vector<std::complex<float> > d_conjmul_result;
     //std::vector<float> d_abs_result;
+    std::vector<float> d_magnitudes;
     float d_max_peak;
     int d_max_peak_idx;
+    int d_max_peak_template;
+    uint64_t d_max_peak_corr_idx;
+    std::vector<float> d_corr_pending;  // Output 1 rows held back while the sync window is open
+    bool d_corr_tag_pending;    // 'sync_template' still to be tagged at d_max_peak_corr_idx
+    pmt::pmt_t d_srcid;
     int d_sync_window_idx;
     int d_current_item_idx;
 
+    int d_fft_threshold;
+    bool d_use_fft;
+    int d_fft_size;
+    int d_fft_step;     // Valid lags per overlap-save block (d_fft_size - sync length + 1)
+    gr::fft::fft_complex* d_fwd_fft;
+    gr::fft::fft_complex* d_inv_fft;
+    std::vector<std::vector<std::complex<float> > > d_template_spectra;  // conj(FFT(template)) / d_fft_size
+    std::vector<float> d_fft_magnitudes;
+
     std::complex<float> correlate(const std::complex<float>* in, const std::complex<float>* sync);
+    // 'in' must hold (count + sync length - 1) items. With template_idx < 0 'out' receives all templates interleaved per lag.
+    void correlate_fft(const std::complex<float>* in, int count, float* out, int template_idx);
+    void correlate_magnitudes(const std::complex<float>* in, int count, float* out, int template_idx = -1);
+    int flush_corr(float* out_corr, int space, uint64_t corr_idx);  // corr_idx: output 1 index of out_corr[0]
 
 public:
     ~baz_correlator();	// public destructor
@@ -36,9 +36,18 @@
 
 #include <vector>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 #include <arpa/inet.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // HAVE_SYS_MMAN_H
+
 // win32 (mingw/msvc) specific
 #ifdef HAVE_IO_H
 #include <io.h>
@@ -55,6 +64,33 @@
 #define OUR_O_LARGEFILE 0
 #endif
 
+#define MMAP_READAHEAD_BYTES  (16 * 1024 * 1024) // How far ahead of the read position to issue MADV_WILLNEED
+#define PREFETCH_ALIGNMENT    4096
+
+#define INDEX_EXTENSION       ".index"
+#define INDEX_HEADER          "# baz file_source index 2"
+
+static void* aligned_block_alloc(size_t size)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, PREFETCH_ALIGNMENT);
+#else
+  void* p = NULL;
+  if (posix_memalign(&p, PREFETCH_ALIGNMENT, size) != 0)
+    return NULL;
+  return p;
+#endif // _WIN32
+}
+
+static void aligned_block_free(void* p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif // _WIN32
+}
+
 static const pmt::pmt_t RX_TIME_KEY = pmt::string_to_symbol("rx_time");
 static const pmt::pmt_t RX_RATE_KEY = pmt::string_to_symbol("rx_rate");
 static const pmt::pmt_t RX_LENGTH_KEY = pmt::string_to_symbol("rx_length");
@@ -107,7 +143,7 @@ namespace gr {
       typedef std::shared_ptr<InputFile> sptr;
       typedef std::pair<uint64_t,uint64_t> TimingPair;
     public:
-      InputFile(const std::string& path, size_t item_size_hint = 0, double sample_rate_hint = 0, double freq_hint = 0, const std::string& timing_path = std::string())
+      InputFile(const std::string& path, size_t item_size_hint = 0, double sample_rate_hint = 0, double freq_hint = 0, const std::string& timing_path = std::string(), bool memory_map = false, size_t prefetch_blocks = 0, size_t prefetch_block_size = 0, bool parse = true)
         : m_path(path)
         , m_path_timing(timing_path)
         , m_item_size_hint(item_size_hint)
@@ -121,13 +157,169 @@ namespace gr {
         , m_data_offset(0)
         , m_freq_hint(freq_hint)
         , m_freq(0)
+        , m_memory_map(memory_map)
+        , m_map(NULL)
+        , m_map_length(0)
+        , m_map_pos(0)
+        , m_map_advised(0)
+        , m_prefetch_block_count(memory_map ? 0 : prefetch_blocks) // Mapping already reads ahead
+        , m_prefetch_block_size(prefetch_block_size)
+        , m_prefetch_running(false)
+        , m_prefetch_stop(false)
+        , m_prefetch_eof(false)
+        , m_prefetch_head(0)
+        , m_prefetch_count(0)
+        , m_prefetch_consumed(0)
+        , m_prefetch_pos(0)
+        , m_prefetch_stalls(0)
       {
+#ifndef HAVE_SYS_MMAN_H
+        if (m_memory_map)
+        {
+          fprintf(stderr, "Memory mapping not supported on this platform (using buffered reads): %s\n", m_path.c_str());
+          m_memory_map = false;
+        }
+#endif // HAVE_SYS_MMAN_H
+
         memset(&m_wfx, 0x00, sizeof(m_wfx));
         memset(&m_auxi, 0x00, sizeof(m_auxi));
         memset(&m_time_start, 0x00, sizeof(m_time_start));
         memset(&m_time_end, 0x00, sizeof(m_time_end));
 
-        _open();
+        if (parse)  // Otherwise filled in by 'from_index'
+        {
+          _open();
+          setup_prefetch();
+        }
+      }
+      void setup_prefetch()
+      {
+        if ((m_prefetch_block_count > 0) && (m_item_size > 0))
+        {
+          if (m_prefetch_block_size < m_item_size)
+            m_prefetch_block_size = m_item_size;
+          m_prefetch_block_size -= (m_prefetch_block_size % m_item_size); // Blocks only ever hold whole items
+        }
+        else
+          m_prefetch_block_count = 0;
+      }
+      static bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime)
+      {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+          return false;
+        size = st.st_size;
+        mtime = st.st_mtime;
+        return true;
+      }
+      void save(std::ostream& index) const // One 'F' line (path last, so it may contain spaces), its 'S' timing sidecar line, then its 'T' timing lines
+      {
+        uint64_t size = 0, timing_size = 0;
+        int64_t mtime = 0, timing_mtime = 0;
+        stat_file(m_path, size, mtime);
+        if (m_path_timing.empty() == false)
+          stat_file(m_path_timing, timing_size, timing_mtime);
+
+        index << "F " << size << " " << mtime
+          << " " << (int)m_filetype << " " << m_item_size << " " << m_data_offset << " " << m_length
+          << " " << std::setprecision(17) << m_sample_rate << " " << m_freq;
+
+        const SYSTEM_TIME* times[] = { &m_time_start, &m_time_end };
+        for (size_t i = 0; i < 2; ++i)
+        {
+          const SYSTEM_TIME& t = *times[i];
+          index << " " << t.year << " " << t.month << " " << t.day_of_week << " " << t.day << " " << t.hour << " " << t.minute << " " << t.second << " " << t.millisecond;
+        }
+
+        index << " " << m_timing_info.size() << " " << m_path << std::endl;
+
+        index << "S " << timing_size << " " << timing_mtime << " " << m_path_timing << std::endl;  // Empty path when no timing file was used
+
+        for (size_t i = 0; i < m_timing_info.size(); ++i)
+          index << "T " << m_timing_info[i].first << " " << m_timing_info[i].second << std::endl;
+      }
+      static sptr from_index(std::istream& index, const std::string& timing_filename, bool first, bool memory_map = false, size_t prefetch_blocks = 0, size_t prefetch_block_size = 0)
+      {
+        std::string line;
+        if (!std::getline(index, line))
+          throw std::runtime_error("truncated index");
+
+        std::istringstream ss(line);
+        std::string tag;
+        uint64_t size, _size = 0;
+        int64_t mtime, _mtime = 0;
+        int filetype;
+        size_t item_size, data_offset, length;
+        double sample_rate, freq;
+        SYSTEM_TIME times[2];
+        size_t timing_count;
+        std::string path;
+
+        ss >> tag >> size >> mtime >> filetype >> item_size >> data_offset >> length >> sample_rate >> freq;
+        for (size_t i = 0; i < 2; ++i)
+        {
+          SYSTEM_TIME& t = times[i];
+          ss >> t.year >> t.month >> t.day_of_week >> t.day >> t.hour >> t.minute >> t.second >> t.millisecond;
+        }
+        ss >> timing_count;
+        std::getline(ss >> std::ws, path);
+
+        if ((ss.fail()) || (tag != "F") || (path.empty()))
+          throw std::runtime_error("invalid index entry: " + line);
+
+        if ((stat_file(path, _size, _mtime) == false) || (_size != size) || (_mtime != mtime))
+          throw std::runtime_error("index out of date for: " + path);
+
+        // Same timing file selection as 'file_source_impl::open': the given (or auto-loaded) one for the first file, then '<path>.timing' if there was one
+        std::string timing_path;
+        if (first)
+          timing_path = timing_filename;
+        else if (timing_filename.empty() == false)
+          timing_path = path + ".timing";
+
+        uint64_t timing_size, _timing_size = 0;
+        int64_t timing_mtime, _timing_mtime = 0;
+        std::string indexed_timing_path;
+
+        if (!std::getline(index, line))
+          throw std::runtime_error("truncated index");
+        std::istringstream ss_timing(line);
+        ss_timing >> tag >> timing_size >> timing_mtime;
+        if ((ss_timing.fail()) || (tag != "S"))
+          throw std::runtime_error("invalid index timing file entry for: " + path);
+        ss_timing >> std::ws;
+        std::getline(ss_timing, indexed_timing_path);
+
+        if (indexed_timing_path != timing_path)
+          throw std::runtime_error("different timing file for: " + path);
+        if ((timing_path.empty() == false) && ((stat_file(timing_path, _timing_size, _timing_mtime) == false) || (_timing_size != timing_size) || (_timing_mtime != timing_mtime)))
+          throw std::runtime_error("index out of date for: " + timing_path);
+
+        sptr f(new InputFile(path, item_size, sample_rate, freq, timing_path, memory_map, prefetch_blocks, prefetch_block_size, false));
+        f->m_filetype = (FileType)filetype;
+        f->m_item_size = item_size;
+        f->m_data_offset = data_offset;
+        f->m_length = length;
+        f->m_sample_rate = sample_rate;
+        f->m_freq = freq;
+        f->m_time_start = times[0];
+        f->m_time_end = times[1];
+
+        f->m_timing_info.reserve(timing_count);
+        for (size_t i = 0; i < timing_count; ++i)
+        {
+          TimingPair tp;
+          if ((!std::getline(index, line)) || (sscanf(line.c_str(), "T %llu %llu", (unsigned long long*)&tp.first, (unsigned long long*)&tp.second) != 2))
+            throw std::runtime_error("invalid index timing entry for: " + path);
+          f->m_timing_info.push_back(tp);
+        }
+
+        if (f->m_timing_info.empty())
+          throw std::runtime_error("no timing entries in index for: " + path);
+
+        f->setup_prefetch();
+
+        return f;
       }
       ~InputFile()
       {
@@ -337,6 +529,15 @@ namespace gr {
       }
       /*int*/FILE* open()
       {
+        if (m_memory_map)
+        {
+          map();
+          return NULL;
+        }
+
+        if (m_prefetch_running)  // Already preloaded from the start of the data
+          return m_fp;
+
         // if (m_fd == -1)
         if (m_fp == NULL)
         {
@@ -358,32 +559,296 @@ namespace gr {
         if (fseek(m_fp, m_data_offset, SEEK_SET) < 0)
           perror("failed to seek");
 
+        if (prefetching())
+        {
+          m_prefetch_pos = 0;
+          start_prefetch();
+        }
+
         // return m_fd;
         return m_fp;
       }
+      bool prefetching() const
+      {
+        return (m_prefetch_block_count > 0);
+      }
+      void preload() // Open and start filling the ring so the first read after a file switch doesn't block
+      {
+        if ((prefetching() == false) || (m_prefetch_running))
+          return;
+        open();
+      }
+      void start_prefetch()
+      {
+        if (m_prefetch_blocks.empty())
+        {
+          for (size_t i = 0; i < m_prefetch_block_count; ++i)
+          {
+            PrefetchBlock block;
+            block.data = (char*)aligned_block_alloc(m_prefetch_block_size);
+            if (block.data == NULL)
+              throw std::runtime_error(std::string("failed to allocate prefetch buffer for: ") + m_path);
+            block.length = 0;
+            m_prefetch_blocks.push_back(block);
+          }
+        }
+
+        m_prefetch_head = 0;
+        m_prefetch_count = 0;
+        m_prefetch_consumed = 0;
+        m_prefetch_eof = false;
+        m_prefetch_stop = false;
+
+        m_prefetch_thread = boost::thread(boost::bind(&InputFile::prefetch_thread, this));
+        m_prefetch_running = true;
+      }
+      void stop_prefetch()
+      {
+        if (m_prefetch_running == false)
+          return;
+
+        {
+          boost::unique_lock<boost::mutex> lock(m_prefetch_mutex);
+          m_prefetch_stop = true;
+          m_prefetch_cond.notify_all();
+        }
+
+        m_prefetch_thread.join();
+        m_prefetch_running = false;
+      }
+      void prefetch_thread()
+      {
+        boost::unique_lock<boost::mutex> lock(m_prefetch_mutex);
+
+        while (m_prefetch_stop == false)
+        {
+          if ((m_prefetch_eof) || (m_prefetch_count == m_prefetch_blocks.size()))
+          {
+            m_prefetch_cond.wait(lock);
+            continue;
+          }
+
+          // Block after the last filled one is not visible to the reader until 'm_prefetch_count' is bumped
+          PrefetchBlock& block = m_prefetch_blocks[(m_prefetch_head + m_prefetch_count) % m_prefetch_blocks.size()];
+
+          lock.unlock();
+          size_t n = fread(block.data, m_item_size, (m_prefetch_block_size / m_item_size), m_fp); // FIXME: Assumes data continues to EOF
+          bool error = (ferror(m_fp) != 0);
+          lock.lock();
+
+          if (n < (m_prefetch_block_size / m_item_size))
+          {
+            if (error)
+              perror("failed to prefetch");
+            m_prefetch_eof = true;
+          }
+
+          if (n > 0)
+          {
+            block.length = n * m_item_size;
+            ++m_prefetch_count;
+          }
+
+          m_prefetch_cond.notify_all();
+        }
+      }
+      int read_prefetched(size_t len, void* p)
+      {
+        char* o = (char*)p;
+        size_t want = len * m_item_size;
+        size_t got = 0;
+        bool stalled = false;
+
+        boost::unique_lock<boost::mutex> lock(m_prefetch_mutex);
+
+        while (got < want)
+        {
+          if (m_prefetch_count == 0)
+          {
+            if ((m_prefetch_eof) || (got > 0))  // Hand back what we have rather than wait
+              break;
+
+            if (stalled == false)
+            {
+              ++m_prefetch_stalls;
+              stalled = true;
+            }
+
+            m_prefetch_cond.wait(lock);
+            continue;
+          }
+
+          PrefetchBlock& block = m_prefetch_blocks[m_prefetch_head];
+          size_t n = std::min(want - got, block.length - m_prefetch_consumed);
+
+          lock.unlock();  // Head block is never touched by the prefetch thread
+          memcpy(o + got, block.data + m_prefetch_consumed, n);
+          lock.lock();
+
+          got += n;
+          m_prefetch_consumed += n;
+
+          if (m_prefetch_consumed == block.length)
+          {
+            m_prefetch_head = (m_prefetch_head + 1) % m_prefetch_blocks.size();
+            --m_prefetch_count;
+            m_prefetch_consumed = 0;
+            m_prefetch_cond.notify_all();
+          }
+        }
+
+        m_prefetch_pos += (got / m_item_size);
+
+        return (got / m_item_size);
+      }
+      double prefetch_fill()
+      {
+        if (prefetching() == false)
+          return 0.0;
+        boost::unique_lock<boost::mutex> lock(m_prefetch_mutex);
+        return ((double)m_prefetch_count / (double)m_prefetch_block_count);
+      }
+      uint64_t prefetch_stalls()
+      {
+        boost::unique_lock<boost::mutex> lock(m_prefetch_mutex);  // Counted by the reader, queried from other threads
+        return m_prefetch_stalls;
+      }
+      size_t prefetch_capacity() const  // Items
+      {
+        return ((m_item_size == 0) ? 0 : ((m_prefetch_block_count * m_prefetch_block_size) / m_item_size));
+      }
+      bool map()
+      {
+#ifdef HAVE_SYS_MMAN_H
+        if (m_map == NULL)
+        {
+          int fd = ::open(m_path.c_str(), O_RDONLY | OUR_O_LARGEFILE | OUR_O_BINARY);
+          if (fd < 0)
+          {
+            perror("failed to open handle");
+            throw std::runtime_error(std::string("failed to open handle: " + m_path));
+          }
+
+          size_t length = m_data_offset + m_length;
+          if (length == 0)  // Cannot map an empty file
+          {
+            ::close(fd);
+            return false;
+          }
+
+          void* p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+          ::close(fd);  // Mapping holds its own reference
+          if (p == MAP_FAILED)
+          {
+            perror("failed to map file");
+            throw std::runtime_error(std::string("failed to map file: " + m_path));
+          }
+
+          if (madvise(p, length, MADV_SEQUENTIAL) < 0)
+            perror("failed to advise sequential access");
+
+          m_map = (const char*)p;
+          m_map_length = length;
+        }
+
+        m_map_pos = 0;
+        m_map_advised = 0;
+        advise();
+
+        return true;
+#else
+        return false;
+#endif // HAVE_SYS_MMAN_H
+      }
+      void advise()
+      {
+#ifdef HAVE_SYS_MMAN_H
+        // Keep the kernel paging in ahead of the read position (one hint per read-ahead window, not per read)
+        size_t pos = m_data_offset + m_map_pos;
+        if ((pos >= m_map_advised) || ((m_map_advised - pos) < (MMAP_READAHEAD_BYTES / 2)))
+        {
+          static const size_t page_size = sysconf(_SC_PAGESIZE);
+          size_t start = (std::max(pos, m_map_advised) / page_size) * page_size;
+          size_t end = std::min(pos + MMAP_READAHEAD_BYTES, m_map_length);
+          if (end > start)
+          {
+            if (madvise((void*)(m_map + start), (end - start), MADV_WILLNEED) < 0)
+              perror("failed to advise read-ahead");
+          }
+          m_map_advised = end;
+        }
+#endif // HAVE_SYS_MMAN_H
+      }
       int read(size_t len, void* p)
       {
+        if (m_memory_map)
+        {
+          if ((m_map == NULL) || (m_item_size == 0))
+            return -1;
+          size_t available = (m_length - m_map_pos) / m_item_size;
+          size_t n = std::min(len, available);
+          memcpy(p, m_map + m_data_offset + m_map_pos, n * m_item_size);
+          m_map_pos += (n * m_item_size);
+          advise();
+          return n;
+        }
+
         if (m_fp == NULL)
           return -1;
+        if (m_prefetch_running)
+          return read_prefetched(len, p);
         return fread(p, m_item_size, len, m_fp); // FIXME: Assumes data continues to EOF
       }
       /*size_t*/int seek(size_t pos)
       {
+        if (m_memory_map)
+        {
+          if (m_map == NULL)
+            return -1;
+          size_t _pos = pos * m_item_size;
+          if (_pos > m_length)
+            return -1;
+          m_map_pos = _pos;
+          m_map_advised = 0;  // Restart read-ahead from the new position
+          advise();
+          return 0;
+        }
+
         if (m_fp == NULL)
           return -1;
+
+        if (m_prefetch_running)
+        {
+          if (pos == m_prefetch_pos)  // e.g. switching to a preloaded file
+            return 0;
+          stop_prefetch();
+        }
+
         size_t _pos = (pos * m_item_size) + m_data_offset;
         if (fseek(m_fp, _pos, SEEK_SET) < 0)
         {
           perror("failed to seek");
           return -1;
         }
+
+        if (prefetching())
+        {
+          m_prefetch_pos = pos;
+          start_prefetch();
+        }
+
         // return ftell(m_fp);
         return 0;
       }
       size_t tell()
       {
+        if (m_memory_map)
+          return ((m_item_size == 0) ? 0 : (m_map_pos / m_item_size));
+
         if (m_fp == NULL)
           return 0;
+        if (m_prefetch_running)
+          return m_prefetch_pos;
         return ((ftell(m_fp) - m_data_offset) / m_item_size);
       }
       size_t samples(bool raw = false) const
@@ -404,6 +869,21 @@ namespace gr {
       }
       void close()
       {
+#ifdef HAVE_SYS_MMAN_H
+        if (m_map != NULL)
+        {
+          munmap((void*)m_map, m_map_length);
+          m_map = NULL;
+          m_map_length = 0;
+        }
+#endif // HAVE_SYS_MMAN_H
+
+        stop_prefetch();
+
+        for (size_t i = 0; i < m_prefetch_blocks.size(); ++i)
+          aligned_block_free(m_prefetch_blocks[i].data);
+        m_prefetch_blocks.clear();
+
         if (m_fp != NULL)
         {
           fclose(m_fp); // Assuming this also closes FD
@@ -453,6 +933,30 @@ namespace gr {
       AUXI m_auxi;
       SYSTEM_TIME m_time_start, m_time_end;
       std::vector<TimingPair> m_timing_info;
+      bool m_memory_map;
+      const char* m_map;  // Whole file (data starts at m_data_offset)
+      size_t m_map_length; // Bytes
+      size_t m_map_pos; // Bytes (relative to m_data_offset)
+      size_t m_map_advised; // Bytes (absolute), end of last MADV_WILLNEED range
+      typedef struct PrefetchBlock
+      {
+        char* data;
+        size_t length; // Bytes
+      } PREFETCH_BLOCK;
+      size_t m_prefetch_block_count;
+      size_t m_prefetch_block_size; // Bytes
+      std::vector<PrefetchBlock> m_prefetch_blocks; // Ring
+      boost::thread m_prefetch_thread;
+      boost::mutex m_prefetch_mutex;
+      boost::condition_variable m_prefetch_cond;
+      bool m_prefetch_running;
+      bool m_prefetch_stop;
+      bool m_prefetch_eof;
+      size_t m_prefetch_head;
+      size_t m_prefetch_count;  // Filled blocks
+      size_t m_prefetch_consumed; // Bytes taken from head block
+      uint64_t m_prefetch_pos;  // Items handed to the reader
+      uint64_t m_prefetch_stalls;
     };
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -484,18 +988,22 @@ namespace gr {
       std::vector<InputFile::sptr> d_input_files, d_input_files_new;
       std::vector<uint64_t> d_input_files_offsets, d_input_files_offsets_new;
       int d_current_file_idx;
+      int d_preloaded_file_idx;
 
       bool do_update();
       bool calculate_offset(uint64_t offset, uint64_t& file_offset, uint64_t& ticks, uint64_t& samples_left, uint64_t& pad_left, int& timing_idx);
+      bool load_index(const std::string& index_path, std::vector<std::string>& files, std::vector<InputFile::sptr>& input_files, const std::string& timing_filename, bool auto_load, bool memory_map, int prefetch_blocks, int prefetch_block_size, double rate);
+      void save_index(const std::string& index_path, const std::vector<InputFile::sptr>& input_files, const std::string& timing_filename, double rate);
       void tag(int offset, uint64_t ticks = -1);
 
     public:
-      file_source_impl(size_t itemsize, const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>());
+      file_source_impl(size_t itemsize, const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>(), bool memory_map = false, int prefetch_blocks = 0, int prefetch_block_size = (1024 * 1024), bool cache_index = false);
       ~file_source_impl();
 
       bool seek(long seek_point, int whence);
       bool seek(long seek_point) { return seek(seek_point, SEEK_SET); }
-      void open(const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>());
+      bool seek_time(double time, bool relative = false);
+      void open(const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>(), bool memory_map = false, int prefetch_blocks = 0, int prefetch_block_size = (1024 * 1024), bool cache_index = false);
       void close();
       size_t offset();
       size_t file_offset();
@@ -506,18 +1014,20 @@ namespace gr {
       size_t file_index();
       std::string file_path();
       std::vector<std::string> files();
+      double prefetch_fill();
+      uint64_t prefetch_stalls();
 
       int work(int noutput_items,
          gr_vector_const_void_star &input_items,
          gr_vector_void_star &output_items);
     };
 
-    file_source::sptr file_source::make(size_t itemsize, const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/)
+    file_source::sptr file_source::make(size_t itemsize, const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/, bool memory_map/* = false*/, int prefetch_blocks/* = 0*/, int prefetch_block_size/* = (1024 * 1024)*/, bool cache_index/* = false*/)
     {
-      return gnuradio::get_initial_sptr(new file_source_impl(itemsize, filename, repeat, offset, timing_filename, pad, rate, auto_load, files));
+      return gnuradio::get_initial_sptr(new file_source_impl(itemsize, filename, repeat, offset, timing_filename, pad, rate, auto_load, files, memory_map, prefetch_blocks, prefetch_block_size, cache_index));
     }
 
-    file_source_impl::file_source_impl(size_t itemsize, const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/)
+    file_source_impl::file_source_impl(size_t itemsize, const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/, bool memory_map/* = false*/, int prefetch_blocks/* = 0*/, int prefetch_block_size/* = (1024 * 1024)*/, bool cache_index/* = false*/)
       : sync_block("file_source",
           io_signature::make(0, 0, 0),
           io_signature::make(1, 1, itemsize)),
@@ -528,11 +1038,12 @@ namespace gr {
       d_rate(1.0),
       d_seeked(false),
       d_pad(pad),
-      d_current_file_idx(-1)
+      d_current_file_idx(-1),
+      d_preloaded_file_idx(-1)
     {
-      fprintf(stderr, "[%s<%ld>] item size: %lu, file: %s, repeat: %s, offset: %ld, timing file: %s, pad: %s, force rate: %f, auto-load: %s, files count: %lu\n", name().c_str(), unique_id(), itemsize, filename, (repeat ? "yes" : "no"), offset, timing_filename, (pad ? "yes" : "no"), rate, (auto_load ? "yes" : "no"), files.size());
+      fprintf(stderr, "[%s<%ld>] item size: %lu, file: %s, repeat: %s, offset: %ld, timing file: %s, pad: %s, force rate: %f, auto-load: %s, files count: %lu, memory map: %s, prefetch: %d x %d bytes, cache index: %s\n", name().c_str(), unique_id(), itemsize, filename, (repeat ? "yes" : "no"), offset, timing_filename, (pad ? "yes" : "no"), rate, (auto_load ? "yes" : "no"), files.size(), (memory_map ? "yes" : "no"), prefetch_blocks, prefetch_block_size, (cache_index ? "yes" : "no"));
 
-      open(filename, repeat, offset, timing_filename, pad, rate, auto_load, files);
+      open(filename, repeat, offset, timing_filename, pad, rate, auto_load, files, memory_map, prefetch_blocks, prefetch_block_size, cache_index);
 
       do_update();
     }
@@ -567,6 +1078,9 @@ namespace gr {
       //   return true;
       // }
 
+      if (d_timing_info.empty())  // Nothing opened yet
+        return false;
+
       uint64_t first_time = d_timing_info[0].first;
 
       if (d_timing_info.size() == 1)
@@ -580,8 +1094,14 @@ namespace gr {
         return true;
       }
 
-      size_t i = 1;
-      for (; i <= d_timing_info.size(); ++i)
+      // First timing point strictly after 'offset' (binary search - there can be very many across a long list of files)
+      struct TicksAfter
+      {
+        bool operator()(uint64_t ticks, const TimingPair& tp) const { return (ticks < tp.first); }
+      };
+      size_t i = std::upper_bound(d_timing_info.begin() + 1, d_timing_info.end(), (offset + first_time), TicksAfter()) - d_timing_info.begin();
+
+      for (; i <= d_timing_info.size(); ++i)  // Only loops again when rounding up past a gap (no padding)
       {
         uint64_t samples = -1;
         if (i < d_timing_info.size())
@@ -599,7 +1119,7 @@ namespace gr {
           }
           else
           {
-            file_part = d_length - d_timing_info[i].second;
+            file_part = d_file_length - d_timing_info[i-1].second;
             section = file_part;
           }
 
@@ -670,17 +1190,11 @@ namespace gr {
       if (file_offset > d_input_files_offsets[d_input_files_offsets.size() - 1])
         throw new std::runtime_error("error calculating file offset");
 
-      size_t _file_idx = 0;
-      uint64_t offset_adj = 0;
-      for (; _file_idx < d_input_files_offsets.size(); ++_file_idx)
-      {
-        if (file_offset < d_input_files_offsets[_file_idx])
-        {
-          if (_file_idx > 0)
-            offset_adj = d_input_files_offsets[_file_idx - 1];
-          break;
-        }
-      }
+      // First file whose cumulative end lies beyond 'file_offset' (at the very end, stay in the last file)
+      size_t _file_idx = std::upper_bound(d_input_files_offsets.begin(), d_input_files_offsets.end(), file_offset) - d_input_files_offsets.begin();
+      if (_file_idx == d_input_files_offsets.size())
+        _file_idx = d_input_files_offsets.size() - 1;
+      uint64_t offset_adj = ((_file_idx > 0) ? d_input_files_offsets[_file_idx - 1] : 0);
 
       int file_idx = (int)_file_idx;
 
@@ -689,6 +1203,10 @@ namespace gr {
         if (d_current_file_idx >= 0)
           d_input_files[d_current_file_idx]->close();
 
+        if ((d_preloaded_file_idx >= 0) && (d_preloaded_file_idx != file_idx))
+          d_input_files[d_preloaded_file_idx]->close(); // Seeked somewhere other than the next file
+        d_preloaded_file_idx = -1;
+
         fprintf(stderr, "[%s<%ld>] Switching to file %d: %s (offset adjust: %llu)\n", name().c_str(), unique_id(), (file_idx + 1), d_input_files[file_idx]->path().c_str(), offset_adj);
 
         d_input_files[file_idx]->open();
@@ -712,6 +1230,35 @@ namespace gr {
       return true;
     }
 
+    bool file_source_impl::seek_time(double time, bool relative/* = false*/) // 'time' in seconds, absolute (from timing ticks) unless relative
+    {
+      scoped_lock lock(fp_mutex);
+
+      if (time < 0)
+        return false;
+
+      uint64_t ticks = (uint64_t)llround(time * d_rate);
+
+      if (relative == false)
+      {
+        if (d_timing_info.empty()) // Nothing opened (or not yet installed by 'do_update'), so there is no time reference
+        {
+          fprintf(stderr, "[%s<%ld>] Cannot seek to absolute time without timing information: %f\n", name().c_str(), unique_id(), time);
+          return false;
+        }
+
+        uint64_t first_time = d_timing_info[0].first;
+        if (ticks < first_time)
+        {
+          fprintf(stderr, "[%s<%ld>] Tried to seek before start: %f\n", name().c_str(), unique_id(), time);
+          return false;
+        }
+        ticks -= first_time;
+      }
+
+      return seek(ticks, SEEK_SET);
+    }
+
     size_t file_source_impl::offset()
     {
       scoped_lock lock(fp_mutex);
@@ -801,7 +1348,28 @@ namespace gr {
       return d_files;
     }
 
-    void file_source_impl::open(const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/)
+    double file_source_impl::prefetch_fill()
+    {
+      scoped_lock lock(fp_mutex);
+
+      if (d_current_file_idx < 0)
+        return 0.0;
+
+      return d_input_files[d_current_file_idx]->prefetch_fill();
+    }
+
+    uint64_t file_source_impl::prefetch_stalls()
+    {
+      scoped_lock lock(fp_mutex);
+
+      uint64_t stalls = 0;
+      for (size_t i = 0; i < d_input_files.size(); ++i)
+        stalls += d_input_files[i]->prefetch_stalls();
+
+      return stalls;
+    }
+
+    void file_source_impl::open(const char *filename, bool repeat/* = false*/, long offset/* = 0*/, const char *timing_filename/* = NULL*/, bool pad/* = false*/, double rate/* = 0.0*/, bool auto_load/* = true*/, const std::vector<std::string>& files/* = std::vector<std::string>()*/, bool memory_map/* = false*/, int prefetch_blocks/* = 0*/, int prefetch_block_size/* = (1024 * 1024)*/, bool cache_index/* = false*/)
     {
       //if ((filename == NULL) || (filename[0] == '\0'))
       //  return;
@@ -834,6 +1402,15 @@ namespace gr {
 
       std::vector<TimingPair> _timing_info;
 
+      std::string index_path;
+      std::vector<InputFile::sptr> _indexed_files;
+      bool indexed = false;
+      if (cache_index)
+      {
+        index_path = _files[0] + INDEX_EXTENSION;
+        indexed = load_index(index_path, _files, _indexed_files, _timing_filename, auto_load, memory_map, prefetch_blocks, prefetch_block_size, rate);
+      }
+
       for (size_t i = 0; i < _files.size(); i++)
       {
         const std::string& path = _files[i];
@@ -842,7 +1419,7 @@ namespace gr {
           timing_file_path = _timing_filename; // Might be empty, populated, or auto-loaded
         else if (_timing_filename.empty() == false) // If > 1 file and first timing file was loaded (either by auto-load or populated)
           timing_file_path = path + ".timing";
-        InputFile::sptr input_file = InputFile::sptr(new InputFile(path, d_itemsize, rate, 0.0, timing_file_path));
+        InputFile::sptr input_file = ((i < _indexed_files.size()) ? _indexed_files[i] : InputFile::sptr(new InputFile(path, d_itemsize, rate, 0.0, timing_file_path, memory_map, std::max(0, prefetch_blocks), std::max(0, prefetch_block_size))));
         if (i == 0)
         {
           _rate = input_file->sample_rate();
@@ -862,7 +1439,8 @@ namespace gr {
         cumulative_samples_raw += input_file->samples(true);
         _input_files_offsets.push_back(cumulative_samples);
 
-        if (auto_load)
+        // An index already holds the auto-loaded chain: only probe past its last file, for files appended since it was written
+        if ((auto_load) && ((indexed == false) || ((i + 1) >= _indexed_files.size())))
         {
 #ifdef _WIN32
           static const char sep = '\\';
@@ -909,6 +1487,9 @@ namespace gr {
         }
       }
 
+      if ((cache_index) && ((indexed == false) || (_input_files.size() > _indexed_files.size())))  // New, or the chain grew
+        save_index(index_path, _input_files, _timing_filename, rate);
+
       double _new_rate = ((_rate <= 0.0) ? 1.0 : _rate);
 
       fprintf(stderr, "[%s<%ld>] Opened %lu files: total samples: %llu, total timing points: %lu, rate: %f\n", name().c_str(), unique_id(), _files.size(), cumulative_samples, _timing_info.size(), _new_rate);
@@ -1052,6 +1633,66 @@ namespace gr {
       d_updated = true;
     }
 
+    bool file_source_impl::load_index(const std::string& index_path, std::vector<std::string>& files, std::vector<InputFile::sptr>& input_files, const std::string& timing_filename, bool auto_load, bool memory_map, int prefetch_blocks, int prefetch_block_size, double rate)
+    {
+      std::ifstream index_file(index_path.c_str());
+      if (index_file.is_open() == false)
+        return false;
+
+      try
+      {
+        std::string header;
+        std::getline(index_file, header);
+        std::string expected_header(boost::str(boost::format("%s %lu %.17g %s") % INDEX_HEADER % d_itemsize % rate % timing_filename));
+        if (header != expected_header)
+          throw std::runtime_error("different index version or parameters");
+
+        std::vector<InputFile::sptr> _input_files;
+        while (index_file.peek() != EOF)
+          _input_files.push_back(InputFile::from_index(index_file, timing_filename, _input_files.empty(), memory_map, std::max(0, prefetch_blocks), std::max(0, prefetch_block_size)));
+
+        // Must start with the requested files, and only contain more if they were auto-loaded
+        if ((_input_files.size() < files.size()) || ((auto_load == false) && (_input_files.size() != files.size())))
+          throw std::runtime_error("different file list");
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+          if (_input_files[i]->path() != files[i])
+            throw std::runtime_error("different file list");
+        }
+
+        files.clear();
+        for (size_t i = 0; i < _input_files.size(); ++i)
+          files.push_back(_input_files[i]->path());
+        input_files = _input_files;
+      }
+      catch (const std::exception& e)
+      {
+        fprintf(stderr, "[%s<%ld>] Ignoring index %s: %s\n", name().c_str(), unique_id(), index_path.c_str(), e.what());
+        return false;
+      }
+
+      fprintf(stderr, "[%s<%ld>] Loaded index %s (%lu files)\n", name().c_str(), unique_id(), index_path.c_str(), input_files.size());
+
+      return true;
+    }
+
+    void file_source_impl::save_index(const std::string& index_path, const std::vector<InputFile::sptr>& input_files, const std::string& timing_filename, double rate)
+    {
+      std::ofstream index_file(index_path.c_str(), std::ofstream::out | std::ofstream::trunc);
+      if (index_file.is_open() == false)
+      {
+        fprintf(stderr, "[%s<%ld>] Failed to write index: %s\n", name().c_str(), unique_id(), index_path.c_str());  // e.g. read-only archive
+        return;
+      }
+
+      index_file << boost::str(boost::format("%s %lu %.17g %s") % INDEX_HEADER % d_itemsize % rate % timing_filename) << std::endl;
+
+      for (size_t i = 0; i < input_files.size(); ++i)
+        input_files[i]->save(index_file);
+
+      fprintf(stderr, "[%s<%ld>] Wrote index %s (%lu files)\n", name().c_str(), unique_id(), index_path.c_str(), input_files.size());
+    }
+
     void file_source_impl::close()
     {
       // obtain exclusive access for duration of this function
@@ -1068,6 +1709,7 @@ namespace gr {
       d_files.clear();
       d_input_files_offsets.clear();
       d_current_file_idx = -1;
+      d_preloaded_file_idx = -1;
 
       d_updated = true;
     }
@@ -1090,6 +1732,7 @@ namespace gr {
         d_input_files_offsets = d_input_files_offsets_new;
 
         d_current_file_idx = -1;
+        d_preloaded_file_idx = -1;
         // d_current_file_idx = 0;
         // /*d_fp = */d_input_files[d_current_file_idx]->open();
 
@@ -1328,6 +1971,20 @@ namespace gr {
         fprintf(stderr, "[%s<%ld>] Repeating\n", name().c_str(), unique_id());
       }
 
+      int next_file_idx = d_current_file_idx + 1;
+      if ((next_file_idx < d_input_files.size()) && (next_file_idx != d_preloaded_file_idx))
+      {
+        InputFile::sptr& current_file = d_input_files[d_current_file_idx];
+        size_t remaining = current_file->samples(true) - current_file->tell();
+        if ((current_file->prefetching()) && (remaining <= current_file->prefetch_capacity()))
+        {
+          fprintf(stderr, "[%s<%ld>] Preloading file %d: %s\n", name().c_str(), unique_id(), (next_file_idx + 1), d_input_files[next_file_idx]->path().c_str());
+
+          d_input_files[next_file_idx]->preload();
+          d_preloaded_file_idx = next_file_idx;
+        }
+      }
+
       if (size > 0) // EOF or error
       {
         if (size == noutput_items)       // we didn't read anything; say we're done
@@ -53,8 +53,12 @@ namespace gr {
        * \param itemsize	the size of each item in the file, in bytes
        * \param filename	name of the file to source from
        * \param repeat	repeat file from start
+       * \param memory_map	read through mmap (with madvise read-ahead) instead of fread
+       * \param prefetch_blocks	number of blocks a background thread reads ahead (0 to read in work)
+       * \param prefetch_block_size	size of each prefetch block, in bytes
+       * \param cache_index	load/save the file list and timing (seek index) in a sidecar next to the first file (<file>.index)
        */
-      static sptr make(size_t itemsize, const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>());
+      static sptr make(size_t itemsize, const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>(), bool memory_map = false, int prefetch_blocks = 0, int prefetch_block_size = (1024 * 1024), bool cache_index = false);
 
       /*!
        * \brief seek file to \p seek_point relative to \p whence
@@ -65,13 +69,18 @@ namespace gr {
       virtual bool seek(long seek_point) = 0;
       virtual bool seek(long seek_point, int whence) = 0;
 
+      /*!
+       * \brief seek to \p time (seconds) on the timing file's clock, or from the start if \p relative
+       */
+      virtual bool seek_time(double time, bool relative = false) = 0;
+
       /*!
        * \brief Opens a new file.
        *
        * \param filename	name of the file to source from
        * \param repeat	repeat file from start
        */
-      virtual void open(const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>()) = 0;
+      virtual void open(const char *filename, bool repeat = false, long offset = 0, const char *timing_filename = NULL, bool pad = false, double rate = 0.0, bool auto_load = true, const std::vector<std::string>& files = std::vector<std::string>(), bool memory_map = false, int prefetch_blocks = 0, int prefetch_block_size = (1024 * 1024), bool cache_index = false) = 0;
 
       /*!
        * \brief Close the file handle.
@@ -87,6 +96,15 @@ namespace gr {
       virtual size_t file_index() = 0;
       virtual std::string file_path() = 0;
       virtual std::vector<std::string> files() = 0;
+
+      /*!
+       * \brief Fraction of the current file's prefetch ring that is filled [0, 1]
+       */
+      virtual double prefetch_fill() = 0;
+      /*!
+       * \brief Number of reads that had to wait on the prefetch thread (all files)
+       */
+      virtual uint64_t prefetch_stalls() = 0;
     };
 
   } /* namespace baz */
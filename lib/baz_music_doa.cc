@@ -26,21 +26,43 @@
 
 #include <gnuradio/io_signature.h>
 
+#include <algorithm>
+#include <cmath>
+
+static bool compare_doa_strength(const doa_t& a, const doa_t& b)
+{
+	return (a.second > b.second);
+}
+
+static inline arma::cx_mat herm(const arma::cx_mat& m)
+{
+#if ARMA_VERSION_MAJOR < 2	// FIXME: .t()
+	return arma::htrans(m);
+#else
+	return arma::trans(m);
+#endif
+}
+
 baz_music_doa_sptr
-baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution)
+baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor /*= 0.0*/, bool subspace_tracking /*= false*/, double ula_spacing /*= 0.0*/)
 {
-	return baz_music_doa_sptr(new baz_music_doa(m, n, nsamples, array_response, resolution));
+	return baz_music_doa_sptr(new baz_music_doa(m, n, nsamples, array_response, resolution, forgetting_factor, subspace_tracking, ula_spacing));
 }
 
-baz_music_doa::baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution)
+baz_music_doa::baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor, bool subspace_tracking, double ula_spacing)
 	: gr::sync_block("music_doa",
 		gr::io_signature::make(1, 1, nsamples * sizeof(gr_complex)),
 		gr::io_signature::make3(1, 3, n * sizeof(float), n * sizeof(float), resolution * sizeof(float))),
 	d_m(m),
 	d_n(n),
 	d_nsamples(nsamples),
-	d_array_response(array_response),
-	d_resolution(resolution)
+	d_resolution(resolution),
+	d_forgetting_factor(forgetting_factor),
+	d_subspace_tracking(subspace_tracking),
+	d_data(nsamples),
+	d_R_valid(false),
+	d_W_valid(false),
+	d_ula_spacing(ula_spacing)
 {
 	assert(m > 0);
 	assert(m >= n);
@@ -48,8 +70,11 @@ baz_music_doa::baz_music_doa(unsigned int m, unsigned int n, unsigned int nsampl
 	assert(resolution > 0);
 	assert(array_response.size() == resolution);
 	assert(array_response[0].size() == m);
+	assert((ula_spacing == 0) || (m > 1));
 	
-	fprintf(stderr, "[%s<%li>] MUSIC DOA: M: %d, N: %d, # samples: %d, angular resolution: %d\n", name().c_str(), unique_id(), m, n, nsamples, resolution);
+	cache_steering_matrix(array_response);
+	
+	fprintf(stderr, "[%s<%li>] MUSIC DOA: M: %d, N: %d, # samples: %d, angular resolution: %d, forgetting factor: %f, subspace tracking: %s, root-MUSIC ULA spacing: %f\n", name().c_str(), unique_id(), m, n, nsamples, resolution, forgetting_factor, (subspace_tracking ? "yes" : "no"), ula_spacing);
 }
 
 baz_music_doa::~baz_music_doa ()
@@ -66,66 +91,251 @@ void baz_music_doa::set_array_response(const array_response_t& array_response)
 	
 	gr::thread::scoped_lock guard(d_mutex);
 	
-	d_array_response = array_response;
+	cache_steering_matrix(array_response);
 }
 
-int baz_music_doa::work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+void baz_music_doa::cache_steering_matrix(const array_response_t& array_response)
 {
-	const gr_complex* in = static_cast<const gr_complex*>(input_items[0]);
-	gr_complexd* data = new gr_complexd[d_nsamples];	// FIXME: Move outside
-	for(int i = 0; i < d_nsamples; i++)
-		data[i] = static_cast<gr_complexd>(in[i]);
+	d_A.set_size(d_m, d_resolution);
+	for (unsigned int step = 0; step < d_resolution; step++)
+	{
+		const antenna_response_t& antenna_response = array_response[step];
+		for (unsigned int t = 0; t < d_m; t++)
+			d_A(t, step) = antenna_response[t];
+	}
 	
-	//double* tmpout = new double[d_n];
+	d_A_power = arma::sum(arma::real(d_A % arma::conj(d_A)), 0);
+}
+
+// Element spacing in wavelengths of a uniform linear array along the 0 degree axis. 0 scans the grid.
+void baz_music_doa::set_ula_spacing(double spacing)
+{
+	assert((spacing == 0) || (d_m > 1));
 	
-	// Correlation estimation
-	arma::cx_mat x(arma::cx_rowvec(data, d_nsamples));
-	unsigned int average_over = d_nsamples / d_m;
-	x.reshape(d_m, average_over);	// (n_rows, n_cols)
-	arma::cx_mat R = x * x.t() / (double)average_over;
+	gr::thread::scoped_lock guard(d_mutex);
+	
+	d_ula_spacing = spacing;
+}
+
+// Roots of a(1/z*)^H.C.a(z), a(z) = [1 z .. z^(m-1)], nearest the unit circle are the DOAs
+bool baz_music_doa::root_music(const arma::cx_mat& C, std::vector<doa_t>& doas)
+{
+	unsigned int order = 2 * (d_m - 1);
+	
+	std::vector<gr_complexd> coeffs(order + 1, 0);	// Coefficient of z^k is the sum of the (k-m+1)'th diagonal of C
+	for (unsigned int i = 0; i < d_m; i++)
+		for (unsigned int j = 0; j < d_m; j++)
+			coeffs[j - i + d_m - 1] += C(i, j);
+	
+	if (std::abs(coeffs[order]) < 1e-12)
+		return false;
+	
+	arma::cx_mat companion = arma::zeros<arma::cx_mat>(order, order);
+	for (unsigned int k = 0; k < order; k++)
+	{
+		companion(0, k) = -coeffs[order - 1 - k] / coeffs[order];
+		if (k > 0)
+			companion(k, k - 1) = 1;
+	}
+	
+	arma::cx_vec roots;
+	if (arma::eig_gen(roots, companion) == false)
+		return false;
+	
+	// Roots come in pairs mirrored about the unit circle: take those inside
+	std::vector<std::pair<double,double> > candidates;	// (distance from circle, phase)
+	for (unsigned int k = 0; k < order; k++)
+	{
+		gr_complexd root = roots[k];
+		if (std::abs(root) <= 1.0)
+			candidates.push_back(std::make_pair(1.0 - std::abs(root), std::arg(root)));
+	}
+	
+	if (candidates.size() < d_n)
+		return false;
+	
+	std::partial_sort(candidates.begin(), candidates.begin() + d_n, candidates.end());
+	
+	for (unsigned int i = 0; i < d_n; i++)
+	{
+		double phase = candidates[i].second;
+		double c = std::max(-1.0, std::min(1.0, -phase / (2.0 * M_PI * d_ula_spacing)));	// a_t = exp(-j.2.pi.t.d.cos(theta))
+		
+		arma::cx_vec a(d_m);
+		for (unsigned int t = 0; t < d_m; t++)
+			a[t] = std::polar(1.0, -2.0 * M_PI * t * d_ula_spacing * c);
+		double projection = std::real(arma::accu(arma::conj(a) % (C * a)));
+		
+		doas[i] = std::make_pair(acos(c) * 180.0 / M_PI, 1.0 / std::max(projection, 1e-12));
+	}
+	
+	std::sort(doas.begin(), doas.end(), compare_doa_strength);
+	
+	return true;
+}
+
+// 0 (or anything outside (0,1)) estimates each block on its own
+void baz_music_doa::set_forgetting_factor(double forgetting_factor)
+{
+	gr::thread::scoped_lock guard(d_mutex);
+	
+	d_forgetting_factor = forgetting_factor;
+}
+
+void baz_music_doa::set_subspace_tracking(bool enable)
+{
+	gr::thread::scoped_lock guard(d_mutex);
+	
+	d_subspace_tracking = enable;
+}
+
+// Exponentially weighted per snapshot: R = l^L.R + (1-l).sum(l^(L-1-k).x_k.x_k^H)
+void baz_music_doa::update_covariance(arma::cx_mat& x, double lambda)
+{
+	unsigned int average_over = x.n_cols;
+	
+	if ((lambda <= 0.0) || (lambda >= 1.0) || (d_R_valid == false))
+	{
+		d_R = x * x.t() / (double)average_over;
+		d_R_valid = ((lambda > 0.0) && (lambda < 1.0));
+		return;
+	}
+	
+	double weight = 1.0 - lambda;
+	for (int k = (int)average_over - 1; k >= 0; k--)
+	{
+		x.col(k) *= sqrt(weight);
+		weight *= lambda;
+	}
 	
-	// Eigendecomposition
+	d_R = (weight / (1.0 - lambda)) * d_R + x * x.t();	// weight is now (1-l).l^L
+}
+
+void baz_music_doa::init_subspace(const arma::cx_mat& R)
+{
 	arma::colvec eigvals;
 	arma::cx_mat eigvec;
 	arma::eig_sym(eigvals, eigvec, R);
+	
+	d_W = eigvec.cols(d_m-d_n, d_m-1);	// Eigenvectors of the n largest eigenvalues
+	d_Z = arma::zeros<arma::cx_mat>(d_n, d_n);
+	for (unsigned int i = 0; i < d_n; i++)
+		d_Z(i, i) = 1.0 / std::max(eigvals[d_m-d_n+i], 1e-12);
+	
+	d_W_valid = true;
+}
+
+// OPAST (Abed-Meraim, Chkeif & Hua): PAST's RLS update of W, plus a rank-one correction that keeps W orthonormal
+void baz_music_doa::track_subspace(const arma::cx_mat& x, double beta)
+{
+	for (unsigned int k = 0; k < x.n_cols; k++)
+	{
+		arma::cx_vec xk = x.col(k);
+		arma::cx_vec y = herm(d_W) * xk;
+		arma::cx_vec q = d_Z * y / beta;
+		double gamma = 1.0 / (1.0 + std::real(arma::accu(arma::conj(y) % q)));
+		arma::cx_vec p = gamma * (xk - d_W * y);
+		d_Z = d_Z / beta - gamma * q * herm(q);
+		
+		double q2 = pow(arma::norm(q, 2), 2);
+		if (q2 <= 0.0)
+			continue;
+		double p2 = pow(arma::norm(p, 2), 2);
+		double tau = (1.0 / sqrt(1.0 + p2 * q2) - 1.0) / q2;
+		d_W += (tau * d_W * q + (1.0 + tau * q2) * p) * herm(q);
+	}
+	
+	d_Z = (d_Z + herm(d_Z)) / 2.0;	// Keep it Hermitian against round-off
+}
 
-	// Generate a base for the noise subspace
-	arma::cx_mat G = eigvec.cols(0, d_m-d_n-1);
+int baz_music_doa::work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+{
+	double forgetting_factor;
+	bool subspace_tracking;
+	{ gr::thread::scoped_lock guard(d_mutex);
+		forgetting_factor = d_forgetting_factor;
+		subspace_tracking = d_subspace_tracking;
+	}
+	
+	unsigned int average_over = d_nsamples / d_m;
+	
+	for (int item = 0; item < noutput_items; item++)
+	{
+	
+	const gr_complex* in = static_cast<const gr_complex*>(input_items[0]) + (item * d_nsamples);
+	for(int i = 0; i < d_nsamples; i++)
+		d_data[i] = static_cast<gr_complexd>(in[i]);
+	
+	// Correlation estimation
+	arma::cx_mat x(arma::cx_rowvec(&d_data[0], d_nsamples));
+	x.reshape(d_m, average_over);	// (n_rows, n_cols)
+	
+	arma::cx_mat G;
+	
+	if (subspace_tracking)
+	{
+		if (d_W_valid == false)
+		{
+			update_covariance(x, forgetting_factor);
+			init_subspace(d_R);
+		}
+		else
+		{
+			double beta = forgetting_factor;
+			if ((beta <= 0.0) || (beta >= 1.0))
+				beta = 1.0 - 1.0 / (double)(average_over + 1);	// Memory of about one block
+			track_subspace(x, beta);
+		}
+		
+		d_R_valid = false;
+		G = d_W;	// Signal subspace
+	}
+	else
+	{
+		update_covariance(x, forgetting_factor);
+		d_W_valid = false;
+		
+		// Eigendecomposition
+		arma::colvec eigvals;
+		arma::cx_mat eigvec;
+		arma::eig_sym(eigvals, eigvec, d_R);
+		
+		// Generate a base for the noise subspace
+		G = eigvec.cols(0, d_m-d_n-1);
+	}
 	
 	std::vector<doa_t> vDOAs(d_n, std::make_pair(0,0));
 	
 	float* out_spectrum = NULL;
 	if (output_items.size() > 2)
-		out_spectrum = static_cast<float*>(output_items[2]);
+		out_spectrum = static_cast<float*>(output_items[2]) + (item * d_resolution);
 	
 	{ gr::thread::scoped_lock guard(d_mutex);
 	
+	bool grid = true;
+	if (d_ula_spacing != 0)
+	{
+		arma::cx_mat C = G * herm(G);	// Noise subspace projector
+		if (subspace_tracking)
+			C = arma::eye<arma::cx_mat>(d_m, d_m) - C;
+		grid = (root_music(C, vDOAs) == false);
+	}
+	
+	if ((grid) || (out_spectrum != NULL))
+	{
+		// |G^H.a|^2 for every steering vector at once
+		arma::cx_mat P = herm(G) * d_A;
+		arma::rowvec projection = arma::sum(arma::real(P % arma::conj(P)), 0);
+		if (subspace_tracking)	// Noise subspace projection is |a|^2 - |W^H.a|^2
+			projection = d_A_power - projection;
+	
 	for (unsigned int step = 0; step < d_resolution; step++)
 	{
-		const antenna_response_t& antenna_response = d_array_response[step];
-		//arma::cx_mat a(arma::cx_rowvec(&antenna_response.begin(), antenna_response.size());
-		//arma::cx_mat c = a * G;
-		//arma::cx_mat d = c * c.t();
-		
-		arma::cx_vec a(d_m);
-		for(int t = 0; t < d_m; t++)
-			a[t] = antenna_response[t];
-		
-		double strength =
-#if ARMA_VERSION_MAJOR < 2	// FIXME: .t()
-		1.0 / pow((arma::norm(arma::htrans(G) * a, 2)),2);
-#else
-		1.0 / pow((arma::norm(arma::trans (G) * a, 2)),2);
-#endif
+		double strength = 1.0 / std::max(projection[step], 1e-12);
 		if (out_spectrum != NULL)
 			out_spectrum[step] = strength;
-static bool bFirst = false;
-if (bFirst == false)
-{
-//fprintf(stderr, "%03i = %f\n", step, strength);
-if (step == (d_resolution-1))
-	bFirst = true;
-}
+		if (grid == false)
+			continue;
 		for (int i = 0; i < d_n; i++)
 		{
 			const doa_t& doa = vDOAs[i];
@@ -141,21 +351,23 @@ if (step == (d_resolution-1))
 		}
 	}
 	
+	}
+	
 	}	// Lock
 	
-	float* out = static_cast<float*> (output_items[0]);
+	float* out = static_cast<float*> (output_items[0]) + (item * d_n);
 	float* lvl = NULL;
 	if (output_items.size() > 1)
-		lvl = static_cast<float*> (output_items[1]);
+		lvl = static_cast<float*> (output_items[1]) + (item * d_n);
 	for(int i = 0; i < d_n; i++)
 	{
 //fprintf(stderr, "Max = %f\n", vDOAs[i].first);
 		out[i] = vDOAs[i].first;	//float(tmpout[i]);
-		lvl[i] = vDOAs[i].second;
+		if (lvl != NULL)
+			lvl[i] = vDOAs[i].second;
 	}
-	//delete[] tmpout;
 	
-	delete[] data;
+	}
 	
-	return 1;
+	return noutput_items;
 }
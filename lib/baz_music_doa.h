@@ -33,14 +33,14 @@ typedef std::vector<gr_complex> antenna_response_t;
 typedef std::vector<antenna_response_t> array_response_t;
 typedef std::pair<double,double> doa_t;
 
-baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution);
+baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor = 0.0, bool subspace_tracking = false, double ula_spacing = 0.0);
 
 class baz_music_doa : public gr::sync_block
 {
 private:
-	friend baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution);
+	friend baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor, bool subspace_tracking, double ula_spacing);
 
-	baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution);
+	baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor, bool subspace_tracking, double ula_spacing);
 
 public:
 	~baz_music_doa();
@@ -51,12 +51,37 @@ private:
 	unsigned int d_m;
 	unsigned int d_n;
 	unsigned int d_nsamples;
-	array_response_t d_array_response;
 	unsigned int d_resolution;
 	gr::thread::mutex  d_mutex;
+	double d_forgetting_factor;
+	bool d_subspace_tracking;
+	std::vector<gr_complexd> d_data;
+	arma::cx_mat d_R;	// Running covariance (eigendecomposition mode)
+	bool d_R_valid;
+	arma::cx_mat d_W;	// Tracked signal subspace (m x n)
+	arma::cx_mat d_Z;	// Inverse correlation of the projected snapshots (n x n)
+	bool d_W_valid;
+	arma::cx_mat d_A;	// Steering matrix (m x resolution)
+	arma::rowvec d_A_power;	// |a|^2 of each steering vector
+	double d_ula_spacing;
+
+	void update_covariance(arma::cx_mat& x, double lambda);
+	void init_subspace(const arma::cx_mat& R);
+	void track_subspace(const arma::cx_mat& x, double beta);
+	void cache_steering_matrix(const array_response_t& array_response);
+	bool root_music(const arma::cx_mat& C, std::vector<doa_t>& doas);
 
 public:
 	void set_array_response(const array_response_t& array_response);
+	void set_forgetting_factor(double forgetting_factor);
+	double forgetting_factor() const
+	{ return d_forgetting_factor; }
+	void set_subspace_tracking(bool enable);
+	bool subspace_tracking() const
+	{ return d_subspace_tracking; }
+	void set_ula_spacing(double spacing);
+	double ula_spacing() const
+	{ return d_ula_spacing; }
 };
 
 #endif /* INCLUDED_BAZ_MUSIC_DOA_H */
@@ -37,6 +37,17 @@
 #include <baz_peak_detector.h>
 #include <gnuradio/io_signature.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define PEAK_DETECTOR_SSE2
+#include <emmintrin.h>
+#endif
+
+static const int SCAN_BLOCK = 256;	// Samples per block of the running average and idle scan
 
 /*
  * Create a new instance of baz_peak_detector and return
@@ -134,6 +145,146 @@ void baz_peak_detector::unset_threshold()
 	d_threshold_set = false;
 }
 
+// Runs the average over samples [begin, end) in blocks. Returns d_ave as seen by each of them (indexed by sample),
+// without changing d_ave: it only depends on the input, so the state machine picks it up as it goes.
+const float *baz_peak_detector::update_average(const float *in, int begin, int end)
+{
+	if (d_ave_buffer.size() < (size_t)end)
+		d_ave_buffer.resize(end);
+
+	float *ave = &d_ave_buffer[0];
+	float last = d_ave;
+
+	for (int i = begin; i < end; i += SCAN_BLOCK)
+	{
+		const int n = std::min(SCAN_BLOCK, end - i);
+		const float *prev = in + i - 1;
+
+		if ((d_alpha == 1.0f) && (isfinite(last)))
+		{
+			// 1*x + 0*ave is exactly x when x is finite and non-zero (a zero would take ave's sign)
+			bool exact = true;
+			int k = 0;
+#ifdef PEAK_DETECTOR_SSE2
+			const __m128 zero = _mm_setzero_ps();
+			__m128 all_ok = _mm_cmpeq_ps(zero, zero);
+			for (; (k + 4) <= n; k += 4)
+			{
+				__m128 x = _mm_loadu_ps(prev + k);
+				all_ok = _mm_and_ps(all_ok, _mm_and_ps(_mm_cmpeq_ps(_mm_sub_ps(x, x), zero), _mm_cmpneq_ps(x, zero)));
+				_mm_storeu_ps(ave + i + k, x);
+			}
+			exact = (_mm_movemask_ps(all_ok) == 0xF);
+#endif // PEAK_DETECTOR_SSE2
+			for (; k < n; ++k)
+			{
+				exact = exact && (isfinite(prev[k])) && (prev[k] != 0.0f);
+				ave[i + k] = prev[k];
+			}
+
+			if (exact)
+			{
+				last = prev[n-1];
+				continue;
+			}
+		}
+
+		for (int k = 0; k < n; ++k)
+		{
+			last = d_alpha * prev[k] + (1.0f - d_alpha) * last;	// As in general_work
+			ave[i + k] = last;
+		}
+	}
+
+	return ave;
+}
+
+// First sample in the block that may pass the rise test in general_work (or 'n' if none does).
+// The test is widened by a few ULPs so that an FMA-contracted state machine can't disagree with it:
+// a false candidate only costs one pass through the state machine, which then finds nothing to do.
+int baz_peak_detector::find_candidate(const float *in, const float *ave, int n, bool threshold_set, float threshold) const
+{
+	int k = 0;
+#ifdef PEAK_DETECTOR_SSE2
+	const __m128 min_level = _mm_set1_ps(threshold_set ? threshold : -std::numeric_limits<float>::infinity());
+	const __m128 drop = _mm_set1_ps(d_drop);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 ulps = _mm_set1_ps((1.0f + 2.0f * fabsf(d_drop)) / (1 << 21));	// Bounds the rounding of ave*drop and the difference
+	const __m128 tiny = _mm_set1_ps(2.0f * std::numeric_limits<float>::denorm_min());
+	for (; (k + 8) <= n; k += 8)
+	{
+		__m128 x0 = _mm_loadu_ps(in + k), x1 = _mm_loadu_ps(in + k + 4);
+		__m128 a0 = _mm_loadu_ps(ave + k), a1 = _mm_loadu_ps(ave + k + 4);
+		__m128 level0 = _mm_sub_ps(a0, _mm_mul_ps(a0, drop)), level1 = _mm_sub_ps(a1, _mm_mul_ps(a1, drop));
+		__m128 slack0 = _mm_add_ps(_mm_mul_ps(_mm_and_ps(a0, abs_mask), ulps), tiny);
+		__m128 slack1 = _mm_add_ps(_mm_mul_ps(_mm_and_ps(a1, abs_mask), ulps), tiny);
+		__m128 hit0 = _mm_and_ps(_mm_cmpge_ps(x0, min_level), _mm_cmpge_ps(x0, _mm_sub_ps(level0, slack0)));
+		__m128 hit1 = _mm_and_ps(_mm_cmpge_ps(x1, min_level), _mm_cmpge_ps(x1, _mm_sub_ps(level1, slack1)));
+		int mask = _mm_movemask_ps(hit0) | (_mm_movemask_ps(hit1) << 4);
+		if (mask != 0)
+		{
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				++k;
+			}
+			return k;
+		}
+	}
+#endif // PEAK_DETECTOR_SSE2
+	for (; k < n; ++k)
+	{
+		if (((threshold_set == false) || (in[k] >= threshold)) &&
+			(in[k] > (ave[k] - (ave[k] * d_drop))))
+			return k;
+	}
+
+	return n;
+}
+
+// Called while not rising and with no look ahead pending: then a sample that fails the rise test
+// only moves the average (and lockout), so it is skipped to the next sample that might pass it (or 'end').
+int baz_peak_detector::scan_idle(const float *in, const float *ave, int i, int end)
+{
+	if (d_lockout_count > 1)	// Locked out: only the average moves
+	{
+		const int n = std::min(d_lockout_count - 1, end - i);
+		d_lockout_count -= n;
+		i += n;
+	}
+
+	const bool threshold_set = d_threshold_set;
+	const float threshold = d_threshold;
+	const int start = i;
+
+	// Crossings are often close together: look at the next few samples before setting up a block scan
+	const int near_end = std::min(i + 8, end);
+	for (; i < near_end; ++i)
+	{
+		if (((threshold_set == false) || (in[i] >= threshold)) &&
+			(in[i] > (ave[i] - (ave[i] * d_drop))))
+			break;
+	}
+
+	if (i == near_end)
+	{
+		while (i < end)
+		{
+			const int n = std::min(SCAN_BLOCK, end - i);
+
+			int k = find_candidate(in + i, ave + i, n, threshold_set, threshold);
+			i += k;
+			if (k < n)
+				break;
+		}
+	}
+
+	if ((i > start) && (d_lockout_count == 1))	// Expired on a sample that was skipped
+		d_lockout_count = 0;
+
+	return i;
+}
+
 //int baz_peak_detector::work (int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 int baz_peak_detector::general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 {
@@ -161,9 +312,18 @@ int baz_peak_detector::general_work(int noutput_items, gr_vector_int &ninput_ite
 	d_advance = 0;
 	
 	const int offset = 1;	// From history
+	const float *ave = update_average(in, offset, (noutput_items+offset));	// Updating average from previous sample (not this one!)
+
 	for (int i = (0+offset + d_advance); i < (noutput_items+offset); i++)
 	{
-		d_ave = d_alpha * in[i-1] + (1.0f - d_alpha) * d_ave;	// Updating average from previous sample (not this one!)
+		if ((d_rising == false) && (d_look_ahead_count == 0))
+		{
+			i = scan_idle(in, ave, i, (noutput_items+offset));
+			if (i == (noutput_items+offset))
+				break;
+		}
+
+		d_ave = ave[i];
 		
 		if (d_lockout_count > 0)
 		{
@@ -306,6 +466,9 @@ int baz_peak_detector::general_work(int noutput_items, gr_vector_int &ninput_ite
 		}
 	}
 
+	if (noutput_items > 0)
+		d_ave = ave[noutput_items+offset-1];
+
 	consume(0, noutput_items);
 
 	return noutput_items;
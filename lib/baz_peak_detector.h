@@ -29,6 +29,7 @@
 #define INCLUDED_BAZ_PEAK_DETECTOR_H
 
 #include <gnuradio/sync_block.h>
+#include <vector>
 
 class BAZ_API baz_peak_detector;
 
@@ -92,6 +93,13 @@ private:
 	bool d_verbose;
 	int64_t d_last_peak_idx;
 
+	std::vector<float> d_ave_buffer;	// d_ave as seen by each sample of the current call
+
+	// Idle fast path: the state machine only runs from a sample that may start a rise
+	const float *update_average(const float *in, int begin, int end);
+	int scan_idle(const float *in, const float *ave, int i, int end);
+	int find_candidate(const float *in, const float *ave, int n, bool threshold_set, float threshold) const;
+
 	public:
 	~baz_peak_detector ();	// public destructor
 
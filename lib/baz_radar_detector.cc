@@ -38,14 +38,16 @@
 #include <gnuradio/io_signature.h>
 
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 
 /*
  * Create a new instance of baz_radar_detector and return
  * a boost shared_ptr.  This is effectively the public constructor.
  */
-baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq)
+baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch /*= 256*/)
 {
-	return baz_radar_detector_sptr (new baz_radar_detector (sample_rate, msgq));
+	return baz_radar_detector_sptr (new baz_radar_detector (sample_rate, msgq, pdw_batch));
 }
 
 /*
@@ -65,7 +67,7 @@ static const int MAX_OUT = 1;	// maximum number of output streams
 /*
  * The private constructor
  */
-baz_radar_detector::baz_radar_detector (int sample_rate, gr::msg_queue::sptr msgq)
+baz_radar_detector::baz_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch)
   : gr::block ("radar_detector",
 		gr::io_signature::make (MIN_IN, MAX_IN, sizeof(float)),
 		gr::io_signature::make (MIN_OUT, MAX_OUT, sizeof(float)))
@@ -82,8 +84,23 @@ baz_radar_detector::baz_radar_detector (int sample_rate, gr::msg_queue::sptr msg
 	, d_skip(0)
 	, d_pulse_plateau(1.0)
 	, d_last(0.0)
+	, d_in_plateau(false)
+	, d_flat_sum_count(0)
+	, d_time_valid(false)
+	, d_time_seconds(0)
+	, d_time_fractional_seconds(0.0)
+	, d_time_sample(0)
+	, d_burst_time_valid(false)
+	, d_burst_time_seconds(0)
+	, d_burst_time_fractional_seconds(0.0)
+	, d_pdw_batch(std::max(1, pdw_batch))
+	, d_pdw_port(pmt::mp("pdw"))
 {
-	fprintf(stderr, "[%s<%li>] sample rate: %i\n", name().c_str(), unique_id(), sample_rate);
+	fprintf(stderr, "[%s<%li>] sample rate: %i, PDW batch: %i\n", name().c_str(), unique_id(), sample_rate, d_pdw_batch);
+
+	message_port_register_out(d_pdw_port);
+
+	d_pdws.reserve(d_pdw_batch);
 }
 
 /*
@@ -142,6 +159,31 @@ void baz_radar_detector::skip(int skip)
 	d_skip = skip;
 }
 
+void baz_radar_detector::set_pdw_batch(int batch)
+{
+	d_pdw_batch = std::max(1, batch);	// Takes effect with the next batch
+}
+
+static const pmt::pmt_t RX_TIME_KEY = pmt::string_to_symbol("rx_time");
+static const pmt::pmt_t SAMPLE_RATE_KEY = pmt::string_to_symbol("sample_rate");
+static const pmt::pmt_t COUNT_KEY = pmt::string_to_symbol("count");
+
+void baz_radar_detector::publish_pdws()
+{
+	if (d_pdws.empty())
+		return;
+
+	pmt::pmt_t meta = pmt::make_dict();
+	meta = pmt::dict_add(meta, SAMPLE_RATE_KEY, pmt::from_long(d_sample_rate));
+	meta = pmt::dict_add(meta, COUNT_KEY, pmt::from_long(d_pdws.size()));
+
+	pmt::pmt_t data = pmt::init_u8vector(d_pdws.size() * sizeof(pulse_descriptor), (const uint8_t*)&d_pdws[0]);
+
+	message_port_pub(d_pdw_port, pmt::cons(meta, data));
+
+	d_pdws.clear();
+}
+
 int baz_radar_detector::general_work (int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 {
 	const float *in = (const float*)input_items[0];
@@ -154,8 +196,31 @@ int baz_radar_detector::general_work (int noutput_items, gr_vector_int &ninput_i
 	if (output_items.size() > 0)
 		out = (float*)output_items[0];
 
+	const uint64_t nread = nitems_read(0);
+
+	std::vector<gr::tag_t> time_tags;
+	get_tags_in_range(time_tags, 0, nread, nread + noutput_items, RX_TIME_KEY);
+	size_t next_time_tag = 0;
+
 	for (int i = 0; i < noutput_items; i++)
 	{
+		while ((next_time_tag < time_tags.size()) && (time_tags[next_time_tag].offset == (nread + i)))
+		{
+			const gr::tag_t& tag = time_tags[next_time_tag++];
+
+			if ((pmt::is_tuple(tag.value) == false) || (pmt::length(tag.value) != 2) ||
+				(pmt::is_uint64(pmt::tuple_ref(tag.value, 0)) == false) || (pmt::is_real(pmt::tuple_ref(tag.value, 1)) == false))
+			{
+				fprintf(stderr, "[%s<%li>] ignoring malformed rx_time tag at %llu: %s\n", name().c_str(), unique_id(), (unsigned long long)tag.offset, pmt::write_string(tag.value).c_str());
+				continue;
+			}
+
+			d_time_seconds = pmt::to_uint64(pmt::tuple_ref(tag.value, 0));
+			d_time_fractional_seconds = pmt::to_double(pmt::tuple_ref(tag.value, 1));
+			d_time_sample = tag.offset;
+			d_time_valid = true;
+		}
+
 		if (d_skip > 0)
 		{
 			--d_skip;
@@ -182,6 +247,15 @@ int baz_radar_detector::general_work (int noutput_items, gr_vector_int &ninput_i
 				d_in_plateau = false;
 				d_flat_sum = 0.0;
 				d_flat_sum_count = 0;
+
+				d_burst_time_valid = d_time_valid;
+				if (d_time_valid)
+				{
+					double t = d_time_fractional_seconds + ((double)(d_burst_start - d_time_sample) / (double)d_sample_rate);
+					double whole = floor(t);
+					d_burst_time_seconds = d_time_seconds + (uint64_t)whole;
+					d_burst_time_fractional_seconds = t - whole;
+				}
 			}
 			
 			if (d_in_burst)
@@ -274,10 +348,33 @@ int baz_radar_detector::general_work (int noutput_items, gr_vector_int &ninput_i
 						//fprintf(stderr, "[%s<%i>] message queue full\n", name().c_str(), unique_id());
 					}
 				}
+
+				pulse_descriptor pdw;
+				memset(&pdw, 0x00, sizeof(pdw));
+				pdw.toa = d_burst_start;
+				pdw.width = (uint32_t)len;
+				pdw.peak = (float)d_max;
+				if (d_flat_sum_count > 0)
+				{
+					pdw.plateau = (float)(d_flat_sum / (double)d_flat_sum_count);
+					pdw.flags |= PDW_PLATEAU;
+				}
+				if (d_burst_time_valid)
+				{
+					pdw.time_seconds = d_burst_time_seconds;
+					pdw.time_fractional_seconds = d_burst_time_fractional_seconds;
+					pdw.flags |= PDW_TIME_VALID;
+				}
+
+				d_pdws.push_back(pdw);
+				if ((int)d_pdws.size() >= d_pdw_batch)
+					publish_pdws();
 			}
 		}
 	}
 	
+	publish_pdws();	// Whatever ended in this call
+	
 	consume_each(noutput_items);
 	
 	return out_count;
@@ -30,6 +30,8 @@
 
 #include <gnuradio/block.h>
 #include <gnuradio/msg_queue.h>
+#include <pmt/pmt.h>
+#include <vector>
 
 class BAZ_API baz_radar_detector;
 
@@ -53,22 +55,26 @@ typedef boost::shared_ptr<baz_radar_detector> baz_radar_detector_sptr;
  * constructor is private.  baz_make_block_status is the public
  * interface for creating new instances.
  */
-BAZ_API baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq);
+BAZ_API baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch = 256);
 
 /*!
  * \brief radar_detector a stream of floats.
  * \ingroup block
  *
  * This uses the preferred technique: subclassing gr_sync_block.
+ *
+ * Besides the ath5k-style messages on msgq, each pulse is described by a pulse_descriptor on the 'pdw' message port.
+ * They are sent as PDUs (metadata dict with 'sample_rate' and 'count', u8vector of packed descriptors):
+ * one per work call with the pulses that ended in it, or sooner once pdw_batch have accumulated.
  */
 class BAZ_API baz_radar_detector : public gr::block
 {
 private:
 	// The friend declaration allows baz_make_block_status to
 	// access the private constructor.
-	friend BAZ_API baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq);
+	friend BAZ_API baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch);
 
-	baz_radar_detector (int sample_rate, gr::msg_queue::sptr msgq);  	// private constructor
+	baz_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch);  	// private constructor
 
 	int d_sample_rate;
 	gr::msg_queue::sptr d_msgq;
@@ -84,6 +90,32 @@ private:
 	double d_flat_sum;
 	bool d_in_plateau;
 	int d_flat_sum_count;
+	bool d_time_valid;			// Last rx_time tag, and the sample it applies to
+	uint64_t d_time_seconds;
+	double d_time_fractional_seconds;
+	uint64_t d_time_sample;
+	bool d_burst_time_valid;		// Absolute time of the current burst's leading edge
+	uint64_t d_burst_time_seconds;
+	double d_burst_time_fractional_seconds;
+	int d_pdw_batch;
+	pmt::pmt_t d_pdw_port;
+public:
+	struct pulse_descriptor {	// 'pdw' port, native byte order (40 bytes)
+		uint64_t toa;			// Sample index of the leading edge
+		uint64_t time_seconds;		// Absolute time of the leading edge from rx_time (PDW_TIME_VALID)
+		double time_fractional_seconds;
+		uint32_t width;			// Samples above threshold
+		float peak;
+		float plateau;			// Mean plateau level (PDW_PLATEAU)
+		uint32_t flags;
+	};
+	enum pdw_flags {
+		PDW_TIME_VALID	= 0x01,
+		PDW_PLATEAU	= 0x02
+	};
+private:
+	std::vector<pulse_descriptor> d_pdws;
+	void publish_pdws();
 public:
 	struct ath5k_radar_error {
 		uint32_t tsf;
@@ -100,6 +132,7 @@ public:
 	void set_pulse_plateau(float level);
 	bool set_param(const std::string& param, float value);
 	void skip(int skip);
+	void set_pdw_batch(int batch);
 
 	int general_work (int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items);
 };
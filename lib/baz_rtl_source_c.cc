@@ -39,8 +39,11 @@
 #include <stdio.h>
 
 #include <iostream>	// cerr
+#include <chrono>
+#include <algorithm>	// fill
 
 #include "rtl2832.h"
+#include "rtl2832-convert.h"
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #define strcasecmp _stricmp
@@ -74,9 +77,25 @@ enum RtlStatusFlags {	// Matches BorIP values
 #define DEFAULT_BUFFER_LEVEL	0.5f
 #define WAIT_FUDGE				(1.2+0.3)
 #define RAW_SAMPLE_SIZE			(1+1)
+#define DEFAULT_TRANSFER_COUNT	0	// Synchronous reads
+#define ASYNC_EVENT_TIMEOUT_MS	50
+#define RAW_SAMPLE_ZERO			0x80
+#define DC_AVERAGE_SAMPLES		(1 << 20)	// Time constant of the DC offset estimate
+#define DEFAULT_REPLAY_TUNER	"r820t"
+#define LATENCY_BUCKETS_PER_OCTAVE	8
+#define LATENCY_BUCKETS			(24 * LATENCY_BUCKETS_PER_OCTAVE)	// 1 us to ~16 s
+#define DEFAULT_RETUNE_SETTLE	0.001	// s (PLL lock)
+#define NO_RETUNE_TAG			(~0ULL)
 //#define EXTREME_LOCKING		// Switched off to improve responsiveness (just don't call certain functions from different threads simultaneously!)
 
-static float _char_to_float_lut[256] = { -1.000000f, -0.992188f, -0.984375f, -0.976562f, -0.968750f, -0.960938f, -0.953125f, -0.945312f, -0.937500f, -0.929688f, -0.921875f, -0.914062f, -0.906250f, -0.898438f, -0.890625f, -0.882812f, -0.875000f, -0.867188f, -0.859375f, -0.851562f, -0.843750f, -0.835938f, -0.828125f, -0.820312f, -0.812500f, -0.804688f, -0.796875f, -0.789062f, -0.781250f, -0.773438f, -0.765625f, -0.757812f, -0.750000f, -0.742188f, -0.734375f, -0.726562f, -0.718750f, -0.710938f, -0.703125f, -0.695312f, -0.687500f, -0.679688f, -0.671875f, -0.664062f, -0.656250f, -0.648438f, -0.640625f, -0.632812f, -0.625000f, -0.617188f, -0.609375f, -0.601562f, -0.593750f, -0.585938f, -0.578125f, -0.570312f, -0.562500f, -0.554688f, -0.546875f, -0.539062f, -0.531250f, -0.523438f, -0.515625f, -0.507812f, -0.500000f, -0.492188f, -0.484375f, -0.476562f, -0.468750f, -0.460938f, -0.453125f, -0.445312f, -0.437500f, -0.429688f, -0.421875f, -0.414062f, -0.406250f, -0.398438f, -0.390625f, -0.382812f, -0.375000f, -0.367188f, -0.359375f, -0.351562f, -0.343750f, -0.335938f, -0.328125f, -0.320312f, -0.312500f, -0.304688f, -0.296875f, -0.289062f, -0.281250f, -0.273438f, -0.265625f, -0.257812f, -0.250000f, -0.242188f, -0.234375f, -0.226562f, -0.218750f, -0.210938f, -0.203125f, -0.195312f, -0.187500f, -0.179688f, -0.171875f, -0.164062f, -0.156250f, -0.148438f, -0.140625f, -0.132812f, -0.125000f, -0.117188f, -0.109375f, -0.101562f, -0.093750f, -0.085938f, -0.078125f, -0.070312f, -0.062500f, -0.054688f, -0.046875f, -0.039062f, -0.031250f, -0.023438f, -0.015625f, -0.007812f, 0.000000f, 0.007812f, 0.015625f, 0.023438f, 0.031250f, 0.039062f, 0.046875f, 0.054688f, 0.062500f, 0.070312f, 0.078125f, 0.085938f, 0.093750f, 0.101562f, 0.109375f, 0.117188f, 0.125000f, 0.132812f, 0.140625f, 0.148438f, 0.156250f, 0.164062f, 0.171875f, 0.179688f, 0.187500f, 0.195312f, 0.203125f, 0.210938f, 0.218750f, 0.226562f, 0.234375f, 0.242188f, 0.250000f, 0.257812f, 0.265625f, 0.273438f, 0.281250f, 0.289062f, 0.296875f, 0.304688f, 0.312500f, 0.320312f, 0.328125f, 0.335938f, 0.343750f, 0.351562f, 0.359375f, 0.367188f, 0.375000f, 0.382812f, 0.390625f, 0.398438f, 0.406250f, 0.414062f, 0.421875f, 0.429688f, 0.437500f, 0.445312f, 0.453125f, 0.460938f, 0.468750f, 0.476562f, 0.484375f, 0.492188f, 0.500000f, 0.507812f, 0.515625f, 0.523438f, 0.531250f, 0.539062f, 0.546875f, 0.554688f, 0.562500f, 0.570312f, 0.578125f, 0.585938f, 0.593750f, 0.601562f, 0.609375f, 0.617188f, 0.625000f, 0.632812f, 0.640625f, 0.648438f, 0.656250f, 0.664062f, 0.671875f, 0.679688f, 0.687500f, 0.695312f, 0.703125f, 0.710938f, 0.718750f, 0.726562f, 0.734375f, 0.742188f, 0.750000f, 0.757812f, 0.765625f, 0.773438f, 0.781250f, 0.789062f, 0.796875f, 0.804688f, 0.812500f, 0.820312f, 0.828125f, 0.835938f, 0.843750f, 0.851562f, 0.859375f, 0.867188f, 0.875000f, 0.882812f, 0.890625f, 0.898438f, 0.906250f, 0.914062f, 0.921875f, 0.929688f, 0.937500f, 0.945312f, 0.953125f, 0.960938f, 0.968750f, 0.976562f, 0.984375f, 0.992188f };
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t _now_ns()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const pmt::pmt_t RX_FREQ_KEY = pmt::string_to_symbol("rx_freq");
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -88,10 +107,13 @@ baz_rtl_source_c::baz_rtl_source_c (bool defer_creation /*= false*/, int output_
 	, m_nOverflows(0)
 	, m_bRunning(false)
 	, m_recv_samples_per_packet(0)
-	, m_nBufferItems(0)
 	, m_pUSBBuffer(NULL)
-	, m_nBufferStart(0)
 	, m_nBufferSize(0)
+	, m_nBlocksWritten(0)
+	, m_nBlocksRead(0)
+	, m_nBlockOffset(0)
+	, m_pBlockTimes(NULL)
+	, m_bConsumerWaiting(false)
 	, m_bBuffering(false)
 	, m_nReadLength(DEFAULT_READLEN)
 	, m_nBufferMultiplier(DEFAULT_BUFFER_MUL)
@@ -100,19 +122,31 @@ baz_rtl_source_c::baz_rtl_source_c (bool defer_creation /*= false*/, int output_
 	, m_nReadPacketCount(0)
 	, m_nBufferOverflowCount(0)
 	, m_nBufferUnderrunCount(0)
+	, m_nTransferCount(DEFAULT_TRANSFER_COUNT)
+	, m_nSlotsPending(0)
+	, m_pTransferScratch(NULL)
+	, m_nShortTransferCount(0)
+	, m_pConvert(&RTL2832_NAMESPACE::convert::best_kernels())
+	, m_bRemoveDC(false)
+	, m_bReplayLoop(false)
+	, m_bReplayPacing(true)
+	, m_pReplay(NULL)
 	, m_verbose(true)
 	, m_relative_gain(false)
 	, m_output_size(0)
+	, m_nWaitDelay(0)	// Set properly in 'set_sample_rate'
+	, m_LatencyHistogram(LATENCY_BUCKETS)
+	, m_nLatencyCount(0)
+	, m_nLatencyMax(0)
+	, m_nBlockDuration(0)
+	, m_dRetuneSettleTime(DEFAULT_RETUNE_SETTLE)
+	, m_nRetuneSettled(0)
+	, m_dRetuneFreq(0)
+	, m_nRetuneTagSample(NO_RETUNE_TAG)
+	, m_dRetuneTagFreq(0)
 {
   ZERO_MEMORY(m_demod_params);
- 
-#ifdef HAVE_XTIME
-  ZERO_MEMORY(m_wait_delay);	// This is not future proof (will be initialised properly in 'set_sample_rate')
-
-//  struct timespec res;
-//  clock_getres(CLOCK_MONOTONIC, &res);
-//  log_verbose("Res (%lld s, %lld ns)\n", res.tv_sec, res.tv_nsec);
-#endif // HAVE_XTIME
+  ZERO_MEMORY(m_fDCOffset);
 
   set_output_format(output_size);
   
@@ -145,16 +179,10 @@ baz_rtl_source_c::general_work (int noutput_items,
 			       gr_vector_const_void_star &input_items,
 			       gr_vector_void_star &output_items)
 {
-  //float *out = (float *)output_items[0];	// gr_complex = float * 2 [_M_real, _M_imag]
-  gr_complex *out = (gr_complex *)output_items[0];
-  short* out4 = (short*)output_items[0];
-  char* out2 = (char*)output_items[0];
   int item_adjust = ((m_output_size == sizeof(gr_complex)) ? 1 : 2);
   
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-  boost::recursive_mutex::scoped_lock lock(d_mutex);
-
   if (m_bRunning == false)
   {
 	log_error(_T("work called while not running!\n"));
@@ -163,6 +191,12 @@ baz_rtl_source_c::general_work (int noutput_items,
   
   if (m_bUseBuffer == false)
   {
+	boost::recursive_mutex::scoped_lock lock(d_mutex);	// Reads share the device with control
+	
+	uint64_t nSettled = m_nRetuneSettled;
+	if ((nSettled != 0) && (_now_ns() >= nSettled) && (m_nRetuneSettled.compare_exchange_strong(nSettled, 0)))
+	  add_item_tag(0, nitems_written(0), RX_FREQ_KEY, pmt::from_double(m_dRetuneFreq));
+	
 	int iToRead = (noutput_items/item_adjust) * RAW_SAMPLE_SIZE;
 	if (iToRead > (m_nBufferSize * RAW_SAMPLE_SIZE))
 	{
@@ -186,28 +220,7 @@ baz_rtl_source_c::general_work (int noutput_items,
 	int iSampleCount = iRead / RAW_SAMPLE_SIZE;
 	m_nSamplesReceived += iSampleCount;
 	
-	if (m_output_size == (sizeof(char)))
-	{
-	  memcpy(out2, m_pUSBBuffer, iRead);
-	}
-	else
-	{
-	  for (int n = 0; n < iSampleCount; n++)
-	  {
-		if (m_output_size == (sizeof(short)))	// No range expansion
-		{
-		  out4[n*2 + 0] = (unsigned char)m_pUSBBuffer[n*RAW_SAMPLE_SIZE + 0] - 128;
-		  out4[n*2 + 1] = (unsigned char)m_pUSBBuffer[n*RAW_SAMPLE_SIZE + 1] - 128;
-		}
-		else if (m_output_size == sizeof(gr_complex))
-		{
-		  out[n] = gr_complex(
-			_char_to_float_lut[m_pUSBBuffer[n*RAW_SAMPLE_SIZE + 0]],
-			_char_to_float_lut[m_pUSBBuffer[n*RAW_SAMPLE_SIZE + 1]]
-		  );
-		}
-	  }
-	}
+	convert_samples(m_pUSBBuffer, output_items[0], 0, iSampleCount);
 	
 	if (res == LIBUSB_ERROR_OVERFLOW)
 	{
@@ -228,35 +241,43 @@ baz_rtl_source_c::general_work (int noutput_items,
 	log_error(_T("work wants more than the buffer size!\n"));
 	noutput_items = m_nBufferSize * item_adjust;
   }
+  
+  // Only this thread moves the read position: the capture thread only ever adds blocks
+  uint32_t nReserve = (uint32_t)(m_fBufferLevel * (float)m_nBufferSize) + m_recv_samples_per_packet;	// If getting too full, send them all through
 retry_notify:
-  while ((m_bBuffering) || (m_nBufferItems <= ((uint32_t)(m_fBufferLevel * (float)m_nBufferSize) + m_recv_samples_per_packet)))	// If getting too full, send them all through
+  while (true)
   {
-	bool notified = true;
+	uint32_t nWritten = m_nBlocksWritten;
+	uint32_t nItems = buffered_items(nWritten);
 	
 	if (m_bBuffering)
-	  m_hPacketEvent.wait(lock);	// Always wait for new samples to arrive while buffering
-	else
 	{
-#ifdef HAVE_XTIME
-	  xtime_get(&m_wait_next, CLOCK_MONOTONIC);
-	  m_wait_next.nsec += m_wait_delay.nsec;
-	  if (m_wait_next.nsec >= 1000000000)
+	  if (nItems >= nReserve)	// Add additional amount that is about to be read back out
 	  {
-		m_wait_next.sec += 1;
-		m_wait_next.nsec -= 1000000000;
+		log_verbose(_T("Finished buffering (%lu/%lu) [#%lu]\n"), nItems, m_nBufferSize, m_nReadPacketCount);
+		m_bBuffering = false;
+		break;
 	  }
-	  ///////////////////////////////////////////////////
-	  notified = m_hPacketEvent.timed_wait(lock, m_wait_next);	// Wait for more samples to arrive, or wait just longer than it would have actually taken and use buffer samples
-#else
-      m_hPacketEvent.wait(lock);	// In this case read prediction will be disabled
-#endif // HAVE_XTIME
+	  
+	  wait_for_block(nWritten, 0);	// Always wait for new samples to arrive while buffering
 	}
-	
-	if (notified == false)	// Timeout
+	else
 	{
-	  log_error("rT");
-	  report_status(RTL_STATUS_TIMEOUT);
-	  break;	// Running late, use up some of the buffer
+	  if (nItems > nReserve)
+		break;
+	  
+	  uint64_t nDelay = m_nWaitDelay;
+	  uint64_t nDeadline = ((nDelay > 0) ? (m_pBlockTimes[(nWritten - 1) % m_nBufferMultiplier] + nDelay) : 0);
+	  
+	  if (wait_for_block(nWritten, nDeadline) == false)	// Wait for more samples to arrive, or wait just longer than the next block should have taken and use buffer samples
+	  {
+		log_error("rT");
+		report_status(RTL_STATUS_TIMEOUT);
+		break;	// Running late, use up some of the buffer
+	  }
+	  
+	  if (m_bRunning)
+		break;
 	}
 	
 	if (m_bRunning == false)
@@ -264,16 +285,12 @@ retry_notify:
 	  log_error(_T("No longer running after packet notification - signalling EOF...\n"));
 	  return -1;	// EOF
 	}
-	
-	if (m_bBuffering == false)	// No longer filling buffer, so send samples back to runtime
-	  break;
-	
-	log_error(_T("Caught packet signal while buffering!\n"));
   }
-
-  if (m_nBufferItems < m_recv_samples_per_packet)
+  
+  uint32_t nItems = buffered_items(m_nBlocksWritten);
+  
+  if (nItems < m_recv_samples_per_packet)
   {
-	//log_error(_T("Reading packet after signal, but not enough items in buffer (only %lu, need at least: %lu, start now %lu) [#%lu]\n"), m_nBufferItems, m_recv_samples_per_packet, m_nBufferStart, m_nReadPacketCount);
 	log_error("rU");
 	report_status(RTL_STATUS_UNDERRUN);
 	
@@ -282,82 +299,239 @@ retry_notify:
 	
 	goto retry_notify;	// Keep waiting for buffer to fill back up sufficiently
   }
-  else if (m_nBufferItems < (noutput_items/item_adjust))	// Double check
+  else if (nItems < (noutput_items/item_adjust))	// Double check
   {
-	log_error(_T("Not enough items for work %lu items (only %lu, s/p: %lu, start now %lu) [#%lu]\n"), (noutput_items/item_adjust), m_nBufferItems, m_recv_samples_per_packet, m_nBufferStart, m_nReadPacketCount);
-	noutput_items = m_nBufferItems * item_adjust;
+	log_error(_T("Not enough items for work %lu items (only %lu, s/p: %lu, offset now %lu) [#%lu]\n"), (noutput_items/item_adjust), nItems, m_recv_samples_per_packet, m_nBlockOffset, m_nReadPacketCount);
+	noutput_items = nItems * item_adjust;
   }
   
   ++m_nReadPacketCount;
   
-  uint32_t nPart1 = min((noutput_items/item_adjust), m_nBufferSize - m_nBufferStart);
-  uint8_t* p = m_pUSBBuffer + (m_nBufferStart * RAW_SAMPLE_SIZE);
-  uint32_t nResidual = (noutput_items/item_adjust) - nPart1;
+  uint32_t nWanted = (noutput_items/item_adjust);
+  uint32_t nDone = 0;
+  uint64_t nNow = 0;
+  
+  while (nDone < nWanted)
+  {
+	uint32_t nRead = m_nBlocksRead.load(std::memory_order_relaxed);
+	
+	if (m_nBlockOffset == 0)
+	{
+	  if (nNow == 0)
+		nNow = _now_ns();
+	  record_latency(nNow - m_pBlockTimes[nRead % m_nBufferMultiplier]);
+	  
+	  find_retune_sample(nRead, m_nSamplesReceived + nDone);
+	}
+	
+	uint32_t nCount = min(nWanted - nDone, m_recv_samples_per_packet - m_nBlockOffset);
+	convert_samples(block_buffer(nRead) + (m_nBlockOffset * RAW_SAMPLE_SIZE), output_items[0], nDone, nCount);
+	
+	nDone += nCount;
+	m_nBlockOffset += nCount;
+	
+	if (m_nBlockOffset == m_recv_samples_per_packet)
+	{
+	  m_nBlockOffset = 0;
+	  m_nBlocksRead.store(nRead + 1, std::memory_order_release);	// Hand the block back to the capture thread
+	}
+  }
+  
+  if ((m_nRetuneTagSample != NO_RETUNE_TAG) && (m_nRetuneTagSample < (m_nSamplesReceived + nWanted)))
+  {
+	uint64_t nOffset = ((m_nRetuneTagSample > m_nSamplesReceived) ? (m_nRetuneTagSample - m_nSamplesReceived) : 0);
+	add_item_tag(0, nitems_written(0) + (nOffset * item_adjust), RX_FREQ_KEY, pmt::from_double(m_dRetuneTagFreq));
+	m_nRetuneTagSample = NO_RETUNE_TAG;
+  }
+  
+  m_nSamplesReceived += nWanted;
   
-  if (m_output_size == (sizeof(char)))
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  
+  //consume_each(0);	// Tell runtime system how many input items we consumed on each input stream.
+  
+  return noutput_items;	// Tell runtime system how many output items we produced.
+}
+
+// Converts raw samples into the output at item 'nOffset' (in samples), updating the DC offset estimate if it is being removed
+void baz_rtl_source_c::convert_samples(const uint8_t* pIn, void* pOut, uint32_t nOffset, uint32_t nSamples)
+{
+  if (nSamples == 0)
+	return;
+  
+  if (m_output_size == sizeof(char))	// Raw
   {
-	memcpy(out2, p, nPart1 * RAW_SAMPLE_SIZE);
-	if (nResidual)
-	  memcpy(out2 + nPart1 * RAW_SAMPLE_SIZE, m_pUSBBuffer, nResidual * RAW_SAMPLE_SIZE);
+	memcpy((uint8_t*)pOut + (nOffset * RAW_SAMPLE_SIZE), pIn, nSamples * RAW_SAMPLE_SIZE);
+	return;
+  }
+  
+  int64_t sum[2] = { 0, 0 };
+  
+  if (m_output_size == sizeof(short))	// No range expansion
+  {
+	int16_t offset[2] = { 0, 0 };
+	if (m_bRemoveDC)
+	{
+	  offset[0] = (int16_t)floor(m_fDCOffset[0] + 0.5f);
+	  offset[1] = (int16_t)floor(m_fDCOffset[1] + 0.5f);
+	}
+	
+	m_pConvert->u8_to_s16(pIn, (int16_t*)pOut + (nOffset * 2), nSamples * RAW_SAMPLE_SIZE, offset, (m_bRemoveDC ? sum : NULL));
   }
   else
   {
-	for (uint32_t n = 0; n < nPart1; n++)
+	float offset[2] = { 0.0f, 0.0f };
+	if (m_bRemoveDC)
 	{
-	  if (m_output_size == (sizeof(short)))
-	  {
-		out4[n*2 + 0] = (unsigned char)p[n*2 + 0] - 128;
-		out4[n*2 + 1] = (unsigned char)p[n*2 + 1] - 128;
-	  }
-	  else if (m_output_size == sizeof(gr_complex))
-	  {
-		//short i = p[n*2+0];
-		//short q = p[n*2+1];
-		//out[n] = gr_complex(i - 127, q - 127);
-		out[n] = gr_complex(
-		  _char_to_float_lut[p[n*2 + 0]],
-		  _char_to_float_lut[p[n*2 + 1]]
-		);
-	  }
+	  offset[0] = m_fDCOffset[0] / 128.0f;
+	  offset[1] = m_fDCOffset[1] / 128.0f;
 	}
 	
-	if (nResidual > 0)
+	m_pConvert->u8_to_f32(pIn, (float*)((gr_complex*)pOut + nOffset), nSamples * RAW_SAMPLE_SIZE, offset, (m_bRemoveDC ? sum : NULL));
+  }
+  
+  if (m_bRemoveDC)
+  {
+	float fWeight = min(1.0f, (float)nSamples / (float)DC_AVERAGE_SAMPLES);
+	m_fDCOffset[0] += fWeight * (((float)sum[0] / (float)nSamples) - m_fDCOffset[0]);
+	m_fDCOffset[1] += fWeight * (((float)sum[1] / (float)nSamples) - m_fDCOffset[1]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Samples 'work' can read (only exact from the 'work' thread)
+uint32_t baz_rtl_source_c::buffered_items(uint32_t nBlocksWritten) const
+{
+  return (((nBlocksWritten - m_nBlocksRead.load(std::memory_order_relaxed)) * m_recv_samples_per_packet) - m_nBlockOffset);
+}
+
+// Capture thread: publishes the block after the last one
+void baz_rtl_source_c::commit_block()
+{
+  uint32_t nWritten = m_nBlocksWritten.load(std::memory_order_relaxed);
+  
+  m_pBlockTimes[nWritten % m_nBufferMultiplier] = _now_ns();
+  m_nBlocksWritten = nWritten + 1;	// 'work' can see the block (and its time) from here on
+  
+  if (m_bConsumerWaiting)	// Only take the lock when 'work' is (or is about to be) asleep
+  {
+	boost::mutex::scoped_lock lock(m_wait_mutex);
+	m_hPacketEvent.notify_one();
+  }
+}
+
+// 'work' thread: waits until a block after 'nBlocksWritten' is published, or capture stops.
+// 'nDeadline' is on the same clock as the block times (0 for none). Returns false on timeout.
+bool baz_rtl_source_c::wait_for_block(uint32_t nBlocksWritten, uint64_t nDeadline)
+{
+  boost::mutex::scoped_lock lock(m_wait_mutex);
+  
+  m_bConsumerWaiting = true;	// Set before checking again, so a block published in between will notify
+  
+  bool bResult = true;
+  
+  while ((m_nBlocksWritten == nBlocksWritten) && m_bRunning)
+  {
+	if (nDeadline == 0)
 	{
-	  for (uint32_t n = 0; n < nResidual; n++)
-	  {
-		if (m_output_size == (sizeof(short)))
-		{
-		  out4[(nPart1 * 2) + n*2 + 0] = (unsigned char)m_pUSBBuffer[n*2 + 0] - 128;
-		  out4[(nPart1 * 2) + n*2 + 1] = (unsigned char)m_pUSBBuffer[n*2 + 1] - 128;
-		}
-		else if (m_output_size == sizeof(gr_complex))
-		{
-		  //short i = m_pUSBBuffer[n*2+0];
-		  //short q = m_pUSBBuffer[n*2+1];
-		  //out[nPart1 + n] = gr_complex(i - 127, q - 127);
-		  out[nPart1 + n] = gr_complex(
-			_char_to_float_lut[m_pUSBBuffer[n*2 + 0]],
-			_char_to_float_lut[m_pUSBBuffer[n*2 + 1]]
-		  );
-		}
-	  }
+	  m_hPacketEvent.wait(lock);
+	  continue;
 	}
+	
+	uint64_t nNow = _now_ns();
+	if (nNow >= nDeadline)
+	{
+	  bResult = false;
+	  break;
+	}
+	
+	m_hPacketEvent.timed_wait(lock, boost::posix_time::microseconds((nDeadline - nNow + 999) / 1000));
   }
   
-  m_nSamplesReceived += (noutput_items/item_adjust);
+  m_bConsumerWaiting = false;
   
-  m_nBufferItems -= (noutput_items/item_adjust);
+  return bResult;
+}
+
+void baz_rtl_source_c::signal_eof()
+{
+  m_bRunning = false;	// This will signal EOF
   
-  if (m_nBufferItems > 0)
-	  m_nBufferStart = (m_nBufferStart + (noutput_items/item_adjust)) % m_nBufferSize;
+  boost::mutex::scoped_lock lock(m_wait_mutex);
+  m_hPacketEvent.notify_all();
+}
+
+// Log-spaced histogram of how long blocks wait for 'work' (in us)
+void baz_rtl_source_c::record_latency(uint64_t nLatency)
+{
+  double dMicroseconds = (double)nLatency / 1000.0;
+  int iBucket = ((dMicroseconds > 1.0) ? (int)(log2(dMicroseconds) * LATENCY_BUCKETS_PER_OCTAVE) : 0);
   
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  ++m_LatencyHistogram[min(iBucket, LATENCY_BUCKETS - 1)];
+  ++m_nLatencyCount;
   
-  //consume_each(0);	// Tell runtime system how many input items we consumed on each input stream.
+  if (nLatency > m_nLatencyMax)
+	m_nLatencyMax = nLatency;
+}
+
+// Upper edge of the histogram bucket the percentile falls in (in ms)
+double baz_rtl_source_c::latency_percentile(double percentile) const
+{
+  if (m_nLatencyCount == 0)
+	return 0;
   
-  return noutput_items;	// Tell runtime system how many output items we produced.
+  uint64_t nTarget = (uint64_t)ceil((double)m_nLatencyCount * percentile / 100.0);
+  if (nTarget == 0)
+	nTarget = 1;
+  
+  uint64_t nSeen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; ++i)
+  {
+	nSeen += m_LatencyHistogram[i];
+	if (nSeen >= nTarget)
+	{
+	  double dEdge = pow(2.0, (double)(i + 1) / LATENCY_BUCKETS_PER_OCTAVE) / 1000.0;
+	  return min(dEdge, latency_max());
+	}
+  }
+  
+  return latency_max();
+}
+
+// Samples captured from 'dSettleTime' on are at the new frequency
+void baz_rtl_source_c::mark_retune(double dSettleTime)
+{
+  m_dRetuneFreq = frequency();
+  m_nRetuneSettled = _now_ns() + (uint64_t)(std::max(dSettleTime, 0.0) * 1e9) + 1;	// Frequency first: it's read once this is seen
+}
+
+// As 'work' starts on a block: if a pending retune settles while it was being captured, find the first sample after that
+void baz_rtl_source_c::find_retune_sample(uint32_t nBlock, uint64_t nBlockSample)
+{
+  if (m_nRetuneTagSample != NO_RETUNE_TAG)
+	return;	// Still to output the previous one
+  
+  uint64_t nSettled = m_nRetuneSettled;
+  uint64_t nEnd = m_pBlockTimes[nBlock % m_nBufferMultiplier];
+  if ((nSettled == 0) || (nSettled > nEnd))
+	return;	// All captured before then
+  
+  uint64_t nDuration = m_nBlockDuration;
+  uint64_t nStart = ((nEnd > nDuration) ? (nEnd - nDuration) : 0);
+  uint64_t nSkip = 0;
+  if ((nSettled > nStart) && (nDuration > 0))
+	nSkip = min(((nSettled - nStart) * m_recv_samples_per_packet) / nDuration, (uint64_t)m_recv_samples_per_packet - 1);
+  
+  if (m_nRetuneSettled.compare_exchange_strong(nSettled, 0) == false)
+	return;	// Retuned again meanwhile, so tag that one instead
+  
+  m_nRetuneTagSample = nBlockSample + nSkip;
+  m_dRetuneTagFreq = m_dRetuneFreq;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
 void baz_rtl_source_c::log(int level, const char* message, va_list args)
 {
   if ((level >= LOG_LEVEL_VERBOSE) && (m_verbose == false))
@@ -375,6 +549,7 @@ void baz_rtl_source_c::set_defaults()
   m_nBufferMultiplier	= DEFAULT_BUFFER_MUL;
   m_fBufferLevel		= DEFAULT_BUFFER_LEVEL;
   m_bUseBuffer			= true;
+  m_nTransferCount		= DEFAULT_TRANSFER_COUNT;
 }
 
 bool baz_rtl_source_c::set_output_format(int size)
@@ -417,6 +592,15 @@ bool baz_rtl_source_c::create(bool reset_buffer_defaults /*= false*/)
   
   m_demod_params.message_output = this;
   m_demod_params.verbose = m_verbose;
+  
+  if (m_strReplayPath.empty() == false)
+  {
+	m_pReplay = new RTL2832_NAMESPACE::replay_transfer_backend(&m_demod, m_strReplayPath.c_str(), m_bReplayLoop);
+	assert(m_pReplay);
+	m_pReplay->set_pacing(m_bReplayPacing);
+	m_pReplay->simulate_tuner(m_demod_params.tuner_name[0] ? m_demod_params.tuner_name : DEFAULT_REPLAY_TUNER);
+	m_demod.set_transfer_backend(m_pReplay);
+  }
 
   /////////////////////////
   
@@ -428,19 +612,41 @@ bool baz_rtl_source_c::create(bool reset_buffer_defaults /*= false*/)
   assert(m_pUSBBuffer);
   ZeroMemory(m_pUSBBuffer, m_nBufferSize * RAW_SAMPLE_SIZE);
   
+  m_pBlockTimes = new uint64_t[m_nBufferMultiplier];
+  assert(m_pBlockTimes);
+  ZeroMemory(m_pBlockTimes, m_nBufferMultiplier * sizeof(uint64_t));
+  
+  uint32_t nMaxTransfers = max_transfers(m_nBufferMultiplier, m_fBufferLevel);
+  if (m_nTransferCount > nMaxTransfers)
+  {
+	log_error(_T("Too many transfers (%lu) for buffer multiplier (%lu) and level (%.1f%%)\n"), m_nTransferCount, m_nBufferMultiplier, (100.0f * m_fBufferLevel));
+	m_nTransferCount = nMaxTransfers;
+  }
+  
+  if (m_nTransferCount > 0)
+  {
+	m_pTransferScratch = new uint8_t[m_nReadLength];
+	assert(m_pTransferScratch);
+  }
+  
   log_verbose(_T("RTL2832 Source block configuration:\n")
 	_T("\tRead length (bytes): %lu\n")
 	_T("\tBuffer enabled: %s\n")
 	_T("\tBuffer multiplier: %lu\n")
 	_T("\tBuffer size (samples): %lu\n")
 	_T("\tSamples per read: %lu\n")
-	_T("\tBuffer level: %.1f%%\n"),
+	_T("\tBuffer level: %.1f%%\n")
+	_T("\tTransfers in flight: %lu%s\n")
+	_T("\tConversion: %s\n"),
 	m_nReadLength,
 	(m_bUseBuffer ? _T("yes") : _T("no")),
 	m_nBufferMultiplier,
 	m_nBufferSize,
 	m_recv_samples_per_packet,
-	(100.0f * m_fBufferLevel)
+	(100.0f * m_fBufferLevel),
+	m_nTransferCount,
+	((m_nTransferCount == 0) ? _T(" (synchronous reads)") : (m_bUseBuffer ? _T("") : _T(" (ignored: buffer disabled)"))),
+	m_pConvert->name
   );
 
   /////////////////////////
@@ -448,13 +654,36 @@ bool baz_rtl_source_c::create(bool reset_buffer_defaults /*= false*/)
   return (m_demod.initialise(&m_demod_params) == RTL2832_NAMESPACE::SUCCESS);
 }
 
+// Transfers land in ring slots, so those in flight must fit alongside what 'work' holds back (the buffered level, plus the
+// packet it waits for before reading one out), and the slot being resubmitted as one completes. One slot is left as slack.
+uint32_t baz_rtl_source_c::max_transfers(uint32_t buffer_multiplier, float buffer_level)
+{
+  if (!(buffer_level >= 0.0f))	// Also NaN
+	buffer_level = 0.0f;
+  else if (buffer_level > 1.0f)
+	buffer_level = 1.0f;
+  
+  int64_t iHeld = 3 + (int64_t)ceil(buffer_level * (float)buffer_multiplier);
+  
+  return (((int64_t)buffer_multiplier > iHeld) ? (uint32_t)((int64_t)buffer_multiplier - iHeld) : 0);
+}
+
 void baz_rtl_source_c::destroy()
 {
   stop();
 
   m_demod.destroy();
+  
+  if (m_pReplay)
+  {
+	if (m_demod.active_transfer_backend() == m_pReplay)
+	  m_demod.set_transfer_backend(NULL);
+	SAFE_DELETE(m_pReplay);
+  }
 
   SAFE_DELETE_ARRAY(m_pUSBBuffer);
+  SAFE_DELETE_ARRAY(m_pBlockTimes);
+  SAFE_DELETE_ARRAY(m_pTransferScratch);
 }
 
 void baz_rtl_source_c::_capture_thread(baz_rtl_source_c* p)
@@ -466,14 +695,26 @@ void baz_rtl_source_c::reset()
 {
   boost::recursive_mutex::scoped_lock lock(d_mutex);
   
-  m_nBufferStart = 0;
-  m_nBufferItems = 0;
+  m_nBlocksWritten = 0;
+  m_nBlocksRead = 0;
+  m_nBlockOffset = 0;
   m_nSamplesReceived = 0;
   m_nOverflows = 0;
   
   m_nReadPacketCount = 0;
   m_nBufferOverflowCount = 0;
   m_nBufferUnderrunCount = 0;
+  m_nShortTransferCount = 0;
+  
+  ZERO_MEMORY(m_fDCOffset);
+  
+  m_nSlotsPending = 0;
+  
+  std::fill(m_LatencyHistogram.begin(), m_LatencyHistogram.end(), 0);
+  m_nLatencyCount = 0;
+  m_nLatencyMax = 0;
+  
+  m_nRetuneTagSample = NO_RETUNE_TAG;
 }
 
 bool baz_rtl_source_c::start()
@@ -488,6 +729,12 @@ bool baz_rtl_source_c::start()
   if (m_demod.reset() != RTL2832_NAMESPACE::SUCCESS)
 	return false;
 
+  if (frequency() > 0)
+  {
+	m_dRetuneFreq = frequency();
+	m_nRetuneSettled = 1;	// Settled before any block, so the first sample is tagged
+  }
+  
   m_bRunning = true;	// Need to set this BEFORE starting thread (otherwise it will exit)
   
   if (m_bUseBuffer)
@@ -511,12 +758,21 @@ bool baz_rtl_source_c::stop()
   if (m_bUseBuffer == false)
 	return true;
   
-  m_hPacketEvent.notify_one();	// In case general_work is waiting
+  {
+	boost::mutex::scoped_lock wait_lock(m_wait_mutex);
+	m_hPacketEvent.notify_all();	// In case general_work is waiting
+  }
 
-  lock.unlock();	// Release lock AFTER notification, so waiting thread resumes in lockstep
+  lock.unlock();
   
   m_pCaptureThread.join();	// Wait for capture thread to finish
   
+  if (m_nLatencyCount > 0)
+  {
+	log_verbose(_T("Capture-to-work latency (ms) over %llu blocks: 50%%: %.3f, 90%%: %.3f, 99%%: %.3f, max: %.3f\n"),
+	  (unsigned long long)m_nLatencyCount, latency_percentile(50), latency_percentile(90), latency_percentile(99), latency_max());
+  }
+  
   return true;
 }
 
@@ -548,7 +804,12 @@ bool baz_rtl_source_c::set_frequency(double dFreq)
   boost::recursive_mutex::scoped_lock lock(d_mutex);
 #endif // EXTREME_LOCKING
 
-  return (m_demod.active_tuner()->set_frequency(dFreq) == RTL2832_NAMESPACE::SUCCESS);
+  if (m_demod.active_tuner()->set_frequency(dFreq) != RTL2832_NAMESPACE::SUCCESS)
+	return false;
+  
+  mark_retune(m_dRetuneSettleTime);
+  
+  return true;
 }
 
 bool baz_rtl_source_c::set_sample_rate(double dSampleRate)
@@ -569,13 +830,8 @@ bool baz_rtl_source_c::set_sample_rate(double dSampleRate)
   double dDelay = 1000000000ULL * WAIT_FUDGE / (double)((dSampleRate * RAW_SAMPLE_SIZE) / (double)m_nReadLength);
   if (m_bUseBuffer)
 	log_verbose("Wait delay: %.3f ms\n", (dDelay / 1000000.0));
-  uint64_t delay = (uint64_t)ceil(dDelay);
-#ifdef HAVE_XTIME
-  m_wait_delay.sec = delay / 1000000000ULL;
-  m_wait_delay.nsec = delay % 1000000000ULL;
-  //if (m_bUseBuffer)
-  //  log_verbose("\t(%lld s, %lld ns)\n", m_wait_delay.sec, m_wait_delay.nsec);
-#endif // HAVE_XTIME
+  m_nWaitDelay = (uint64_t)ceil(dDelay);
+  m_nBlockDuration = (uint64_t)ceil(dDelay / WAIT_FUDGE);
 
   return true;
 }
@@ -635,21 +891,47 @@ bool baz_rtl_source_c::set_auto_gain_mode(bool on /*= true*/)
   return (m_demod.active_tuner()->set_auto_gain_mode(on) == RTL2832_NAMESPACE::SUCCESS);
 }
 
+bool baz_rtl_source_c::set_conversion(const char* name)
+{
+  const RTL2832_NAMESPACE::convert::KERNELS* pConvert = &RTL2832_NAMESPACE::convert::best_kernels();
+  if ((name != NULL) && (name[0] != '\0'))
+  {
+	pConvert = RTL2832_NAMESPACE::convert::find_kernels(name);
+	if (pConvert == NULL)
+	{
+	  log_error(_T("Conversion not supported: %s\n"), name);
+	  return false;
+	}
+  }
+  
+  boost::recursive_mutex::scoped_lock lock(d_mutex);
+  
+  m_pConvert = pConvert;
+  
+  return true;
+}
+
+std::vector<std::string> baz_rtl_source_c::conversions() const
+{
+  std::vector<const RTL2832_NAMESPACE::convert::KERNELS*> kernels = RTL2832_NAMESPACE::convert::supported_kernels();
+  
+  std::vector<std::string> names;
+  for (size_t i = 0; i < kernels.size(); ++i)
+	names.push_back(kernels[i]->name);
+  
+  return names;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 void baz_rtl_source_c::capture_thread()
 {
-  boost::recursive_mutex::scoped_lock lock(d_mutex, boost::defer_lock);
-  
   if ((m_nReadLength == 0) ||
 	  (m_pUSBBuffer == NULL) ||
 	  (m_nBufferSize == 0) ||
 	  (m_fBufferLevel < 0))
   {
-	lock.lock();
-	m_bRunning = false;	// This will signal EOF
-	m_hPacketEvent.notify_one();
-	lock.unlock();
+	signal_eof();
 	
 	if (m_verbose)
 	  std::cerr << "Capture threading NOT starting due to state error: " << boost::this_thread::get_id() << std::endl;
@@ -659,21 +941,28 @@ void baz_rtl_source_c::capture_thread()
   if (m_verbose)
 	std::cerr << "Capture threading starting: " << boost::this_thread::get_id() << std::endl;
   
-  uint32_t nCount = 0;
+  if (m_nTransferCount > 0)
+  {
+	capture_thread_async();
+	
+	if (m_verbose)
+	  std::cerr << "Capture threading exiting: " << boost::this_thread::get_id() << std::endl;
+	return;
+  }
   
-  uint8_t* pBuffer = new uint8_t[m_nReadLength];
+  uint8_t* pBuffer = new uint8_t[m_nReadLength];	// Read into this when the ring is full (samples will be dropped)
   
-  while (true)
+  while (m_bRunning)
   {
-	lock.lock();
-	if (m_bRunning == false)
-	  break;
-	lock.unlock();
+	uint32_t nWritten = m_nBlocksWritten.load(std::memory_order_relaxed);	// Only this thread adds blocks
+	bool bFree = ((nWritten - m_nBlocksRead.load(std::memory_order_acquire)) < m_nBufferMultiplier);
+	uint8_t* p = (bFree ? block_buffer(nWritten) : pBuffer);
 	
 	int lLockSize = 0;
-	int res = m_demod.read_samples(pBuffer, m_nReadLength, &lLockSize);
+	int res = m_demod.read_samples(p, m_nReadLength, &lLockSize);
 	if (res == LIBUSB_ERROR_OVERFLOW)
 	{
+	  ++m_nOverflows;
 	  log_error(_T("rO"));
 	  report_status(RTL_STATUS_HARDWARE_OVERRUN);
 	}
@@ -681,10 +970,7 @@ void baz_rtl_source_c::capture_thread()
 	{
 	  log_error(_T("libusb error: %s [%i]\n"), libusb_result_to_string(res), res);
 	  
-	  lock.lock();
-	  m_bRunning = false;	// This will signal EOF
-	  m_hPacketEvent.notify_one();
-	  lock.unlock();
+	  signal_eof();
 	  
 	  if (m_verbose)
 		std::cerr << "Capture threading aborting due to libusb error: " << boost::this_thread::get_id() << std::endl;
@@ -694,55 +980,18 @@ void baz_rtl_source_c::capture_thread()
 	if ((uint32_t)lLockSize < m_nReadLength)
 	{
 	  log_error(_T("Short bulk read: given %i bytes (expecting %lu)\n"), lLockSize, m_nReadLength);
+	  memset(p + lLockSize, RAW_SAMPLE_ZERO, m_nReadLength - lLockSize);	// Blocks are always whole
+	  ++m_nShortTransferCount;
 	}
 	
-	lock.lock();
-	
-	++nCount;
-	
-	if (res == LIBUSB_ERROR_OVERFLOW)
-	  ++m_nOverflows;
-	
-	uint32_t nRemaining = min(m_nBufferSize - m_nBufferItems, (uint32_t)lLockSize / RAW_SAMPLE_SIZE);
-	
-	bool bSignal = true;
-	
-	if (nRemaining > 0)
-	{
-	  //log_verbose(_T("Buffer write: count=%lu, start=%lu, items=%lu\n"), nCount, m_nBufferStart, m_nBufferItems);
-	  
-	  uint8_t* p = m_pUSBBuffer + (((m_nBufferStart + m_nBufferItems) % m_nBufferSize) * RAW_SAMPLE_SIZE);
-	  
-	  uint32_t nPart1 = (m_nBufferStart + m_nBufferItems) % m_nBufferSize;
-	  uint32_t nSize1 = min(nRemaining, m_nBufferSize - nPart1);
-	  
-	  memcpy(p, pBuffer, nSize1 * RAW_SAMPLE_SIZE);
-	  
-	  uint32_t nResidual = nRemaining - nSize1;
-	  if (nResidual > 0)
-		  memcpy(m_pUSBBuffer, pBuffer + (nSize1 * 2), nResidual * RAW_SAMPLE_SIZE);
-	  
-	  m_nBufferItems += nRemaining;
-	  
-	  if ((m_bBuffering) && (m_nBufferItems >= (uint32_t)(m_recv_samples_per_packet + (float)m_nBufferSize * m_fBufferLevel)))	// Add additional amount that is about to be read back out in ReadPacket
-	  {
-		log_verbose(_T("Finished buffering (%lu/%lu) [#%lu]\n"), m_nBufferItems, m_nBufferSize, m_nReadPacketCount);
-		m_bBuffering = false;
-	  }
-	  
-	  bSignal = !m_bBuffering;
-	}
+	if (bFree)
+	  commit_block();
 	else
 	{
 	  log_error("rB");
 	  report_status(RTL_STATUS_BUFFER_OVERRUN);
 	  ++m_nBufferOverflowCount;
 	}
-	
-	lock.unlock();
-	
-	if (bSignal)
-	  m_hPacketEvent.notify_one();
   }
   
   if (m_verbose)
@@ -750,3 +999,109 @@ void baz_rtl_source_c::capture_thread()
 capture_thread_exit:
 	SAFE_DELETE_ARRAY(pBuffer);
 }
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Each transfer reads straight into the next free block of the ring, so completed transfers
+// are committed by publishing the block - no copy.
+
+void baz_rtl_source_c::capture_thread_async()
+{
+  int res = m_demod.start_async(this, m_nTransferCount, m_nReadLength);
+  if (res != RTL2832_NAMESPACE::SUCCESS)
+  {
+	log_error(_T("Failed to start transfers: %s [%i]\n"), libusb_result_to_string(res), res);
+	
+	signal_eof();
+	return;
+  }
+  
+  log_verbose(_T("Started %lu transfers of %lu bytes\n"), m_nTransferCount, m_nReadLength);
+  
+  while (m_bRunning)
+  {
+	res = m_demod.handle_async_events(ASYNC_EVENT_TIMEOUT_MS);	// Completions arrive via 'on_transfer_complete'
+	if (res > 0)
+	  continue;
+	
+	if (m_bRunning)
+	{
+	  if (res < 0)
+		log_error(_T("libusb error: %s [%i]\n"), libusb_result_to_string(res), res);
+	  else
+		log_error(_T("No transfers left in flight\n"));
+	  
+	  signal_eof();
+	}
+	break;
+  }
+  
+  m_demod.stop_async();
+}
+
+uint8_t* baz_rtl_source_c::next_transfer_buffer(uint32_t length)
+{
+  if (m_bRunning == false)
+	return NULL;
+  
+  assert(length == m_nReadLength);
+  
+  uint32_t nNext = m_nBlocksWritten.load(std::memory_order_relaxed) + m_nSlotsPending;
+  if ((nNext + 1 - m_nBlocksRead.load(std::memory_order_acquire)) > m_nBufferMultiplier)
+	return m_pTransferScratch;	// Keep the device streaming, but these samples will be dropped
+  
+  ++m_nSlotsPending;
+  
+  return block_buffer(nNext);
+}
+
+uint8_t* baz_rtl_source_c::on_transfer_complete(uint8_t* buffer, int length, int status)
+{
+  bool bDropped = (buffer == m_pTransferScratch);
+  
+  if (bDropped == false)
+  {
+	assert(m_nSlotsPending > 0);
+	--m_nSlotsPending;
+  }
+  
+  if (status == LIBUSB_ERROR_OVERFLOW)
+  {
+	++m_nOverflows;
+	log_error(_T("rO"));
+	report_status(RTL_STATUS_HARDWARE_OVERRUN);
+  }
+  else if (status != 0)
+  {
+	if ((status != LIBUSB_ERROR_INTERRUPTED) || m_bRunning)
+	  log_error(_T("libusb error: %s [%i]\n"), libusb_result_to_string(status), status);
+	
+	signal_eof();
+	return NULL;
+  }
+  
+  if (m_bRunning == false)
+	return NULL;
+  
+  if (bDropped)
+  {
+	log_error("rB");
+	report_status(RTL_STATUS_BUFFER_OVERRUN);
+	++m_nBufferOverflowCount;
+  }
+  else
+  {
+	assert(buffer == block_buffer(m_nBlocksWritten.load(std::memory_order_relaxed)));	// Bulk transfers complete in order (failed ones end the stream)
+	
+	if ((uint32_t)length < m_nReadLength)
+	{
+	  log_error(_T("Short bulk read: given %i bytes (expecting %lu)\n"), length, m_nReadLength);
+	  memset(buffer + length, RAW_SAMPLE_ZERO, m_nReadLength - length);	// Keep the ring block-aligned
+	  ++m_nShortTransferCount;
+	}
+	
+	commit_block();
+  }
+  
+  return next_transfer_buffer(m_nReadLength);
+}
@@ -42,14 +42,14 @@
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/recursive_mutex.hpp>
-#ifdef HAVE_XTIME
-#include <boost/thread/xtime.hpp>
-#endif // HAVE_XTIME
+#include <atomic>
 
 #include <libusb-1.0/libusb.h>	// FIXME: Automake
 #include <stdarg.h>	// va_list
 
 #include "rtl2832.h"
+#include "rtl2832-convert.h"
+#include "rtl2832-replay.h"
 
 class BAZ_API baz_rtl_source_c;
 typedef boost::shared_ptr<baz_rtl_source_c> baz_rtl_source_c_sptr;
@@ -65,7 +65,7 @@ BAZ_API baz_rtl_source_c_sptr baz_make_rtl_source_c(bool defer_creation = false,
  *
  * \sa gr-baz: http://wiki.spench.net/wiki/gr-baz
  */
-class BAZ_API baz_rtl_source_c : public gr::block, public RTL2832_NAMESPACE::log_sink
+class BAZ_API baz_rtl_source_c : public gr::block, public RTL2832_NAMESPACE::log_sink, private RTL2832_NAMESPACE::async_client
 {
 private:
 	friend BAZ_API baz_rtl_source_c_sptr baz_make_rtl_source_c(bool defer_creation, int output_size);
@@ -78,12 +78,16 @@ private:
 	size_t m_recv_samples_per_packet;
 	uint64_t m_nSamplesReceived;
 	uint32_t m_nOverflows;
-	bool m_bRunning;
-	boost::recursive_mutex d_mutex;
+	std::atomic<bool> m_bRunning;
+	boost::recursive_mutex d_mutex;	// Control only: samples pass from the capture thread to 'work' without it
 	boost::thread m_pCaptureThread;
 	uint32_t m_nBufferSize;
-	uint32_t m_nBufferStart;
-	uint32_t m_nBufferItems;
+	std::atomic<uint32_t> m_nBlocksWritten;	// Capture thread publishes whole blocks (one read length each)...
+	std::atomic<uint32_t> m_nBlocksRead;	// ...and 'work' hands them back once consumed
+	uint32_t m_nBlockOffset;	// Samples already consumed from the block at the read position
+	uint64_t* m_pBlockTimes;	// When each block was published (ns)
+	std::atomic<bool> m_bConsumerWaiting;
+	boost::mutex m_wait_mutex;	// Only for sleeping on 'm_hPacketEvent'
 	boost::condition m_hPacketEvent;
 	uint8_t* m_pUSBBuffer;
 	bool m_bBuffering;
@@ -94,9 +98,27 @@ private:
 	uint32_t m_nReadPacketCount;
 	uint32_t m_nBufferOverflowCount;
 	uint32_t m_nBufferUnderrunCount;
-#ifdef HAVE_XTIME
-	boost::xtime m_wait_delay, m_wait_next;
-#endif // HAVE_XTIME
+	uint32_t m_nTransferCount;
+	uint32_t m_nSlotsPending;	// Blocks after the last published one that are handed to transfers still in flight
+	uint8_t* m_pTransferScratch;	// Target for transfers when the ring is full
+	uint32_t m_nShortTransferCount;
+	const RTL2832_NAMESPACE::convert::KERNELS* m_pConvert;
+	bool m_bRemoveDC;
+	float m_fDCOffset[2];	// I, Q (raw sample units)
+	std::string m_strReplayPath;
+	bool m_bReplayLoop;
+	bool m_bReplayPacing;
+	RTL2832_NAMESPACE::replay_transfer_backend* m_pReplay;
+	std::atomic<uint64_t> m_nWaitDelay;	// ns after a block that 'work' waits for the next, before using the buffer
+	std::vector<uint32_t> m_LatencyHistogram;
+	uint64_t m_nLatencyCount;
+	uint64_t m_nLatencyMax;	// ns
+	std::atomic<uint64_t> m_nBlockDuration;	// ns of samples in one block
+	double m_dRetuneSettleTime;
+	std::atomic<uint64_t> m_nRetuneSettled;	// When the last retune will have settled (ns, 0: none pending)
+	std::atomic<double> m_dRetuneFreq;
+	uint64_t m_nRetuneTagSample;	// Sample (since start) the next 'rx_freq' tag goes on
+	double m_dRetuneTagFreq;
 private:
 	RTL2832_NAMESPACE::demod::PARAMS m_demod_params;
 	bool m_verbose;
@@ -113,6 +135,9 @@ private:
 private: // log_sink
 	void on_log_message_va(int level, const char* msg, va_list args)
 	{ log(level, msg, args); }
+private: // async_client
+	uint8_t* next_transfer_buffer(uint32_t length);
+	uint8_t* on_transfer_complete(uint8_t* buffer, int length, int status);
 private:
 	void log(int level, const char* message, va_list args);
 #define IMPLEMENT_LOG_FUNCTION(suffix,level) \
@@ -124,6 +149,17 @@ private:
 	void reset();
 	static void _capture_thread(baz_rtl_source_c* p);
 	void capture_thread();
+	void capture_thread_async();
+	void convert_samples(const uint8_t* pIn, void* pOut, uint32_t nOffset, uint32_t nSamples);
+	inline uint8_t* block_buffer(uint32_t nBlock) const
+	{ return m_pUSBBuffer + ((nBlock % m_nBufferMultiplier) * m_recv_samples_per_packet * 2); }
+	uint32_t buffered_items(uint32_t nBlocksWritten) const;
+	void commit_block();
+	bool wait_for_block(uint32_t nBlocksWritten, uint64_t nDeadline);
+	void signal_eof();
+	void record_latency(uint64_t nLatency);
+	void mark_retune(double dSettleTime);
+	void find_retune_sample(uint32_t nBlock, uint64_t nBlockSample);
 	void report_status(int status);
 public:
 	void set_defaults();
@@ -131,6 +167,7 @@ public:
 	void set_status_msgq(gr::msg_queue::sptr queue);
 	bool create(bool reset_defaults = false);
 	void destroy();
+	static uint32_t max_transfers(uint32_t buffer_multiplier, float buffer_level);	// Transfers that fit in the ring alongside the buffered level
 public:	// SWIG demod params set only
 	inline void set_vid(uint16_t vid)
 	{ m_demod_params.vid = vid; }
@@ -144,6 +181,12 @@ public:	// SWIG demod params set only
 	{ m_demod_params.crystal_frequency = freq; }
 	inline void set_tuner_name(const char* name)
 	{ if (name == NULL) m_demod_params.tuner_name[0] = '\0'; else strncpy(m_demod_params.tuner_name, name, /*RTL2832_NAMESPACE::demod::*/RTL2832_TUNER_NAME_LEN-1); }
+	inline void set_transfer_backend(RTL2832_NAMESPACE::transfer_backend* backend)	// NULL: libusb (not SWIG)
+	{ m_demod.set_transfer_backend(backend); }
+	inline void set_replay(const char* path, bool loop = false)	// Raw u8 I/Q file instead of a device ("-": stdin, NULL/empty: off)
+	{ m_strReplayPath = (path ? path : ""); m_bReplayLoop = loop; }
+	inline void set_replay_pacing(bool on = true)	// Off: replay as fast as the source is read
+	{ m_bReplayPacing = on; }
 public:	// SWIG get only
 	inline size_t recv_samples_per_packet() const
 	{ return m_recv_samples_per_packet; }
@@ -156,7 +199,7 @@ public:	// SWIG get only
 	inline uint32_t buffer_size() const
 	{ return m_nBufferSize; }
 	inline uint32_t buffer_times() const
-	{ return m_nBufferItems; }
+	{ return buffered_items(m_nBlocksWritten); }
 	inline bool buffering() const
 	{ return m_bBuffering; }
 	inline uint32_t read_packet_count() const
@@ -165,6 +208,25 @@ public:	// SWIG get only
 	{ return m_nBufferOverflowCount; }
 	inline uint32_t buffer_underrun_count() const
 	{ return m_nBufferUnderrunCount; }
+	inline int transfers_in_flight() const
+	{ return m_demod.active_transfer_backend()->transfers_in_flight(); }
+	inline uint32_t short_transfer_count() const
+	{ return m_nShortTransferCount; }
+	double latency_percentile(double percentile) const;	// ms from a block arriving to 'work' starting on it
+	inline double latency_max() const
+	{ return (m_nLatencyMax / 1e6); }
+	inline uint64_t latency_count() const
+	{ return m_nLatencyCount; }
+	inline RTL2832_NAMESPACE::replay_transfer_backend* replay() const	// NULL when not replaying (not SWIG)
+	{ return m_pReplay; }
+	inline uint32_t replay_overrun_count() const
+	{ return (m_pReplay ? m_pReplay->overrun_count() : 0); }
+	inline uint64_t replay_bytes_dropped() const
+	{ return (m_pReplay ? m_pReplay->bytes_dropped() : 0); }
+	inline uint32_t replay_i2c_transfer_count() const
+	{ return (m_pReplay ? (m_pReplay->i2c_read_count() + m_pReplay->i2c_write_count()) : 0); }
+	inline uint32_t replay_i2c_repeater_count() const
+	{ return (m_pReplay ? m_pReplay->i2c_repeater_count() : 0); }
 public:	// SWIG set (pre-create)
 	inline void set_relative_gain(bool on = true)
 	{ m_relative_gain = on; }
@@ -178,6 +240,8 @@ public:	// SWIG set (pre-create)
 	{ m_bUseBuffer = use; }
 	inline void set_buffer_level(float level)
 	{ m_fBufferLevel = level; }
+	inline void set_transfer_count(uint32_t count)	// 0: synchronous reads
+	{ m_nTransferCount = count; }
 public:	// SWIG get
 	inline bool relative_gain() const
 	{ return m_relative_gain; }
@@ -191,6 +255,16 @@ public:	// SWIG get
 	{ return m_bUseBuffer; }
 	inline float buffer_level() const
 	{ return m_fBufferLevel; }
+	inline uint32_t transfer_count() const
+	{ return m_nTransferCount; }
+	inline uint32_t transfer_size() const
+	{ return m_nReadLength; }
+	inline std::string replay_path() const
+	{ return m_strReplayPath; }
+	inline bool replay_loop() const
+	{ return m_bReplayLoop; }
+	inline bool replay_pacing() const
+	{ return m_bReplayPacing; }
 public:	// SWIG set
 	bool set_sample_rate(double sample_rate);
 	bool set_frequency(double freq);
@@ -199,6 +273,11 @@ public:	// SWIG set
 	bool set_gain_mode(int mode);
 	bool set_gain_mode(const char* mode);
 	bool set_auto_gain_mode(bool on = true);
+	inline void set_remove_dc(bool on = true)	// Not for byte output
+	{ m_bRemoveDC = on; }
+	bool set_conversion(const char* name);	// One of 'conversions' (NULL/empty: the fastest). Before starting.
+	inline void set_retune_settle_time(double seconds)	// 'rx_freq' is tagged on the first sample captured this long after a retune
+	{ m_dRetuneSettleTime = seconds; }
 public:	// SWIG get
 	inline const char* name() const
 	{ return m_demod.name(); }
@@ -217,6 +296,13 @@ public:	// SWIG get
 	std::string gain_mode_string() const;
 	inline bool auto_gain_mode() const
 	{ return m_demod.active_tuner()->auto_gain_mode(); }
+	inline bool remove_dc() const
+	{ return m_bRemoveDC; }
+	inline const char* conversion() const
+	{ return m_pConvert->name; }
+	std::vector<std::string> conversions() const;	// Supported by this CPU, slowest first
+	inline double retune_settle_time() const
+	{ return m_dRetuneSettleTime; }
 public:	// SWIG get: tuner ranges/values
 	inline RTL2832_NAMESPACE::range_t gain_range() const
 	{ return m_demod.active_tuner()->gain_range(); }
@@ -37,6 +37,10 @@
 #include <iostream>
 #include <stdexcept>
 #include <string.h>
+#include <time.h>
+#include <atomic>
+#include <algorithm>
+#include <ctype.h>
 
 #include <SDL.h>
 
@@ -68,6 +72,49 @@ namespace gr {
       int copy_plane_to_surface(int plane,int noutput_items,
                                 const unsigned char * src_pixels);
 
+      // Triple-buffered frame store: work() fills one frame, the newest complete frame waits in
+      // another and the render thread shows the third, so a slow display never holds up work()
+      struct frame_buffer {
+        std::vector<unsigned char> pixels;  // YV12 planes (as in the overlay) or RGB surface rows
+        size_t number;
+        time_t time;
+      };
+      frame_buffer d_frames[3];
+      int d_fill_frame, d_ready_frame, d_show_frame;
+      bool d_frame_ready;
+      size_t d_plane_offset[3];
+      int d_plane_pitch[3];
+      gr::thread::mutex d_frame_mutex;
+      gr::thread::condition_variable d_frame_cond;
+      boost::thread d_render_thread;
+      bool d_running;
+      std::atomic<uint64_t> d_frames_presented, d_frames_dropped;
+
+      unsigned char *fill_plane(int plane)
+      { return &d_frames[d_fill_frame].pixels[d_plane_offset[plane]]; }
+      void publish_frame();
+      void render_loop();
+      void present_frame(const frame_buffer& frame);
+      void stop_render_thread();
+
+      // Offscreen capture, written by the render thread straight from the frame store
+      enum capture_type { CAPTURE_NONE, CAPTURE_Y4M, CAPTURE_PGM, CAPTURE_PPM, CAPTURE_PAM };
+      bool d_rgb;
+      bool d_headless;
+      std::string d_capture;
+      int d_capture_type;
+      bool d_capture_sequence;  // One file per frame (format specifier in path)
+      int d_capture_decimation;
+      int d_capture_rotate;
+      FILE *d_capture_file;
+      std::vector<unsigned char> d_capture_row;  // RGBA -> RGB for PPM
+      std::atomic<uint64_t> d_frames_captured;
+      std::atomic<uint64_t> d_capture_drops;  // Due for capture, but replaced before the render thread got to them
+
+      void capture_frame(const frame_buffer& frame);
+      void write_y4m_header(FILE *fp);
+      bool write_capture(FILE *fp, const frame_buffer& frame, bool header);
+
       float d_framerate;
       int d_wanted_frametime_ms;
       int d_width;
@@ -79,8 +126,6 @@ namespace gr {
       SDL_Surface *d_screen, *d_rgb_image;
       SDL_Overlay *d_image;
       SDL_Rect d_dst_rect;
-      float d_avg_delay;
-      unsigned int d_wanted_ticks;
       std::string d_filename;
       size_t d_frame_counter;
       bool d_manual_flip;
@@ -92,11 +137,20 @@ namespace gr {
       sdl_sink_uc_impl(double framerate,
                    int width, int height,
                    unsigned int format,
-                   int dst_width, int dst_height, const std::string filename = "", bool manual_flip = false, const std::string font_path = "");
+                   int dst_width, int dst_height, const std::string filename = "", bool manual_flip = false, const std::string font_path = "",
+                   bool headless = false, const std::string capture = "", int capture_decimation = 1, int capture_rotate = 0);
       ~sdl_sink_uc_impl();
 
       void flip(void);
 
+      uint64_t frames_presented() const { return d_frames_presented; }
+      uint64_t frames_dropped() const { return d_frames_dropped; }
+      uint64_t frames_captured() const { return d_frames_captured; }
+      uint64_t capture_drops() const { return d_capture_drops; }
+
+      bool start();
+      bool stop();
+
       int work(int noutput_items,
                gr_vector_const_void_star &input_items,
                gr_vector_void_star &output_items);
@@ -105,14 +159,17 @@ namespace gr {
 
     sdl_sink_uc::sptr
     sdl_sink_uc::make(double framerate, int width, int height,
-		  unsigned int format, int dst_width, int dst_height, const std::string filename, bool manual_flip/* = false*/, const std::string font_path/* = ""*/)
+		  unsigned int format, int dst_width, int dst_height, const std::string filename, bool manual_flip/* = false*/, const std::string font_path/* = ""*/,
+		  bool headless/* = false*/, const std::string capture/* = ""*/, int capture_decimation/* = 1*/, int capture_rotate/* = 0*/)
     {
       return gnuradio::get_initial_sptr
-	(new sdl_sink_uc_impl(framerate, width, height, format, dst_width, dst_height, filename, manual_flip, font_path));
+	(new sdl_sink_uc_impl(framerate, width, height, format, dst_width, dst_height, filename, manual_flip, font_path,
+			      headless, capture, capture_decimation, capture_rotate));
     }
 
     sdl_sink_uc_impl::sdl_sink_uc_impl(double framerate, int width, int height,
-			       unsigned int format, int dst_width, int dst_height, const std::string filename, bool manual_flip/* = false*/, const std::string font_path/* = ""*/)
+			       unsigned int format, int dst_width, int dst_height, const std::string filename, bool manual_flip/* = false*/, const std::string font_path/* = ""*/,
+			       bool headless/* = false*/, const std::string capture/* = ""*/, int capture_decimation/* = 1*/, int capture_rotate/* = 0*/)
       : sync_block("baz_sdl_sink_uc",
 		      io_signature::make(1, 3, sizeof(unsigned char)),
 		      io_signature::make(0, 0, 0)),
@@ -121,13 +178,26 @@ namespace gr {
 	d_dst_width(dst_width), d_dst_height(dst_height),
 	d_format(format),
 	d_current_line(0), d_screen(NULL), d_image(NULL),
-	d_avg_delay(0.0), d_wanted_ticks(0),
   d_rgb_image(NULL),
   d_filename(filename),
   d_manual_flip(manual_flip),
   d_flip_pending(false),
   d_frame_counter(0),
-  d_font(NULL)
+  d_font(NULL),
+  d_fill_frame(0), d_ready_frame(1), d_show_frame(2),
+  d_frame_ready(false),
+  d_running(false),
+  d_frames_presented(0), d_frames_dropped(0),
+  d_rgb(false),
+  d_headless(headless),
+  d_capture(capture),
+  d_capture_type(CAPTURE_NONE),
+  d_capture_sequence(false),
+  d_capture_decimation(std::max(1, capture_decimation)),
+  d_capture_rotate(std::max(0, capture_rotate)),
+  d_capture_file(NULL),
+  d_frames_captured(0),
+  d_capture_drops(0)
     {
       if(framerate <= 0.0)
 	d_wanted_frametime_ms = 0; //Go as fast as possible
@@ -135,6 +205,10 @@ namespace gr {
 	d_wanted_frametime_ms = (int)(1000.0/framerate);
 
     bool rgb = (format == vid_fourcc('A', 'B', 'G', 'R'));
+    d_rgb = rgb;
+
+    if ((d_headless) && (d_capture.empty()))
+      throw std::runtime_error("baz::sdl_sink_uc: headless mode needs a capture path");
 
     if (rgb)
     {
@@ -158,71 +232,78 @@ namespace gr {
       // FIXME: !
       //atexit(SDL_Quit); //check if this is the way to do this
 
-      if(SDL_Init(SDL_INIT_VIDEO) < 0) {
-	std::cerr << "baz::sdl_sink_uc: Couldn't initialize SDL:"
-		  << SDL_GetError() << " \n SDL_Init(SDL_INIT_VIDEO) failed\n";
-	throw std::runtime_error ("baz::sdl_sink_uc");
-      }
-
-      Uint32 flags = SDL_SWSURFACE | SDL_RESIZABLE | SDL_ANYFORMAT;
-      if (rgb)
+      if (d_headless == false)
       {
-        flags |= SDL_DOUBLEBUF;
-        //flags |= SDL_HWSURFACE;
-        //flags &= ~SDL_SWSURFACE;
-      }
-      /* accept any depth */
-      d_screen = SDL_SetVideoMode(dst_width, dst_height, (/*rgb ? 32 : */0),
-				  flags);//SDL_DOUBLEBUF|SDL_SWSURFACE|SDL_HWSURFACE|SDL_FULLSCREEN
+        if(SDL_Init(SDL_INIT_VIDEO) < 0) {
+	  std::cerr << "baz::sdl_sink_uc: Couldn't initialize SDL:"
+	  	  << SDL_GetError() << " \n SDL_Init(SDL_INIT_VIDEO) failed\n";
+	  throw std::runtime_error ("baz::sdl_sink_uc");
+        }
 
-      if(d_screen == NULL) {
-	std::cerr << "Unable to set SDL video mode: " << SDL_GetError()
-		  <<"\n SDL_SetVideoMode() Failed \n";
-	throw std::runtime_error ("baz::sdl_sink_uc");
-      }
+        Uint32 flags = SDL_SWSURFACE | SDL_RESIZABLE | SDL_ANYFORMAT;
+        if (rgb)
+        {
+          flags |= SDL_DOUBLEBUF;
+          //flags |= SDL_HWSURFACE;
+          //flags &= ~SDL_SWSURFACE;
+        }
+        /* accept any depth */
+        d_screen = SDL_SetVideoMode(dst_width, dst_height, (/*rgb ? 32 : */0),
+	  			  flags);//SDL_DOUBLEBUF|SDL_SWSURFACE|SDL_HWSURFACE|SDL_FULLSCREEN
+
+        if(d_screen == NULL) {
+	  std::cerr << "Unable to set SDL video mode: " << SDL_GetError()
+	  	  <<"\n SDL_SetVideoMode() Failed \n";
+	  throw std::runtime_error ("baz::sdl_sink_uc");
+        }
 
-      printf("SDL screen mode: %d bits-per-pixel, %d bytes-per-pixel, pitch: %d, flip: %s\n",
-       d_screen->format->BitsPerPixel, d_screen->format->BytesPerPixel, d_screen->pitch, (d_manual_flip ? "manual" : "auto"));
+        printf("SDL screen mode: %d bits-per-pixel, %d bytes-per-pixel, pitch: %d, flip: %s\n",
+         d_screen->format->BitsPerPixel, d_screen->format->BytesPerPixel, d_screen->pitch, (d_manual_flip ? "manual" : "auto"));
 
-      if (rgb) {
-    Uint32 rmask, gmask, bmask, amask;  // FIXME: Decide on format (needs to match colouriser)
+        if (rgb) {
+      Uint32 rmask, gmask, bmask, amask;  // FIXME: Decide on format (needs to match colouriser)
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    rmask = 0xff000000;
-    gmask = 0x00ff0000;
-    bmask = 0x0000ff00;
-    amask = 0x000000ff;
+      rmask = 0xff000000;
+      gmask = 0x00ff0000;
+      bmask = 0x0000ff00;
+      amask = 0x000000ff;
 #else
-    rmask = 0x000000ff;
-    gmask = 0x0000ff00;
-    bmask = 0x00ff0000;
-    amask = 0xff000000;
+      rmask = 0x000000ff;
+      gmask = 0x0000ff00;
+      bmask = 0x00ff0000;
+      amask = 0xff000000;
 #endif
-        d_rgb_image = SDL_CreateRGBSurface(SDL_SWSURFACE, d_width, d_height, 32, rmask, gmask, bmask, amask);
-        if (d_rgb_image == NULL)
+          d_rgb_image = SDL_CreateRGBSurface(SDL_SWSURFACE, d_width, d_height, 32, rmask, gmask, bmask, amask);
+          if (d_rgb_image == NULL)
+          {
+            std::cerr << "SDL: Couldn't create a RGB surface: \n"<< SDL_GetError() <<"\n";
+            throw std::runtime_error("baz::sdl_sink_uc");
+          }
+
+          printf("SDL RGB surface mode: %d bits-per-pixel, %d bytes-per-pixel, pitch: %d\n",
+         d_rgb_image->format->BitsPerPixel, d_rgb_image->format->BytesPerPixel, d_rgb_image->pitch);
+        }
+        else
         {
-          std::cerr << "SDL: Couldn't create a RGB surface: \n"<< SDL_GetError() <<"\n";
-          throw std::runtime_error("baz::sdl_sink_uc");
+          /* Initialize and create the YUV Overlay used for video out */
+          if(!(d_image = SDL_CreateYUVOverlay(d_width, d_height, SDL_YV12_OVERLAY, d_screen))) {
+	  std::cerr << "SDL: Couldn't create a YUV overlay: \n"<< SDL_GetError() <<"\n";
+	  throw std::runtime_error("baz::sdl_sink_uc");
+        }
+        else {
+          printf("SDL overlay_mode %i \n",
+         d_image->format);
         }
-
-        printf("SDL RGB surface mode: %d bits-per-pixel, %d bytes-per-pixel, pitch: %d\n",
-       d_rgb_image->format->BitsPerPixel, d_rgb_image->format->BytesPerPixel, d_rgb_image->pitch);
       }
-      else
-      {
-        /* Initialize and create the YUV Overlay used for video out */
-        if(!(d_image = SDL_CreateYUVOverlay(d_width, d_height, SDL_YV12_OVERLAY, d_screen))) {
-	std::cerr << "SDL: Couldn't create a YUV overlay: \n"<< SDL_GetError() <<"\n";
-	throw std::runtime_error("baz::sdl_sink_uc");
       }
-      else {
-        printf("SDL overlay_mode %i \n",
-       d_image->format);
+      else if (!d_filename.empty())
+      {
+        std::cerr << "SDL: Not saving BMPs in headless mode (use capture)" << std::endl;
       }
-    }
 
       if (rgb)
       {
-        int bytes_per_scanline = width * d_rgb_image->format->BytesPerPixel;  // Note for RGB: 24 bits still is 4 bytes!
+        int bytes_per_scanline = width * (d_rgb_image ? d_rgb_image->format->BytesPerPixel : 4);  // Note for RGB: 24 bits still is 4 bytes!
 
         d_chunk_size = bytes_per_scanline;
         //d_chunk_size = bytes_per_scanline * height; // Load whole image
@@ -262,7 +343,31 @@ namespace gr {
         // FIXME: Clear RGB
       }
 
-      if (font_path.empty() == false)
+      size_t frame_size;
+      if (rgb)
+      {
+        d_plane_offset[0] = d_plane_offset[1] = d_plane_offset[2] = 0;
+        d_plane_pitch[0] = d_plane_pitch[1] = d_plane_pitch[2] = d_chunk_size;  // One scanline
+        frame_size = d_plane_pitch[0] * d_height;
+      }
+      else
+      {
+        // Interleaved chroma lines are copied a full luma width at a time, so each chroma plane has a spare line
+        d_plane_pitch[0] = d_width;
+        d_plane_pitch[1] = d_plane_pitch[2] = d_width/2;
+        d_plane_offset[0] = 0;
+        d_plane_offset[1] = d_width*d_height;
+        d_plane_offset[2] = d_plane_offset[1] + d_plane_pitch[1]*(d_height/2 + 1);
+        frame_size = d_plane_offset[2] + d_plane_pitch[2]*(d_height/2 + 1);
+      }
+      for (int i = 0; i < 3; ++i)
+      {
+        d_frames[i].pixels.assign(frame_size, (rgb ? 0 : 128));
+        d_frames[i].number = 0;
+        d_frames[i].time = 0;
+      }
+
+      if ((font_path.empty() == false) && (d_headless == false))
       {
 #ifdef SDL_TTF_FOUND
           //if (TTF_WasInit() == 0)
@@ -280,10 +385,61 @@ namespace gr {
           std::cerr << "Cannot load font with SDL TTF support" << std::endl;
 #endif
       }
+
+      if (d_capture.empty() == false)
+      {
+        size_t dot = d_capture.find_last_of('.');
+        std::string extension = ((dot == std::string::npos) ? "" : d_capture.substr(dot + 1));
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        if (extension == "y4m")
+          d_capture_type = CAPTURE_Y4M;
+        else if (extension == "pgm")
+          d_capture_type = CAPTURE_PGM;
+        else if (extension == "ppm")
+          d_capture_type = CAPTURE_PPM;
+        else if (extension == "pam")
+          d_capture_type = CAPTURE_PAM;
+        else if (d_capture == "-")
+          d_capture_type = (rgb ? CAPTURE_PPM : CAPTURE_Y4M);
+        else
+          throw std::runtime_error("baz::sdl_sink_uc: capture must be .y4m, .pgm, .ppm or .pam");
+
+        if (rgb != ((d_capture_type == CAPTURE_PPM) || (d_capture_type == CAPTURE_PAM)))
+          throw std::runtime_error("baz::sdl_sink_uc: .ppm/.pam capture needs ABGR input, .y4m/.pgm needs YUV");
+
+        if (d_capture_type == CAPTURE_PPM)
+          d_capture_row.resize(d_width * 3);
+
+        d_capture_sequence = (d_capture.find('%') != std::string::npos);
+        if (d_capture_sequence == false)
+        {
+          if (d_capture == "-")
+            d_capture_file = stdout;
+          else if ((d_capture_file = fopen(d_capture.c_str(), "wb")) == NULL)
+            throw std::runtime_error("baz::sdl_sink_uc: failed to open capture file: " + d_capture);
+
+          if (d_capture_type == CAPTURE_Y4M)
+            write_y4m_header(d_capture_file);
+        }
+
+        std::cerr << "SDL: Capturing every " << d_capture_decimation << " frame(s) to: " << d_capture
+          << (d_capture_sequence ? " (sequence)" : "") << std::endl;
+      }
     }
 
     sdl_sink_uc_impl::~sdl_sink_uc_impl()
     {
+      stop_render_thread();
+
+      if (d_capture_file)
+      {
+        if (d_capture_file == stdout)
+          fflush(d_capture_file);
+        else
+          fclose(d_capture_file);
+      }
+
       std::cerr << "SDL: Exiting...";
 
       if (d_image)
@@ -306,7 +462,8 @@ namespace gr {
         TTF_Quit();
       }
 #endif // SDL_TTF_FOUND
-      SDL_Quit();
+      if (d_headless == false)
+        SDL_Quit();
     }
 
     void
@@ -357,11 +514,11 @@ namespace gr {
       const int second_dst_plane = (12==plane || 1122 == plane) ? 2 : plane;
       int current_line = (0 == plane) ? d_current_line : d_current_line/2;
 
-      unsigned char *dst_pixels = (unsigned char*)d_image->pixels[first_dst_plane];
-      dst_pixels =& dst_pixels[current_line*d_image->pitches[first_dst_plane]];
+      unsigned char *dst_pixels = fill_plane(first_dst_plane);
+      dst_pixels =& dst_pixels[current_line*d_plane_pitch[first_dst_plane]];
 
-      unsigned char * dst_pixels_2 = (unsigned char *)d_image->pixels[second_dst_plane];
-      dst_pixels_2 =& dst_pixels_2[current_line*d_image->pitches[second_dst_plane]];
+      unsigned char * dst_pixels_2 = fill_plane(second_dst_plane);
+      dst_pixels_2 =& dst_pixels_2[current_line*d_plane_pitch[second_dst_plane]];
 
       int src_width = (0 == plane || 12 == plane || 1122 == plane) ? d_width : d_width/2;
       int noutput_items_produced = 0;
@@ -371,11 +528,11 @@ namespace gr {
         //output one line at a time
         if(12 == plane) {
           copy_line_pixel_interleaved(dst_pixels, dst_pixels_2, src_pixels, src_width);
-          dst_pixels_2 += d_image->pitches[second_dst_plane];
+          dst_pixels_2 += d_plane_pitch[second_dst_plane];
         }
         else if(1122 == plane) {
           copy_line_line_interleaved(dst_pixels, dst_pixels_2, src_pixels, src_width);
-          dst_pixels_2 += d_image->pitches[second_dst_plane];
+          dst_pixels_2 += d_plane_pitch[second_dst_plane];
           src_pixels += src_width;
         }
         else if(0 == plane)
@@ -384,50 +541,17 @@ namespace gr {
           copy_line_single_plane_dec2(dst_pixels, src_pixels, src_width); //decimate by two horizontally
 
         src_pixels += src_width;
-        dst_pixels += d_image->pitches[first_dst_plane];
+        dst_pixels += d_plane_pitch[first_dst_plane];
         noutput_items_produced+=src_width;
         current_line++;
 
         if(current_line > max_height) {
           //Start new frame
-          //TODO, do this all in a seperate thread
           current_line = 0;
-          dst_pixels = d_image->pixels[first_dst_plane];
-          dst_pixels_2 = d_image->pixels[second_dst_plane];
-          if(0 == plane) {
-            if (d_image)
-            {
-              if (d_manual_flip == false)
-              {
-                SDL_DisplayYUVOverlay(d_image, &d_dst_rect);
-              }
-              else
-              {
-                gr::thread::scoped_lock guard(d_mutex);
-                d_flip_pending = true;
-              }
-            }
-
-            //SDL_Flip(d_screen);
-
-            if (!d_filename.empty())
-            {
-              std::string filename;
-              
-              filename = boost::str(boost::format(d_filename) % d_frame_counter);
-
-              if (SDL_SaveBMP(d_screen, filename.c_str()) != 0)
-                std::cerr << "Failed to save image to: " << filename << " (" << SDL_GetError() << ")" << std::endl;
-            }
-
-            unsigned int ticks = SDL_GetTicks();//milliseconds
-            d_wanted_ticks += d_wanted_frametime_ms;
-            float avg_alpha = 0.1;
-            int time_diff = d_wanted_ticks-ticks;
-            d_avg_delay = time_diff*avg_alpha + d_avg_delay*(1.0-avg_alpha);
-
-            ++d_frame_counter;
-          }
+          if(0 == plane)
+            publish_frame();
+          dst_pixels = fill_plane(first_dst_plane);
+          dst_pixels_2 = fill_plane(second_dst_plane);
         }
       }
 
@@ -449,147 +573,368 @@ namespace gr {
           SDL_DisplayYUVOverlay(d_image, &d_dst_rect);
 
         d_flip_pending = false;
+        ++d_frames_presented;
       }
     }
 
-    int
-    sdl_sink_uc_impl::work(int noutput_items,
-		       gr_vector_const_void_star &input_items,
-		       gr_vector_void_star &output_items)
+    bool sdl_sink_uc_impl::start()
     {
-      unsigned char *src_pixels_0,*src_pixels_1,*src_pixels_2,*src_pixels_3;
-      int noutput_items_produced = 0;
-      int plane;
-      int delay = (int)d_avg_delay;
+      gr::thread::scoped_lock guard(d_frame_mutex);
 
-      if(0 == d_wanted_ticks)
-        d_wanted_ticks=SDL_GetTicks();
-
-      if(delay > 0)
-        SDL_Delay((unsigned int)delay);//compensate if running too fast
+      if (d_running == false)
+      {
+        d_running = true;
+        d_render_thread = boost::thread(boost::bind(&sdl_sink_uc_impl::render_loop, this));
+      }
 
-      if (d_image) {
-        if(SDL_LockYUVOverlay(d_image)) {
-          return 0;
-        }
+      return true;
     }
-    else
+
+    bool sdl_sink_uc_impl::stop()
     {
-      /*if (SDL_LockSurface(d_screen)) {
-        std::cerr << "Failed to lock screen" << std::endl;
-        return 0;
-      }*/
+      stop_render_thread();
+
+      if (d_capture_drops > 0)
+        std::cerr << "SDL: " << d_capture_drops << " frame(s) not captured (display fell behind)" << std::endl;
+
+      return true;
     }
 
-    if (d_rgb_image)
+    void sdl_sink_uc_impl::stop_render_thread()
     {
-      src_pixels_0 = (unsigned char *) input_items[0];
+      {
+        gr::thread::scoped_lock guard(d_frame_mutex);
+
+        if (d_running == false)
+          return;
 
-      if (SDL_LockSurface(d_rgb_image))  {
-        std::cerr << "Failed to lock surface" << std::endl;
-        return 0;
+        d_running = false;
+        d_frame_cond.notify_all();  // work() may be waiting too (headless)
       }
 
-      bool flip = false;
+      d_render_thread.join();
+    }
+
+    // Called by work() with the fill frame complete: it becomes the ready frame.
+    // Headless, this waits for the render thread to take the previous one, so every frame due is captured.
+    void sdl_sink_uc_impl::publish_frame()
+    {
+      frame_buffer& frame = d_frames[d_fill_frame];
+      frame.number = d_frame_counter++;
+
+      if ((d_headless) && ((frame.number % d_capture_decimation) != 0))
+        return; // Not captured: the fill frame is simply overwritten
+
+      time(&frame.time);
 
-      int i = 0;
-      /*int images = noutput_items / (d_screen->format->BytesPerPixel * d_width * d_height);
-      if (images > 1)
+      gr::thread::scoped_lock guard(d_frame_mutex);
+
+      if (d_headless)
       {
-        i += ((d_height - d_current_line) * (d_screen->format->BytesPerPixel * d_width)); // Finish current
-        i += ((images - 1) * (d_screen->format->BytesPerPixel * d_width * d_height));
-      }*/
+        while ((d_running) && (d_frame_ready))
+          d_frame_cond.wait(guard);
+      }
 
-      for (; i < noutput_items; i += d_chunk_size) {  // [Chunk size should be one scanline]
-        memcpy((char*)d_rgb_image->pixels + (d_rgb_image->pitch * d_current_line), src_pixels_0, d_chunk_size);
-        src_pixels_0 += d_chunk_size;
-        noutput_items_produced += d_chunk_size;
-        d_current_line += (d_chunk_size / (d_screen->format->BytesPerPixel * d_width));
+      if (d_frame_ready)
+      {
+        ++d_frames_dropped; // Render thread is behind: the newer frame replaces the one still waiting
 
-        if (d_current_line > d_height)
+        if ((d_capture_type != CAPTURE_NONE) && ((d_frames[d_ready_frame].number % d_capture_decimation) == 0))
+          ++d_capture_drops;
+      }
+
+      std::swap(d_fill_frame, d_ready_frame);
+      d_frame_ready = true;
+
+      d_frame_cond.notify_one();
+    }
+
+    void sdl_sink_uc_impl::render_loop()
+    {
+      const bool paced = ((d_headless == false) && (d_wanted_frametime_ms > 0));  // Headless writes frames as they arrive
+      unsigned int next_ticks = (paced ? SDL_GetTicks() : 0);
+
+      while (true)
+      {
         {
-          std::cerr << "Off image: " << d_current_line << std::endl;
-          d_current_line = d_height;
+          gr::thread::scoped_lock guard(d_frame_mutex);
+
+          while ((d_running) && (d_frame_ready == false))
+            d_frame_cond.wait(guard);
+
+          if (d_running == false)
+            break;
+
+          std::swap(d_ready_frame, d_show_frame);
+          d_frame_ready = false;
+
+          if (d_headless)
+            d_frame_cond.notify_all();  // work() may be waiting to publish
         }
 
-        if (d_current_line == d_height)
+        present_frame(d_frames[d_show_frame]);
+
+        if (paced)
         {
-          SDL_UnlockSurface(d_rgb_image);
+          next_ticks += d_wanted_frametime_ms;
+
+          unsigned int ticks = SDL_GetTicks();//milliseconds
+          int ahead = (int)(next_ticks - ticks);
+          if (ahead > 0)
+            SDL_Delay((unsigned int)ahead);
+          else if (ahead < -d_wanted_frametime_ms)
+            next_ticks = ticks;  // Too far behind to catch up: don't present a burst
+        }
+      }
+    }
+
+    void sdl_sink_uc_impl::present_frame(const frame_buffer& frame)
+    {
+      if (d_capture_type != CAPTURE_NONE)
+        capture_frame(frame);
+
+      if (d_headless)
+        return;
+
+      gr::thread::scoped_lock guard(d_mutex);  // flip() shows the surfaces too
+
+      if (d_flip_pending)
+        ++d_frames_dropped; // Never flipped
+
+      if (d_rgb_image)
+      {
+        if (SDL_LockSurface(d_rgb_image)) {
+          std::cerr << "Failed to lock surface" << std::endl;
+          return;
+        }
+
+        for (int y = 0; y < d_height; ++y)
+          memcpy((char*)d_rgb_image->pixels + (d_rgb_image->pitch * y), &frame.pixels[d_plane_pitch[0] * y], d_plane_pitch[0]);
+
+        SDL_UnlockSurface(d_rgb_image);
 
-          //printf("SDL: Frame done\n");
 #ifdef SDL_TTF_FOUND
-          if (d_font != NULL)
-          {
-            time_t time_now;
-            char buffer[26];
-            struct tm tm_info;
+        if (d_font != NULL)
+        {
+          char buffer[26];
+          struct tm tm_info;
 
-            time(&time_now);
-            localtime_r(&time_now, &tm_info);
+          localtime_r(&frame.time, &tm_info);
 
-            strftime(buffer, 26, "%Y-%m-%d %H:%M:%S", &tm_info);
+          strftime(buffer, 26, "%Y-%m-%d %H:%M:%S", &tm_info);
 
-            SDL_Color textColor = { 0, 255, 0 };
-            SDL_Surface* message = TTF_RenderText_Solid(d_font, buffer, textColor);
-            if (message != NULL)
-            {
-              if (SDL_BlitSurface(message, NULL, d_rgb_image, /*NULL*/&d_dst_rect) != 0)
-              {
-                std::cerr << "Failed to blit message" << std::endl;
-              }
-              SDL_FreeSurface(message);
-            }
-            else
+          SDL_Color textColor = { 0, 255, 0 };
+          SDL_Surface* message = TTF_RenderText_Solid(d_font, buffer, textColor);
+          if (message != NULL)
+          {
+            if (SDL_BlitSurface(message, NULL, d_rgb_image, /*NULL*/&d_dst_rect) != 0)
             {
-              std::cerr << "Failed to render text" << std::endl;
+              std::cerr << "Failed to blit message" << std::endl;
             }
+            SDL_FreeSurface(message);
+          }
+          else
+          {
+            std::cerr << "Failed to render text" << std::endl;
           }
+        }
 #endif // SDL_TTF_FOUND
-          flip = true;
 
-          //SDL_UnlockSurface(d_rgb_image);
+        if (!d_filename.empty())
+        {
+          std::string filename;
 
-          //SDL_BlitSurface(d_rgb_image, NULL, d_screen, &d_dst_rect);
-          //SDL_Flip(d_screen);
+          filename = boost::str(boost::format(d_filename) % frame.number);
 
-          if (!d_filename.empty())
-          {
-            std::string filename;
-            
-            filename = boost::str(boost::format(d_filename) % d_frame_counter);
-
-            if (SDL_SaveBMP(d_rgb_image, filename.c_str()) != 0)
-              std::cerr << "Failed to save image to: " << filename << " (" << SDL_GetError() << ")" << std::endl;
-          }
+          if (SDL_SaveBMP(d_rgb_image, filename.c_str()) != 0)
+            std::cerr << "Failed to save image to: " << filename << " (" << SDL_GetError() << ")" << std::endl;
+        }
 
-          if (SDL_LockSurface(d_rgb_image)) {
-            std::cerr << "Failed to lock surface" << std::endl;
-            return 0;
-          }
+        SDL_BlitSurface(d_rgb_image, NULL, d_screen, &d_dst_rect);
 
-          d_current_line = 0;
-          ++d_frame_counter;
+        if (d_manual_flip == false)
+        {
+          SDL_Flip(d_screen);
+          ++d_frames_presented;
+        }
+        else
+        {
+          d_flip_pending = true;
         }
       }
+      else if (d_image)
+      {
+        if (SDL_LockYUVOverlay(d_image)) {
+          std::cerr << "Failed to lock overlay" << std::endl;
+          return;
+        }
 
-      SDL_UnlockSurface(d_rgb_image);
+        for (int plane = 0; plane < 3; ++plane)
+        {
+          const int lines = (0 == plane) ? d_height : d_height/2;
+          const int width = std::min(d_plane_pitch[plane], (int)d_image->pitches[plane]);
+          for (int y = 0; y < lines; ++y)
+            memcpy(d_image->pixels[plane] + (d_image->pitches[plane] * y), &frame.pixels[d_plane_offset[plane] + (d_plane_pitch[plane] * y)], width);
+        }
 
-      if (flip)
-      {
-        SDL_BlitSurface(d_rgb_image, NULL, d_screen, &d_dst_rect);
+        SDL_UnlockYUVOverlay(d_image);
 
         if (d_manual_flip == false)
         {
-          SDL_Flip(d_screen);
+          SDL_DisplayYUVOverlay(d_image, &d_dst_rect);
+          ++d_frames_presented;
         }
         else
         {
-          gr::thread::scoped_lock guard(d_mutex);
           d_flip_pending = true;
         }
+
+        if (!d_filename.empty())
+        {
+          std::string filename;
+
+          filename = boost::str(boost::format(d_filename) % frame.number);
+
+          if (SDL_SaveBMP(d_screen, filename.c_str()) != 0)
+            std::cerr << "Failed to save image to: " << filename << " (" << SDL_GetError() << ")" << std::endl;
+        }
+      }
+    }
+
+    void sdl_sink_uc_impl::capture_frame(const frame_buffer& frame)
+    {
+      if ((frame.number % d_capture_decimation) != 0)
+        return;
+
+      if (d_capture_sequence)
+      {
+        size_t index = frame.number / d_capture_decimation;
+        if (d_capture_rotate > 0)
+          index %= d_capture_rotate;
+
+        std::string filename = boost::str(boost::format(d_capture) % index);
+
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL)
+        {
+          std::cerr << "Failed to open capture file: " << filename << std::endl;
+          return;
+        }
+
+        bool ok = write_capture(fp, frame, true);
+        if (fclose(fp) != 0)
+          ok = false;
+
+        if (ok == false)
+        {
+          std::cerr << "Failed to write capture file: " << filename << std::endl;
+          return;
+        }
+      }
+      else
+      {
+        if ((write_capture(d_capture_file, frame, false) == false) || (fflush(d_capture_file) != 0))
+        {
+          std::cerr << "Failed to write to capture: " << d_capture << std::endl;
+          return;
+        }
+      }
+
+      ++d_frames_captured;
+    }
+
+    void sdl_sink_uc_impl::write_y4m_header(FILE *fp)
+    {
+      int rate_num = 25, rate_den = 1;  // Nominal when free-running
+      if (d_framerate > 0)
+      {
+        rate_num = (int)(d_framerate * 1000.0 + 0.5);
+        rate_den = 1000;
+      }
+
+      fprintf(fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", d_width, d_height, rate_num, rate_den * d_capture_decimation);
+    }
+
+    // Each plane is contiguous at its pitch in the frame store, so most formats are written without copying
+    bool sdl_sink_uc_impl::write_capture(FILE *fp, const frame_buffer& frame, bool header)
+    {
+      const unsigned char *pixels = &frame.pixels[0];
+
+      switch (d_capture_type)
+      {
+        case CAPTURE_Y4M:
+          if (header)
+            write_y4m_header(fp);
+          fputs("FRAME\n", fp);
+          // Store is laid out as the YV12 overlay (Y, V, U): Y4M wants Y, U, V
+          fwrite(pixels + d_plane_offset[0], d_plane_pitch[0], d_height, fp);
+          fwrite(pixels + d_plane_offset[2], d_plane_pitch[2], d_height/2, fp);
+          fwrite(pixels + d_plane_offset[1], d_plane_pitch[1], d_height/2, fp);
+          break;
+
+        case CAPTURE_PGM:
+          fprintf(fp, "P5\n%d %d\n255\n", d_width, d_height);
+          fwrite(pixels + d_plane_offset[0], d_plane_pitch[0], d_height, fp);
+          break;
+
+        case CAPTURE_PAM:
+          fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", d_width, d_height);
+          fwrite(pixels, d_plane_pitch[0], d_height, fp);
+          break;
+
+        case CAPTURE_PPM:
+          fprintf(fp, "P6\n%d %d\n255\n", d_width, d_height);
+          for (int y = 0; y < d_height; ++y)
+          {
+            const unsigned char *src = pixels + (d_plane_pitch[0] * y);  // R, G, B, A (see surface masks)
+            for (int x = 0; x < d_width; ++x)
+            {
+              d_capture_row[x*3 + 0] = src[x*4 + 0];
+              d_capture_row[x*3 + 1] = src[x*4 + 1];
+              d_capture_row[x*3 + 2] = src[x*4 + 2];
+            }
+            fwrite(&d_capture_row[0], 1, d_capture_row.size(), fp);
+          }
+          break;
+      }
+
+      return (ferror(fp) == 0);
+    }
+
+    int
+    sdl_sink_uc_impl::work(int noutput_items,
+		       gr_vector_const_void_star &input_items,
+		       gr_vector_void_star &output_items)
+    {
+      unsigned char *src_pixels_0,*src_pixels_1,*src_pixels_2,*src_pixels_3;
+      int noutput_items_produced = 0;
+      int plane;
+
+    if (d_rgb)
+    {
+      src_pixels_0 = (unsigned char *) input_items[0];
+
+      for (int i = 0; i < noutput_items; i += d_chunk_size) {  // [Chunk size should be one scanline]
+        memcpy(fill_plane(0) + (d_plane_pitch[0] * d_current_line), src_pixels_0, d_chunk_size);
+        src_pixels_0 += d_chunk_size;
+        noutput_items_produced += d_chunk_size;
+        d_current_line += (d_chunk_size / d_plane_pitch[0]);
+
+        if (d_current_line > d_height)
+        {
+          std::cerr << "Off image: " << d_current_line << std::endl;
+          d_current_line = d_height;
+        }
+
+        if (d_current_line == d_height)
+        {
+          publish_frame();
+
+          d_current_line = 0;
+        }
       }
     }
-    else if (d_image)
+    else
     {
       switch(input_items.size ()) {
       case 3:		// first channel=Y, second channel is  U , third channel is V
@@ -649,15 +994,6 @@ namespace gr {
       }
     }
 
-      if (d_image)
-      {
-        SDL_UnlockYUVOverlay(d_image);
-      }
-      else
-      {
-        //SDL_UnlockSurface(d_screen);
-        //SDL_Flip(d_screen);
-      }
       return noutput_items_produced;
     }
 
@@ -36,6 +36,14 @@ namespace gr {
      * two streems: first is grey (Y), second is alternating U and V
      * Three streams: first is grey (Y), second is U, third is V
      * Input samples must be in the range [0,255].
+     *
+     * With headless set no display is opened and frames only go to the capture path:
+     * a .y4m (YUV4MPEG2) or .pgm stream for YUV input, or a .ppm/.pam stream for ABGR input ("-" is stdout).
+     * A path containing a format specifier (e.g. "frame%04d.ppm") writes one image per frame,
+     * cycling through capture_rotate files if it is non-zero. Every capture_decimation'th frame is written.
+     * Headless capture is lossless: work() waits while the previous frame is still being written.
+     * With a display open, work() never waits: a frame due for capture that is replaced by a newer one
+     * before the render thread reaches it is counted in capture_drops() (and reported on stop).
      */
     class BAZ_API sdl_sink_uc : virtual public sync_block
     {
@@ -46,9 +54,15 @@ namespace gr {
       static sptr make(double framerate,
 		       int width, int height,
 		       unsigned int format,
-		       int dst_width, int dst_height, const std::string filename = "", bool manual_flip = false, const std::string font_path = "");
+		       int dst_width, int dst_height, const std::string filename = "", bool manual_flip = false, const std::string font_path = "",
+		       bool headless = false, const std::string capture = "", int capture_decimation = 1, int capture_rotate = 0);
 
       virtual void flip(void)=0;
+
+      virtual uint64_t frames_presented() const = 0;
+      virtual uint64_t frames_dropped() const = 0;  // Replaced by a newer frame before they were shown
+      virtual uint64_t frames_captured() const = 0;
+      virtual uint64_t capture_drops() const = 0;
     };
 
   } /* namespace baz */
@@ -48,6 +48,24 @@
 typedef void* optval_t;
 
 #include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+#if defined(HAVE_LINUX_ERRQUEUE_H)
+#include <linux/errqueue.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define TCP_SINK_ZEROCOPY	1
+#endif
+#endif // HAVE_LINUX_ERRQUEUE_H
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define TCP_SINK_SERVER		1
+#endif // HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H
 
 #elif defined(HAVE_WINDOWS_H)
 
@@ -67,6 +85,14 @@ typedef char* optval_t;
 
 #define SNK_VERBOSE 0
 
+#define DEFAULT_CLIENT_QUEUE_SIZE	(4*1024*1024)
+#define PEER_CAPS_TIMEOUT_MS		500	// Receivers that support BT_CAPS send it as soon as they accept
+#define ZEROCOPY_REAP_TIMEOUT_MS	100	// Wait for completions when there is nothing new to send (bounds how long 'work' blocks)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif // MSG_NOSIGNAL
+
 /////////////////////////////////////////////////
 
 #pragma pack(push)
@@ -85,13 +111,57 @@ typedef struct BorPacketHeader {
 
 #pragma pack(pop)
 
+struct baz_tcp_sink::server_client
+{
+	struct queued_packet {
+		BOR_PACKET_HEADER header;	// per client, so overrun flags can be set
+		boost::shared_ptr<std::vector<char> > payload;	// shared between clients
+		size_t sent;
+	};
+
+	int socket;
+	std::string address;
+	std::deque<queued_packet> queue;
+	size_t queued_bytes;
+	bool writable;		// EPOLLOUT registered
+	bool overrun;		// packets were dropped since the last one was queued
+	bool dead;
+	uint64_t packets;
+	uint64_t drops;
+};
+
 enum BorType
 {
 	BT_NONE	= 0x00,
 	BT_DATA	= 0x01,
-	BT_TAGS	= 0x02
+	BT_TAGS	= 0x02,
+	BT_TAGS_COMPACT	= 0x03,	// See BorTagRecord
+	BT_CAPS	= 0x04			// Receiver -> sender: uint32 BorCaps
+};
+
+enum BorCaps
+{
+	BC_NONE			= 0x00,
+	BC_COMPACT_TAGS	= 0x01
+};
+
+// BT_TAGS_COMPACT payload is a sequence of { uint8 record, uint16 key, value }
+enum BorTagRecord
+{
+	BTR_KEY		= 0x00,	// uint8 length, name: binds 'key' to a symbol for the rest of the connection
+	BTR_UINT64	= 0x01,	// uint64
+	BTR_INT64	= 0x02,	// int64
+	BTR_DOUBLE	= 0x03,	// double
+	BTR_TIME	= 0x04,	// uint64 seconds, double fractional seconds
+	BTR_TRUE	= 0x05,
+	BTR_FALSE	= 0x06,
+	BTR_PMT		= 0x07	// uint32 length, pmt::serialize_str
 };
 
+// Largest BT_TAGS_COMPACT payload a sender may use. A receiver only advertises BC_COMPACT_TAGS if it can stage
+// one this size, so key bindings are never lost to a skipped packet (larger groups go as BT_TAGS instead).
+#define BT_TAGS_COMPACT_MAX	4096
+
 enum BorFlags
 {
 	BF_NONE				= 0x00,
@@ -145,7 +215,7 @@ static void report_error( const char *msg1, const char *msg2 )
 		throw std::runtime_error(msg2);
 }
 
-baz_tcp_sink::baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose)
+baz_tcp_sink::baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose, int zerocopy_threshold, int coalesce_size, double coalesce_latency, bool server, int client_queue_size, bool disconnect_slow, bool compact_tags)
 	: gr::sync_block ("tcp_sink",
 		gr::io_signature::make (1, 1, itemsize),
 		gr::io_signature::make (0, 0, 0))
@@ -157,7 +227,41 @@ baz_tcp_sink::baz_tcp_sink (size_t itemsize, const char *host, unsigned short po
 	, d_verbose(verbose)
 	, d_last_host(host)
 	, d_last_port(port)
+	, d_sent_offset(0)
+	, d_zerocopy_threshold(std::max(zerocopy_threshold, 0))
+	, d_zerocopy(false)
+	, d_zerocopy_next_id(0)
+	, d_zerocopy_completed(0)
+	, d_zerocopy_copied(0)
+	, d_coalesce_size(std::max(coalesce_size, 0))
+	, d_coalesce_latency(coalesce_latency)
+	, d_flush_running(false)
+	, d_server(server)
+	, d_client_queue_size(client_queue_size > 0 ? client_queue_size : DEFAULT_CLIENT_QUEUE_SIZE)
+	, d_disconnect_slow(disconnect_slow)
+	, d_listen_socket(-1)
+	, d_epoll(-1)
+	, d_wake(-1)
+	, d_server_running(false)
+	, d_packets_dropped(0)
+	, d_clients_evicted(0)
+	, d_compact_tags(compact_tags)
+	, d_peer_caps_known(false)
+	, d_peer_caps(BC_NONE)
 {
+#if !defined(TCP_SINK_ZEROCOPY)
+	if (d_zerocopy_threshold > 0) {
+		fprintf(stderr, "[TCP Sink \"%s (%ld)\"] MSG_ZEROCOPY not available\n", name().c_str(), unique_id());
+		d_zerocopy_threshold = 0;
+	}
+#endif // TCP_SINK_ZEROCOPY
+
+	if ((d_server) && ((d_zerocopy_threshold > 0) || (d_coalesce_size > 0))) {
+		fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Zero-copy and coalescing are not used in server mode\n", name().c_str(), unique_id());
+		d_zerocopy_threshold = 0;
+		d_coalesce_size = 0;
+	}
+
 #if defined(USING_WINSOCK) // for Windows (with MinGW)
 	// initialize winsock DLL
 	WSADATA wsaData;
@@ -169,8 +273,18 @@ baz_tcp_sink::baz_tcp_sink (size_t itemsize, const char *host, unsigned short po
 
 	//create();
 
+	if (d_server) {
+		start_server(host, port);
+		return;
+	}
+
 	// Get the destination address
 	connect(host, port);
+
+	if (d_coalesce_size > 0) {
+		d_flush_running = true;
+		d_flush_thread = boost::thread(boost::bind(&baz_tcp_sink::flush_loop, this));
+	}
 }
 
 void baz_tcp_sink::set_status_msgq(gr::msg_queue::sptr queue)	// Only call this once before beginning run! (otherwise locking required)
@@ -194,6 +308,19 @@ bool baz_tcp_sink::create()
 		fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Could not set TCP_NODELAY\n", name().c_str(), unique_id());
 	}
 
+#if defined(TCP_SINK_ZEROCOPY)
+	d_zerocopy = false;
+	d_zerocopy_pending.clear();
+	d_zerocopy_next_id = 0;
+	if (d_zerocopy_threshold > 0) {
+		int one = 1;
+		if (setsockopt(d_socket, SOL_SOCKET, SO_ZEROCOPY, (optval_t)&one, sizeof(one)) == 0)
+			d_zerocopy = true;
+		else
+			fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Could not set SO_ZEROCOPY\n", name().c_str(), unique_id());
+	}
+#endif // TCP_SINK_ZEROCOPY
+
 	// Don't wait when shutting down
 	linger lngr;
 	lngr.l_onoff  = 1;
@@ -250,50 +377,239 @@ void baz_tcp_sink::destroy()
 
 // public constructor that returns a shared_ptr
 
-baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose)
+baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose, int zerocopy_threshold, int coalesce_size, double coalesce_latency, bool server, int client_queue_size, bool disconnect_slow, bool compact_tags)
 {
-	return gnuradio::get_initial_sptr(new baz_tcp_sink (itemsize, host, port, blocking, auto_reconnect, verbose));
+	return gnuradio::get_initial_sptr(new baz_tcp_sink (itemsize, host, port, blocking, auto_reconnect, verbose, zerocopy_threshold, coalesce_size, coalesce_latency, server, client_queue_size, disconnect_slow, compact_tags));
 }
 
 baz_tcp_sink::~baz_tcp_sink ()
 {
+	if (d_flush_thread.joinable()) {
+		{
+			gr::thread::scoped_lock guard(d_mutex);
+			d_flush_running = false;
+			d_flush_cond.notify_one();
+		}
+		d_flush_thread.join();
+	}
+
 	//destroy();
 	disconnect();
 
+	if (d_server)
+		stop_server();
+
 #if defined(USING_WINSOCK) // for Windows (with MinGW)
 	// free winsock resources
 	WSACleanup();
 #endif
 }
 
-int baz_tcp_sink::send_data(int type, const char* data, int length)
+// Write all of the iovecs, resuming after partial sends. Returns the number of bytes sent, or -1.
+int baz_tcp_sink::send_all(struct iovec* iov, int iov_count, int flags, uint64_t first_item)
+{
+	int total = 0;
+
+	while (iov_count > 0) {
+		struct msghdr msg;
+		memset(&msg, 0x00, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov_count;
+
+		ssize_t r = sendmsg(d_socket, &msg, flags);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+#if defined(TCP_SINK_ZEROCOPY)
+			if ((flags & MSG_ZEROCOPY) && (errno == ENOBUFS)) {
+				flags &= ~MSG_ZEROCOPY;	// Out of pinned memory: copy this one
+				continue;
+			}
+#endif // TCP_SINK_ZEROCOPY
+			return -1;
+		}
+
+#if defined(TCP_SINK_ZEROCOPY)
+		if (flags & MSG_ZEROCOPY) {
+			zerocopy_send zs;
+			zs.id = d_zerocopy_next_id++;
+			zs.first_item = first_item;
+			d_zerocopy_pending.push_back(zs);
+		}
+#endif // TCP_SINK_ZEROCOPY
+
+		total += r;
+
+		while ((iov_count > 0) && ((size_t)r >= iov->iov_len)) {
+			r -= iov->iov_len;
+			++iov;
+			--iov_count;
+		}
+
+		if (iov_count > 0) {
+			iov->iov_base = (char*)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+
+	return total;
+}
+
+int baz_tcp_sink::flush_coalesced()
 {
+	if (d_coalesce_buff.empty())
+		return 0;
+
+	struct iovec iov;
+	iov.iov_base = &d_coalesce_buff[0];
+	iov.iov_len = d_coalesce_buff.size();
+
+	int r = send_all(&iov, 1, 0, 0);
+
+	d_coalesce_buff.clear();
+
+	return r;
+}
+
+// Flushes a partly filled coalesce buffer when its latency deadline passes, even if work() is not called again.
+// work() holds d_mutex while it fills the buffer, so this only ever sends between calls.
+void baz_tcp_sink::flush_loop()
+{
+	gr::thread::scoped_lock guard(d_mutex);
+
+	while (d_flush_running) {
+		if (d_coalesce_buff.empty()) {
+			d_flush_cond.wait(guard);
+			continue;
+		}
+
+		const boost::system_time deadline = d_coalesce_start + boost::posix_time::microseconds((int64_t)(d_coalesce_latency * 1e6));
+		if (boost::get_system_time() < deadline) {
+			d_flush_cond.timed_wait(guard, deadline);
+			continue;	// Re-check: flushed (or restarted) by work() in the meantime
+		}
+
+		if (flush_coalesced() < 0) {
+			report_error("tcp_sink/data", NULL);
+			_disconnect();
+		}
+	}
+}
+
+// 'first_item' is the absolute input offset of a BT_DATA payload taken straight from the input buffer, or -1
+int baz_tcp_sink::send_packet(int type, const char* data, int length, uint64_t first_item)
+{
+	if (d_server)
+		return broadcast_packet(type, data, length);
+
 	BOR_PACKET_HEADER header;
 	memset(&header, 0x00, sizeof(header));
 	header.type = type;
 	header.length = length;
-	
-	int r;
-	
-	r = send(d_socket, (char*)&header, sizeof(header), 0);
-	if (r < 0) {
-		return r;
+
+	if ((d_coalesce_size > 0) && ((int)(sizeof(header) + length) < d_coalesce_size)) {
+		if (d_coalesce_buff.empty()) {
+			d_coalesce_start = boost::get_system_time();
+			d_flush_cond.notify_one();	// Start the latency deadline
+		}
+
+		d_coalesce_buff.insert(d_coalesce_buff.end(), (const char*)&header, (const char*)&header + sizeof(header));
+		d_coalesce_buff.insert(d_coalesce_buff.end(), data, data + length);
+
+		if ((int)d_coalesce_buff.size() >= d_coalesce_size) {
+			if (flush_coalesced() < 0)
+				return -1;
+		}
+
+		return length;
 	}
-	
-	r = send(d_socket, (char*)data, length, 0);
-	if (r < 0) {
-		return r;
+
+	if (flush_coalesced() < 0)	// Keep packet order
+		return -1;
+
+	struct iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = length;
+
+#if defined(TCP_SINK_ZEROCOPY)
+	if ((d_zerocopy) && (first_item != (uint64_t)-1) && (length >= d_zerocopy_threshold)) {
+		// The header lives on the stack, so it is copied (and held back to share a segment with the payload)
+		if (send_all(&iov[0], 1, MSG_MORE, 0) < 0)
+			return -1;
+		if (send_all(&iov[1], 1, MSG_ZEROCOPY, first_item) < 0)
+			return -1;
+
+		return length;
 	}
-	
+#endif // TCP_SINK_ZEROCOPY
+
+	if (send_all(iov, 2, 0, 0) < 0)
+		return -1;
+
 	return length;
 }
 
+int baz_tcp_sink::send_data(int type, const char* data, int length)
+{
+	return send_packet(type, data, length, (uint64_t)-1);
+}
+
+// Collect MSG_ZEROCOPY completions, waiting up to 'timeout_ms' for the first one
+void baz_tcp_sink::reap_zerocopy(int timeout_ms)
+{
+#if defined(TCP_SINK_ZEROCOPY)
+	if (d_zerocopy_pending.empty())
+		return;
+
+	if (timeout_ms > 0) {
+		struct pollfd pfd;
+		pfd.fd = d_socket;
+		pfd.events = 0;	// POLLERR is always reported
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return;
+	}
+
+	while (d_zerocopy_pending.empty() == false) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0x00, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(d_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if ((serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+				continue;
+
+			const uint32_t lo = serr->ee_info, hi = serr->ee_data;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				d_zerocopy_copied += (hi - lo + 1);
+
+			while ((d_zerocopy_pending.empty() == false) && ((int32_t)(d_zerocopy_pending.front().id - hi) <= 0)) {
+				d_zerocopy_pending.pop_front();
+				++d_zerocopy_completed;
+			}
+		}
+	}
+#endif // TCP_SINK_ZEROCOPY
+}
+
 int baz_tcp_sink::work (int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 {
 	gr::thread::scoped_lock guard(d_mutex);  // protect d_socket
 
-	if (d_connected == false)
+	const uint64_t nread = nitems_read(0);
+
+	if ((d_server == false) && (d_connected == false))
 	{
+		d_sent_offset = std::max(d_sent_offset, nread);	// Anything still in flight went with the old socket
+		
 		if (d_auto_reconnect == false)
 			return -1;
 		
@@ -316,82 +632,114 @@ int baz_tcp_sink::work (int noutput_items, gr_vector_const_void_star &input_item
 	printf("Entered tcp_sink\n");
 #endif
 */
-	std::vector<gr::tag_t> tags;
-	const uint64_t nread = nitems_read(0);
-	get_tags_in_range(tags, 0, nread, nread + noutput_items);
+	// Items before 'start' were sent in an earlier call but are still held by zero-copy sends
+	const uint64_t start = std::max(nread, d_sent_offset);
+	const uint64_t end = nread + noutput_items;
 
-	int to_copy = noutput_items;
-
-	if (tags.size() > 0)
+	if (start < end)
 	{
-		gr::tag_t& tag = tags[0];
-		if (tag.offset > nread)
-		{
-			to_copy = tag.offset - nread;
-		}
-		else if (tag.offset == nread)
+		std::vector<gr::tag_t> tags;
+		get_tags_in_range(tags, 0, start, end);
+
+		int to_copy = (int)(end - start);
+
+		if (tags.size() > 0)
 		{
-			pmt::pmt_t pdu_meta = pmt::make_dict();
-			
-			uint64_t next_offset = -1;
-			
-			BOOST_FOREACH(gr::tag_t& t, tags)
+			gr::tag_t& tag = tags[0];
+			if (tag.offset > start)
+			{
+				to_copy = tag.offset - start;
+			}
+			else if (tag.offset == start)
 			{
-				if (t.offset != nread)
+				uint64_t next_offset = -1;
+				
+				BOOST_FOREACH(gr::tag_t& t, tags)
 				{
-					next_offset = t.offset;
-					break;
+					if (t.offset != start)
+					{
+						next_offset = t.offset;
+						break;
+					}
 				}
 				
-				pdu_meta = dict_add(pdu_meta, t.key, t.value);
+				if ((d_server == false) && (d_compact_tags) && (d_peer_caps_known == false))
+					read_peer_caps();
+				
+				int r;
+				
+				if ((d_server == false) && (d_peer_caps & BC_COMPACT_TAGS) && (encode_tags(tags, start)))
+				{
+					r = send_data(BT_TAGS_COMPACT, &d_tag_buff[0], d_tag_buff.size());
+				}
+				else
+				{
+					pmt::pmt_t pdu_meta = pmt::make_dict();
+					
+					BOOST_FOREACH(gr::tag_t& t, tags)
+					{
+						if (t.offset != start)
+							break;
+						
+						pdu_meta = dict_add(pdu_meta, t.key, t.value);
+					}
+					
+					/*std::streambuf buf;
+					if (pmt::serialize(pdu_meta, buf) == false)
+					{
+						//
+					}*/
+					
+					std::string tags_str = pmt::serialize_str(pdu_meta);
+					
+					r = send_data(BT_TAGS, tags_str.c_str(), tags_str.size() + 1);
+				}
+				
+				if (r == -1)
+				{
+					report_error("tcp_sink/tags", NULL);
+					
+					if (d_verbose) fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Disconnecting...\n", name().c_str(), unique_id());
+					
+					_disconnect();
+					
+					return 0;
+				}
+				
+				if (next_offset != -1)
+					to_copy = next_offset - start;
 			}
-			
-			/*std::streambuf buf;
-			if (pmt::serialize(pdu_meta, buf) == false)
+			else
 			{
-				//
-			}*/
-			
-			std::string tags_str = pmt::serialize_str(pdu_meta);
-			
-			int r = send_data(BT_TAGS, tags_str.c_str(), tags_str.size() + 1);
-			if (r == -1)
+				assert(false);	// Tags before first sample
+			}
+		}
+
+		int r = send_packet(BT_DATA, in + ((start - nread) * d_itemsize), to_copy * d_itemsize, start);
+
+		if (r == -1)	// error on send command
+		{
+			/*if (is_error(ECONNREFUSED))
 			{
-				report_error("tcp_sink/tags", NULL);
-				
-				if (d_verbose) fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Disconnecting...\n", name().c_str(), unique_id());
+				r = bytes_to_send;	// discard data until receiver is started
+			}
+			else*/
+			{
+				report_error("tcp_sink/data", NULL);	// there should be no error case where this function should not exit immediately
 				
 				_disconnect();
 				
 				return 0;
 			}
-			
-			if (next_offset != -1)
-				to_copy = next_offset - nread;
-		}
-		else
-		{
-			assert(false);	// Tags before first sample
 		}
+
+		d_sent_offset = start + to_copy;
 	}
 
-	int r = send_data(BT_DATA, in, to_copy * d_itemsize);
+	// Only consume what the kernel no longer references. With nothing new to send, wait for it rather than spin.
+	reap_zerocopy((start < end) ? 0 : ZEROCOPY_REAP_TIMEOUT_MS);
 
-	if (r == -1)	// error on send command
-	{
-		/*if (is_error(ECONNREFUSED))
-		{
-			r = bytes_to_send;	// discard data until receiver is started
-		}
-		else*/
-		{
-			report_error("tcp_sink/data", NULL);	// there should be no error case where this function should not exit immediately
-			
-			_disconnect();
-			
-			return 0;
-		}
-	}
+	const uint64_t done = (d_zerocopy_pending.empty() ? d_sent_offset : d_zerocopy_pending.front().first_item);
 /*
 #if SNK_VERBOSE
 	printf("\tbyte sent: %d bytes\n", r);
@@ -401,11 +749,133 @@ int baz_tcp_sink::work (int noutput_items, gr_vector_const_void_star &input_item
 	printf("Sent: %d bytes (noutput_items: %d)\n", bytes_sent, noutput_items);
 #endif
 */
-	return to_copy;
+	return (int)(done - nread);
+}
+
+// A receiver that understands BT_TAGS_COMPACT announces it with a BT_CAPS packet right after accepting
+void baz_tcp_sink::read_peer_caps()
+{
+	char buffer[sizeof(BOR_PACKET_HEADER) + sizeof(uint32_t)];
+
+	int r = recv(d_socket, buffer, sizeof(buffer), MSG_PEEK | MSG_DONTWAIT);
+	if (r < (int)sizeof(buffer)) {
+		const bool pending = (((r > 0) || ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))) &&
+			((boost::get_system_time() - d_connect_time).total_milliseconds() < PEER_CAPS_TIMEOUT_MS));
+		if (pending)
+			return;	// Not (all) here yet
+
+		// An older receiver that never sends it (or the connection failed): stop probing until the next connection
+		d_peer_caps_known = true;
+		if (d_verbose) fprintf(stderr, "[TCP Sink \"%s (%ld)\"] No receiver capabilities (legacy receiver)\n", name().c_str(), unique_id());
+		return;
+	}
+
+	PBOR_PACKET_HEADER header = (PBOR_PACKET_HEADER)buffer;
+	if ((header->type == BT_CAPS) && (header->length == sizeof(uint32_t))) {
+		recv(d_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+		memcpy(&d_peer_caps, buffer + sizeof(BOR_PACKET_HEADER), sizeof(uint32_t));
+	}
+
+	d_peer_caps_known = true;
+
+	if (d_verbose) fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Receiver capabilities: 0x%02x\n", name().c_str(), unique_id(), d_peer_caps);
+}
+
+static void append_record(std::vector<char>& buff, int record, uint16_t key, const void* data, size_t length)
+{
+	buff.push_back((char)record);
+	buff.insert(buff.end(), (const char*)&key, (const char*)&key + sizeof(key));
+	if (length > 0)
+		buff.insert(buff.end(), (const char*)data, (const char*)data + length);
+}
+
+// Encode the tags at 'offset' into d_tag_buff. Returns false if they must go as a PMT dict instead
+// (including when they would not fit in BT_TAGS_COMPACT_MAX bytes).
+bool baz_tcp_sink::encode_tags(const std::vector<gr::tag_t>& tags, uint64_t offset)
+{
+	d_tag_buff.clear();
+
+	std::vector<pmt::pmt_t> new_keys;
+	bool ok = true;
+
+	for (size_t i = 0; (i < tags.size()) && (tags[i].offset == offset); ++i) {
+		const gr::tag_t& t = tags[i];
+
+		if (pmt::is_symbol(t.key) == false) {
+			ok = false;
+			break;
+		}
+
+		uint16_t key;
+		std::map<pmt::pmt_t, uint16_t>::iterator it = d_tag_keys.find(t.key);
+		if (it != d_tag_keys.end()) {
+			key = it->second;
+		}
+		else {
+			const std::string key_name = pmt::symbol_to_string(t.key);
+			if ((d_tag_keys.size() >= 0xFFFF) || (key_name.size() > 0xFF)) {
+				ok = false;
+				break;
+			}
+
+			key = d_tag_keys.size();
+			d_tag_keys[t.key] = key;
+			new_keys.push_back(t.key);
+
+			append_record(d_tag_buff, BTR_KEY, key, NULL, 0);
+			d_tag_buff.push_back((char)key_name.size());
+			d_tag_buff.insert(d_tag_buff.end(), key_name.begin(), key_name.end());
+		}
+
+		const pmt::pmt_t& v = t.value;
+
+		if (pmt::is_bool(v)) {
+			append_record(d_tag_buff, (pmt::to_bool(v) ? BTR_TRUE : BTR_FALSE), key, NULL, 0);
+		}
+		else if (pmt::is_uint64(v)) {
+			uint64_t u = pmt::to_uint64(v);
+			append_record(d_tag_buff, BTR_UINT64, key, &u, sizeof(u));
+		}
+		else if (pmt::is_integer(v)) {
+			int64_t l = pmt::to_long(v);
+			append_record(d_tag_buff, BTR_INT64, key, &l, sizeof(l));
+		}
+		else if (pmt::is_real(v)) {
+			double d = pmt::to_double(v);
+			append_record(d_tag_buff, BTR_DOUBLE, key, &d, sizeof(d));
+		}
+		else if ((pmt::is_tuple(v)) && (pmt::length(v) == 2) && (pmt::is_uint64(pmt::tuple_ref(v, 0))) && (pmt::is_real(pmt::tuple_ref(v, 1)))) {
+			char time[sizeof(uint64_t) + sizeof(double)];
+			uint64_t secs = pmt::to_uint64(pmt::tuple_ref(v, 0));
+			double frac = pmt::to_double(pmt::tuple_ref(v, 1));
+			memcpy(time, &secs, sizeof(secs));
+			memcpy(time + sizeof(secs), &frac, sizeof(frac));
+			append_record(d_tag_buff, BTR_TIME, key, time, sizeof(time));
+		}
+		else {
+			const std::string value_str = pmt::serialize_str(v);
+			uint32_t length = value_str.size();
+			append_record(d_tag_buff, BTR_PMT, key, &length, sizeof(length));
+			d_tag_buff.insert(d_tag_buff.end(), value_str.begin(), value_str.end());
+		}
+	}
+
+	if (d_tag_buff.size() > BT_TAGS_COMPACT_MAX)
+		ok = false;
+
+	if (ok == false) {
+		BOOST_FOREACH(const pmt::pmt_t& k, new_keys)	// Their definitions are not being sent
+			d_tag_keys.erase(k);
+	}
+
+	return ok;
 }
 
 bool baz_tcp_sink::connect( const char *host, unsigned short port )
 {
+	if (d_server)
+		return false;
+
 	if (d_connected)
 		disconnect();
 
@@ -462,6 +932,10 @@ retry_connect:
 	}
 
 	d_connected = true;
+	d_peer_caps_known = false;
+	d_peer_caps = BC_NONE;
+	d_connect_time = boost::get_system_time();
+	d_tag_keys.clear();
 	d_last_host = host;
 	d_last_port = port;
 
@@ -491,6 +965,8 @@ void baz_tcp_sink::_disconnect()
 	printf("baz_tcp_sink disconnecting\n");
 #endif
 
+	flush_coalesced();
+
 	BOR_PACKET_HEADER end_packet;
 	memset(&end_packet, 0x00, sizeof(end_packet));
 	end_packet.type = BT_DATA;
@@ -539,6 +1015,476 @@ void baz_tcp_sink::_disconnect()
 	//fprintf(stderr, "[TCP Sink \"%s\"] Disconnected\n", name().c_str());
 
 	d_connected = false;
+	d_zerocopy_pending.clear();	// Released along with the socket
+	d_coalesce_buff.clear();
 	
 	destroy();
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Server mode: every accepted client gets the same packet sequence through its
+// own bounded queue, drained by an epoll thread so work() never waits on a client.
+
+int baz_tcp_sink::client_count()
+{
+	gr::thread::scoped_lock guard(d_server_mutex);
+
+	int count = 0;
+	for (std::map<int, server_client_sptr>::iterator it = d_clients.begin(); it != d_clients.end(); ++it) {
+		if (it->second->dead == false)
+			++count;
+	}
+
+	return count;
+}
+
+#if defined(TCP_SINK_SERVER)
+
+bool baz_tcp_sink::start_server(const char* host, unsigned short port)
+{
+	struct addrinfo *ip_src = NULL;
+	struct addrinfo hints;
+	memset( (void*)&hints, 0, sizeof(hints) );
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+	char port_str[12];
+	sprintf( port_str, "%d", port );
+
+	if ((host != NULL) && (host[0] == '\0'))
+		host = NULL;
+
+	int ret = getaddrinfo( host, port_str, &hints, &ip_src );
+	if ( ret != 0 ) {
+		char error_msg[1024];
+		snprintf(error_msg, sizeof(error_msg), "[TCP Sink \"%s (%ld)\"] getaddrinfo(%s:%d) - %s\n", name().c_str(), unique_id(), (host ? host : "*"), port, gai_strerror(ret));
+		report_error(error_msg, error_msg);
+	}
+
+	// 'report_error' throws: from the constructor, so close what is open first (the destructor will not run)
+
+	d_listen_socket = socket(ip_src->ai_family, ip_src->ai_socktype, ip_src->ai_protocol);
+	if (d_listen_socket == -1) {
+		freeaddrinfo(ip_src);
+		report_error("socket open", "can't create socket");
+	}
+
+	int opt_val = 1;
+	if (setsockopt(d_listen_socket, SOL_SOCKET, SO_REUSEADDR, (optval_t)&opt_val, sizeof(opt_val)) == -1) {
+		freeaddrinfo(ip_src);
+		close_server_fds();
+		report_error("SO_REUSEADDR", "can't set socket option SO_REUSEADDR");
+	}
+
+	if (bind(d_listen_socket, ip_src->ai_addr, ip_src->ai_addrlen) == -1) {
+		freeaddrinfo(ip_src);
+		close_server_fds();
+		report_error("socket bind", "can't bind socket");	// e.g. port in use
+	}
+
+	freeaddrinfo(ip_src);
+
+	if (listen(d_listen_socket, SOMAXCONN) == -1) {
+		close_server_fds();
+		report_error("socket listen", "can't listen on socket");
+	}
+
+	fcntl(d_listen_socket, F_SETFL, fcntl(d_listen_socket, F_GETFL, 0) | O_NONBLOCK);
+
+	d_epoll = epoll_create(16);
+	d_wake = eventfd(0, EFD_NONBLOCK);
+	if ((d_epoll == -1) || (d_wake == -1)) {
+		close_server_fds();
+		report_error("epoll", "can't create epoll/eventfd");
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0x00, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = d_listen_socket;
+	epoll_ctl(d_epoll, EPOLL_CTL_ADD, d_listen_socket, &ev);
+	ev.data.fd = d_wake;
+	epoll_ctl(d_epoll, EPOLL_CTL_ADD, d_wake, &ev);
+
+	d_server_running = true;
+	d_server_thread = boost::thread(boost::bind(&baz_tcp_sink::server_loop, this));
+
+	fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Listening: %s:%d (client queue: %d bytes, slow clients are %s)\n", name().c_str(), unique_id(), (host ? host : "*"), port, d_client_queue_size, (d_disconnect_slow ? "disconnected" : "dropped packets"));
+
+	return true;
+}
+
+void baz_tcp_sink::stop_server()
+{
+	if (d_server_running) {
+		d_server_running = false;
+
+		uint64_t one = 1;
+		if (write(d_wake, &one, sizeof(one)) < 0) { }
+
+		d_server_thread.join();
+	}
+
+	{
+		gr::thread::scoped_lock guard(d_server_mutex);
+
+		boost::shared_ptr<std::vector<char> > empty(new std::vector<char>());
+
+		for (std::map<int, server_client_sptr>::iterator it = d_clients.begin(); it != d_clients.end(); ++it) {
+			server_client& client = *it->second;
+
+			if (client.dead == false) {
+				queue_packet(client, BT_DATA, BF_STREAM_END, empty);
+				service_client(client);	// Best effort: whatever fits in the socket buffer now
+			}
+
+			shutdown(client.socket, SHUT_RDWR);
+			::close(client.socket);
+		}
+
+		d_clients.clear();
+	}
+
+	close_server_fds();
+}
+
+void baz_tcp_sink::close_server_fds()	// Keeps errno for a following 'report_error'
+{
+	const int err = errno;
+
+	if (d_epoll != -1) {
+		::close(d_epoll);
+		d_epoll = -1;
+	}
+
+	if (d_wake != -1) {
+		::close(d_wake);
+		d_wake = -1;
+	}
+
+	if (d_listen_socket != -1) {
+		::close(d_listen_socket);
+		d_listen_socket = -1;
+	}
+
+	errno = err;
+}
+
+// Called with d_server_mutex held
+void baz_tcp_sink::queue_packet(server_client& client, int type, int flags, const boost::shared_ptr<std::vector<char> >& payload)
+{
+	server_client::queued_packet packet;
+	memset(&packet.header, 0x00, sizeof(packet.header));
+	packet.header.type = type;
+	packet.header.flags = flags;
+	packet.header.length = payload->size();
+	packet.payload = payload;
+	packet.sent = 0;
+
+	if (payload->empty())
+		packet.header.flags |= BF_EMPTY_PAYLOAD;
+
+	if (client.overrun) {
+		packet.header.flags |= BF_NETWORK_OVERRUN;
+		client.overrun = false;
+	}
+
+	client.queue.push_back(packet);
+	client.queued_bytes += sizeof(packet.header) + payload->size();
+}
+
+int baz_tcp_sink::broadcast_packet(int type, const char* data, int length)
+{
+	bool wake = false;
+
+	{
+		gr::thread::scoped_lock guard(d_server_mutex);
+
+		boost::shared_ptr<std::vector<char> > payload;
+
+		if ((d_clients.empty() == false) || (type == BT_TAGS))
+			payload.reset(new std::vector<char>(data, data + length));
+
+		if (type == BT_TAGS)
+			d_last_tags = payload;
+
+		const size_t size = sizeof(BOR_PACKET_HEADER) + length;
+
+		for (std::map<int, server_client_sptr>::iterator it = d_clients.begin(); it != d_clients.end(); ++it) {
+			server_client& client = *it->second;
+
+			if (client.dead)
+				continue;
+
+			// A packet larger than the whole queue is still let through on its own
+			if ((client.queue.empty() == false) && ((client.queued_bytes + size) > (size_t)d_client_queue_size)) {
+				if (d_disconnect_slow) {
+					if (d_verbose) fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Disconnecting slow client: %s\n", name().c_str(), unique_id(), client.address.c_str());
+
+					client.dead = true;
+					++d_clients_evicted;
+					wake = true;
+				}
+				else {
+					client.overrun = true;
+					++client.drops;
+					++d_packets_dropped;
+				}
+
+				continue;
+			}
+
+			queue_packet(client, type, BF_NONE, payload);
+
+			if (client.writable == false)
+				wake = true;	// Idle client: the epoll thread needs to start sending
+		}
+	}
+
+	if (wake) {
+		uint64_t one = 1;
+		if (write(d_wake, &one, sizeof(one)) < 0) { }
+	}
+
+	return length;
+}
+
+// Called with d_server_mutex held
+void baz_tcp_sink::set_writable(server_client& client, bool writable)
+{
+	if (client.writable == writable)
+		return;
+
+	struct epoll_event ev;
+	memset(&ev, 0x00, sizeof(ev));
+	ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+	ev.data.fd = client.socket;
+	epoll_ctl(d_epoll, EPOLL_CTL_MOD, client.socket, &ev);
+
+	client.writable = writable;
+}
+
+// Write as much of the client's queue as the socket takes without blocking. Returns false on error.
+bool baz_tcp_sink::service_client(server_client& client)
+{
+	const int max_iov = 64;	// MAGIC
+
+	while (client.queue.empty() == false) {
+		struct iovec iov[max_iov];
+		int iov_count = 0;
+
+		for (std::deque<server_client::queued_packet>::iterator it = client.queue.begin(); (it != client.queue.end()) && ((iov_count + 2) <= max_iov); ++it) {
+			size_t sent = it->sent;
+
+			if (sent < sizeof(it->header)) {
+				iov[iov_count].iov_base = (char*)&it->header + sent;
+				iov[iov_count].iov_len = sizeof(it->header) - sent;
+				++iov_count;
+				sent = 0;
+			}
+			else
+				sent -= sizeof(it->header);
+
+			if (it->payload->size() > sent) {
+				iov[iov_count].iov_base = &(*it->payload)[sent];
+				iov[iov_count].iov_len = it->payload->size() - sent;
+				++iov_count;
+			}
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0x00, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov_count;
+
+		ssize_t r = sendmsg(client.socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				set_writable(client, true);
+				return true;
+			}
+
+			return false;
+		}
+
+		while (r > 0) {
+			server_client::queued_packet& packet = client.queue.front();
+			const size_t size = sizeof(packet.header) + packet.payload->size();
+			const size_t remaining = size - packet.sent;
+
+			if ((size_t)r < remaining) {
+				packet.sent += r;
+				break;
+			}
+
+			r -= remaining;
+			client.queued_bytes -= size;
+			++client.packets;
+			client.queue.pop_front();
+		}
+	}
+
+	set_writable(client, false);
+
+	return true;
+}
+
+// Called with d_server_mutex held
+void baz_tcp_sink::accept_clients()
+{
+	while (true) {
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+
+		int s = accept(d_listen_socket, (struct sockaddr*)&addr, &addr_len);
+		if (s == -1) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				report_error("tcp_sink/accept", NULL);
+			return;
+		}
+
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+
+		int no_delay = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (optval_t)&no_delay, sizeof(no_delay));
+
+		struct epoll_event ev;
+		memset(&ev, 0x00, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = s;
+		if (epoll_ctl(d_epoll, EPOLL_CTL_ADD, s, &ev) == -1) {
+			report_error("tcp_sink/epoll_ctl", NULL);
+			::close(s);
+			continue;
+		}
+
+		char address[64];
+		snprintf(address, sizeof(address), "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+		server_client_sptr client(new server_client());
+		client->socket = s;
+		client->address = address;
+		client->queued_bytes = 0;
+		client->writable = false;
+		client->overrun = false;
+		client->dead = false;
+		client->packets = 0;
+		client->drops = 0;
+
+		if (d_last_tags)
+			queue_packet(*client, BT_TAGS, BF_NONE, d_last_tags);
+
+		d_clients[s] = client;
+
+		fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Client connected: %s (%d clients)\n", name().c_str(), unique_id(), address, (int)d_clients.size());
+
+		if (service_client(*client) == false)
+			client->dead = true;
+	}
+}
+
+void baz_tcp_sink::server_loop()
+{
+	const int max_events = 32;	// MAGIC
+	struct epoll_event events[max_events];
+
+	while (d_server_running) {
+		int n = epoll_wait(d_epoll, events, max_events, 100);	// MAGIC: re-check d_server_running
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			report_error("tcp_sink/epoll_wait", NULL);
+			break;
+		}
+
+		gr::thread::scoped_lock guard(d_server_mutex);
+
+		for (int i = 0; i < n; ++i) {
+			const int fd = events[i].data.fd;
+
+			if (fd == d_listen_socket) {
+				accept_clients();
+				continue;
+			}
+
+			if (fd == d_wake) {
+				uint64_t count;
+				if (read(d_wake, &count, sizeof(count)) < 0) { }
+
+				for (std::map<int, server_client_sptr>::iterator it = d_clients.begin(); it != d_clients.end(); ++it) {
+					server_client& client = *it->second;
+					if ((client.dead == false) && (client.writable == false) && (client.queue.empty() == false)) {
+						if (service_client(client) == false)
+							client.dead = true;
+					}
+				}
+
+				continue;
+			}
+
+			std::map<int, server_client_sptr>::iterator it = d_clients.find(fd);
+			if (it == d_clients.end())
+				continue;
+
+			server_client& client = *it->second;
+			if (client.dead)
+				continue;
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				client.dead = true;
+				continue;
+			}
+
+			if (events[i].events & EPOLLIN) {	// Clients don't talk: only look for them going away
+				char buffer[256];
+				ssize_t r = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				if ((r == 0) || ((r < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+					client.dead = true;
+					continue;
+				}
+			}
+
+			if (events[i].events & EPOLLOUT) {
+				if (service_client(client) == false)
+					client.dead = true;
+			}
+		}
+
+		for (std::map<int, server_client_sptr>::iterator it = d_clients.begin(); it != d_clients.end(); ) {
+			server_client& client = *it->second;
+			if (client.dead == false) {
+				++it;
+				continue;
+			}
+
+			::close(client.socket);	// Also leaves the epoll set
+
+			fprintf(stderr, "[TCP Sink \"%s (%ld)\"] Client disconnected: %s (sent %llu packets, dropped %llu, %d clients left)\n", name().c_str(), unique_id(), client.address.c_str(), (unsigned long long)client.packets, (unsigned long long)client.drops, (int)d_clients.size() - 1);
+
+			d_clients.erase(it++);
+		}
+	}
+}
+
+#else
+
+bool baz_tcp_sink::start_server(const char* host, unsigned short port)
+{
+	throw std::runtime_error("TCP Sink server mode is not supported on this platform");
+}
+
+void baz_tcp_sink::stop_server() { }
+void baz_tcp_sink::close_server_fds() { }
+void baz_tcp_sink::server_loop() { }
+void baz_tcp_sink::accept_clients() { }
+void baz_tcp_sink::queue_packet(server_client& client, int type, int flags, const boost::shared_ptr<std::vector<char> >& payload) { }
+bool baz_tcp_sink::service_client(server_client& client) { return false; }
+void baz_tcp_sink::set_writable(server_client& client, bool writable) { }
+int baz_tcp_sink::broadcast_packet(int type, const char* data, int length) { return -1; }
+
+#endif // TCP_SINK_SERVER
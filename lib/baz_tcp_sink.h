@@ -30,10 +30,16 @@
 #include <gnuradio/msg_queue.h>
 #include <gnuradio/thread/thread.h>
 
+#include <deque>
+#include <map>
+#include <vector>
+
+struct iovec;
+
 class BAZ_API baz_tcp_sink;
 typedef boost::shared_ptr<baz_tcp_sink> baz_tcp_sink_sptr;
 
-BAZ_API baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking = true, bool auto_reconnect = false, bool verbose = false);
+BAZ_API baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking = true, bool auto_reconnect = false, bool verbose = false, int zerocopy_threshold = 0, int coalesce_size = 0, double coalesce_latency = 0.01, bool server = false, int client_queue_size = 0, bool disconnect_slow = false, bool compact_tags = true);
 
 /*!
  * \brief Write stream to an TCP socket.
@@ -43,12 +49,27 @@ BAZ_API baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host,
  * \param host         The name or IP address of the receiving host; use
  *                     NULL or None for no connection
  * \param port         Destination port to connect to on receiving host
+ * \param zerocopy_threshold BT_DATA payloads of at least this many bytes are
+ *                     sent with MSG_ZEROCOPY (0: never). Input items are only
+ *                     consumed once the kernel reports it has released them,
+ *                     i.e. once the peer has ACKed them, which caps throughput
+ *                     at roughly input buffer size / round-trip time.
+ * \param coalesce_size Packets smaller than this are packed together and sent
+ *                     once this many bytes are waiting (0: send immediately)
+ * \param coalesce_latency Longest time (seconds) a packed packet is held
+ * \param server       Listen on host:port and stream to every client that
+ *                     connects (instead of connecting out)
+ * \param client_queue_size Bytes queued per client in server mode before it
+ *                     counts as slow (0: default)
+ * \param disconnect_slow Disconnect slow clients instead of dropping packets
+ * \param compact_tags Send tags in the compact binary encoding when the
+ *                     receiver advertises support for it (client mode)
  */
 
 class BAZ_API baz_tcp_sink : public gr::sync_block
 {
 private:
-	friend BAZ_API baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose);
+	friend BAZ_API baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose, int zerocopy_threshold, int coalesce_size, double coalesce_latency, bool server, int client_queue_size, bool disconnect_slow, bool compact_tags);
 	size_t d_itemsize;
 
 	int d_socket;          // handle to socket
@@ -60,6 +81,45 @@ private:
 	bool d_verbose;
 	std::string d_last_host;
 	unsigned short d_last_port;
+	uint64_t d_sent_offset;		// absolute input item up to which data has been handed to the socket
+	int d_zerocopy_threshold;
+	bool d_zerocopy;			// MSG_ZEROCOPY accepted by the current socket
+	struct zerocopy_send {
+		uint32_t id;			// kernel notification counter
+		uint64_t first_item;	// input must not be consumed past here until 'id' completes
+	};
+	std::deque<zerocopy_send> d_zerocopy_pending;
+	uint32_t d_zerocopy_next_id;
+	uint64_t d_zerocopy_completed;
+	uint64_t d_zerocopy_copied;	// completions where the kernel fell back to copying
+	int d_coalesce_size;
+	double d_coalesce_latency;
+	std::vector<char> d_coalesce_buff;
+	boost::system_time d_coalesce_start;
+	boost::thread d_flush_thread;		// flushes d_coalesce_buff once 'coalesce_latency' expires without work() filling it
+	gr::thread::condition_variable d_flush_cond;	// with d_mutex: coalescing started, or stopping
+	bool d_flush_running;
+	bool d_server;
+	int d_client_queue_size;
+	bool d_disconnect_slow;
+	int d_listen_socket;
+	int d_epoll;
+	int d_wake;					// eventfd: packets queued for idle clients
+	boost::thread d_server_thread;
+	volatile bool d_server_running;
+	gr::thread::mutex d_server_mutex;	// protects d_clients and d_last_tags
+	struct server_client;
+	typedef boost::shared_ptr<server_client> server_client_sptr;
+	std::map<int, server_client_sptr> d_clients;
+	boost::shared_ptr<std::vector<char> > d_last_tags;	// replayed to new clients
+	uint64_t d_packets_dropped;
+	uint64_t d_clients_evicted;
+	bool d_compact_tags;
+	bool d_peer_caps_known;		// BT_CAPS received (or given up on) for this connection
+	boost::system_time d_connect_time;	// a receiver that has not sent BT_CAPS soon after this is a legacy one
+	uint32_t d_peer_caps;
+	std::map<pmt::pmt_t, uint16_t> d_tag_keys;	// keys already defined on this connection
+	std::vector<char> d_tag_buff;
 
 protected:
   /*!
@@ -70,12 +130,28 @@ protected:
    *                     NULL or None for no connection
    * \param port         Destination port to connect to on receiving host
    */
-	baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose);
+	baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose, int zerocopy_threshold, int coalesce_size, double coalesce_latency, bool server, int client_queue_size, bool disconnect_slow, bool compact_tags);
   
 	bool create();
 	void allocate();
 	void destroy();
 	void _disconnect();
+	int send_all(struct iovec* iov, int iov_count, int flags, uint64_t first_item);
+	int send_packet(int type, const char* data, int length, uint64_t first_item);
+	int flush_coalesced();
+	void flush_loop();
+	void reap_zerocopy(int timeout_ms);
+	bool start_server(const char* host, unsigned short port);
+	void stop_server();
+	void close_server_fds();
+	void server_loop();
+	void accept_clients();
+	void queue_packet(server_client& client, int type, int flags, const boost::shared_ptr<std::vector<char> >& payload);
+	bool service_client(server_client& client);
+	void set_writable(server_client& client, bool writable);
+	int broadcast_packet(int type, const char* data, int length);
+	void read_peer_caps();
+	bool encode_tags(const std::vector<gr::tag_t>& tags, uint64_t offset);
 
 public:
 	~baz_tcp_sink ();
@@ -101,6 +177,14 @@ public:
 
 	int send_data(int type, const char* data, int length);
 
+	uint64_t zerocopy_completed() const { return d_zerocopy_completed; }
+	uint64_t zerocopy_copied() const { return d_zerocopy_copied; }
+	int zerocopy_pending() const { return (int)d_zerocopy_pending.size(); }
+
+	int client_count();
+	uint64_t packets_dropped() const { return d_packets_dropped; }
+	uint64_t clients_evicted() const { return d_clients_evicted; }
+
 	int work (int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items);
 };
 
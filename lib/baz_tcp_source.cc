@@ -92,10 +92,35 @@ enum BorType
 	BT_NONE	= 0x00,
 	BT_DATA	= 0x01,
 	BT_TAGS	= 0x02,
+	BT_TAGS_COMPACT	= 0x03,	// See BorTagRecord
+	BT_CAPS	= 0x04,			// Receiver -> sender: uint32 BorCaps
 	BT_MAX,
 	BT_VALID = ((BT_MAX-1) << 1) - 1
 };
 
+enum BorCaps
+{
+	BC_NONE			= 0x00,
+	BC_COMPACT_TAGS	= 0x01
+};
+
+// BT_TAGS_COMPACT payload is a sequence of { uint8 record, uint16 key, value }
+enum BorTagRecord
+{
+	BTR_KEY		= 0x00,	// uint8 length, name: binds 'key' to a symbol for the rest of the connection
+	BTR_UINT64	= 0x01,	// uint64
+	BTR_INT64	= 0x02,	// int64
+	BTR_DOUBLE	= 0x03,	// double
+	BTR_TIME	= 0x04,	// uint64 seconds, double fractional seconds
+	BTR_TRUE	= 0x05,
+	BTR_FALSE	= 0x06,
+	BTR_PMT		= 0x07	// uint32 length, pmt::serialize_str
+};
+
+// Largest BT_TAGS_COMPACT payload a sender may use. A receiver only advertises BC_COMPACT_TAGS if it can stage
+// one this size, so key bindings are never lost to a skipped packet (larger groups go as BT_TAGS instead).
+#define BT_TAGS_COMPACT_MAX	4096
+
 enum BorFlags
 {
 	BF_NONE				= 0x00,
@@ -111,6 +136,8 @@ enum BorFlags
 
 #define DEFAULT_BUFFER_SIZE	(1024*1024)
 
+#define STAGING_READAHEAD	1024	// MAGIC
+
 #define USE_SELECT		1  // non-blocking receive on all platforms
 #define USE_RCV_TIMEO	0  // non-blocking receive on all but Cygwin
 #define SRC_VERBOSE		0
@@ -158,12 +185,13 @@ baz_tcp_source::baz_tcp_source(size_t itemsize, const char *host, unsigned short
 		gr::io_signature::make(1, 1, itemsize))
 	, d_itemsize(itemsize)
 	, d_socket(-1)
-	//, d_residual(0)
-	, d_temp_offset(0)
 	, d_eos(false)
 	, d_temp_buff(NULL)
 	, d_temp_buff_size(0)
-	, d_temp_buff_used(0)
+	, d_ring_head(0)
+	, d_ring_used(0)
+	, d_item_buff(NULL)
+	, d_item_used(0)
 	, d_client_socket(-1)
 	, d_client_addr(NULL)
 	, d_client_addr_len(0)
@@ -171,9 +199,10 @@ baz_tcp_source::baz_tcp_source(size_t itemsize, const char *host, unsigned short
 	, d_packet_type(BT_NONE)
 	, d_packet_length(0)
 	, d_packet_offset(0)
-	, d_tags(pmt::PMT_NIL)
 	, d_new_tags(false)
 	, d_work_count(0)
+	, d_bytes_direct(0)
+	, d_bytes_staged(0)
 {
 	if (buffer_size <= 0)
 		buffer_size = DEFAULT_BUFFER_SIZE;
@@ -296,6 +325,8 @@ baz_tcp_source::baz_tcp_source(size_t itemsize, const char *host, unsigned short
 	d_temp_buff = new char[buffer_size];   // allow it to hold up to payload_size bytes
 	d_temp_buff_size = buffer_size;
 	
+	d_item_buff = new char[itemsize];
+	
 	d_client_addr = new char[d_client_addr_len];
 }
 
@@ -330,6 +361,9 @@ baz_tcp_source::~baz_tcp_source ()
 	
 	if (d_client_addr)
 		delete [] d_client_addr;
+	
+	if (d_item_buff)
+		delete [] d_item_buff;
 }
 
 void baz_tcp_source::disconnect_client()
@@ -348,8 +382,13 @@ void baz_tcp_source::disconnect_client()
 	
 	d_packet_type = BT_NONE;
 	d_packet_length = 0;
-	d_temp_buff_used = 0;
-	d_temp_offset = 0;
+	d_packet_offset = 0;
+	d_tags.clear();
+	d_new_tags = false;
+	d_tag_keys.clear();
+	d_ring_head = 0;
+	d_ring_used = 0;
+	d_item_used = 0;
 }
 
 void baz_tcp_source::signal_eos()
@@ -358,85 +397,260 @@ void baz_tcp_source::signal_eos()
 	d_eos = true;
 }
 
-int baz_tcp_source::work (int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+void baz_tcp_source::ring_peek(char* dest, int length)
 {
-	++d_work_count;
-	
-	if (d_eos)
-		return -1;
+	assert(length <= d_ring_used);
 
-	////////////////////////////////////////////////////////////////////////////
+	int first = std::min(length, d_temp_buff_size - d_ring_head);
+	memcpy(dest, d_temp_buff + d_ring_head, first);
+	if (first < length)
+		memcpy(dest + first, d_temp_buff, length - first);
+}
 
-	char *out = (char*)output_items[0];
-	
-	int data_remaining_in_buffer = d_temp_buff_used - d_temp_offset;
+void baz_tcp_source::ring_skip(int length)
+{
+	assert(length <= d_ring_used);
+
+	d_ring_used -= length;
+
+	if (d_ring_used == 0)
+		d_ring_head = 0;	// Keep the free span as large as possible
+	else
+		d_ring_head = (d_ring_head + length) % d_temp_buff_size;
+}
+
+int baz_tcp_source::ring_recv(int limit)
+{
+	int tail = (d_ring_head + d_ring_used) % d_temp_buff_size;
+	int free_span = std::min(d_temp_buff_size - d_ring_used, d_temp_buff_size - tail);
+	assert(free_span > 0);
+
+	int r = recv(d_client_socket, d_temp_buff + tail, std::min(free_span, limit), 0);
+	if (r > 0)
+	{
+		d_ring_used += r;
+		d_bytes_staged += r;
+	}
+
+	return r;
+}
+
+int baz_tcp_source::wait_for_data(int timeout_us)
+{
+#if USE_SELECT
+	// RCV_TIMEO doesn't work on all systems (e.g., Cygwin)
+	// use select() instead of, or in addition to RCV_TIMEO
+	fd_set readfds;
+
+	timeval timeout;
+	timeout.tv_sec = 0;			// Init timeout each iteration.  Select can modify it.
+	timeout.tv_usec = timeout_us;
+
+	FD_ZERO(&readfds);
+	FD_SET(d_client_socket, &readfds);
+
+	return select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
+#else
+	return 1;
+#endif // USE_SELECT
+}
+
+bool baz_tcp_source::parse_header()
+{
+	if (d_ring_used < (int)sizeof(BOR_PACKET_HEADER))
+		return false;
+
+	BOR_PACKET_HEADER header;
+	ring_peek((char*)&header, sizeof(BOR_PACKET_HEADER));
+	ring_skip(sizeof(BOR_PACKET_HEADER));
+
+	d_packet_type = header.type;
+	d_packet_length = header.length;
+	d_packet_offset = 0;
+
+	if (d_packet_length == 0)
+	{
+		assert(header.flags & BF_EMPTY_PAYLOAD);
+		d_packet_type = BT_NONE;
+	}
+	else
+	{
+		assert((header.flags & BF_EMPTY_PAYLOAD) != BF_EMPTY_PAYLOAD);
+
+		if ((d_packet_type != BT_DATA) && (d_packet_type != BT_TAGS) && (d_packet_type != BT_TAGS_COMPACT))
+		{
+			if (d_verbose)
+				fprintf(stderr, "[%s<%li>] skipping unknown packet type %d (%d bytes)\n", name().c_str(), unique_id(), d_packet_type, d_packet_length);
+		}
+		else if ((d_packet_type != BT_DATA) && (d_packet_length > d_temp_buff_size))
+		{
+			fprintf(stderr, "[%s<%li>] skipping tags packet larger than staging buffer (%d > %d bytes)\n", name().c_str(), unique_id(), d_packet_length, d_temp_buff_size);
+
+			if (d_packet_type == BT_TAGS_COMPACT)	// Only a sender ignoring BT_TAGS_COMPACT_MAX gets here
+				fprintf(stderr, "[%s<%li>] key bindings in the skipped compact tags are lost: tags using them will be dropped\n", name().c_str(), unique_id());
+		}
+	}
 
-	if ((d_packet_type == BT_DATA) && (d_packet_length > 0))
+	return true;
+}
+
+void baz_tcp_source::parse_tags()
+{
+	d_tag_buff.resize(d_packet_length);
+	ring_peek(&d_tag_buff[0], d_packet_length);
+	ring_skip(d_packet_length);
+
+	d_tags.clear();
+
+	if (d_packet_type == BT_TAGS_COMPACT)
+	{
+		decode_tags(&d_tag_buff[0], d_packet_length);
+	}
+	else
 	{
-		if (data_remaining_in_buffer > 0)
+		pmt::pmt_t tags(pmt::deserialize_str(std::string(&d_tag_buff[0], d_packet_length)));
+
+		if (pmt::eq(tags, pmt::PMT_NIL) == false)
 		{
-			int remaining_in_packet = d_packet_length - d_packet_offset;
-			int remaining = std::min(remaining_in_packet, data_remaining_in_buffer);
-			int remaining_items = remaining / d_itemsize;
-			int to_copy = std::min(noutput_items, remaining_items);
-			int to_copy_bytes = to_copy * d_itemsize;
-			
-			if (to_copy_bytes > 0)
+			pmt::pmt_t klist(pmt::dict_keys(tags));
+
+			for(size_t i = 0; i < pmt::length(klist); i++)
 			{
-				if (d_new_tags)
-				{
-					if (pmt::eq(d_tags, pmt::PMT_NIL) == false)
-					{
-						pmt::pmt_t klist(pmt::dict_keys(d_tags));
-						
-						for(size_t i = 0; i < pmt::length(klist); i++)
-						{
-							pmt::pmt_t k(pmt::nth(i, klist));
-							pmt::pmt_t v(pmt::dict_ref(d_tags, k, pmt::PMT_NIL));
-							add_item_tag(0, nitems_written(0), k, v, pmt::mp(alias()));
-						}
-					}
-					
-					d_new_tags = false;
-				}
-				
-				memcpy(out, d_temp_buff + d_temp_offset, to_copy_bytes);
-				
-				int residual = data_remaining_in_buffer - to_copy_bytes;
-//fprintf(stderr, "[%s<%i>] work %d, in data (temp buff usage: %d) copied bytes: %d, packet length: %d, residual: %d\n", name().c_str(), unique_id(), d_work_count, d_temp_buff_used, to_copy_bytes, d_packet_length, residual);
-				// FIXME: Item size mismatch
-				//	Careful with next 'assert'
-				//if ((remaining_in_packet < d_itemsize) && (data_remaining_in_buffer > 
-				
-				if (residual > 0)
-					memmove(d_temp_buff, d_temp_buff + d_temp_offset + to_copy_bytes, residual);
-				
-				d_temp_buff_used -= (d_temp_offset + to_copy_bytes);
-				assert(d_temp_buff_used == residual);
-				d_temp_offset = 0;
-				
-				d_packet_offset += to_copy_bytes;
-				
-				if (d_packet_offset == d_packet_length)
-				{
-					d_packet_type = BT_NONE;
-					d_packet_offset = 0;
-					d_packet_length = 0;
-				}
-				
-				return to_copy;
+				pmt::pmt_t k(pmt::nth(i, klist));
+				d_tags.push_back(std::make_pair(k, pmt::dict_ref(tags, k, pmt::PMT_NIL)));
 			}
-			else
+		}
+	}
+
+	d_new_tags = true;
+
+	d_packet_type = BT_NONE;
+	d_packet_length = 0;
+}
+
+// Decode a BT_TAGS_COMPACT payload into d_tags, defining keys along the way
+void baz_tcp_source::decode_tags(const char* data, int length)
+{
+	const char* end = data + length;
+
+	while (data < end)
+	{
+		if ((end - data) < (int)(sizeof(uint8_t) + sizeof(uint16_t)))
+			break;
+
+		int record = (unsigned char)data[0];
+		uint16_t key;
+		memcpy(&key, data + 1, sizeof(key));
+		data += sizeof(uint8_t) + sizeof(uint16_t);
+
+		if (record == BTR_KEY)
+		{
+			if ((data == end) || ((end - data - 1) < (unsigned char)data[0]))
+				break;
+
+			int key_length = (unsigned char)data[0];
+
+			if (key >= d_tag_keys.size())
+				d_tag_keys.resize(key + 1);
+			d_tag_keys[key] = pmt::string_to_symbol(std::string(data + 1, key_length));
+
+			data += 1 + key_length;
+
+			continue;
+		}
+
+		if ((key >= d_tag_keys.size()) || (!d_tag_keys[key]))
+		{
+			fprintf(stderr, "[%s<%li>] compact tag with undefined key %d\n", name().c_str(), unique_id(), key);
+			return;
+		}
+
+		pmt::pmt_t value;
+
+		switch (record)
+		{
+			case BTR_UINT64:
+			{
+				uint64_t u;
+				if ((end - data) < (int)sizeof(u))
+					break;
+				memcpy(&u, data, sizeof(u));
+				data += sizeof(u);
+				value = pmt::from_uint64(u);
+				break;
+			}
+			case BTR_INT64:
+			{
+				int64_t l;
+				if ((end - data) < (int)sizeof(l))
+					break;
+				memcpy(&l, data, sizeof(l));
+				data += sizeof(l);
+				value = pmt::from_long(l);
+				break;
+			}
+			case BTR_DOUBLE:
+			{
+				double d;
+				if ((end - data) < (int)sizeof(d))
+					break;
+				memcpy(&d, data, sizeof(d));
+				data += sizeof(d);
+				value = pmt::from_double(d);
+				break;
+			}
+			case BTR_TIME:
 			{
-				// Need to receive more data
+				uint64_t secs;
+				double frac;
+				if ((end - data) < (int)(sizeof(secs) + sizeof(frac)))
+					break;
+				memcpy(&secs, data, sizeof(secs));
+				memcpy(&frac, data + sizeof(secs), sizeof(frac));
+				data += sizeof(secs) + sizeof(frac);
+				value = pmt::make_tuple(pmt::from_uint64(secs), pmt::from_double(frac));
+				break;
+			}
+			case BTR_TRUE:
+				value = pmt::PMT_T;
+				break;
+			case BTR_FALSE:
+				value = pmt::PMT_F;
+				break;
+			case BTR_PMT:
+			{
+				uint32_t value_length;
+				if ((end - data) < (int)sizeof(value_length))
+					break;
+				memcpy(&value_length, data, sizeof(value_length));
+				if ((uint32_t)(end - data - sizeof(value_length)) < value_length)
+					break;
+				value = pmt::deserialize_str(std::string(data + sizeof(value_length), value_length));
+				data += sizeof(value_length) + value_length;
+				break;
 			}
 		}
-		else
+
+		if (!value)
 		{
-			// Need to receive more data
+			fprintf(stderr, "[%s<%li>] malformed compact tag (record %d, key %d)\n", name().c_str(), unique_id(), record, key);
+			return;
 		}
+
+		d_tags.push_back(std::make_pair(d_tag_keys[key], value));
 	}
 
+	if (data != end)
+		fprintf(stderr, "[%s<%li>] truncated compact tags packet\n", name().c_str(), unique_id());
+}
+
+int baz_tcp_source::work (int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+{
+	++d_work_count;
+
+	if (d_eos)
+		return -1;
+
 	////////////////////////////////////////////////////////////////////////////
 
 	if (d_client_socket == -1)
@@ -445,16 +659,16 @@ int baz_tcp_source::work (int noutput_items, gr_vector_const_void_star &input_it
 		// RCV_TIMEO doesn't work on all systems (e.g., Cygwin)
 		// use select() instead of, or in addition to RCV_TIMEO
 		fd_set readfds;
-		
+
 		timeval timeout;
 		timeout.tv_sec = 0;			// Init timeout each iteration.  Select can modify it.
 		timeout.tv_usec = 1000*10;	// MAGIC: 10 ms
-		
+
 		FD_ZERO(&readfds);
 		FD_SET(d_socket, &readfds);
-		
+
 		int r = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
-		
+
 		if (r < 0)
 		{
 			report_error("tcp_source/select", NULL);
@@ -465,15 +679,25 @@ int baz_tcp_source::work (int noutput_items, gr_vector_const_void_star &input_it
 			boost::this_thread::interruption_point();	// Allow boost thread interrupt, then try again
 			return 0;	// Was 'continue'
 		}
-		
+
 		d_client_socket = accept(d_socket, (struct sockaddr *)d_client_addr, &d_client_addr_len);
 		if (d_client_socket < 0)
 		{
 			report_error("tcp_source/accept", NULL);
 			return 0;
 		}
-		
+
 		fprintf(stderr, "[%s<%li>] accepted connection (socket: %d)\n", name().c_str(), unique_id(), d_client_socket);
+
+		// Let the sender know whether it may use BT_TAGS_COMPACT (older senders never read this)
+		char caps_packet[sizeof(BOR_PACKET_HEADER) + sizeof(uint32_t)];
+		PBOR_PACKET_HEADER caps_header = (PBOR_PACKET_HEADER)caps_packet;
+		caps_header->type = BT_CAPS;
+		caps_header->flags = BF_NONE;
+		caps_header->length = sizeof(uint32_t);
+		uint32_t caps = ((d_temp_buff_size >= BT_TAGS_COMPACT_MAX) ? BC_COMPACT_TAGS : BC_NONE);
+		memcpy(caps_packet + sizeof(BOR_PACKET_HEADER), &caps, sizeof(caps));
+		send(d_client_socket, caps_packet, sizeof(caps_packet), 0);
 #endif // USE_SELECT
 	}
 
@@ -483,142 +707,176 @@ int baz_tcp_source::work (int noutput_items, gr_vector_const_void_star &input_it
 	printf("\nEntered tcp_source\n");
 #endif
 
-	// Can only get here if there are NO samples to be copied
-	int free_buffer_space = d_temp_buff_size - d_temp_buff_used;
-	if (free_buffer_space > 0)
+	// Payload bytes are written straight into 'out' (either received there directly,
+	// or drained from the staging ring if they arrived together with a header).
+	// A partial item left over from the last call is placed at the front.
+
+	char *out = (char*)output_items[0];
+	int capacity = noutput_items * d_itemsize;
+
+	if (d_item_used > 0)
+		memcpy(out, d_item_buff, d_item_used);
+	int out_bytes = d_item_used;
+	d_item_used = 0;
+
+	bool received = false;
+	bool connected = true;
+
+	while (true)
 	{
-//fprintf(stderr, "."); fflush(stderr);
-#if USE_SELECT
-		// RCV_TIMEO doesn't work on all systems (e.g., Cygwin)
-		// use select() instead of, or in addition to RCV_TIMEO
-		fd_set readfds;
-	
-		timeval timeout;
-		timeout.tv_sec = 0;			// Init timeout each iteration.  Select can modify it.
-		timeout.tv_usec = 1000*10;	// 10 ms
-	
-		FD_ZERO(&readfds);
-		FD_SET(d_client_socket, &readfds);
-	
-		int r = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
-		if (r < 0)
+		// Drain the staging ring
+
+		while (d_ring_used > 0)
 		{
-			report_error("tcp_source/select", NULL);
-			//return -1;
-			
-			disconnect_client();
-			
-			return 0;
+			if (d_packet_type == BT_NONE)
+			{
+				if (parse_header() == false)
+					break;
+			}
+			else if (d_packet_type == BT_DATA)
+			{
+				int to_copy = std::min(std::min(d_packet_length - d_packet_offset, d_ring_used), capacity - out_bytes);
+				if (to_copy == 0)
+					break;
+
+				if (d_new_tags)
+					break;	// Apply below
+
+				int first = std::min(to_copy, d_temp_buff_size - d_ring_head);
+				memcpy(out + out_bytes, d_temp_buff + d_ring_head, first);
+				if (first < to_copy)
+					memcpy(out + out_bytes + first, d_temp_buff, to_copy - first);
+				ring_skip(to_copy);
+
+				out_bytes += to_copy;
+				d_packet_offset += to_copy;
+			}
+			else if (((d_packet_type == BT_TAGS) || (d_packet_type == BT_TAGS_COMPACT)) && (d_packet_length <= d_temp_buff_size))
+			{
+				if (d_ring_used < d_packet_length)
+					break;
+
+				parse_tags();
+			}
+			else	// Unknown, or oversized tags
+			{
+				int to_skip = std::min(d_packet_length - d_packet_offset, d_ring_used);
+				ring_skip(to_skip);
+				d_packet_offset += to_skip;
+			}
+
+			if ((d_packet_type != BT_NONE) && (d_packet_offset == d_packet_length))
+			{
+				d_packet_type = BT_NONE;
+				d_packet_length = 0;
+				d_packet_offset = 0;
+			}
 		}
-		else if (r == 0)	// timed out
+
+		if ((d_packet_type == BT_DATA) && d_new_tags)
 		{
-//fprintf(stderr, "_"); fflush(stderr);
-			boost::this_thread::interruption_point();	// Allow boost thread interrupt, then try again
-			
-			// Free buffer space, but no data yet available
-			// Might be:
-			//	- in a data packet
-			//	- in a tag packet (assumption is it'll fit in the temp buffer)
-			//	- parsing a new packet header
-//fprintf(stderr, "[%s<%i>] timed out (%d bytes remaining in buffer)\n", name().c_str(), unique_id(), data_remaining_in_buffer);
-			if (data_remaining_in_buffer == 0)
-				return 0;
+			if (d_tags.empty() == false)
+			{
+				const uint64_t offset = nitems_written(0) + (out_bytes / d_itemsize);
+				const pmt::pmt_t srcid(pmt::mp(alias()));
+
+				for(size_t i = 0; i < d_tags.size(); i++)
+					add_item_tag(0, offset, d_tags[i].first, d_tags[i].second, srcid);
+			}
+
+			d_new_tags = false;
+
+			continue;	// Resume draining with tags applied
 		}
-		
-		r = recv(d_client_socket, d_temp_buff + d_temp_buff_used, free_buffer_space, 0);
+
+		if (out_bytes == capacity)
+			break;
+
+		// Wait for the first chunk, then only take what is immediately available
+
+		int r = wait_for_data(received ? 0 : 1000*10);	// MAGIC: 10 ms
 		if (r < 0)
 		{
-			report_error("tcp_source/recv", NULL);
-			//return -1;
-			
+			report_error("tcp_source/select", NULL);
+
 			disconnect_client();
-			
-			return 0;
+			connected = false;
+
+			break;
 		}
-		else if (r == 0)
+		else if (r == 0)	// timed out
 		{
-//fprintf(stderr, "!"); fflush(stderr);
-			fprintf(stderr, "[%s<%li>] recv returned 0 - disconnecting client\n", name().c_str(), unique_id());
-			
-			disconnect_client();
-			
-			return 0;
+			if (received == false)
+				boost::this_thread::interruption_point();	// Allow boost thread interrupt, then try again
+
+			break;
 		}
-		
-//fprintf(stderr, "[%s<%i>] received %d bytes\n", name().c_str(), unique_id(), r);
-		
-		d_temp_buff_used += r;
-	}
-#endif // USE_SELECT
 
-	while ((d_temp_buff_used - d_temp_offset) > 0)
-	{
-//fprintf(stderr, "[%s<%i>] work %d, in parse loop (temp buff usage: %d) packet type: %d\n", name().c_str(), unique_id(), d_work_count, d_temp_buff_used, d_packet_type);
-		if (d_packet_type == BT_NONE)
+		received = true;
+
+		if ((d_packet_type == BT_DATA) && (d_ring_used == 0))
 		{
-			assert(d_temp_offset == 0);
-			
-			if (d_temp_buff_used < sizeof(BOR_PACKET_HEADER))
-				return 0;
-			
-			PBOR_PACKET_HEADER pHeader = (PBOR_PACKET_HEADER)d_temp_buff;
-			
-			d_packet_type = pHeader->type;
-			assert(d_packet_type & BT_VALID);
-			
-			d_packet_length = pHeader->length;
-			assert(d_packet_length >= 0);
-			
-			if (d_packet_length == 0)
-			{
-				assert(pHeader->flags & BF_EMPTY_PAYLOAD);
-				d_packet_type = BT_NONE;
-			}
-			else
+			int to_recv = std::min(d_packet_length - d_packet_offset, capacity - out_bytes);
+
+			r = recv(d_client_socket, out + out_bytes, to_recv, 0);
+			if (r > 0)
 			{
-				assert((pHeader->flags & BF_EMPTY_PAYLOAD) != BF_EMPTY_PAYLOAD);
+				out_bytes += r;
+				d_packet_offset += r;
+				d_bytes_direct += r;
+
+				if (d_packet_offset == d_packet_length)
+				{
+					d_packet_type = BT_NONE;
+					d_packet_length = 0;
+					d_packet_offset = 0;
+				}
 			}
-			
-			d_temp_buff_used -= sizeof(BOR_PACKET_HEADER);
-			if (d_temp_buff_used > 0)
-				memmove(d_temp_buff, d_temp_buff + sizeof(BOR_PACKET_HEADER), d_temp_buff_used);
-			//d_temp_offset is 0
 		}
-		else if (d_packet_type == BT_DATA)
+		else
 		{
-			assert(d_packet_length > 0);
-			
-			return 0;	// Process data up top
+			if (d_ring_used == d_temp_buff_size)
+				break;	// Output is full and ring holds the rest
+
+			// Stage what the current header/tags need plus a little read-ahead, so small packets
+			// are batched while the bulk of a large payload is left for a direct receive
+			int needed = sizeof(BOR_PACKET_HEADER);
+			if (d_packet_type != BT_NONE)
+				needed = d_packet_length - d_packet_offset;
+
+			r = ring_recv(std::max(needed - d_ring_used, 0) + STAGING_READAHEAD);
 		}
-		else if (d_packet_type == BT_TAGS)
+
+		if (r < 0)
 		{
-			assert(d_temp_offset == 0);
-			
-			assert(d_packet_length <= d_temp_buff_size);	// FIXME: Gracefully skip
-			
-			data_remaining_in_buffer = d_temp_buff_used - d_temp_offset;
-			
-			if (data_remaining_in_buffer < d_packet_length)
-				return 0;
-			
-			std::string tag_str((const char*)(d_temp_buff + d_temp_offset), d_packet_length);
-			d_tags = pmt::deserialize_str(tag_str);
-			d_new_tags = true;
-			
-			d_temp_buff_used -= d_packet_length;
-			if (d_temp_buff_used > 0)
-				memmove(d_temp_buff, d_temp_buff + d_packet_length, d_temp_buff_used);
-			//d_temp_offset is 0
-			
-			d_packet_type = BT_NONE;
+			report_error("tcp_source/recv", NULL);
+
+			disconnect_client();
+			connected = false;
+
+			break;
 		}
-		else
+		else if (r == 0)
 		{
-			assert(false);
+			fprintf(stderr, "[%s<%li>] recv returned 0 - disconnecting client\n", name().c_str(), unique_id());
+
+			disconnect_client();
+			connected = false;
+
+			break;
 		}
 	}
 
-	return (d_eos ? -1 : 0);
+	int produced = out_bytes / d_itemsize;
+
+	if (connected)
+	{
+		d_item_used = out_bytes - (produced * d_itemsize);
+		if (d_item_used > 0)
+			memcpy(d_item_buff, out + (produced * d_itemsize), d_item_used);
+	}
+
+	return (d_eos ? -1 : produced);
 }
 
 // Return port number of d_socket
@@ -32,6 +32,7 @@ typedef ptrdiff_t ssize_t;
 #endif
 
 #include <stdio.h>
+#include <vector>
 
 class BAZ_API baz_tcp_source;
 typedef boost::shared_ptr<baz_tcp_source> baz_tcp_source_sptr;
@@ -48,7 +49,7 @@ BAZ_API baz_tcp_source_sptr baz_make_tcp_source(size_t itemsize, const char *hos
  *                     interface on the host
  * \param port         The port number on which to receive data; use 0 to
  *                     have the system assign an unused port number
- * \param buffer_size  TCP receiver buffer size
+ * \param buffer_size  Staging buffer size for packet headers and tags (compact tags are only accepted if it holds at least 4096 bytes)
  * \param verbose      Output BorIP packet debug messages (helpful to judge packet loss)
  *
 */
@@ -61,11 +62,12 @@ private:
 	size_t	d_itemsize;
 	//bool d_wait;          // wait if data if not immediately available
 	int d_socket;        // handle to socket
-	char *d_temp_buff;    // hold buffer between calls
+	char *d_temp_buff;    // staging ring for headers and tag blobs
 	int d_temp_buff_size;
-	int d_temp_buff_used;
-	//ssize_t d_residual;   // hold information about number of bytes stored in the temp buffer
-	int d_temp_offset; // point to temp buffer location offset
+	int d_ring_head;      // read position in staging ring
+	int d_ring_used;      // bytes held in staging ring
+	char *d_item_buff;    // partial item carried between calls
+	int d_item_used;
 	bool d_verbose;
 	bool d_eos;
 	int d_client_socket;
@@ -75,10 +77,21 @@ private:
 	int d_packet_type;
 	int d_packet_length;
 	int d_packet_offset;
-	pmt::pmt_t d_tags;
+	std::vector<std::pair<pmt::pmt_t, pmt::pmt_t> > d_tags;	// applied to the next data
 	bool d_new_tags;
+	std::vector<pmt::pmt_t> d_tag_keys;	// BT_TAGS_COMPACT keys defined on this connection
+	std::vector<char> d_tag_buff;
 	int d_work_count;
+	unsigned long long d_bytes_direct;
+	unsigned long long d_bytes_staged;
 	
+	void ring_peek(char* dest, int length);
+	void ring_skip(int length);
+	int ring_recv(int limit);
+	bool parse_header();
+	void parse_tags();
+	void decode_tags(const char* data, int length);
+	int wait_for_data(int timeout_us);
 	void disconnect_client();
 
 protected:
@@ -91,7 +104,7 @@ protected:
    *                     interface on the host
    * \param port         The port number on which to receive data; use 0 to
    *                     have the system assign an unused port number
-   * \param buffer_size  TCP receiver buffer size
+   * \param buffer_size  Staging buffer size for packet headers and tags (compact tags are only accepted if it holds at least 4096 bytes)
    * \param verbose      Output BorIP packet debug messages (helpful to judge packet loss)
    */
   baz_tcp_source(size_t itemsize, const char *host, unsigned short port, int buffer_size, bool verbose);
@@ -104,6 +117,9 @@ public:
 
 	void signal_eos();
 
+	unsigned long long bytes_direct() const { return d_bytes_direct; }
+	unsigned long long bytes_staged() const { return d_bytes_staged; }
+
 	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items);
 };
 
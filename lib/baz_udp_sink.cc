@@ -42,6 +42,10 @@
 #include <sys/socket.h>  //usually included by <netdb.h>?
 #endif
 typedef void* optval_t;
+#if defined(HAVE_SENDMMSG)
+#include <sys/uio.h>
+#include <netinet/udp.h>  // UDP_SEGMENT, where the headers are new enough
+#endif // HAVE_SENDMMSG
 #elif defined(HAVE_WINDOWS_H)
 // if not posix, assume winsock
 #define NOMINMAX
@@ -54,6 +58,10 @@ typedef void* optval_t;
 typedef char* optval_t;
 #endif
 
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif // MSG_DONTWAIT
+
 #include <gnuradio/thread/thread.h>
 
 #define SNK_VERBOSE 0
@@ -135,17 +143,34 @@ static void report_error( const char *msg1, const char *msg2 )
 
 UDP_SINK_NAME::UDP_SINK_NAME (size_t itemsize, 
 			  const char *host, unsigned short port,
-			  int payload_size, bool eof, bool bor)
+			  int payload_size, bool eof, bool bor, int batch_size)
   : gr::sync_block ("udp_sink",
 		   gr::io_signature::make (1, 1, itemsize),
 		   gr::io_signature::make (0, 0, 0)),
     d_itemsize (itemsize), d_payload_size(0), d_eof(eof),
     d_socket(-1), d_connected(false), d_bor(false),
 	d_bor_counter(0), d_bor_first(false), d_bor_packet(NULL), d_residual(0), d_offset(0),
-	d_data_length(0)
+	d_data_length(0), d_batch_size(std::max(batch_size, 0)), d_gso(false),
+	d_msgs(NULL), d_iovecs(NULL), d_batch_headers(NULL)
 {
   set_payload_size(payload_size);
   set_borip(bor);
+
+  if (d_batch_size > 0) {
+#if defined(HAVE_SENDMMSG)
+    d_msgs = new struct mmsghdr[d_batch_size];
+    d_iovecs = new struct iovec[2 * d_batch_size];
+    d_batch_headers = new unsigned char[sizeof(BOR_PACKET_HEADER) * d_batch_size];
+    memset(d_msgs, 0x00, sizeof(struct mmsghdr) * d_batch_size);
+#ifdef UDP_SEGMENT
+    d_gso = true;  // Dropped on the first failure (old kernel, or segment larger than the path MTU)
+#endif // UDP_SEGMENT
+    fprintf(stderr, "[UDP Sink \"%s (%ld)\"] Batch size: %d (%s)\n", name().c_str(), unique_id(), d_batch_size, (d_gso ? "GSO" : "sendmmsg"));
+#else
+    fprintf(stderr, "[UDP Sink \"%s (%ld)\"] Batched send not available, batch size %d ignored\n", name().c_str(), unique_id(), d_batch_size);
+    d_batch_size = 0;
+#endif // HAVE_SENDMMSG
+  }
 #if defined(USING_WINSOCK) // for Windows (with MinGW)
   // initialize winsock DLL
   WSADATA wsaData;
@@ -236,11 +261,11 @@ void UDP_SINK_NAME::destroy()
 UDP_SINK_SPTR
 UDP_SINK_MAKER (size_t itemsize, 
 		  const char *host, unsigned short port,
-		  int payload_size, bool eof, bool bor)
+		  int payload_size, bool eof, bool bor, int batch_size)
 {
   return gnuradio::get_initial_sptr(new UDP_SINK_NAME (itemsize, 
 					    host, port,
-					    payload_size, eof, bor));
+					    payload_size, eof, bor, batch_size));
 }
 
 void UDP_SINK_NAME::set_borip(bool enable)
@@ -284,6 +309,7 @@ void UDP_SINK_NAME::set_payload_size(int payload_size)
 
 UDP_SINK_NAME::~UDP_SINK_NAME ()
 {
+  clear_destinations();
   destroy();
 
 #if defined(USING_WINSOCK) // for Windows (with MinGW)
@@ -293,6 +319,191 @@ UDP_SINK_NAME::~UDP_SINK_NAME ()
 
   if (d_bor_packet != NULL)
 	delete [] d_bor_packet;
+
+#if defined(HAVE_SENDMMSG)
+  delete [] d_msgs;
+  delete [] d_iovecs;
+#endif // HAVE_SENDMMSG
+  delete [] d_batch_headers;
+}
+
+#define GSO_MAX_SEGMENTS  64     // UDP_MAX_SEGMENTS in the kernel
+#define GSO_MAX_BYTES     65507  // Largest UDP payload over IPv4
+
+// Send the first 'n' messages prepared in d_msgs/d_iovecs. Returns the number sent, or -1 (errno set).
+// 'gso' belongs to the destination: a path that cannot take GSO does not turn it off for the others.
+int UDP_SINK_NAME::transmit(int socket, bool& gso, int n, int flags)
+{
+#if defined(HAVE_SENDMMSG)
+#ifdef UDP_SEGMENT
+  if (gso) {
+	// One datagram per header+payload pair: the kernel splits the concatenation every packet_size bytes
+	const int iov_per_packet = (d_bor ? 2 : 1);
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	struct msghdr msg;
+	memset(&msg, 0x00, sizeof(msg));
+	msg.msg_iov = d_iovecs;
+	msg.msg_iovlen = n * iov_per_packet;
+	if (n > 1) {
+	  memset(control, 0x00, sizeof(control));
+	  msg.msg_control = control;
+	  msg.msg_controllen = sizeof(control);
+	  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	  cmsg->cmsg_level = IPPROTO_UDP;
+	  cmsg->cmsg_type = UDP_SEGMENT;
+	  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	  *((uint16_t*)CMSG_DATA(cmsg)) = (d_bor ? offsetof(BOR_PACKET, data) : 0) + d_payload_size;
+	}
+
+	if (sendmsg(socket, &msg, flags) >= 0)
+	  return n;
+
+	if ((is_error(EIO) == 0) && (is_error(EINVAL) == 0) && (is_error(ENOPROTOOPT) == 0) && (is_error(EOPNOTSUPP) == 0))
+	  return -1;
+
+	fprintf(stderr, "[UDP Sink \"%s (%ld)\"] GSO unavailable (%s), using sendmmsg%s\n", name().c_str(), unique_id(), strerror(errno), ((socket == d_socket) ? "" : " for extra destination"));
+	gso = false;
+  }
+#endif // UDP_SEGMENT
+  return sendmmsg(socket, d_msgs, n, flags);
+#else
+  return -1;
+#endif // HAVE_SENDMMSG
+}
+
+// Copy of the first 'n' prepared messages to every extra destination. Never blocks: what does not fit is dropped.
+void UDP_SINK_NAME::fan_out_batch(int n)
+{
+  for (size_t i = 0; i < d_destinations.size(); ++i) {
+	destination& dest = d_destinations[i];
+	int r = transmit(dest.socket, dest.gso, n, MSG_DONTWAIT);
+	r = std::max(r, 0);
+	dest.packets += r;
+	dest.drops += (n - r);
+  }
+}
+
+// Wait (interruptibly) for room in the primary socket's send buffer: it is sent to without blocking, so a stop request still gets through
+void UDP_SINK_NAME::wait_writable()
+{
+  fd_set writefds;
+  timeval timeout;
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  FD_ZERO(&writefds);
+  FD_SET(d_socket, &writefds);
+  select(FD_SETSIZE, NULL, &writefds, NULL, &timeout);
+  boost::this_thread::interruption_point();
+}
+
+// Send 'count' full packets straight from the input buffer (payloads are not copied)
+// Returns the number of packets sent or discarded, or -1 on error.
+int UDP_SINK_NAME::send_batch(const char *in, int count)
+{
+#if defined(HAVE_SENDMMSG)
+  const int header_size = (d_bor ? offsetof(BOR_PACKET, data) : 0);
+  const int packet_size = header_size + d_payload_size;
+  int status_flags = 0;
+  int sent = 0;
+  bool refused = false;  // Receiver not started: the rest of this batch is discarded for the primary (extra destinations still get it)
+
+  if (d_bor && d_status_queue) {
+	while (d_status_queue->empty_p() == false) {
+	  gr::message::sptr msg = d_status_queue->delete_head();
+	  fprintf(stderr, "[UDP Sink \"%s (%ld)\"] Received status: 0x%02lx\n", name().c_str(), unique_id(), msg->type());
+	  status_flags |= msg->type();
+	}
+  }
+
+  bool gso = d_gso;  // Keep each call within what a GSO destination can take
+  for (size_t i = 0; i < d_destinations.size(); ++i)
+	gso |= d_destinations[i].gso;
+
+  while (sent < count) {
+	int n = std::min(count - sent, d_batch_size);
+	if (gso)
+	  n = std::min(n, std::max(1, std::min(GSO_MAX_SEGMENTS, (GSO_MAX_BYTES / packet_size))));
+
+	int iov_count = 0;
+	for (int i = 0; i < n; ++i) {
+	  struct iovec* iov = d_iovecs + iov_count;
+	  int k = 0;
+	  if (d_bor) {
+		PBOR_PACKET_HEADER header = (PBOR_PACKET_HEADER)(d_batch_headers + (i * sizeof(BOR_PACKET_HEADER)));
+		header->notification = 0;
+		header->flags = 0;
+		if (i == 0) {
+		  header->flags = (d_bor_first ? BF_STREAM_START : 0) | status_flags;
+		}
+		header->idx = (USHORT)(d_bor_counter + i);
+		iov[k].iov_base = header;
+		iov[k].iov_len = header_size;
+		++k;
+	  }
+	  iov[k].iov_base = (void*)(in + ((sent + i) * d_payload_size));
+	  iov[k].iov_len = d_payload_size;
+	  ++k;
+	  d_msgs[i].msg_hdr.msg_iov = iov;
+	  d_msgs[i].msg_hdr.msg_iovlen = k;
+	  iov_count += k;
+	}
+
+	int r = n;  // discarded for lack of connection
+	if ((d_connected) && (refused == false)) {
+	  r = transmit(d_socket, d_gso, n, MSG_DONTWAIT);
+	  if ((r == -1) && (is_error(EAGAIN))) {
+		wait_writable();
+		continue;  // Nothing went out: try again with the same messages
+	  }
+	  if ((r == -1) && (is_error(ECONNREFUSED))) {
+		refused = true;
+		r = n;  // discard data until receiver is started
+	  }
+	}
+
+	if (r > 0)
+	  fan_out_batch(r);
+
+	if (r == -1) {
+	  report_error("udp_sink",NULL);
+	  return -1;
+	}
+
+	if (d_bor) {
+	  d_bor_counter += r;
+	  d_bor_first = false;
+	  status_flags = 0;
+	}
+
+	sent += r;
+  }
+
+  return sent;
+#else
+  return -1;
+#endif // HAVE_SENDMMSG
+}
+
+// Send one packet to every extra destination (without blocking), then to the primary one
+int UDP_SINK_NAME::send_packet(const char *data, int length)
+{
+  for (size_t i = 0; i < d_destinations.size(); ++i) {
+	destination& dest = d_destinations[i];
+	if (send(dest.socket, data, length, MSG_DONTWAIT) == length)
+	  ++dest.packets;
+	else
+	  ++dest.drops;
+  }
+
+  if (d_connected == false)
+	return length;  // discarded for lack of connection
+
+  while (true) {
+	int r = send(d_socket, data, length, MSG_DONTWAIT);
+	if ((r != -1) || (is_error(EAGAIN) == 0))
+	  return r;
+	wait_writable();
+  }
 }
 
 int 
@@ -337,7 +548,16 @@ UDP_SINK_NAME::work (int noutput_items,
 	
 	assert(bytes_to_send == d_payload_size);
 	
-    if (d_connected) {
+	if (((d_connected) || (d_destinations.empty() == false)) && (d_batch_size > 0) && (d_residual == 0)) {
+	  int count = (total_size - bytes_sent) / d_payload_size;
+	  r = send_batch((in + std::max(0, bytes_sent - prev_residual)), count);
+	  if (r == -1)
+		return -1;
+	  bytes_sent += (r * d_payload_size);
+	  continue;
+	}
+	
+    if ((d_connected) || (d_destinations.empty() == false)) {
 	  if (d_bor) {
 //if (d_residual != 0) fprintf(stderr, "[UDP Sink \"%s (%ld)\"] > Total size: %i, To send: %i, Sent: %i, Residual: %i, Prev residual: %i\n", name().c_str(), unique_id(), total_size, bytes_to_send, bytes_sent, d_residual, prev_residual);
 		PBOR_PACKET packet = (PBOR_PACKET)d_bor_packet;
@@ -361,7 +581,7 @@ UDP_SINK_NAME::work (int noutput_items,
 		//assert((d_residual + (bytes_to_send - d_residual)) == d_payload_size);
 		memcpy(packet->data + d_residual, (in + std::max(0, bytes_sent - prev_residual)), (bytes_to_send - d_residual));
 		
-		r = send(d_socket, (char*)packet, (offsetof(BOR_PACKET, data) + bytes_to_send), 0);
+		r = send_packet((char*)packet, (offsetof(BOR_PACKET, data) + bytes_to_send));
 		if (r > 0)
 		  r -= offsetof(BOR_PACKET, data);
 		
@@ -377,10 +597,10 @@ UDP_SINK_NAME::work (int noutput_items,
 		  
 		  memcpy(d_bor_packet + d_residual, (in + std::max(0, bytes_sent - prev_residual)), (bytes_to_send - d_residual));
 		  
-		  r = send(d_socket, (char*)d_bor_packet, bytes_to_send, 0);
+		  r = send_packet((char*)d_bor_packet, bytes_to_send);
 		}
 		else
-		  r = send(d_socket, (in + std::max(0, bytes_sent - prev_residual)), bytes_to_send, 0);
+		  r = send_packet((in + std::max(0, bytes_sent - prev_residual)), bytes_to_send);
 	  }
 	  
       if (r == -1) {         // error on send command
@@ -533,3 +753,139 @@ void UDP_SINK_NAME::disconnect()
 
   d_connected = false;
 }
+
+void UDP_SINK_NAME::add_destination(const char *host, unsigned short port)
+{
+  if ((host == NULL) || (host[0] == '\0'))
+	return;
+
+  gr::thread::scoped_lock guard(d_mutex);  // protect d_destinations from work()
+
+  for (size_t i = 0; i < d_destinations.size(); ++i) {
+	if ((d_destinations[i].host == host) && (d_destinations[i].port == port))
+	  return;
+  }
+
+  struct addrinfo *ip_dst;
+  struct addrinfo hints;
+  memset( (void*)&hints, 0, sizeof(hints) );
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  char port_str[12];
+  sprintf( port_str, "%d", port );
+
+  int ret = getaddrinfo( host, port_str, &hints, &ip_dst );
+  if ( ret != 0 ) {
+	char error_msg[1024];
+	snprintf(error_msg, sizeof(error_msg), "[UDP Sink \"%s (%ld)\"] getaddrinfo(%s:%d) - %s\n", name().c_str(), unique_id(), host, port, gai_strerror(ret));
+	report_error(error_msg, error_msg);
+  }
+
+  // Own socket per destination, so ICMP errors and a full send buffer stay with it
+  destination dest;
+  dest.host = host;
+  dest.port = port;
+  dest.packets = 0;
+  dest.drops = 0;
+#ifdef UDP_SEGMENT
+  dest.gso = (d_batch_size > 0);  // Dropped on its first failure, as for the primary
+#else
+  dest.gso = false;
+#endif // UDP_SEGMENT
+  dest.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (dest.socket == -1) {
+	freeaddrinfo(ip_dst);
+	report_error("socket open","can't create socket");
+  }
+
+  int requested_send_buff_size = 1024 * 1024;
+  setsockopt(dest.socket, SOL_SOCKET, SO_SNDBUF, (optval_t)&requested_send_buff_size, sizeof(int));  // best effort
+
+  if (::connect(dest.socket, ip_dst->ai_addr, ip_dst->ai_addrlen) == -1) {
+	freeaddrinfo(ip_dst);
+#if defined(USING_WINSOCK)
+	closesocket(dest.socket);
+#else
+	::close(dest.socket);
+#endif
+	report_error("socket connect", "can't connect to socket");
+  }
+
+  freeaddrinfo(ip_dst);
+
+  d_destinations.push_back(dest);
+
+  fprintf(stderr, "[UDP Sink \"%s (%ld)\"] Added destination: %s:%d (%d extra)\n", name().c_str(), unique_id(), host, port, (int)d_destinations.size());
+}
+
+void UDP_SINK_NAME::close_destination(destination& dest)
+{
+  if ((d_bor) && (d_bor_first == false)) {
+    BOR_PACKET_HEADER end_packet;
+    memset(&end_packet, 0x00, sizeof(end_packet));
+    end_packet.flags = BF_STREAM_END | BF_EMPTY_PAYLOAD;
+    end_packet.idx = d_bor_counter;  // Not consumed: the stream carries on elsewhere
+    
+    send(dest.socket, (char*)&end_packet, sizeof(end_packet), MSG_DONTWAIT);
+  }
+
+  if (d_eof) {
+    for (int i = 0; i < 3; i++)
+      (void) send(dest.socket, NULL, 0, MSG_DONTWAIT);  // ignore errors
+  }
+
+  shutdown(dest.socket, SHUT_RDWR);
+#if defined(USING_WINSOCK)
+  closesocket(dest.socket);
+#else
+  ::close(dest.socket);
+#endif
+  dest.socket = -1;
+
+  fprintf(stderr, "[UDP Sink \"%s (%ld)\"] Removed destination: %s:%d (%llu packets, %llu dropped)\n", name().c_str(), unique_id(), dest.host.c_str(), dest.port, (unsigned long long)dest.packets, (unsigned long long)dest.drops);
+}
+
+void UDP_SINK_NAME::remove_destination(const char *host, unsigned short port)
+{
+  if (host == NULL)
+	return;
+
+  gr::thread::scoped_lock guard(d_mutex);
+
+  for (std::vector<destination>::iterator it = d_destinations.begin(); it != d_destinations.end(); ++it) {
+	if ((it->host == host) && (it->port == port)) {
+	  close_destination(*it);
+	  d_destinations.erase(it);
+	  return;
+	}
+  }
+}
+
+void UDP_SINK_NAME::clear_destinations()
+{
+  gr::thread::scoped_lock guard(d_mutex);
+
+  for (size_t i = 0; i < d_destinations.size(); ++i)
+	close_destination(d_destinations[i]);
+
+  d_destinations.clear();
+}
+
+int UDP_SINK_NAME::destination_count()
+{
+  gr::thread::scoped_lock guard(d_mutex);
+
+  return (int)d_destinations.size();
+}
+
+uint64_t UDP_SINK_NAME::destination_drops()
+{
+  gr::thread::scoped_lock guard(d_mutex);
+
+  uint64_t drops = 0;
+  for (size_t i = 0; i < d_destinations.size(); ++i)
+	drops += d_destinations[i].drops;
+
+  return drops;
+}
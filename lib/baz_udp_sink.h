@@ -48,6 +48,11 @@
 #include <gnuradio/sync_block.h>
 #include <gnuradio/msg_queue.h>
 #include <gnuradio/thread/thread.h>
+#include <string>
+#include <vector>
+
+struct mmsghdr;
+struct iovec;
 
 class BAZ_API UDP_SINK_NAME;
 typedef boost::shared_ptr<UDP_SINK_NAME> UDP_SINK_SPTR;
@@ -55,7 +60,7 @@ typedef boost::shared_ptr<UDP_SINK_NAME> UDP_SINK_SPTR;
 BAZ_API UDP_SINK_SPTR
 UDP_SINK_MAKER (size_t itemsize, 
 		  const char *host, unsigned short port,
-		  int payload_size=1472, bool eof=true, bool bor=false);
+		  int payload_size=1472, bool eof=true, bool bor=false, int batch_size=0);
 
 /*!
  * \brief Write stream to an UDP socket.
@@ -68,6 +73,8 @@ UDP_SINK_MAKER (size_t itemsize,
  * \param payload_size UDP payload size by default set to 1472 =
  *                     (1500 MTU - (8 byte UDP header) - (20 byte IP header))
  * \param eof          Send zero-length packet on disconnect
+ * \param batch_size   Maximum packets handed to the kernel per call using
+ *                     UDP GSO or sendmmsg (0: one send per packet)
  */
 
 class BAZ_API UDP_SINK_NAME : public gr::sync_block
@@ -75,7 +82,7 @@ class BAZ_API UDP_SINK_NAME : public gr::sync_block
   friend BAZ_API UDP_SINK_SPTR UDP_SINK_MAKER (size_t itemsize, 
 					    const char *host,
 					    unsigned short port,
-					    int payload_size, bool eof, bool bor);
+					    int payload_size, bool eof, bool bor, int batch_size);
  private:
   size_t	d_itemsize;
 
@@ -92,6 +99,20 @@ class BAZ_API UDP_SINK_NAME : public gr::sync_block
   int           d_offset;
   int           d_data_length;
   gr::msg_queue::sptr d_status_queue;
+  int           d_batch_size;      // packets per sendmmsg/GSO call (0: disabled)
+  bool          d_gso;             // UDP GSO still believed to work (primary destination)
+  struct mmsghdr* d_msgs;
+  struct iovec* d_iovecs;          // two per packet: header, payload
+  unsigned char* d_batch_headers;  // BorIP headers for the packets in flight
+  struct destination {
+    std::string host;
+    unsigned short port;
+    int socket;
+    uint64_t packets;
+    uint64_t drops;                // not sent because its socket was busy or refused
+    bool gso;                      // UDP GSO still believed to work for this destination
+  };
+  std::vector<destination> d_destinations;  // extra copies of the stream
 
  protected:
   /*!
@@ -105,14 +126,21 @@ class BAZ_API UDP_SINK_NAME : public gr::sync_block
    *                     1472 = (1500 MTU - (8 byte UDP header) - (20 byte IP header))
    * \param eof          Send zero-length packet on disconnect
    * \param bor          Enable BorIP encapsulation
+   * \param batch_size   Maximum packets per GSO/sendmmsg call (0: one send per packet)
    */
   UDP_SINK_NAME (size_t itemsize, 
 	       const char *host, unsigned short port,
-	       int payload_size, bool eof, bool bor);
+	       int payload_size, bool eof, bool bor, int batch_size);
   
   bool create();
   void allocate();
   void destroy();
+  int send_batch(const char *in, int count);
+  int transmit(int socket, bool& gso, int n, int flags);
+  void wait_writable();
+  void fan_out_batch(int n);
+  int send_packet(const char *data, int length);
+  void close_destination(destination& dest);
 
  public:
   ~UDP_SINK_NAME ();
@@ -140,6 +168,21 @@ class BAZ_API UDP_SINK_NAME : public gr::sync_block
   void set_borip(bool enable);
   void set_payload_size(int payload_size);
   void set_status_msgq(gr::msg_queue::sptr queue);
+  /*! \brief Also send the stream to another host
+   *
+   * Packets are built once and sent to every destination. Extra
+   * destinations never block the sink: packets that do not fit in their
+   * socket buffer are dropped (see destination_drops()).
+   */
+  void add_destination(const char *host, unsigned short port);
+  /*! \brief Stop sending to an extra destination (sends EOF if enabled) */
+  void remove_destination(const char *host, unsigned short port);
+  void clear_destinations();
+  int destination_count();
+  uint64_t destination_drops();
+
+  int batch_size() const { return d_batch_size; }
+  bool gso() const { return d_gso; }
 
   int work (int noutput_items,
 	    gr_vector_const_void_star &input_items,
@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 
 #if defined(HAVE_NETDB_H)
 #include <netdb.h>
@@ -51,6 +52,9 @@ typedef void* optval_t;
 #if defined(HAVE_ARPA_INET_H)
 #include <arpa/inet.h>
 #endif
+#if defined(HAVE_RECVMMSG)
+#include <sys/uio.h>
+#endif
 
 #elif defined(HAVE_WINDOWS_H)
 // if not posix, assume winsock
@@ -132,6 +136,8 @@ enum BorFlags
 #define USE_RCV_TIMEO 0  // non-blocking receive on all but Cygwin
 #define SRC_VERBOSE 0
 
+static const pmt::pmt_t RX_GAP_KEY = pmt::string_to_symbol("rx_gap");
+
 static int is_error( int perr )
 {
   // Compare error to posix error code; return nonzero if match.
@@ -172,22 +178,60 @@ static void report_error( const char *msg1, const char *msg2 )
 
 UDP_SOURCE_NAME::UDP_SOURCE_NAME(size_t itemsize, const char *host, 
 			     unsigned short port, int payload_size,
-			     bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode)
+			     bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode, int batch_size, int reorder_window)
   : gr::sync_block ("udp_source",
 		   gr::io_signature::make(0, 0, 0),
 		   gr::io_signature::make(1, 1, itemsize)),
     d_itemsize(itemsize), d_payload_size(payload_size),
     d_eof(eof), d_wait(wait), d_socket(-1), d_residual(0), d_temp_offset(0),
 	d_bor(bor), d_verbose(verbose), d_bor_counter(0), d_bor_first(false),
-	d_eos(false), d_mode((UDPProtocol)mode)
+	d_eos(false), d_mode((UDPProtocol)mode), d_header_size(0),
+	d_batch_size(std::max(batch_size, 0)), d_msgs(NULL), d_iovecs(NULL), d_batch_headers(NULL),
+	d_batches(0), d_batch_datagrams(0), d_batch_bytes(0), d_batch_max(0), d_batch_last(0),
+	d_reorder_window(std::max(reorder_window, 0)), d_reorder_buff(NULL),
+	d_reorder_head(0), d_reorder_span(0), d_reorder_offset(0), d_reorder_next(0), d_reorder_started(false),
+	d_stage_buff(NULL), d_stage_pos(0), d_stage_count(0),
+	d_reorder_lost(0), d_reorder_reordered(0), d_reorder_duplicates(0), d_reorder_late(0)
 {
   if (d_mode == UP_COMPAT)
     d_mode = (bor ? UP_BORIP : UP_RAW);
 
   if (d_mode == UP_BORIP)
-    d_payload_size += sizeof(BOR_PACKET_HEADER);
+    d_header_size = sizeof(BOR_PACKET_HEADER);
   else if (d_mode == UP_ATA)
-    d_payload_size += sizeof(ATA_PACKET_HEADER);
+    d_header_size = sizeof(ATA_PACKET_HEADER);
+
+  d_payload_size += d_header_size;
+
+#if defined(HAVE_RECVMMSG)
+  if (d_batch_size > 0) {
+    // One extra message lands in d_temp_buff to pick up a datagram that straddles the end of the output buffer
+    d_msgs = new struct mmsghdr[d_batch_size + 1];
+    d_iovecs = new struct iovec[2 * (d_batch_size + 1)];
+    d_batch_headers = new char[std::max(d_header_size * d_batch_size, 1)];
+    memset(d_msgs, 0x00, sizeof(struct mmsghdr) * (d_batch_size + 1));
+  }
+#else
+  if (d_batch_size > 0) {
+    fprintf(stderr, UDP_SOURCE_STRING ": recvmmsg not available, batch size %d ignored\n", d_batch_size);
+    d_batch_size = 0;
+  }
+#endif // HAVE_RECVMMSG
+
+  if (d_reorder_window > 0) {
+    if ((d_mode != UP_BORIP) && (d_mode != UP_ATA)) {
+      fprintf(stderr, UDP_SOURCE_STRING ": reorder window needs BorIP or ATA sequence numbers, ignored\n");
+      d_reorder_window = 0;
+    }
+    else {
+      d_reorder_buff = new char[d_reorder_window * (d_payload_size - d_header_size)];
+      d_reorder_len.assign(d_reorder_window, -1);
+      d_reorder_prev_seq.assign(d_reorder_window, 0);
+      d_reorder_prev_recv.assign(d_reorder_window, false);
+      d_stage_buff = new char[std::max(d_batch_size, 1) * d_payload_size];
+      d_stage_len.assign(std::max(d_batch_size, 1), 0);
+    }
+  }
   
   int ret = 0;
 
@@ -292,15 +336,32 @@ UDP_SOURCE_NAME::UDP_SOURCE_NAME(size_t itemsize, const char *host,
 
 UDP_SOURCE_SPTR
 UDP_SOURCE_MAKER (size_t itemsize, const char *ipaddr, 
-		    unsigned short port, int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode)
+		    unsigned short port, int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode, int batch_size, int reorder_window)
 {
   return gnuradio::get_initial_sptr(new UDP_SOURCE_NAME (itemsize, ipaddr, 
-						port, payload_size, eof, wait, bor, verbose, buf_size, mode));
+						port, payload_size, eof, wait, bor, verbose, buf_size, mode, batch_size, reorder_window));
 }
 
 UDP_SOURCE_NAME::~UDP_SOURCE_NAME ()
 {
+  if ((d_verbose) && (d_batches > 0)) {
+    fprintf(stderr, UDP_SOURCE_STRING ": %llu batches, %llu datagrams (%.1f avg, %d max), %llu bytes\n",
+      (unsigned long long)d_batches, (unsigned long long)d_batch_datagrams, batch_average(), d_batch_max, (unsigned long long)d_batch_bytes);
+  }
+
+  if ((d_verbose) && (d_reorder_window > 0)) {
+    fprintf(stderr, UDP_SOURCE_STRING ": packets lost %llu, reordered %llu, duplicated %llu, late %llu\n",
+      (unsigned long long)d_reorder_lost, (unsigned long long)d_reorder_reordered, (unsigned long long)d_reorder_duplicates, (unsigned long long)d_reorder_late);
+  }
+
   delete [] d_temp_buff;
+#if defined(HAVE_RECVMMSG)
+  delete [] d_msgs;
+  delete [] d_iovecs;
+#endif // HAVE_RECVMMSG
+  delete [] d_batch_headers;
+  delete [] d_reorder_buff;
+  delete [] d_stage_buff;
 
   if (d_socket != -1){
     shutdown(d_socket, SHUT_RDWR);
@@ -324,6 +385,89 @@ UDP_SOURCE_NAME::signal_eos() {
   d_eos = true;
 }
 
+void
+UDP_SOURCE_NAME::check_header(const char *header, ssize_t recvd)
+{
+  if (recvd != d_payload_size) {
+    if (d_verbose)
+      fprintf(stderr, "Received size %d != payload %d\n", (int)recvd, d_payload_size);
+    else
+      fprintf(stderr, "b!");
+  }
+  else {
+      if (d_mode == UP_BORIP) {
+  		  PBOR_PACKET_HEADER pHeader = (PBOR_PACKET_HEADER)header;
+  		  if (pHeader->flags & BF_HARDWARE_OVERRUN) {
+  			 fprintf(stderr, "uO");
+  		  }
+
+  		  if (pHeader->flags & BF_STREAM_START) {
+  			 fprintf(stderr, "Stream start (%d)\n", (int)pHeader->idx);
+  			if (d_bor_first)
+  			  d_bor_first = false;
+  		  }
+
+  		  if (pHeader->idx != d_bor_counter) {
+    			if (d_bor_first == false) {
+    			  if ((pHeader->flags & BF_STREAM_START) == 0) {
+    			    fprintf(stderr, "First packet (%d)\n", (int)pHeader->idx);
+    			  }
+    			  d_bor_first = true;
+    			}
+    			else {
+    			  if (d_verbose)
+    				  fprintf(stderr, "Dropped %03d packets: %05d -> %05d\n", (int)(pHeader->idx - d_bor_counter), (int)d_bor_counter, (int)pHeader->idx);
+    			  else
+    				  fprintf(stderr, "bO");
+    			}
+
+    			d_bor_counter = pHeader->idx;
+  		  }
+
+  		  d_bor_counter = ((unsigned short)d_bor_counter) + 1;
+      }
+      else if (d_mode == UP_ATA) {
+        PATA_PACKET_HEADER pHeader = (PATA_PACKET_HEADER)header;
+
+        if (pHeader->seq != d_bor_counter) {
+          if (d_bor_first == false) {
+            /*for (int i = 0; i < sizeof(ATA_PACKET_HEADER); ++i)
+              printf("%02x", (int)*((unsigned char*)pHeader + i));
+            printf("\n");*/
+            // For some reason anything after 'reserved' uses prior data in the struct, and so the wrong variables are printed
+            // FIXME: Accidentally left 'seq' in 'fprintf' valist - was this the cause?! Need to re-test...
+            fprintf(stderr, "ATA: group: %d, version: %d, bitsPerSample: %d, binaryPoint: %d, order: %u, type: %d, streams: %d, polCode: %d, hdrLen: %d, src: %u, chan: %u, freq: %f, sampleRate: %f, usableFraction: %f, reserved: %f\n",//, flags: %x, len: %u\n",
+              (int)pHeader->group, (int)pHeader->version, (int)pHeader->bitsPerSample, (int)pHeader->binaryPoint,
+  pHeader->order,
+  (int)pHeader->type, (int)pHeader->streams, (int)pHeader->polCode, (int)pHeader->hdrLen,
+  pHeader->src,
+  pHeader->chan,
+  // pHeader->seq, // Not printed above
+  pHeader->freq,
+  pHeader->sampleRate,
+  pHeader->usableFraction,
+  pHeader->reserved);/*,
+  (unsigned long long)pHeader->absTime,
+  pHeader->flags,
+  pHeader->len);*/
+            fprintf(stderr, "ATA: absTime: %llu, flags: %08x, len: %u\n", pHeader->absTime, pHeader->flags, pHeader->len);
+            d_bor_first = true;
+          }
+          else {
+            if (d_verbose)
+              fprintf(stderr, "Dropped %03lu packets: %05lu -> %05u\n", (pHeader->seq - d_bor_counter), d_bor_counter, pHeader->seq);
+            else
+              fprintf(stderr, "bO");
+          }
+
+          d_bor_counter = pHeader->seq;
+        }
+
+        ++d_bor_counter;
+      }
+  }
+}
+
 int 
 UDP_SOURCE_NAME::work (int noutput_items,
 		     gr_vector_const_void_star &input_items,
@@ -336,6 +480,9 @@ UDP_SOURCE_NAME::work (int noutput_items,
   ssize_t r=0, nbytes=0, bytes_received=0;
   ssize_t total_bytes = (ssize_t)(d_itemsize*noutput_items);
 
+  if (d_reorder_window > 0)
+    return work_reorder(out, total_bytes);
+
   #if SRC_VERBOSE
   printf("\nEntered udp_source\n");
   #endif
@@ -363,6 +510,9 @@ UDP_SOURCE_NAME::work (int noutput_items,
     return nbytes/d_itemsize;
   }
 
+  if (d_batch_size > 0)
+    return work_batch(out, total_bytes);
+
   while(1) {
     // get the data into our output buffer and record the number of bytes
 
@@ -407,6 +557,12 @@ UDP_SOURCE_NAME::work (int noutput_items,
 	  else {
 		r = (r/d_itemsize) * d_itemsize;
 	  }
+
+    if (r < 0) {  // Shorter than the header: report and drop it
+      check_header(d_temp_buff, recvd);
+      boost::this_thread::interruption_point();
+      continue;
+    }
     }
 
     // Check if there was a problem; forget it if the operation just timed out
@@ -449,86 +605,9 @@ UDP_SOURCE_NAME::work (int noutput_items,
 
 	  int offset = 0;
 	  if ((d_mode == UP_BORIP) || (d_mode == UP_ATA)) {
-		if (recvd != d_payload_size) {
-		  if (d_verbose)
-			fprintf(stderr, "Received size %d != payload %d\n", recvd, d_payload_size);
-		  else
-			fprintf(stderr, "b!");
-		}
-		else {
-      if (d_mode == UP_BORIP) {
-  		  PBOR_PACKET_HEADER pHeader = (PBOR_PACKET_HEADER)d_temp_buff;
-  		  if (pHeader->flags & BF_HARDWARE_OVERRUN) {
-  			 fprintf(stderr, "uO");
-  		  }
-
-  		  if (pHeader->flags & BF_STREAM_START) {
-  			 fprintf(stderr, "Stream start (%d)\n", (int)pHeader->idx);
-  			if (d_bor_first)
-  			  d_bor_first = false;
-  		  }
-
-  		  if (pHeader->idx != d_bor_counter) {
-    			if (d_bor_first == false) {
-    			  if ((pHeader->flags & BF_STREAM_START) == 0) {
-    			    fprintf(stderr, "First packet (%d)\n", (int)pHeader->idx);
-    			  }
-    			  d_bor_first = true;
-    			}
-    			else {
-    			  if (d_verbose)
-    				  fprintf(stderr, "Dropped %03d packets: %05d -> %05d\n", (int)(pHeader->idx - d_bor_counter), (int)d_bor_counter, (int)pHeader->idx);
-    			  else
-    				  fprintf(stderr, "bO");
-    			}
-
-    			d_bor_counter = pHeader->idx;
-  		  }
-
-  		  d_bor_counter = ((unsigned short)d_bor_counter) + 1;
-  		  offset = sizeof(BOR_PACKET_HEADER);
-      }
-      else if (d_mode == UP_ATA) {
-        PATA_PACKET_HEADER pHeader = (PATA_PACKET_HEADER)d_temp_buff;
-
-        if (pHeader->seq != d_bor_counter) {
-          if (d_bor_first == false) {
-            /*for (int i = 0; i < sizeof(ATA_PACKET_HEADER); ++i)
-              printf("%02x", (int)*((unsigned char*)pHeader + i));
-            printf("\n");*/
-            // For some reason anything after 'reserved' uses prior data in the struct, and so the wrong variables are printed
-            // FIXME: Accidentally left 'seq' in 'fprintf' valist - was this the cause?! Need to re-test...
-            fprintf(stderr, "ATA: group: %d, version: %d, bitsPerSample: %d, binaryPoint: %d, order: %u, type: %d, streams: %d, polCode: %d, hdrLen: %d, src: %u, chan: %u, freq: %f, sampleRate: %f, usableFraction: %f, reserved: %f\n",//, flags: %x, len: %u\n",
-              (int)pHeader->group, (int)pHeader->version, (int)pHeader->bitsPerSample, (int)pHeader->binaryPoint,
-  pHeader->order,
-  (int)pHeader->type, (int)pHeader->streams, (int)pHeader->polCode, (int)pHeader->hdrLen,
-  pHeader->src,
-  pHeader->chan,
-  // pHeader->seq, // Not printed above
-  pHeader->freq,
-  pHeader->sampleRate,
-  pHeader->usableFraction,
-  pHeader->reserved);/*,
-  (unsigned long long)pHeader->absTime,
-  pHeader->flags,
-  pHeader->len);*/
-            fprintf(stderr, "ATA: absTime: %llu, flags: %08x, len: %u\n", pHeader->absTime, pHeader->flags, pHeader->len);
-            d_bor_first = true;
-          }
-          else {
-            if (d_verbose)
-              fprintf(stderr, "Dropped %03lu packets: %05lu -> %05u\n", (pHeader->seq - d_bor_counter), d_bor_counter, pHeader->seq);
-            else
-              fprintf(stderr, "bO");
-          }
-
-          d_bor_counter = pHeader->seq;
-        }
-
-        ++d_bor_counter;
-        offset = sizeof(ATA_PACKET_HEADER);
-      }
-		}
+		check_header(d_temp_buff, recvd);
+		if (recvd == d_payload_size)
+		  offset = d_header_size;
 	  }
 	  
       // Calculate the number of bytes we can take from the buffer in this call
@@ -566,6 +645,448 @@ UDP_SOURCE_NAME::work (int noutput_items,
   return (d_eos ? -1 : bytes_received/d_itemsize);
 }
 
+int
+UDP_SOURCE_NAME::work_batch(char *out, ssize_t total_bytes)
+{
+#if defined(HAVE_RECVMMSG)
+  // Whole datagrams are scattered straight into the output buffer (headers go to d_batch_headers).
+  // If there is room left over, one more datagram goes into d_temp_buff and is split via d_residual.
+  const ssize_t data_size = d_payload_size - d_header_size;
+  const int direct = (int)std::min((ssize_t)d_batch_size, total_bytes / data_size);
+  int count = direct;
+
+  for (int i = 0; i < direct; ++i) {
+    struct iovec *iov = d_iovecs + (2 * i);
+    int n = 0;
+    if (d_header_size > 0) {
+      iov[n].iov_base = d_batch_headers + (i * d_header_size);
+      iov[n].iov_len = d_header_size;
+      ++n;
+    }
+    iov[n].iov_base = out + (i * data_size);
+    iov[n].iov_len = data_size;
+    ++n;
+    d_msgs[i].msg_hdr.msg_iov = iov;
+    d_msgs[i].msg_hdr.msg_iovlen = n;
+  }
+
+  if ((direct < d_batch_size) && (total_bytes > (direct * data_size))) {
+    struct iovec *iov = d_iovecs + (2 * direct);
+    iov[0].iov_base = d_temp_buff;
+    iov[0].iov_len = d_payload_size;
+    d_msgs[direct].msg_hdr.msg_iov = iov;
+    d_msgs[direct].msg_hdr.msg_iovlen = 1;
+    ++count;
+  }
+
+  ssize_t bytes_received = 0;
+  bool eof = false;
+
+  while ((bytes_received == 0) && (eof == false)) {
+#if USE_SELECT
+    fd_set readfds;
+    timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    FD_ZERO(&readfds);
+    FD_SET(d_socket, &readfds);
+    int r = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
+    if (r < 0) {
+      report_error("udp_source/select",NULL);
+      return -1;
+    }
+    else if (r == 0) {  // timed out
+      if (d_wait) {
+        boost::this_thread::interruption_point();
+        continue;
+      }
+      else
+        return -1;
+    }
+#endif // USE_SELECT
+
+#ifdef MSG_WAITFORONE
+    int received = recvmmsg(d_socket, d_msgs, count, MSG_WAITFORONE, NULL);
+#else
+    int received = recvmmsg(d_socket, d_msgs, count, MSG_DONTWAIT, NULL);
+#endif // MSG_WAITFORONE
+    if (received == -1) {
+      if ((is_error(EAGAIN)) || (is_error(EINTR))) {
+        if (d_wait) {
+          boost::this_thread::interruption_point();
+          continue;
+        }
+        else
+          return -1;
+      }
+      else {
+        report_error("udp_source/recvmmsg",NULL);
+        return -1;
+      }
+    }
+
+    ++d_batches;
+    d_batch_datagrams += received;
+    d_batch_last = received;
+    d_batch_max = std::max(d_batch_max, received);
+
+    for (int i = 0; i < received; ++i) {
+      ssize_t recvd = d_msgs[i].msg_len;
+      d_batch_bytes += recvd;
+
+      const char *header = ((i < direct) ? (d_batch_headers + (i * d_header_size)) : d_temp_buff);
+      if ((d_mode == UP_BORIP) || (d_mode == UP_ATA))
+        check_header(header, recvd);
+
+      // Same rules as the single datagram path: shorter than the header is dropped (already reported above),
+      // and any other short datagram is taken as-is from its first byte (no header is stripped from it)
+      ssize_t len = recvd - d_header_size;
+      if (len < 0)
+        continue;
+      len -= (len % d_itemsize);
+
+      if (len == 0) {
+        if (recvd == d_header_size) {  // zero-length payload
+          if (d_eof) {
+            // Hand out what arrived before it; anything after it in this batch is past the end of the stream
+            if ((d_verbose) && (i < (received - 1)))
+              fprintf(stderr, "Discarding %d datagrams received after EOF\n", (received - 1 - i));
+            eof = true;
+            break;
+          }
+        }
+        continue;
+      }
+
+      const ssize_t offset = ((recvd == d_payload_size) ? d_header_size : 0);
+
+      if (i < direct) {
+        char *p = out + (i * data_size);
+        if (offset == 0) {
+          // The datagram's first bytes were scattered into the header buffer: put them back in front of the rest
+          const ssize_t head = std::min((ssize_t)d_header_size, len);
+          if (len > head)
+            memmove(out + bytes_received + head, p, len - head);
+          memcpy(out + bytes_received, header, head);
+        }
+        else if (p != (out + bytes_received))  // close the gap left by a short datagram
+          memmove(out + bytes_received, p, len);
+        bytes_received += len;
+      }
+      else {
+        ssize_t nbytes = std::min(len, total_bytes - bytes_received);
+        nbytes -= (nbytes % d_itemsize);
+        memcpy(out + bytes_received, d_temp_buff + offset, nbytes);
+        d_residual = len - nbytes;
+        d_temp_offset = offset + nbytes;
+        bytes_received += nbytes;
+      }
+    }
+
+    boost::this_thread::interruption_point();
+  }
+
+  if (eof) {
+    if (bytes_received == 0)
+      return -1;
+    d_eos = true; // Deliver what arrived before the EOF packet first
+  }
+
+  return bytes_received / d_itemsize;
+#else
+  return -1;
+#endif // HAVE_RECVMMSG
+}
+
+#define REORDER_RESYNC_FACTOR 16  // jumps beyond this many windows are treated as a stream restart
+
+uint32_t
+UDP_SOURCE_NAME::sequence(const char *header) const
+{
+  if (d_mode == UP_BORIP)
+    return ((PBOR_PACKET_HEADER)header)->idx;
+  return ((PATA_PACKET_HEADER)header)->seq;
+}
+
+int32_t
+UDP_SOURCE_NAME::sequence_delta(uint32_t seq) const
+{
+  if (d_mode == UP_BORIP)
+    return (int16_t)(uint16_t)(seq - d_reorder_next);  // BorIP index is 16-bit
+  return (int32_t)(seq - d_reorder_next);
+}
+
+// Forget what the window holds and expect 'seq' next (the old stream's sequence no longer applies)
+void
+UDP_SOURCE_NAME::restart_reorder(uint32_t seq)
+{
+  d_reorder_len.assign(d_reorder_window, -1);
+  d_reorder_prev_recv.assign(d_reorder_window, false);
+  d_reorder_span = 0;
+  d_reorder_offset = 0;
+  d_reorder_next = seq;
+}
+
+int
+UDP_SOURCE_NAME::receive_stage()
+{
+#if USE_SELECT
+  fd_set readfds;
+  timeval timeout;
+  timeout.tv_sec = 1;
+  timeout.tv_usec = 0;
+  FD_ZERO(&readfds);
+  FD_SET(d_socket, &readfds);
+  int r = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
+  if (r < 0) {
+    report_error("udp_source/select",NULL);
+    return -1;
+  }
+  else if (r == 0)
+    return 0;
+#endif // USE_SELECT
+
+  int count = 1;
+#if defined(HAVE_RECVMMSG)
+  if (d_batch_size > 0) {
+    for (int i = 0; i < d_batch_size; ++i) {
+      struct iovec *iov = d_iovecs + (2 * i);
+      iov->iov_base = d_stage_buff + (i * d_payload_size);
+      iov->iov_len = d_payload_size;
+      d_msgs[i].msg_hdr.msg_iov = iov;
+      d_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#ifdef MSG_WAITFORONE
+    count = recvmmsg(d_socket, d_msgs, d_batch_size, MSG_WAITFORONE, NULL);
+#else
+    count = recvmmsg(d_socket, d_msgs, d_batch_size, MSG_DONTWAIT, NULL);
+#endif // MSG_WAITFORONE
+    if (count == -1) {
+      if ((is_error(EAGAIN)) || (is_error(EINTR)))
+        return 0;
+      report_error("udp_source/recvmmsg",NULL);
+      return -1;
+    }
+
+    ++d_batches;
+    d_batch_datagrams += count;
+    d_batch_last = count;
+    d_batch_max = std::max(d_batch_max, count);
+
+    for (int i = 0; i < count; ++i) {
+      d_stage_len[i] = d_msgs[i].msg_len;
+      d_batch_bytes += d_msgs[i].msg_len;
+    }
+  }
+  else
+#endif // HAVE_RECVMMSG
+  {
+    ssize_t recvd = recv(d_socket, d_stage_buff, d_payload_size, 0);
+    if (recvd == -1) {
+      if (is_error(EAGAIN))
+        return 0;
+      report_error("udp_source/recv",NULL);
+      return -1;
+    }
+    d_stage_len[0] = recvd;
+  }
+
+  d_stage_pos = 0;
+  d_stage_count = count;
+
+  return count;
+}
+
+// Output (part of) the head slot, zero-filling it if the packet never arrived. Returns true once the slot is released.
+bool
+UDP_SOURCE_NAME::emit_head(char *out, ssize_t &produced, ssize_t total_bytes)
+{
+  const ssize_t data_size = d_payload_size - d_header_size;
+  const ssize_t held = d_reorder_len[d_reorder_head];
+  const ssize_t len = ((held >= 0) ? held : (data_size - (data_size % d_itemsize)));
+  const ssize_t nbytes = std::min(len - d_reorder_offset, total_bytes - produced);
+
+  if (held >= 0) {
+    memcpy(out + produced, d_reorder_buff + (d_reorder_head * data_size) + d_reorder_offset, nbytes);
+  }
+  else {
+    if (d_reorder_offset == 0) {
+      ++d_reorder_lost;
+      add_item_tag(0, nitems_written(0) + (produced / d_itemsize), RX_GAP_KEY, pmt::from_long(len / d_itemsize));
+      if (d_verbose)
+        fprintf(stderr, "Lost packet %05u\n", d_reorder_next);
+      else
+        fprintf(stderr, "bL");
+    }
+    memset(out + produced, 0x00, nbytes);
+  }
+
+  produced += nbytes;
+  d_reorder_offset += nbytes;
+
+  if (d_reorder_offset < len)
+    return false;
+
+  d_reorder_prev_seq[d_reorder_head] = d_reorder_next;
+  d_reorder_prev_recv[d_reorder_head] = (held >= 0);
+  d_reorder_len[d_reorder_head] = -1;
+  d_reorder_head = (d_reorder_head + 1) % d_reorder_window;
+  d_reorder_next = ((d_mode == UP_BORIP) ? (uint16_t)(d_reorder_next + 1) : (d_reorder_next + 1));
+  d_reorder_span = std::max(d_reorder_span - 1, 0);
+  d_reorder_offset = 0;
+
+  return true;
+}
+
+void
+UDP_SOURCE_NAME::place_stage(const char *datagram, ssize_t len, int d)
+{
+  const ssize_t data_size = d_payload_size - d_header_size;
+  const int slot = (d_reorder_head + d) % d_reorder_window;
+
+  if (d_reorder_len[slot] >= 0) {
+    ++d_reorder_duplicates;
+    return;
+  }
+
+  if ((d + 1) < d_reorder_span)
+    ++d_reorder_reordered;
+
+  memcpy(d_reorder_buff + (slot * data_size), datagram + d_header_size, len);
+  d_reorder_len[slot] = len;
+  d_reorder_span = std::max(d_reorder_span, d + 1);
+}
+
+int
+UDP_SOURCE_NAME::work_reorder(char *out, ssize_t total_bytes)
+{
+  ssize_t produced = 0;
+  bool eof = false;
+
+  while (true) {
+    // Whatever is already in sequence at the head of the window
+    while ((produced < total_bytes) && ((d_reorder_len[d_reorder_head] >= 0) || (d_reorder_offset > 0)))
+      emit_head(out, produced, total_bytes);
+
+    while (d_stage_pos < d_stage_count) {
+      const char *datagram = d_stage_buff + (d_stage_pos * d_payload_size);
+      const ssize_t recvd = d_stage_len[d_stage_pos];
+      ssize_t len = recvd - d_header_size;
+
+      if (len == 0) {
+        if (d_eof) {
+          // Hand out everything still held before signalling EOF
+          while ((produced < total_bytes) && ((d_reorder_span > 0) || (d_reorder_offset > 0)))
+            emit_head(out, produced, total_bytes);
+          if ((d_reorder_span > 0) || (d_reorder_offset > 0))
+            break;
+          eof = true;
+        }
+        ++d_stage_pos;
+        if (eof)
+          break;
+        continue;
+      }
+
+      if (recvd != d_payload_size) {
+        if (d_verbose)
+          fprintf(stderr, "Received size %d != payload %d\n", (int)recvd, d_payload_size);
+        else
+          fprintf(stderr, "b!");
+
+        if (len < 0) {
+          ++d_stage_pos;
+          continue;
+        }
+      }
+
+      if ((d_mode == UP_BORIP) && (((PBOR_PACKET_HEADER)datagram)->flags & BF_HARDWARE_OVERRUN))
+        fprintf(stderr, "uO");
+
+      const uint32_t seq = sequence(datagram);
+      if ((d_mode == UP_BORIP) && (((PBOR_PACKET_HEADER)datagram)->flags & BF_STREAM_START)) {
+        if (d_reorder_started) {
+          // Hand out what is still held from the old stream, then follow the new stream's sequence
+          while ((produced < total_bytes) && ((d_reorder_span > 0) || (d_reorder_offset > 0)))
+            emit_head(out, produced, total_bytes);
+          if ((d_reorder_span > 0) || (d_reorder_offset > 0))
+            break;  // Output is full, keep the datagram staged
+          restart_reorder(seq);
+        }
+        fprintf(stderr, "Stream start (%u)\n", seq);
+      }
+
+      if (d_reorder_started == false) {
+        fprintf(stderr, "First packet (%u)\n", seq);
+        d_reorder_next = seq;
+        d_reorder_started = true;
+      }
+
+      int d = sequence_delta(seq);
+
+      if ((d >= (d_reorder_window * REORDER_RESYNC_FACTOR)) || (d < -(d_reorder_window * REORDER_RESYNC_FACTOR))) {
+        fprintf(stderr, "Resynchronising: %05u -> %05u\n", d_reorder_next, seq);
+        restart_reorder(seq);
+        d = 0;
+      }
+
+      if (d < 0) {
+        // Its slot has been released: either already output or given up on
+        const int slot = (d_reorder_head + (d % d_reorder_window) + d_reorder_window) % d_reorder_window;
+        if ((d >= -d_reorder_window) && (d_reorder_prev_seq[slot] == seq) && (d_reorder_prev_recv[slot]))
+          ++d_reorder_duplicates;
+        else
+          ++d_reorder_late;
+        ++d_stage_pos;
+        continue;
+      }
+
+      // Beyond the window: give up on the oldest slots to make room
+      while ((d >= d_reorder_window) && (produced < total_bytes)) {
+        if (emit_head(out, produced, total_bytes))
+          --d;
+      }
+
+      if (d >= d_reorder_window)
+        break;  // Output is full, keep the datagram staged
+
+      place_stage(datagram, len - (len % d_itemsize), d);
+      ++d_stage_pos;
+
+      while ((produced < total_bytes) && ((d_reorder_len[d_reorder_head] >= 0) || (d_reorder_offset > 0)))
+        emit_head(out, produced, total_bytes);
+    }
+
+    if ((produced > 0) || (eof))
+      break;
+
+    int r = receive_stage();
+    if (r < 0)
+      return -1;
+    else if (r == 0) {  // timed out
+      if (d_wait == false)
+        return -1;
+
+      // Nothing more is coming for now, so stop waiting for the gaps in what is held
+      while ((produced < total_bytes) && (d_reorder_span > 0))
+        emit_head(out, produced, total_bytes);
+
+      boost::this_thread::interruption_point();
+
+      if (produced > 0)
+        break;
+    }
+  }
+
+  if (eof) {
+    if (produced == 0)
+      return -1;
+    d_eos = true;
+  }
+
+  return (produced / d_itemsize);
+}
+
 // Return port number of d_socket
 int UDP_SOURCE_NAME::get_port(void)
 {
@@ -43,7 +43,8 @@
 #ifndef _TO_STR
 #define _TO_STR(x)        #x
 #endif // _TO_STR
-#define UDP_SOURCE_STRING _TO_STR(UDP_SOURCE_NAME)
+#define _UDP_SOURCE_STR(x) _TO_STR(x)
+#define UDP_SOURCE_STRING _UDP_SOURCE_STR(UDP_SOURCE_NAME)
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #include <cstddef>
@@ -51,6 +52,10 @@ typedef ptrdiff_t ssize_t;
 #endif
 
 #include <stdio.h>
+#include <vector>
+
+struct mmsghdr;
+struct iovec;
 
 class BAZ_API UDP_SOURCE_NAME;
 typedef boost::shared_ptr<UDP_SOURCE_NAME> UDP_SOURCE_SPTR;
@@ -65,7 +70,7 @@ enum UDPProtocol {
 BAZ_API UDP_SOURCE_SPTR UDP_SOURCE_MAKER(size_t itemsize, const char *host, 
 						unsigned short port,
 						int payload_size=1472,
-						bool eof=true, bool wait=true, bool bor=false, bool verbose=false, size_t buf_size = 0, int mode = UP_COMPAT);
+						bool eof=true, bool wait=true, bool bor=false, bool verbose=false, size_t buf_size = 0, int mode = UP_COMPAT, int batch_size = 0, int reorder_window = 0);
 
 /*! 
  * \brief Read stream from an UDP socket.
@@ -82,7 +87,13 @@ BAZ_API UDP_SOURCE_SPTR UDP_SOURCE_MAKER(size_t itemsize, const char *host,
  * \param eof          Interpret zero-length packet as EOF (default: true)
  * \param wait         Wait for data if not immediately available
  *                     (default: true)
+ * \param batch_size   Maximum datagrams pulled per recvmmsg call
+ *                     (0: one recv per datagram)
+ * \param reorder_window Number of BorIP/ATA packets held to resequence
+ *                     late arrivals (0: disabled)
  *
+ * With a reorder window, gaps that do not close within the window are
+ * zero-filled and tagged 'rx_gap' (value: number of items filled).
 */
 
 class BAZ_API UDP_SOURCE_NAME : public gr::sync_block
@@ -91,7 +102,7 @@ class BAZ_API UDP_SOURCE_NAME : public gr::sync_block
 					       const char *host, 
 					       unsigned short port,
 					       int payload_size,
-					       bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode);
+					       bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode, int batch_size, int reorder_window);
 
  private:
   size_t	d_itemsize;
@@ -108,6 +119,45 @@ class BAZ_API UDP_SOURCE_NAME : public gr::sync_block
   bool			d_verbose;
   bool			d_eos;
   UDPProtocol d_mode;
+  int			d_header_size;   // BorIP/ATA header bytes at the start of each datagram
+  int			d_batch_size;    // datagrams per recvmmsg (0: disabled)
+  struct mmsghdr *d_msgs;
+  struct iovec *d_iovecs;        // two per message: header, payload
+  char *d_batch_headers;         // header landing area for direct-to-output messages
+  uint64_t		d_batches;
+  uint64_t		d_batch_datagrams;
+  uint64_t		d_batch_bytes;
+  int			d_batch_max;
+  int			d_batch_last;
+
+  int			d_reorder_window;      // packets (0: disabled)
+  char *d_reorder_buff;          // one payload per window slot
+  std::vector<ssize_t> d_reorder_len;       // bytes held per slot (-1: empty)
+  std::vector<uint32_t> d_reorder_prev_seq; // sequence last released from each slot
+  std::vector<bool> d_reorder_prev_recv;    // whether it had arrived or was zero-filled
+  int			d_reorder_head;        // slot of d_reorder_next
+  int			d_reorder_span;        // slots from head to the furthest packet held
+  ssize_t		d_reorder_offset;      // bytes of the head slot already output
+  uint32_t		d_reorder_next;        // sequence expected at the head
+  bool			d_reorder_started;
+  char *d_stage_buff;            // received datagrams not yet placed in the window
+  std::vector<ssize_t> d_stage_len;
+  int			d_stage_pos;
+  int			d_stage_count;
+  uint64_t		d_reorder_lost;
+  uint64_t		d_reorder_reordered;
+  uint64_t		d_reorder_duplicates;
+  uint64_t		d_reorder_late;
+
+  void check_header(const char *header, ssize_t recvd);
+  int work_batch(char *out, ssize_t total_bytes);
+  int work_reorder(char *out, ssize_t total_bytes);
+  int receive_stage();
+  bool emit_head(char *out, ssize_t &produced, ssize_t total_bytes);
+  void place_stage(const char *datagram, ssize_t len, int d);
+  uint32_t sequence(const char *header) const;
+  int32_t sequence_delta(uint32_t seq) const;
+  void restart_reorder(uint32_t seq);
 
  protected:
   /*!
@@ -126,9 +176,11 @@ class BAZ_API UDP_SOURCE_NAME : public gr::sync_block
    *                     (default: true)
    * \param bor          Enable BorIP encapsulation
    * \param verbose      Output BorIP packet debug messages (helpful to judge packet loss)
+   * \param batch_size   Maximum datagrams pulled per recvmmsg call (0: one recv per datagram)
+   * \param reorder_window Number of BorIP/ATA packets held to resequence late arrivals (0: disabled)
    */
   UDP_SOURCE_NAME(size_t itemsize, const char *host, unsigned short port,
-		int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode);
+		int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode, int batch_size, int reorder_window);
 
  public:
   ~UDP_SOURCE_NAME();
@@ -141,6 +193,22 @@ class BAZ_API UDP_SOURCE_NAME : public gr::sync_block
   
   void signal_eos();
 
+  /*! \brief batched receive statistics (all zero when batching is off) */
+  int batch_size() const { return d_batch_size; }
+  uint64_t batch_count() const { return d_batches; }
+  uint64_t batch_datagrams() const { return d_batch_datagrams; }
+  uint64_t batch_bytes() const { return d_batch_bytes; }
+  int batch_max() const { return d_batch_max; }
+  int batch_last() const { return d_batch_last; }
+  double batch_average() const { return (d_batches ? ((double)d_batch_datagrams / (double)d_batches) : 0.0); }
+
+  /*! \brief reorder window statistics (packets) */
+  int reorder_window() const { return d_reorder_window; }
+  uint64_t packets_lost() const { return d_reorder_lost; }
+  uint64_t packets_reordered() const { return d_reorder_reordered; }
+  uint64_t packets_duplicated() const { return d_reorder_duplicates; }
+  uint64_t packets_late() const { return d_reorder_late; }
+
   // should we export anything else?
 
   int work(int noutput_items,
@@ -0,0 +1,276 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2004 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <baz_correlator.h>
+#include <gnuradio/block_detail.h>
+#include <gnuradio/buffer.h>
+
+#include <boost/test/unit_test.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// The overlap-save path is not bit-identical to the time-domain loop (FFT rounding differs), so magnitudes are
+// compared within a tolerance. Peaks in the test input clear the threshold and their neighbours by a wide margin,
+// so every decision (where the search syncs, which template wins, where each window lands) must be identical.
+
+#define TEST_SAMP_RATE		1e6f
+#define TEST_SYMBOL_RATE	250e3f
+#define TEST_SYNC_LENGTH	127
+#define TEST_BURST_PERIOD	3000
+#define TEST_BURSTS			12
+#define TEST_NOISE			0.1f
+#define TEST_WIDTH			256
+#define TEST_SYNC_WINDOW	64
+#define TEST_MAX_CHUNK		4096
+#define TEST_BUFFER_ITEMS	(64 * 1024)
+#define TEST_TOLERANCE		(1e-5f * TEST_SYNC_LENGTH)	// Magnitudes are at most ~TEST_SYNC_LENGTH (unit-modulus sync)
+
+static const int CHUNKS[] = { 300, 1000, 4096, 131, 2048, 127, 777 };
+static const int OUTPUT_SPACE[] = { 4096, 64, 1000, 1, 500 };
+static const int SMALL_OUTPUT_SPACE[] = { 1, 2, 7, 3 };	// Held-back items take several calls to go out
+
+static float uniform()
+{
+	return ((float)rand() / (float)RAND_MAX);
+}
+
+static float gaussian()	// Box-Muller
+{
+	return (sqrtf(-2.0f * logf(std::max(uniform(), 1e-12f))) * cosf(2.0f * (float)M_PI * uniform()));
+}
+
+class sync_file
+{
+public:
+	sync_file(const std::vector<gr_complex>& sync)
+	{
+		char path[] = "/tmp/qa_baz_correlator_XXXXXX";
+		int fd = mkstemp(path);
+		BOOST_REQUIRE(fd > -1);
+		BOOST_REQUIRE_EQUAL(write(fd, &sync[0], sync.size() * sizeof(gr_complex)), (ssize_t)(sync.size() * sizeof(gr_complex)));
+		close(fd);
+		m_path = path;
+	}
+	~sync_file()
+	{ unlink(m_path.c_str()); }
+public:
+	inline const std::string& path() const
+	{ return m_path; }
+private:
+	std::string m_path;
+};
+
+struct correlator_under_test
+{
+	baz_correlator_sptr block;
+	gr::block_detail_sptr detail;
+	gr::buffer_reader_sptr readers[2];
+
+	correlator_under_test(baz_correlator_sptr correlator, int templates)
+		: block(correlator)
+	{
+		detail = gr::make_block_detail(1, 2);
+		detail->set_input(0, gr::buffer_add_reader(gr::make_buffer(TEST_BUFFER_ITEMS, sizeof(gr_complex)), 0));
+		for (int i = 0; i < 2; ++i)
+		{
+			gr::buffer_sptr buffer = gr::make_buffer(TEST_BUFFER_ITEMS, (sizeof(float) * ((i == 0) ? TEST_WIDTH : templates)));
+			detail->set_output(i, buffer);
+			readers[i] = gr::buffer_add_reader(buffer, 0);	// To read back tags
+		}
+		block->set_detail(detail);
+	}
+
+	std::vector<gr::tag_t> tags(int output, uint64_t start, uint64_t end)
+	{
+		std::vector<gr::tag_t> v;
+		readers[output]->get_tags_in_range(v, start, end, block->unique_id());
+		std::sort(v.begin(), v.end(), gr::tag_t::offset_compare);
+		return v;
+	}
+};
+
+static void check_close(const float* fft, const float* scalar, int count, const char* what, int call)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		if (fabsf(fft[i] - scalar[i]) > TEST_TOLERANCE)
+		{
+			char buffer[256];
+			snprintf(buffer, sizeof(buffer), "%s item %d (call %d): FFT %g, scalar %g (tolerance %g)", what, i, call, fft[i], scalar[i], TEST_TOLERANCE);
+			BOOST_FAIL(buffer);
+		}
+	}
+}
+
+static void check_tags(const std::vector<gr::tag_t>& fft, const std::vector<gr::tag_t>& scalar, const char* what, int call)
+{
+	BOOST_REQUIRE_MESSAGE(fft.size() == scalar.size(), what << " tag count differs in call " << call);
+	for (size_t i = 0; i < fft.size(); ++i)
+	{
+		BOOST_CHECK_EQUAL(fft[i].offset, scalar[i].offset);
+		BOOST_CHECK(pmt::equal(fft[i].key, scalar[i].key));
+		BOOST_CHECK(pmt::equal(fft[i].value, scalar[i].value));
+	}
+}
+
+// Bursts of template 'burst_template' (a sync file rotated by an offset) in noise, searched by a bank of all of them
+static void check_case(const std::vector<float>& freq_offsets, int burst_template, unsigned int seed, bool small_space = false)
+{
+	srand(seed);
+
+	std::vector<gr_complex> sync(TEST_SYNC_LENGTH);
+	for (int i = 0; i < TEST_SYNC_LENGTH; ++i)
+		sync[i] = gr_complex(((rand() & 1) ? 1.0f : -1.0f), ((rand() & 1) ? 1.0f : -1.0f)) * (float)M_SQRT1_2;	// QPSK
+
+	sync_file file(sync);
+	const std::vector<std::string> paths(1, file.path());
+	const int templates = std::max((size_t)1, freq_offsets.size());
+
+	std::vector<gr_complex> burst(sync);
+	if (freq_offsets.empty() == false)
+	{
+		const double phase_inc = 2.0 * M_PI * (double)freq_offsets[burst_template] / (double)TEST_SAMP_RATE;
+		for (int n = 0; n < TEST_SYNC_LENGTH; ++n)
+			burst[n] *= std::polar(1.0f, (float)fmod(phase_inc * n, 2.0 * M_PI));
+	}
+
+	std::vector<gr_complex> data(TEST_BURSTS * TEST_BURST_PERIOD);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = gr_complex(gaussian(), gaussian()) * TEST_NOISE;
+	int first_burst = -1;
+	for (int b = 0; b < TEST_BURSTS; ++b)
+	{
+		const int start = (TEST_BURST_PERIOD / 3) + (b * TEST_BURST_PERIOD) + (rand() % 16);
+		for (int n = 0; n < TEST_SYNC_LENGTH; ++n)
+			data[start + n] += burst[n];
+		if (first_burst == -1)
+			first_burst = start;
+	}
+
+	const float threshold = 0.5f * TEST_SYNC_LENGTH;
+	correlator_under_test fft(baz_make_correlator_bank(TEST_SAMP_RATE, TEST_SYMBOL_RATE, TEST_BURST_PERIOD, threshold, TEST_WIDTH,
+		paths, TEST_SYNC_LENGTH, 0, TEST_SYNC_WINDOW, freq_offsets, 1), templates);
+	correlator_under_test scalar(baz_make_correlator_bank(TEST_SAMP_RATE, TEST_SYMBOL_RATE, TEST_BURST_PERIOD, threshold, TEST_WIDTH,
+		paths, TEST_SYNC_LENGTH, 0, TEST_SYNC_WINDOW, freq_offsets, 0), templates);
+
+	// Output 0 is written one magnitude per item (not per float of its 'width' vector), so both are sized per item
+	std::vector<float> out[2], corr[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		out[i].resize(TEST_MAX_CHUNK);
+		corr[i].resize(TEST_MAX_CHUNK * templates);
+	}
+
+	const int chunk_count = (int)(sizeof(CHUNKS) / sizeof(CHUNKS[0]));
+	const int* spaces = (small_space ? SMALL_OUTPUT_SPACE : OUTPUT_SPACE);
+	const int space_count = (small_space ? (int)(sizeof(SMALL_OUTPUT_SPACE) / sizeof(SMALL_OUTPUT_SPACE[0])) : (int)(sizeof(OUTPUT_SPACE) / sizeof(OUTPUT_SPACE[0])));
+	int pos = 0, stalled = 0, syncs = 0;
+	for (int call = 0; (pos < (int)data.size()) && (stalled < (chunk_count * space_count)); ++call)	// Until input stops being consumed
+	{
+		int n = std::min(CHUNKS[call % chunk_count], (int)data.size() - pos);
+		int space = spaces[call % space_count];
+
+		uint64_t written[2][2], read[2];
+		int produced[2][2], consumed[2];
+		correlator_under_test* const runs[2] = { &fft, &scalar };
+		for (int r = 0; r < 2; ++r)
+		{
+			correlator_under_test& c = *runs[r];
+			for (int o = 0; o < 2; ++o)
+				written[r][o] = c.detail->output(o)->nitems_written();
+			read[r] = c.detail->input(0)->nitems_read();
+
+			gr_vector_int ninput_items(1, n);
+			gr_vector_const_void_star input_items(1, &data[pos]);
+			gr_vector_void_star output_items(2);
+			output_items[0] = &out[r][0];
+			output_items[1] = &corr[r][0];
+
+			BOOST_REQUIRE_EQUAL(c.block->general_work(space, ninput_items, input_items, output_items), (int)gr::block::WORK_CALLED_PRODUCE);
+
+			for (int o = 0; o < 2; ++o)
+				produced[r][o] = (int)(c.detail->output(o)->nitems_written() - written[r][o]);
+			consumed[r] = (int)(c.detail->input(0)->nitems_read() - read[r]);
+
+			BOOST_REQUIRE_LE(produced[r][1], space);
+		}
+
+		BOOST_REQUIRE_EQUAL(read[0], read[1]);
+		BOOST_REQUIRE_EQUAL(consumed[0], consumed[1]);	// The search stops just past the peak: same peak index
+		BOOST_REQUIRE_EQUAL(produced[0][0], produced[1][0]);
+		BOOST_REQUIRE_EQUAL(produced[0][1], produced[1][1]);
+
+		check_close(&out[0][0], &out[1][0], produced[0][0], "window", call);
+		check_close(&corr[0][0], &corr[1][0], (produced[0][1] * templates), "correlation", call);
+
+		for (int o = 0; o < 2; ++o)
+		{
+			std::vector<gr::tag_t> fft_tags = fft.tags(o, written[0][o], written[0][o] + produced[0][o]);
+			check_tags(fft_tags, scalar.tags(o, written[1][o], written[1][o] + produced[1][o]), ((o == 0) ? "window" : "correlation"), call);
+
+			for (size_t t = 0; t < fft_tags.size(); ++t)
+			{
+				BOOST_CHECK_EQUAL(pmt::to_long(fft_tags[t].value), burst_template);
+				if (o == 1)
+				{
+					BOOST_CHECK_EQUAL(fft_tags[t].offset, (uint64_t)first_burst);	// One output 1 item per lag: on the peak
+					++syncs;
+				}
+			}
+		}
+
+		pos += consumed[0];
+		stalled = ((consumed[0] == 0) ? (stalled + 1) : 0);
+	}
+
+	BOOST_CHECK_GT(pos, TEST_BURST_PERIOD);	// Searched up to the first burst, then skipped ahead to the next window
+	BOOST_CHECK_EQUAL(syncs, 1);	// The search locks on once
+}
+
+BOOST_AUTO_TEST_CASE(t1_single_template)
+{
+	check_case(std::vector<float>(), 0, 1);
+}
+
+BOOST_AUTO_TEST_CASE(t2_template_bank)
+{
+	std::vector<float> freq_offsets;
+	freq_offsets.push_back(-20e3f);
+	freq_offsets.push_back(0.0f);
+	freq_offsets.push_back(20e3f);
+
+	for (int t = 0; t < (int)freq_offsets.size(); ++t)
+		check_case(freq_offsets, t, (2 + t));
+}
+
+BOOST_AUTO_TEST_CASE(t3_small_output_space)
+{
+	check_case(std::vector<float>(), 0, 5, true);
+}
@@ -0,0 +1,317 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2004 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <baz_peak_detector.h>
+#include <gnuradio/block_detail.h>
+#include <gnuradio/buffer.h>
+
+#include <boost/test/unit_test.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+// The idle fast path must not change what the detector outputs. Each case is run through the block and through
+// its original per-sample state machine (below), with the same chunking: output depends on where calls split
+// the stream, as peak indices are relative to the call that reports them.
+
+#define TEST_SAMPLES		20000
+#define TEST_MAX_CHUNK		1024
+#define TEST_BUFFER_ITEMS	(64 * 1024)
+
+static const int CHUNKS[] = { 1, 2, 3, 7, 255, 256, 257, 300, 511, 512, 513, 1000, 1024, 64, 5 };
+
+struct reference_peak_detector	// baz_peak_detector::general_work before the idle fast path (float output)
+{
+	float d_min_diff;
+	int d_min_len;
+	int d_lockout;
+	float d_drop;
+	float d_alpha;
+	int d_look_ahead;
+	bool d_threshold_set;
+	float d_threshold;
+	bool d_rising;
+	int d_rise_count;
+	int d_lockout_count;
+	float d_first;
+	float d_ave;
+	float d_peak;
+	int d_peak_idx;
+	int d_look_ahead_count;
+	int d_advance;
+	int64_t d_last_peak_idx;
+	int64_t d_nitems_written;
+
+	reference_peak_detector(float min_diff, int min_len, int lockout, float drop, float alpha, int look_ahead)
+		: d_min_diff(min_diff), d_min_len(min_len), d_lockout(lockout), d_drop(drop), d_alpha(alpha), d_look_ahead(look_ahead)
+		, d_threshold_set(false), d_threshold(0.0f)
+		, d_rising(false), d_rise_count(0), d_lockout_count(1), d_first(0.0f), d_ave(0.0f), d_peak(0.0f), d_peak_idx(-1)
+		, d_look_ahead_count(0), d_advance(0), d_last_peak_idx(-1), d_nitems_written(0)
+	{ }
+
+	int work(int noutput_items, const float *in, float *out, int *idx_diff_out)	// Returns items consumed (and produced)
+	{
+		memset(idx_diff_out, 0x00, sizeof(int) * noutput_items);
+		memset(out, 0x00, sizeof(float) * noutput_items);
+
+		if ((d_look_ahead > 0) && (noutput_items < (d_look_ahead + 1 + 1)))
+			return 0;
+
+		d_advance = 0;
+
+		const int offset = 1;
+		for (int i = (0+offset + d_advance); i < (noutput_items+offset); i++)
+		{
+			d_ave = d_alpha * in[i-1] + (1.0f - d_alpha) * d_ave;
+
+			if (d_lockout_count > 0)
+			{
+				--d_lockout_count;
+
+				if (d_lockout_count > 0)
+					continue;
+			}
+
+			if (((d_threshold_set == false) || (in[i] >= d_threshold)) &&
+				(in[i] > (d_ave - (d_ave * d_drop))))
+			{
+				bool new_peak = false;
+
+				if (d_rising == false)
+				{
+					d_rising = true;
+					d_rise_count = 0;
+					d_first = in[i];
+
+					new_peak = true;
+				}
+				else if (in[i] > d_peak)
+					new_peak = true;
+
+				if (new_peak)
+				{
+					d_peak = in[i];
+					d_peak_idx = i - offset;
+
+					if (d_look_ahead > 0)
+					{
+						d_look_ahead_count = d_look_ahead;
+
+						int to_consume = (i - offset);
+
+						if (d_look_ahead > (noutput_items - (to_consume + 1 + 1)))
+						{
+							d_peak_idx = 0;
+							d_advance = 1;
+
+							d_nitems_written += to_consume;
+							return to_consume;
+						}
+					}
+				}
+
+				++d_rise_count;
+
+				bool bContinue = true;
+
+				if (d_look_ahead_count > 0)
+				{
+					--d_look_ahead_count;
+
+					if (d_look_ahead_count == 0)
+						bContinue = false;
+				}
+
+				if (bContinue)
+					continue;
+			}
+
+			if (d_look_ahead_count > 0)
+			{
+				--d_look_ahead_count;
+
+				if (d_look_ahead_count > 0)
+					continue;
+			}
+
+			if (d_rising)
+			{
+				if (d_rise_count >= d_min_len)
+				{
+					float diff = d_peak - d_first;
+
+					if ((d_min_diff == 0.0f) || (diff >= d_min_diff))
+					{
+						out[d_peak_idx] = 1.0f;
+
+						int64_t idx = d_nitems_written + d_peak_idx;
+						if (d_last_peak_idx > -1)
+							idx_diff_out[d_peak_idx] = (int)(idx - d_last_peak_idx);
+						d_last_peak_idx = idx;
+
+						d_lockout_count = d_lockout;
+					}
+				}
+
+				d_rising = false;
+			}
+		}
+
+		d_nitems_written += noutput_items;
+		return noutput_items;
+	}
+};
+
+// Long quiet stretches (so the idle scan covers whole blocks), bursts, then zeros, -0, infinities and NaNs too
+static std::vector<float> make_input(unsigned int seed)
+{
+	std::vector<float> data(TEST_SAMPLES + 1);	// +1 for history
+
+	srand(seed);
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		float v = (float)rand() / (float)RAND_MAX;
+
+		if (((i / 700) % 5) == 2)
+			v += 20.0f * std::sin(3.14159f * (float)(i % 700) / 700.0f);
+		else if (((i / 700) % 5) == 4)
+			v = 0.0f;
+
+		switch ((i < (3 * data.size() / 4)) ? -1 : (rand() % 500))	// Last: NaN sticks in an averaged (alpha < 1) run
+		{
+			case 0: v = 0.0f; break;
+			case 1: v = -0.0f; break;
+			case 2: v = std::numeric_limits<float>::infinity(); break;
+			case 3: v = -std::numeric_limits<float>::infinity(); break;
+			case 4: v = std::numeric_limits<float>::quiet_NaN(); break;
+		}
+
+		data[i] = v;
+	}
+
+	return data;
+}
+
+static void check_case(float min_diff, int min_len, int lockout, float drop, float alpha, int look_ahead, float threshold, unsigned int seed)
+{
+	const std::vector<float> data = make_input(seed);
+
+	baz_peak_detector_sptr detector = baz_make_peak_detector(min_diff, min_len, lockout, drop, alpha, look_ahead, false, false);
+	reference_peak_detector reference(min_diff, min_len, lockout, drop, alpha, look_ahead);
+	if (std::isnan(threshold) == false)
+	{
+		detector->set_threshold(threshold);
+		reference.d_threshold_set = true;
+		reference.d_threshold = threshold;
+	}
+
+	// 'consume' and 'nitems_written' go through the block's detail, as under the scheduler
+	gr::block_detail_sptr detail = gr::make_block_detail(1, 2);
+	detail->set_input(0, gr::buffer_add_reader(gr::make_buffer(TEST_BUFFER_ITEMS, sizeof(float)), 0));
+	detail->set_output(0, gr::make_buffer(TEST_BUFFER_ITEMS, sizeof(float)));
+	detail->set_output(1, gr::make_buffer(TEST_BUFFER_ITEMS, sizeof(int)));
+	detector->set_detail(detail);
+
+	// Peaks can be reported at an index left over from an earlier, longer call, so outputs have room for that
+	std::vector<float> out(2 * TEST_MAX_CHUNK), ref_out(2 * TEST_MAX_CHUNK);
+	std::vector<int> idx(2 * TEST_MAX_CHUNK), ref_idx(2 * TEST_MAX_CHUNK);
+
+	const int multiple = ((look_ahead > 0) ? (look_ahead + 1 + 1) : 1);
+	int pos = 0, peaks = 0, stalled = 0;
+	for (size_t call = 0; (pos < TEST_SAMPLES) && (stalled < (int)(sizeof(CHUNKS) / sizeof(CHUNKS[0]))); ++call)
+	{
+		int n = std::min(CHUNKS[call % (sizeof(CHUNKS) / sizeof(CHUNKS[0]))], TEST_SAMPLES - pos);
+		n -= (n % multiple);
+		if (n == 0)
+		{
+			if ((TEST_SAMPLES - pos) < multiple)
+				break;
+			n = multiple;
+		}
+
+		gr_vector_int ninput_items(1, n);
+		gr_vector_const_void_star input_items(1, &data[pos]);
+		gr_vector_void_star output_items(2);
+		output_items[0] = &out[0];
+		output_items[1] = &idx[0];
+
+		uint64_t read = detail->input(0)->nitems_read();
+		int produced = detector->general_work(n, ninput_items, input_items, output_items);
+		int consumed = (int)(detail->input(0)->nitems_read() - read);
+		detail->produce_each(produced);
+
+		int ref_consumed = reference.work(n, &data[pos], &ref_out[0], &ref_idx[0]);
+
+		BOOST_REQUIRE_EQUAL(consumed, ref_consumed);
+		BOOST_REQUIRE_EQUAL(produced, ref_consumed);
+		for (int i = 0; i < produced; ++i)
+		{
+			if ((memcmp(&out[i], &ref_out[i], sizeof(float)) != 0) || (idx[i] != ref_idx[i]))
+			{
+				char buffer[256];
+				snprintf(buffer, sizeof(buffer), "min diff %g, min len %d, lockout %d, drop %g, alpha %g, look ahead %d, threshold %g: "
+					"sample %d (call %d, chunk %d): %g/%d (reference %g/%d)",
+					min_diff, min_len, lockout, drop, alpha, look_ahead, threshold,
+					(pos + i), (int)call, n, out[i], idx[i], ref_out[i], ref_idx[i]);
+				BOOST_FAIL(buffer);
+			}
+
+			if (out[i] != 0.0f)
+				++peaks;
+		}
+
+		pos += produced;
+		stalled = ((produced == 0) ? (stalled + 1) : 0);
+	}
+
+	BOOST_CHECK_EQUAL(detail->output(0)->nitems_written(), (uint64_t)pos);
+	BOOST_CHECK_GT(pos, TEST_SAMPLES - TEST_MAX_CHUNK);
+	BOOST_CHECK_GT(peaks, 0);
+}
+
+BOOST_AUTO_TEST_CASE(t1_matches_reference)
+{
+	const float alphas[] = { 1.0f, 0.25f };
+	const float drops[] = { 0.0f, 0.1f };
+	const int min_lens[] = { 1, 3 };
+	const int lockouts[] = { 0, 5, 300 };
+	const int look_aheads[] = { 0, 4 };
+	const float thresholds[] = { std::numeric_limits<float>::quiet_NaN(), 2.0f };	// NaN: unset
+	const float min_diffs[] = { 0.0f, 1.0f };
+
+	unsigned int seed = 0;
+	for (size_t a = 0; a < (sizeof(alphas) / sizeof(alphas[0])); ++a)
+	for (size_t d = 0; d < (sizeof(drops) / sizeof(drops[0])); ++d)
+	for (size_t m = 0; m < (sizeof(min_lens) / sizeof(min_lens[0])); ++m)
+	for (size_t l = 0; l < (sizeof(lockouts) / sizeof(lockouts[0])); ++l)
+	for (size_t h = 0; h < (sizeof(look_aheads) / sizeof(look_aheads[0])); ++h)
+	for (size_t t = 0; t < (sizeof(thresholds) / sizeof(thresholds[0])); ++t)
+	for (size_t f = 0; f < (sizeof(min_diffs) / sizeof(min_diffs[0])); ++f)
+		check_case(min_diffs[f], min_lens[m], lockouts[l], drops[d], alphas[a], look_aheads[h], thresholds[t], ++seed);
+}
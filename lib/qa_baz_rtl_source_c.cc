@@ -0,0 +1,201 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2004 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <baz_rtl_source_c.h>
+
+#include <boost/test/unit_test.hpp>
+#include <limits>
+#include <deque>
+#include <atomic>
+
+// Drives the async path without hardware: the demod's control transfers go to the source's own replay backend,
+// while transfers complete as each test dictates - in order while streaming, then retired out of order (as
+// libusb does with cancelled and failed transfers).
+
+#define TEST_BUFFER_MUL		16
+#define TEST_BUFFER_LEVEL	0.25f
+#define TEST_TRANSFERS		4
+#define TEST_GOOD_ROUNDS	6	// Fewer blocks than the ring holds, so none are dropped
+#define TEST_WAIT_MS		2000
+
+class fake_transfer_backend : public RTL2832_NAMESPACE::transfer_backend
+{
+public:
+	fake_transfer_backend(RTL2832_NAMESPACE::transfer_backend* device, int retire_status)
+		: m_device(device)
+		, m_retire_status(retire_status)
+		, m_client(NULL)
+		, m_good_rounds(0)
+		, m_stopped(false)
+	{ }
+public:
+	int open()
+	{ return m_device->open(); }
+	void close()
+	{ m_device->close(); }
+	bool is_open() const
+	{ return m_device->is_open(); }
+	int control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeout)
+	{ return m_device->control_transfer(request_type, value, index, data, length, timeout); }
+	int read_samples(uint8_t* buffer, uint32_t buffer_size, int* bytes_read, int timeout)
+	{ return m_device->read_samples(buffer, buffer_size, bytes_read, timeout); }
+	int start_async(RTL2832_NAMESPACE::async_client* client, uint32_t transfer_count, uint32_t transfer_size)
+	{
+		m_client = client;
+		for (uint32_t i = 0; i < transfer_count; ++i)
+		{
+			uint8_t* buffer = client->next_transfer_buffer(transfer_size);
+			if (buffer == NULL)
+				break;
+			m_transfers.push_back(std::make_pair(buffer, transfer_size));
+		}
+		return RTL2832_NAMESPACE::SUCCESS;
+	}
+	int handle_events(int timeout_ms)
+	{
+		if (m_good_rounds < TEST_GOOD_ROUNDS)
+		{
+			complete(m_transfers.front(), 0, true);
+			m_transfers.pop_front();
+			++m_good_rounds;
+		}
+		else if (m_retire_status == LIBUSB_ERROR_INTERRUPTED)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));	// Wait to be cancelled by 'stop'
+		else
+			retire();
+		return (int)m_transfers.size();
+	}
+	int stop_async()
+	{
+		retire();
+		m_client = NULL;
+		m_stopped = true;
+		return RTL2832_NAMESPACE::SUCCESS;
+	}
+	int transfers_in_flight() const
+	{ return (int)m_transfers.size(); }
+public:
+	inline int good_rounds() const
+	{ return m_good_rounds; }
+	inline bool stopped() const
+	{ return m_stopped; }
+private:
+	typedef std::pair<uint8_t*,uint32_t> transfer_t;
+private:
+	void complete(const transfer_t& transfer, int status, bool resubmit)
+	{
+		memset(transfer.first, 0x80, transfer.second);
+		uint8_t* next = m_client->on_transfer_complete(transfer.first, ((status == 0) ? (int)transfer.second : 0), status);
+		if (resubmit && (next != NULL))
+			m_transfers.push_back(std::make_pair(next, transfer.second));
+	}
+	void retire()	// The oldest fails, then the rest newest first: one completes anyway (it was already on the wire)
+	{
+		if (m_transfers.empty())
+			return;
+		complete(m_transfers.front(), m_retire_status, false);
+		m_transfers.pop_front();
+		for (bool first = true; m_transfers.empty() == false; first = false)
+		{
+			complete(m_transfers.back(), (first ? 0 : m_retire_status), false);
+			m_transfers.pop_back();
+		}
+	}
+private:
+	RTL2832_NAMESPACE::transfer_backend* m_device;
+	int m_retire_status;
+	RTL2832_NAMESPACE::async_client* m_client;
+	std::deque<transfer_t> m_transfers;
+	std::atomic<int> m_good_rounds;
+	std::atomic<bool> m_stopped;
+};
+
+static baz_rtl_source_c_sptr make_source()
+{
+	baz_rtl_source_c_sptr source = baz_make_rtl_source_c(true);
+	source->set_replay("/dev/zero");
+	source->set_buffer_multiplier(TEST_BUFFER_MUL);
+	source->set_buffer_level(TEST_BUFFER_LEVEL);
+	source->set_transfer_count(TEST_TRANSFERS);
+	BOOST_REQUIRE(source->create());
+	BOOST_REQUIRE_EQUAL(source->transfer_count(), TEST_TRANSFERS);
+	return source;
+}
+
+template<typename Condition>
+static bool wait_until(Condition condition)
+{
+	for (int i = 0; (i < TEST_WAIT_MS) && (condition() == false); ++i)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	return condition();
+}
+
+static void check_run(int retire_status)
+{
+	baz_rtl_source_c_sptr source = make_source();
+	fake_transfer_backend backend(source->replay(), retire_status);
+	source->set_transfer_backend(&backend);
+
+	BOOST_REQUIRE(source->start());
+	BOOST_REQUIRE(wait_until([&]() { return (backend.good_rounds() == TEST_GOOD_ROUNDS); }));
+
+	if (retire_status == LIBUSB_ERROR_INTERRUPTED)
+		source->stop();
+	BOOST_REQUIRE(wait_until([&]() { return backend.stopped(); }));
+	source->stop();
+
+	// Only the in-order completions reach the ring: those retiring after the stream ended are discarded
+	BOOST_CHECK_EQUAL(source->buffer_times(), (uint32_t)(TEST_GOOD_ROUNDS * source->recv_samples_per_packet()));
+	BOOST_CHECK_EQUAL(source->buffer_overflow_count(), 0);
+	BOOST_CHECK_EQUAL(source->transfers_in_flight(), 0);
+	BOOST_CHECK(source->running() == false);
+
+	source->set_transfer_backend(source->replay());
+	source->destroy();
+}
+
+BOOST_AUTO_TEST_CASE(t1_cancelled_transfers_retire_out_of_order)
+{
+	check_run(LIBUSB_ERROR_INTERRUPTED);
+}
+
+BOOST_AUTO_TEST_CASE(t2_failed_transfers_retire_out_of_order)
+{
+	check_run(LIBUSB_ERROR_IO);
+}
+
+BOOST_AUTO_TEST_CASE(t3_max_transfers)
+{
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, 0.25f), 9);
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, 0.0f), 13);
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, -1.0f), 13);	// Clamped to 0
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, std::numeric_limits<float>::quiet_NaN()), 13);
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, 2.0f), 0);	// Clamped to 1
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(16, 1.0f), 0);
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(4, 0.5f), 0);	// No underflow
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(2, 0.0f), 0);
+	BOOST_CHECK_EQUAL(baz_rtl_source_c::max_transfers(0xFFFFFFFF, 0.0f), 0xFFFFFFFF - 3);
+}
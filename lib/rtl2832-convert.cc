@@ -0,0 +1,531 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2004 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * gr-baz by Balint Seeber (http://spench.net/contact)
+ * Information, documentation & samples: http://wiki.spench.net/wiki/gr-baz
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rtl2832-convert.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(CONVERT_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || defined(__clang__))
+#define CONVERT_AVX2	// Built with a function target attribute and selected at run-time
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)	// Compiler was told NEON is present
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+// SCALE is exact. The table in baz_rtl_source_c this replaces was written with 6-decimal literals, so its 128 odd
+// entries (e.g. 0.007812f for 1/128) were up to 5.1e-7 off: float output differs from it there, by less than 1/15000 LSB.
+#define CENTRE				128
+#define SCALE				(1.0f / 128.0f)
+#define ACCUMULATE_LIMIT	(1 << 20)		// Bytes per run of 32-bit lane sums (keeps them from overflowing)
+
+namespace RTL2832_NAMESPACE { namespace convert {
+
+///////////////////////////////////////////////////////////////////////////////
+
+static struct u8_to_f32_lut	// Scalar int-to-float conversion is slower than a look-up
+{
+	float values[256];
+	u8_to_f32_lut()
+	{ for (int i = 0; i < 256; ++i) values[i] = (float)(i - CENTRE) * SCALE; }
+} _lut;
+
+template<bool SUM>
+static void u8_to_f32_generic(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	const float i_offset = offset[0], q_offset = offset[1];	// Otherwise reloaded after every store
+	int64_t i_sum = 0, q_sum = 0;
+
+	for (uint32_t j = 0; j < count; j += 2)
+	{
+		int i = (int)in[j + 0] - CENTRE;
+		int q = (int)in[j + 1] - CENTRE;
+
+		if (SUM)
+		{
+			i_sum += i;
+			q_sum += q;
+		}
+
+		out[j + 0] = _lut.values[i + CENTRE] - i_offset;
+		out[j + 1] = _lut.values[q + CENTRE] - q_offset;
+	}
+
+	if (SUM)
+	{
+		sum[0] += i_sum;
+		sum[1] += q_sum;
+	}
+}
+
+template<bool SUM>
+static void u8_to_s16_generic(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	const int i_offset = offset[0], q_offset = offset[1];
+	int64_t i_sum = 0, q_sum = 0;
+
+	for (uint32_t j = 0; j < count; j += 2)
+	{
+		int i = (int)in[j + 0] - CENTRE;
+		int q = (int)in[j + 1] - CENTRE;
+
+		if (SUM)
+		{
+			i_sum += i;
+			q_sum += q;
+		}
+
+		out[j + 0] = (int16_t)(i - i_offset);
+		out[j + 1] = (int16_t)(q - q_offset);
+	}
+
+	if (SUM)
+	{
+		sum[0] += i_sum;
+		sum[1] += q_sum;
+	}
+}
+
+static void u8_to_f32_generic_dispatch(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_f32_generic<true>(in, out, count, offset, sum);
+	else
+		u8_to_f32_generic<false>(in, out, count, offset, sum);
+}
+
+static void u8_to_s16_generic_dispatch(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_s16_generic<true>(in, out, count, offset, sum);
+	else
+		u8_to_s16_generic<false>(in, out, count, offset, sum);
+}
+
+static const KERNELS _generic_kernels = { "generic", u8_to_f32_generic_dispatch, u8_to_s16_generic_dispatch };
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONVERT_SSE2
+
+// Lanes alternate I/Q, so even lanes of the 32-bit sums are I and odd lanes are Q
+
+static inline void sse2_add_lanes(__m128i acc, int64_t sum[2])
+{
+	int32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	sum[0] += (int64_t)lanes[0] + lanes[2];
+	sum[1] += (int64_t)lanes[1] + lanes[3];
+}
+
+template<bool SUM>
+static void u8_to_f32_sse2(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128 scale = _mm_set1_ps(SCALE);
+	const __m128 off = _mm_setr_ps(offset[0], offset[1], offset[0], offset[1]);
+
+	const uint32_t vector_count = count & ~15U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		__m128i acc = _mm_setzero_si128();
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 16)
+		{
+			__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + j)), bias);	// Now signed, centred on 0
+			__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+			__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+
+			__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+			__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+			__m128i c = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+			__m128i d = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+
+			if (SUM)
+				acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_add_epi32(a, b), _mm_add_epi32(c, d)));
+
+			_mm_storeu_ps(out + j +  0, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), scale), off));
+			_mm_storeu_ps(out + j +  4, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(b), scale), off));
+			_mm_storeu_ps(out + j +  8, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), scale), off));
+			_mm_storeu_ps(out + j + 12, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(d), scale), off));
+		}
+
+		if (SUM)
+			sse2_add_lanes(acc, sum);
+	}
+
+	u8_to_f32_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+template<bool SUM>
+static void u8_to_s16_sse2(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i off = _mm_setr_epi16(offset[0], offset[1], offset[0], offset[1], offset[0], offset[1], offset[0], offset[1]);
+	const __m128i i_mask = _mm_setr_epi16(1, 0, 1, 0, 1, 0, 1, 0);	// 'madd' then sums each I/Q pair into one 32-bit lane
+	const __m128i q_mask = _mm_setr_epi16(0, 1, 0, 1, 0, 1, 0, 1);
+
+	const uint32_t vector_count = count & ~15U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		__m128i i_acc = _mm_setzero_si128(), q_acc = _mm_setzero_si128();
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 16)
+		{
+			__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + j)), bias);
+			__m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+			__m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+
+			if (SUM)
+			{
+				i_acc = _mm_add_epi32(i_acc, _mm_add_epi32(_mm_madd_epi16(lo, i_mask), _mm_madd_epi16(hi, i_mask)));
+				q_acc = _mm_add_epi32(q_acc, _mm_add_epi32(_mm_madd_epi16(lo, q_mask), _mm_madd_epi16(hi, q_mask)));
+			}
+
+			_mm_storeu_si128((__m128i*)(out + j + 0), _mm_sub_epi16(lo, off));
+			_mm_storeu_si128((__m128i*)(out + j + 8), _mm_sub_epi16(hi, off));
+		}
+
+		if (SUM)
+		{
+			int32_t lanes[4];
+			_mm_storeu_si128((__m128i*)lanes, i_acc);
+			sum[0] += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			_mm_storeu_si128((__m128i*)lanes, q_acc);
+			sum[1] += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		}
+	}
+
+	u8_to_s16_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+static void u8_to_f32_sse2_dispatch(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_f32_sse2<true>(in, out, count, offset, sum);
+	else
+		u8_to_f32_sse2<false>(in, out, count, offset, sum);
+}
+
+static void u8_to_s16_sse2_dispatch(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_s16_sse2<true>(in, out, count, offset, sum);
+	else
+		u8_to_s16_sse2<false>(in, out, count, offset, sum);
+}
+
+static const KERNELS _sse2_kernels = { "sse2", u8_to_f32_sse2_dispatch, u8_to_s16_sse2_dispatch };
+
+#endif // CONVERT_SSE2
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONVERT_AVX2
+
+#define AVX2_TARGET	__attribute__((target("avx2")))
+
+template<bool SUM>
+AVX2_TARGET static void u8_to_f32_avx2(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m256 scale = _mm256_set1_ps(SCALE);
+	const __m256 off = _mm256_setr_ps(offset[0], offset[1], offset[0], offset[1], offset[0], offset[1], offset[0], offset[1]);
+
+	const uint32_t vector_count = count & ~31U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		__m256i acc = _mm256_setzero_si256();
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 32)
+		{
+			for (int k = 0; k < 32; k += 8)
+			{
+				__m128i x = _mm_xor_si128(_mm_loadl_epi64((const __m128i*)(in + j + k)), bias);
+				__m256i a = _mm256_cvtepi8_epi32(x);
+
+				if (SUM)
+					acc = _mm256_add_epi32(acc, a);
+
+				_mm256_storeu_ps(out + j + k, _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(a), scale), off));
+			}
+		}
+
+		if (SUM)
+		{
+			int32_t lanes[8];
+			_mm256_storeu_si256((__m256i*)lanes, acc);
+			sum[0] += (int64_t)lanes[0] + lanes[2] + lanes[4] + lanes[6];
+			sum[1] += (int64_t)lanes[1] + lanes[3] + lanes[5] + lanes[7];
+		}
+	}
+
+	u8_to_f32_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+template<bool SUM>
+AVX2_TARGET static void u8_to_s16_avx2(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m256i off = _mm256_setr_epi16(offset[0], offset[1], offset[0], offset[1], offset[0], offset[1], offset[0], offset[1],
+										  offset[0], offset[1], offset[0], offset[1], offset[0], offset[1], offset[0], offset[1]);
+	const __m256i i_mask = _mm256_setr_epi16(1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0);
+	const __m256i q_mask = _mm256_setr_epi16(0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1);
+
+	const uint32_t vector_count = count & ~31U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		__m256i i_acc = _mm256_setzero_si256(), q_acc = _mm256_setzero_si256();
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 32)
+		{
+			for (int k = 0; k < 32; k += 16)
+			{
+				__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + j + k)), bias);
+				__m256i s = _mm256_cvtepi8_epi16(x);
+
+				if (SUM)
+				{
+					i_acc = _mm256_add_epi32(i_acc, _mm256_madd_epi16(s, i_mask));
+					q_acc = _mm256_add_epi32(q_acc, _mm256_madd_epi16(s, q_mask));
+				}
+
+				_mm256_storeu_si256((__m256i*)(out + j + k), _mm256_sub_epi16(s, off));
+			}
+		}
+
+		if (SUM)
+		{
+			int32_t lanes[8];
+			_mm256_storeu_si256((__m256i*)lanes, i_acc);
+			for (int k = 0; k < 8; ++k)
+				sum[0] += lanes[k];
+			_mm256_storeu_si256((__m256i*)lanes, q_acc);
+			for (int k = 0; k < 8; ++k)
+				sum[1] += lanes[k];
+		}
+	}
+
+	u8_to_s16_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+static void u8_to_f32_avx2_dispatch(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_f32_avx2<true>(in, out, count, offset, sum);
+	else
+		u8_to_f32_avx2<false>(in, out, count, offset, sum);
+}
+
+static void u8_to_s16_avx2_dispatch(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_s16_avx2<true>(in, out, count, offset, sum);
+	else
+		u8_to_s16_avx2<false>(in, out, count, offset, sum);
+}
+
+static const KERNELS _avx2_kernels = { "avx2", u8_to_f32_avx2_dispatch, u8_to_s16_avx2_dispatch };
+
+#endif // CONVERT_AVX2
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONVERT_NEON
+
+template<bool SUM>
+static void u8_to_f32_neon(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	const uint8x16_t bias = vdupq_n_u8(0x80);
+	const float off_lanes[4] = { offset[0], offset[1], offset[0], offset[1] };
+	const float32x4_t off = vld1q_f32(off_lanes);
+
+	const uint32_t vector_count = count & ~15U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		int32x4_t acc = vdupq_n_s32(0);
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 16)
+		{
+			int8x16_t x = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(in + j), bias));
+			int16x8_t lo = vmovl_s8(vget_low_s8(x));
+			int16x8_t hi = vmovl_s8(vget_high_s8(x));
+
+			int32x4_t a = vmovl_s16(vget_low_s16(lo));
+			int32x4_t b = vmovl_s16(vget_high_s16(lo));
+			int32x4_t c = vmovl_s16(vget_low_s16(hi));
+			int32x4_t d = vmovl_s16(vget_high_s16(hi));
+
+			if (SUM)
+				acc = vaddq_s32(acc, vaddq_s32(vaddq_s32(a, b), vaddq_s32(c, d)));
+
+			vst1q_f32(out + j +  0, vsubq_f32(vmulq_n_f32(vcvtq_f32_s32(a), SCALE), off));
+			vst1q_f32(out + j +  4, vsubq_f32(vmulq_n_f32(vcvtq_f32_s32(b), SCALE), off));
+			vst1q_f32(out + j +  8, vsubq_f32(vmulq_n_f32(vcvtq_f32_s32(c), SCALE), off));
+			vst1q_f32(out + j + 12, vsubq_f32(vmulq_n_f32(vcvtq_f32_s32(d), SCALE), off));
+		}
+
+		if (SUM)
+		{
+			int32_t lanes[4];
+			vst1q_s32(lanes, acc);
+			sum[0] += (int64_t)lanes[0] + lanes[2];
+			sum[1] += (int64_t)lanes[1] + lanes[3];
+		}
+	}
+
+	u8_to_f32_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+template<bool SUM>
+static void u8_to_s16_neon(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	const uint8x16_t bias = vdupq_n_u8(0x80);
+	const int16_t off_lanes[8] = { offset[0], offset[1], offset[0], offset[1], offset[0], offset[1], offset[0], offset[1] };
+	const int16x8_t off = vld1q_s16(off_lanes);
+
+	const uint32_t vector_count = count & ~15U;
+	uint32_t j = 0;
+
+	while (j < vector_count)
+	{
+		int32x4_t acc = vdupq_n_s32(0);
+		const uint32_t end = ((vector_count - j) > ACCUMULATE_LIMIT ? (j + ACCUMULATE_LIMIT) : vector_count);
+
+		for (; j < end; j += 16)
+		{
+			int8x16_t x = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(in + j), bias));
+			int16x8_t lo = vmovl_s8(vget_low_s8(x));
+			int16x8_t hi = vmovl_s8(vget_high_s8(x));
+
+			if (SUM)
+				acc = vaddq_s32(acc, vaddl_s16(vadd_s16(vget_low_s16(lo), vget_high_s16(lo)), vadd_s16(vget_low_s16(hi), vget_high_s16(hi))));	// 4 values per 16-bit lane: no overflow
+
+			vst1q_s16(out + j + 0, vsubq_s16(lo, off));
+			vst1q_s16(out + j + 8, vsubq_s16(hi, off));
+		}
+
+		if (SUM)
+		{
+			int32_t lanes[4];
+			vst1q_s32(lanes, acc);
+			sum[0] += (int64_t)lanes[0] + lanes[2];
+			sum[1] += (int64_t)lanes[1] + lanes[3];
+		}
+	}
+
+	u8_to_s16_generic<SUM>(in + j, out + j, count - j, offset, sum);
+}
+
+static void u8_to_f32_neon_dispatch(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_f32_neon<true>(in, out, count, offset, sum);
+	else
+		u8_to_f32_neon<false>(in, out, count, offset, sum);
+}
+
+static void u8_to_s16_neon_dispatch(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2])
+{
+	if (sum)
+		u8_to_s16_neon<true>(in, out, count, offset, sum);
+	else
+		u8_to_s16_neon<false>(in, out, count, offset, sum);
+}
+
+static const KERNELS _neon_kernels = { "neon", u8_to_f32_neon_dispatch, u8_to_s16_neon_dispatch };
+
+#endif // CONVERT_NEON
+
+///////////////////////////////////////////////////////////////////////////////
+
+const KERNELS& generic_kernels()
+{
+	return _generic_kernels;
+}
+
+std::vector<const KERNELS*> supported_kernels()
+{
+	std::vector<const KERNELS*> kernels(1, &_generic_kernels);
+#ifdef CONVERT_SSE2
+	kernels.push_back(&_sse2_kernels);
+#endif // CONVERT_SSE2
+#ifdef CONVERT_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		kernels.push_back(&_avx2_kernels);
+#endif // CONVERT_AVX2
+#ifdef CONVERT_NEON
+	kernels.push_back(&_neon_kernels);
+#endif // CONVERT_NEON
+	return kernels;
+}
+
+const KERNELS* find_kernels(const char* name)
+{
+	std::vector<const KERNELS*> kernels = supported_kernels();
+	for (size_t i = 0; i < kernels.size(); ++i)
+	{
+		if (strcmp(kernels[i]->name, name) == 0)
+			return kernels[i];
+	}
+	return NULL;
+}
+
+const KERNELS& best_kernels()
+{
+	static const KERNELS* kernels = supported_kernels().back();
+	return *kernels;
+}
+
+} } // convert	// RTL2832_NAMESPACE
@@ -0,0 +1,28 @@
+#ifndef INCLUDED_RTL2832_CONVERT
+#define INCLUDED_RTL2832_CONVERT
+
+#include "rtl2832.h"
+
+namespace RTL2832_NAMESPACE { namespace convert {
+
+// 'in' holds 'count' bytes (even) of interleaved unsigned I/Q.
+// Each value is centred on 128 (and scaled by 1/128 for float), then 'offset' (I, Q) is subtracted.
+// If 'sum' is not NULL, the centred (pre-offset) I & Q values are added to it (for DC estimation).
+typedef void (*u8_to_f32_fn)(const uint8_t* in, float* out, uint32_t count, const float offset[2], int64_t sum[2]);
+typedef void (*u8_to_s16_fn)(const uint8_t* in, int16_t* out, uint32_t count, const int16_t offset[2], int64_t sum[2]);
+
+typedef struct kernels
+{
+	const char*		name;
+	u8_to_f32_fn	u8_to_f32;
+	u8_to_s16_fn	u8_to_s16;
+} KERNELS, *PKERNELS;
+
+RTL2832_API const KERNELS& generic_kernels();
+RTL2832_API const KERNELS& best_kernels();	// Chosen once, from what the CPU supports
+RTL2832_API std::vector<const KERNELS*> supported_kernels();	// Those this CPU can run, narrowest first
+RTL2832_API const KERNELS* find_kernels(const char* name);	// NULL if not supported here
+
+} } // convert	// RTL2832_NAMESPACE
+
+#endif // INCLUDED_RTL2832_CONVERT
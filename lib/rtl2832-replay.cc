@@ -0,0 +1,520 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2004 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * GNU Radio is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * GNU Radio is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Radio; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * gr-baz by Balint Seeber (http://spench.net/contact)
+ * Information, documentation & samples: http://wiki.spench.net/wiki/gr-baz
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rtl2832-replay.h"
+
+#include <assert.h>
+#include <string.h>	// strcasecmp, strerror
+#include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#define strcasecmp	_stricmp
+#else
+#include <unistd.h>
+#include <time.h>
+#define O_BINARY	0
+#endif // _WIN32
+
+#define REPLAY_FIFO_SIZE		(64 * 1024)	// MAGIC: ~13 ms at 2.4 MS/s
+#define REPLAY_SCRATCH_SIZE		(64 * 1024)
+#define REPLAY_SAMPLE_SIZE		2	// u8 I & Q
+
+// The writes the simulation reacts to (these mirror demod's protected register map)
+#define REPLAY_WRITE_FLAG		0x10
+#define REPLAY_I2C_INDEX		(6 << 8)	// IICB
+#define REPLAY_EPA_CTL_INDEX	((1 << 8) | REPLAY_WRITE_FLAG)	// USBB
+#define REPLAY_EPA_CTL_VALUE	0x2148	// USB_EPA_CTL
+#define REPLAY_REPEATER_INDEX	(REPLAY_WRITE_FLAG | 1)	// Demod page 1...
+#define REPLAY_REPEATER_VALUE	((0x01 << 8) | 0x20)	// ...register 0x01
+#define REPLAY_REPEATER_ON		0x08
+
+namespace RTL2832_NAMESPACE
+{
+
+// Probe constants are those in the tuner sources. Status registers make the drivers' lock/calibration checks pass.
+static const struct _replay_tuner_info
+{
+	const char* name;
+	uint8_t i2c_addr;
+	uint8_t regs[2][2];	// Register, value (value 0: unused)
+} _replay_tuners[] = {
+	{ "e4k",	0xc8, { { 0x02, 0x40 } } },
+	{ "e4000",	0xc8, { { 0x02, 0x40 } } },
+	{ "fc0013",	0xc6, { { 0x00, 0xa3 } } },
+	{ "fc0012",	0xc6, { { 0x00, 0xa1 } } },
+	{ "fc2580",	0xac, { { 0x01, 0x56 }, { 0x2f, 0xc0 } } },	// Filter calibration done
+	{ "r820t",	0x34, { { 0x00, 0x69 }, { 0x02, 0x02 } } },	// PLL locked (bit-reversed on read)
+};
+
+static uint64_t _now_ns()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+#endif // _WIN32
+}
+
+static void _sleep_ns(uint64_t ns)
+{
+#ifdef _WIN32
+	Sleep((DWORD)((ns + 999999) / 1000000));
+#else
+	struct timespec ts;
+	ts.tv_sec = (time_t)(ns / 1000000000ULL);
+	ts.tv_nsec = (long)(ns % 1000000000ULL);
+	nanosleep(&ts, NULL);
+#endif // _WIN32
+}
+
+replay_transfer_backend::replay_transfer_backend(demod* p, const char* path, bool loop /*= false*/)
+	: m_demod(p)
+	, m_path(path ? path : "-")
+	, m_loop(loop)
+	, m_fd(-1)
+	, m_eof(false)
+	, m_eof_reported(false)
+	, m_pacing(true)
+	, m_fifo_size(REPLAY_FIFO_SIZE)
+	, m_rate(0)
+	, m_epoch_ns(0)
+	, m_epoch_bytes(0)
+	, m_stream_bytes(0)
+	, m_overrun_pending(false)
+	, m_client(NULL)
+	, m_i2c_repeater(false)
+	, m_control_transfer_count(0)
+	, m_i2c_read_count(0)
+	, m_i2c_write_count(0)
+	, m_i2c_repeater_count(0)
+	, m_overrun_count(0)
+	, m_bytes_dropped(0)
+	, m_bytes_replayed(0)
+{
+	assert(m_demod);
+}
+
+replay_transfer_backend::~replay_transfer_backend()
+{
+	stop_async();
+	close();
+}
+
+int replay_transfer_backend::open()
+{
+	if (m_fd >= 0)
+		return SUCCESS;
+
+	if (m_path == "-")
+	{
+		m_fd = 0;	// stdin
+#ifdef _WIN32
+		_setmode(m_fd, _O_BINARY);
+#endif // _WIN32
+	}
+	else
+	{
+		m_fd = ::open(m_path.c_str(), O_RDONLY | O_BINARY);
+		if (m_fd < 0)
+		{
+			m_demod->log("Could not open replay file \"%s\": %s\n", m_path.c_str(), strerror(errno));
+			return FAILURE;
+		}
+	}
+
+	m_eof = false;
+	m_eof_reported = false;
+	m_stream_bytes = 0;
+	m_i2c_repeater = false;
+	m_demod_regs.clear();
+	m_scratch.resize(REPLAY_SCRATCH_SIZE);
+
+	restart_clock();
+
+	m_demod->log("Replaying: %s%s\n", ((m_fd == 0) ? "(stdin)" : m_path.c_str()), (m_loop ? " (looping)" : ""));
+
+	return SUCCESS;
+}
+
+void replay_transfer_backend::close()
+{
+	if (m_fd > 0)
+		::close(m_fd);
+
+	m_fd = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool replay_transfer_backend::simulate_tuner(const char* name)
+{
+	if ((name == NULL) || (name[0] == '\0'))
+		return false;
+
+	for (size_t i = 0; i < (sizeof(_replay_tuners)/sizeof(_replay_tuners[0])); ++i)
+	{
+		const struct _replay_tuner_info& info = _replay_tuners[i];
+		if (strcasecmp(info.name, name) != 0)
+			continue;
+
+		for (size_t j = 0; j < (sizeof(info.regs)/sizeof(info.regs[0])); ++j)
+		{
+			if (info.regs[j][1] != 0)
+				set_i2c_register(info.i2c_addr, info.regs[j][0], info.regs[j][1], true);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void replay_transfer_backend::set_i2c_register(uint8_t i2c_addr, uint8_t reg, uint8_t val, bool read_only /*= false*/)
+{
+	std::map<uint8_t,I2C_DEVICE>::iterator it = m_i2c_devices.find(i2c_addr);
+	if (it == m_i2c_devices.end())
+	{
+		I2C_DEVICE device;
+		memset(&device, 0x00, sizeof(device));
+		it = m_i2c_devices.insert(std::make_pair(i2c_addr, device)).first;
+	}
+
+	it->second.regs[reg] = val;
+	it->second.read_only[reg] = read_only;
+}
+
+uint8_t replay_transfer_backend::i2c_register(uint8_t i2c_addr, uint8_t reg) const
+{
+	std::map<uint8_t,I2C_DEVICE>::const_iterator it = m_i2c_devices.find(i2c_addr);
+	return ((it == m_i2c_devices.end()) ? 0 : it->second.regs[reg]);
+}
+
+int replay_transfer_backend::control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeout)
+{
+	if (is_open() == false)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	++m_control_transfer_count;
+
+	bool write = ((request_type & LIBUSB_ENDPOINT_IN) == 0);
+
+	if ((index & ~REPLAY_WRITE_FLAG) == REPLAY_I2C_INDEX)
+		return i2c_transfer(write, (uint8_t)value, data, length);
+
+	uint32_t key = ((uint32_t)(index & ~REPLAY_WRITE_FLAG) << 16) | value;
+
+	if (write)
+	{
+		if ((index == REPLAY_REPEATER_INDEX) && (value == REPLAY_REPEATER_VALUE) && (length > 0))
+		{
+			bool on = ((data[0] & REPLAY_REPEATER_ON) != 0);
+			if (on != m_i2c_repeater)
+			{
+				m_i2c_repeater = on;
+				++m_i2c_repeater_count;
+			}
+		}
+		else if ((index == REPLAY_EPA_CTL_INDEX) && (value == REPLAY_EPA_CTL_VALUE))
+			restart_clock();	// Endpoint reset before streaming: nothing is waiting in the FIFO
+
+		m_demod_regs[key].assign(data, data + length);
+	}
+	else
+	{
+		std::map<uint32_t,std::vector<uint8_t> >::const_iterator it = m_demod_regs.find(key);
+		for (uint16_t i = 0; i < length; ++i)
+			data[i] = (((it != m_demod_regs.end()) && (i < it->second.size())) ? it->second[i] : 0);
+	}
+
+	return length;
+}
+
+// The register pointer is set by the first byte of a write, and auto-increments
+int replay_transfer_backend::i2c_transfer(bool write, uint8_t i2c_addr, uint8_t* data, uint16_t length)
+{
+	if (m_i2c_repeater == false)
+		return LIBUSB_ERROR_PIPE;	// Tuner is not on the bus
+
+	std::map<uint8_t,I2C_DEVICE>::iterator it = m_i2c_devices.find(i2c_addr);
+	if (it == m_i2c_devices.end())
+		return LIBUSB_ERROR_PIPE;	// NAK
+
+	I2C_DEVICE& device = it->second;
+
+	if (write)
+	{
+		++m_i2c_write_count;
+
+		if (length == 0)
+			return 0;
+
+		device.pointer = data[0];
+
+		for (uint16_t i = 1; i < length; ++i, ++device.pointer)
+		{
+			if (device.read_only[device.pointer] == false)
+				device.regs[device.pointer] = data[i];
+		}
+	}
+	else
+	{
+		++m_i2c_read_count;
+
+		for (uint16_t i = 0; i < length; ++i, ++device.pointer)
+			data[i] = device.regs[device.pointer];
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int replay_transfer_backend::read_file(uint8_t* buffer, uint32_t length)
+{
+	uint32_t total = 0;
+	bool rewound = false;
+
+	while ((total < length) && (m_eof == false))
+	{
+		int r = ::read(m_fd, buffer + total, length - total);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			m_demod->log("Replay read failed: %s\n", strerror(errno));
+			m_eof = true;
+		}
+		else if (r == 0)
+		{
+			if ((m_loop) && (rewound == false) && (lseek(m_fd, 0, SEEK_SET) == 0))	// Not possible with a pipe
+				rewound = true;
+			else
+				m_eof = true;
+		}
+		else
+		{
+			total += r;
+			rewound = false;
+		}
+	}
+
+	m_stream_bytes += total;
+
+	return total;
+}
+
+int replay_transfer_backend::end_of_stream()
+{
+	if (m_eof_reported == false)
+	{
+		m_demod->log("Replay finished after %llu bytes (%llu dropped)\n", (unsigned long long)m_bytes_replayed, (unsigned long long)m_bytes_dropped);
+		m_eof_reported = true;
+	}
+
+	return LIBUSB_ERROR_NO_DEVICE;	// As if unplugged
+}
+
+// The device produces bytes at the sample rate from here on
+void replay_transfer_backend::restart_clock()
+{
+	m_rate = (m_pacing ? (m_demod->sample_rate() * REPLAY_SAMPLE_SIZE) : 0);
+	m_epoch_ns = _now_ns();
+	m_epoch_bytes = m_stream_bytes;
+	m_overrun_pending = false;
+}
+
+uint64_t replay_transfer_backend::bytes_available()
+{
+	if (m_rate != (m_pacing ? (m_demod->sample_rate() * REPLAY_SAMPLE_SIZE) : 0))
+		restart_clock();
+
+	if (m_rate <= 0)
+		return ~0ULL;
+
+	uint64_t produced = m_epoch_bytes + (uint64_t)((double)(_now_ns() - m_epoch_ns) * m_rate / 1e9);
+
+	return ((produced > m_stream_bytes) ? (produced - m_stream_bytes) : 0);
+}
+
+// Anything produced beyond what the device (and the transfers waiting on it) can hold is lost
+bool replay_transfer_backend::drop_overrun(uint64_t capacity)
+{
+	if (m_rate <= 0)
+		return false;
+
+	uint64_t available = bytes_available();
+	if (available <= capacity)
+		return false;
+
+	uint64_t drop = (available - capacity) & ~(uint64_t)(REPLAY_SAMPLE_SIZE - 1);
+
+	while ((drop > 0) && (m_eof == false))
+	{
+		int r = read_file(&m_scratch[0], (uint32_t)std::min(drop, (uint64_t)m_scratch.size()));
+		drop -= r;
+		m_bytes_dropped += r;
+	}
+
+	++m_overrun_count;
+
+	return true;
+}
+
+bool replay_transfer_backend::wait_for(uint64_t bytes, int timeout_ms)
+{
+	if (bytes_available() >= bytes)
+		return true;
+
+	uint64_t due_ns = m_epoch_ns + (uint64_t)((double)(m_stream_bytes + bytes - m_epoch_bytes) * 1e9 / m_rate);
+	uint64_t now_ns = _now_ns();
+	uint64_t wait_ns = ((due_ns > now_ns) ? (due_ns - now_ns) : 0);
+
+	if ((timeout_ms >= 0) && (wait_ns > ((uint64_t)timeout_ms * 1000000ULL)))
+	{
+		_sleep_ns((uint64_t)timeout_ms * 1000000ULL);
+		return false;
+	}
+
+	_sleep_ns(wait_ns);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int replay_transfer_backend::read_samples(uint8_t* buffer, uint32_t buffer_size, int* bytes_read, int timeout)
+{
+	*bytes_read = 0;
+
+	if (is_open() == false)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	if (m_eof)
+		return end_of_stream();
+
+	bool overrun = drop_overrun((uint64_t)m_fifo_size + buffer_size);
+
+	if (wait_for(buffer_size, ((timeout > 0) ? timeout : -1)) == false)
+		return LIBUSB_ERROR_TIMEOUT;
+
+	int r = read_file(buffer, buffer_size);
+	if (r == 0)
+		return end_of_stream();
+
+	m_bytes_replayed += r;
+	*bytes_read = r;
+
+	return (overrun ? LIBUSB_ERROR_OVERFLOW : 0);
+}
+
+int replay_transfer_backend::start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size)
+{
+	assert(client);
+	assert(m_transfers.empty());
+
+	if (is_open() == false)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	m_client = client;
+
+	for (uint32_t i = 0; i < transfer_count; ++i)
+	{
+		uint8_t* buffer = client->next_transfer_buffer(transfer_size);
+		if (buffer == NULL)
+			break;
+
+		m_transfers.push_back(std::make_pair(buffer, transfer_size));
+	}
+
+	return SUCCESS;
+}
+
+// Transfers complete in order once the stream has produced enough to fill them
+int replay_transfer_backend::handle_events(int timeout_ms)
+{
+	if (m_transfers.empty())
+		return 0;
+
+	uint64_t capacity = m_fifo_size;
+	for (size_t i = 0; i < m_transfers.size(); ++i)
+		capacity += m_transfers[i].second;
+
+	if (drop_overrun(capacity))
+		m_overrun_pending = true;
+
+	if ((m_eof == false) && (wait_for(m_transfers.front().second, timeout_ms) == false))
+		return (int)m_transfers.size();
+
+	for (size_t n = m_transfers.size(); (n > 0) && (m_transfers.empty() == false); --n)
+	{
+		if ((m_eof == false) && (bytes_available() < m_transfers.front().second))
+			break;
+
+		transfer_t transfer = m_transfers.front();
+		m_transfers.pop_front();
+
+		int status = 0;
+		int r = read_file(transfer.first, transfer.second);
+		if (r == 0)
+			status = end_of_stream();
+		else if (m_overrun_pending)
+			status = LIBUSB_ERROR_OVERFLOW;
+
+		m_overrun_pending = false;
+		m_bytes_replayed += r;
+
+		uint8_t* next = m_client->on_transfer_complete(transfer.first, r, status);
+		if (next != NULL)
+			m_transfers.push_back(std::make_pair(next, transfer.second));
+	}
+
+	return (int)m_transfers.size();
+}
+
+int replay_transfer_backend::stop_async()
+{
+	m_transfers.clear();	// Like cancelled transfers, these are not handed back to the client
+	m_client = NULL;
+
+	return SUCCESS;
+}
+
+}	// namespace rtl2832
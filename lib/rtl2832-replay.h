@@ -0,0 +1,101 @@
+#ifndef INCLUDED_RTL2832_REPLAY
+#define INCLUDED_RTL2832_REPLAY
+
+#include "rtl2832.h"
+
+#include <deque>
+
+namespace RTL2832_NAMESPACE
+{
+
+// Stands in for the device: raw u8 I/Q comes from a file (or pipe), paced at the demod's sample rate.
+// Demod registers are remembered, and tuner I2C is simulated with a register file per I2C address
+// (only addresses that have been given registers answer, and only while the repeater is on).
+class RTL2832_API replay_transfer_backend : public transfer_backend
+{
+public:
+	replay_transfer_backend(demod* p, const char* path, bool loop = false);	// 'path': "-" is stdin
+	~replay_transfer_backend();
+public:	// transfer_backend
+	int open();
+	void close();
+	bool is_open() const
+	{ return (m_fd >= 0); }
+	int control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeout);
+	int read_samples(uint8_t* buffer, uint32_t buffer_size, int* bytes_read, int timeout);
+	int start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size);
+	int handle_events(int timeout_ms);
+	int stop_async();
+	int transfers_in_flight() const
+	{ return (int)m_transfers.size(); }
+public:
+	bool simulate_tuner(const char* name);	// Presets chip ID (& status) registers of a known tuner so it probes & initialises
+	void set_i2c_register(uint8_t i2c_addr, uint8_t reg, uint8_t val, bool read_only = false);
+	uint8_t i2c_register(uint8_t i2c_addr, uint8_t reg) const;
+	inline void set_pacing(bool on = true)	// Off: as fast as the reader goes (never overruns)
+	{ m_pacing = on; }
+	inline void set_fifo_size(uint32_t bytes)	// Device-side buffering before samples are lost
+	{ m_fifo_size = bytes; }
+public:
+	inline uint32_t control_transfer_count() const
+	{ return m_control_transfer_count; }
+	inline uint32_t i2c_read_count() const
+	{ return m_i2c_read_count; }
+	inline uint32_t i2c_write_count() const
+	{ return m_i2c_write_count; }
+	inline uint32_t i2c_repeater_count() const
+	{ return m_i2c_repeater_count; }
+	inline uint32_t overrun_count() const
+	{ return m_overrun_count; }
+	inline uint64_t bytes_dropped() const
+	{ return m_bytes_dropped; }
+	inline uint64_t bytes_replayed() const
+	{ return m_bytes_replayed; }
+private:
+	typedef struct i2c_device
+	{
+		uint8_t	regs[256];
+		bool	read_only[256];
+		uint8_t	pointer;
+	} I2C_DEVICE, *PI2C_DEVICE;
+	typedef std::pair<uint8_t*,uint32_t> transfer_t;
+private:
+	int i2c_transfer(bool write, uint8_t i2c_addr, uint8_t* data, uint16_t length);
+	int read_file(uint8_t* buffer, uint32_t length);
+	int end_of_stream();
+	void restart_clock();
+	uint64_t bytes_available();
+	bool drop_overrun(uint64_t capacity);
+	bool wait_for(uint64_t bytes, int timeout_ms);
+private:
+	demod* m_demod;
+	std::string m_path;
+	bool m_loop;
+	int m_fd;
+	bool m_eof;
+	bool m_eof_reported;
+	bool m_pacing;
+	uint32_t m_fifo_size;
+	double m_rate;	// Bytes/s the clock is running at (0: unpaced)
+	uint64_t m_epoch_ns;
+	uint64_t m_epoch_bytes;
+	uint64_t m_stream_bytes;	// Position in the device's stream (replayed + dropped)
+	bool m_overrun_pending;
+	std::vector<uint8_t> m_scratch;
+	async_client* m_client;
+	std::deque<transfer_t> m_transfers;
+	std::map<uint32_t,std::vector<uint8_t> > m_demod_regs;
+	std::map<uint8_t,I2C_DEVICE> m_i2c_devices;
+	bool m_i2c_repeater;
+	uint32_t m_control_transfer_count;
+	uint32_t m_i2c_read_count;
+	uint32_t m_i2c_write_count;
+	uint32_t m_i2c_repeater_count;
+	uint32_t m_overrun_count;
+	uint64_t m_bytes_dropped;
+	uint64_t m_bytes_replayed;
+};
+
+}
+
+#endif // INCLUDED_RTL2832_REPLAY
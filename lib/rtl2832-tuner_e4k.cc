@@ -226,6 +226,19 @@ int e4k::TUNER_PROBE_FN_NAME(demod* d)
 	return ((reg == E4K_CHECK_VAL) ? SUCCESS : FAILURE);
 }
 
+static const uint8_t _volatileRegsE4K[] = {	// Status, self-clearing triggers & readbacks the AGC/calibration can change
+	E4K_REG_MASTER1,
+	E4K_REG_SYNTH1,
+	E4K_REG_GAIN1,
+	E4K_REG_GAIN2,
+	E4K_REG_DC1,
+	E4K_REG_DC2,
+	E4K_REG_DC3,
+	E4K_REG_DC4,
+	E4K_REG_CHFILT_CALIB,
+	E4K_REG_I2C_REG_ADDR,
+};
+
 e4k::e4k(demod* p)
 	: tuner_skeleton(p)
 {
@@ -249,6 +262,8 @@ e4k::e4k(demod* p)
 	m_stateE4K.vco.fosc = p->crystal_frequency();
 	m_stateE4K.pTuner = this;
 	m_stateE4K.i2c_addr = E4K_I2C_ADDR;
+
+	cache_registers(E4K_I2C_ADDR, _volatileRegsE4K, sizeof(_volatileRegsE4K)/sizeof(_volatileRegsE4K[0]), CACHE_READS);
 }
 
 int e4k::initialise(PPARAMS params /*= NULL*/)
@@ -1550,6 +1565,7 @@ int e4k_init(struct e4k_state *e4k, bool enable_dc_offset_loop /*= true*/, bool
 		E4K_MASTER1_NORM_STBY |
 		E4K_MASTER1_POR_DET
 	);
+	e4k->pTuner->invalidate_register_cache();	/* registers are back at their defaults */
 
 	/* Configure clock input */
 	e4k_reg_write(e4k, E4K_REG_CLK_INP, 0x00);
@@ -17,6 +17,8 @@
 #define FC0013_CHECK_ADDR	0x00
 #define FC0013_CHECK_VAL	0xa3
 
+#define FC0013_VCO_CAL_ADDR	0x0e	// Calibration trigger & result
+
 #define LOG_PREFIX			"[fc0013] "
 
 int _FC0013_Write(RTL2832_NAMESPACE::tuner* pTuner, unsigned char RegAddr, unsigned char Byte,
@@ -195,6 +197,9 @@ fc0013::fc0013(demod* p)
 	values_to_range(m_bandwidth_values, m_bandwidth_range);
 
 	m_bandwidth = m_bandwidth_range.second;	// Default
+
+	static const uint8_t volatile_regs[] = { FC0013_VCO_CAL_ADDR };
+	cache_registers(FC0013_I2C_ADDR, volatile_regs, 1, CACHE_READS);
 }
 
 int fc0013::initialise(tuner::PPARAMS params /*= NULL*/)
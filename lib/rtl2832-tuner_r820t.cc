@@ -113,6 +113,8 @@ r820t::r820t(demod* p)
 //	values_to_range(m_bandwidth_values, m_bandwidth_range);
 
 	m_bandwidth = m_bandwidth_range.first;	// Default
+	
+	cache_registers(R820T_I2C_ADDR, NULL, 0, DEFER_WRITES);	// Reads come back bit-reversed, so only writes use the shadow
 }
 
 int r820t::initialise(tuner::PPARAMS params /*= NULL*/)
@@ -131,6 +133,9 @@ int r820t::initialise(tuner::PPARAMS params /*= NULL*/)
 	if (R828_RfGainMode(this, RF_MANUAL) != RT_Success)
 		return FAILURE;
 
+	if (flush_registers() <= 0)	// Here rather than on leaving the scope, which can't report it
+		return FAILURE;
+
 	parent()->set_if(R820T_IF_FREQ);
 	
 	if (m_params.message_output && m_params.verbose)
@@ -151,6 +156,9 @@ int r820t::set_frequency(double freq)
 	if (r820t_SetRfFreqHz(this, (unsigned long)freq) != FUNCTION_SUCCESS)
 		return FAILURE;
 	
+	if (flush_registers() <= 0)
+		return FAILURE;
+	
 	m_freq = (((unsigned long)freq + 500) / 1000) * 1000;
 	
 	return SUCCESS;
@@ -178,6 +186,9 @@ int r820t::set_gain(double gain)
 	
 	if (R828_SetRfGain(this, iGain) != FUNCTION_SUCCESS)
 		return FAILURE;
+	
+	if (flush_registers() <= 0)
+		return FAILURE;
 
 	m_gain = gain;
 	
@@ -268,7 +279,7 @@ _I2C_Write_Len(RTL2832_NAMESPACE::TUNERS_NAMESPACE::r820t* pTuner, R828_I2C_LEN_
 	
 	// Calculate maximum writing byte number.
 	//	WritingByteNumMax = pBaseInterface->I2cWritingByteNumMax - LEN_1_BYTE;
-	WritingByteNumMax = 2 - 1; //9 orig
+	WritingByteNumMax = RTL2832_I2C_MAX_WRITE - 1; //9 orig
 	
 	// Set tuner register bytes with writing bytes.
 	// Note: Set tuner register bytes considering maximum writing byte number.
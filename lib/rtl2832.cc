@@ -39,6 +39,7 @@
 #include "memory.h"	// memset
 #include "assert.h"	// assert
 #include "math.h"	// pow
+#include <algorithm>	// min
 #include <stdarg.h>	// va_list
 #include "string.h"	// strcasecmp
 
@@ -272,27 +273,443 @@ int tuner_skeleton::initialise(PPARAMS params /*= NULL*/)
 
 int tuner_skeleton::set_i2c_repeater(bool on /*= true*/, const char* function_name /*= NULL*/, int line_number /*= -1*/, const char* line /*= NULL*/)
 {
-	return m_demod->set_i2c_repeater(on, function_name, line_number, line);
+	int r = SUCCESS;
+	if (on == false)
+		r = flush_registers();	// Deferred writes must go out while the tuner can still hear them
+
+	int r2 = m_demod->set_i2c_repeater(on, function_name, line_number, line);	// Closed even if they failed
+
+	return ((r <= 0) ? r : r2);
+}
+
+// Registers of 'i2c_addr' are shadowed from now on: writes of unchanged values are skipped,
+// and only the changed span of a multi-byte write is sent.
+void tuner_skeleton::cache_registers(uint8_t i2c_addr, const uint8_t* volatile_regs /*= NULL*/, int volatile_count /*= 0*/, int flags /*= 0*/)
+{
+	REGISTER_CACHE& c = m_register_cache[i2c_addr];
+
+	memset(c.regs, 0x00, sizeof(c.regs));
+	c.valid.reset();
+	c.volatile_regs.reset();
+	c.pending.reset();
+	c.last_pending = -1;
+	c.pointer = -1;
+	c.flags = flags;
+
+	for (int i = 0; i < volatile_count; ++i)
+		c.volatile_regs.set(volatile_regs[i]);
+}
+
+tuner_skeleton::PREGISTER_CACHE tuner_skeleton::register_cache(uint8_t i2c_addr)
+{
+	std::map<uint8_t,REGISTER_CACHE>::iterator it = m_register_cache.find(i2c_addr);
+	if (it == m_register_cache.end())
+		return NULL;
+
+	return &it->second;
+}
+
+void tuner_skeleton::invalidate_register_cache()
+{
+	for (std::map<uint8_t,REGISTER_CACHE>::iterator it = m_register_cache.begin(); it != m_register_cache.end(); ++it)
+	{
+		it->second.valid.reset();
+		it->second.pending.reset();
+		it->second.last_pending = -1;
+		it->second.pointer = -1;
+	}
+}
+
+// Sends 'len' bytes from 'reg' on, splitting them into as few I2C writes as the demod allows
+int tuner_skeleton::write_registers(uint8_t i2c_addr, uint8_t reg, const uint8_t* data, int len)
+{
+	uint8_t buffer[RTL2832_I2C_MAX_WRITE];
+
+	for (int i = 0; i < len; i += (RTL2832_I2C_MAX_WRITE - 1))
+	{
+		int count = std::min(len - i, RTL2832_I2C_MAX_WRITE - 1);
+
+		buffer[0] = (uint8_t)(reg + i);
+		memcpy(buffer + 1, data + i, count);
+
+		int r = m_demod->i2c_write(i2c_addr, buffer, count + 1);
+		if (r <= 0)
+			return r;
+	}
+
+	return len;
+}
+
+// Sends writes held back by DEFER_WRITES. Runs of pending registers are joined across registers that are
+// known and not volatile (rewriting those is harmless), so each burst covers as much as it can.
+int tuner_skeleton::flush_registers()
+{
+	for (std::map<uint8_t,REGISTER_CACHE>::iterator it = m_register_cache.begin(); it != m_register_cache.end(); ++it)
+	{
+		REGISTER_CACHE& c = it->second;
+
+		int reg = 0;
+		while (c.pending.any())
+		{
+			while (c.pending.test(reg) == false)
+				++reg;
+
+			int last = reg;
+			for (int next = reg + 1; (next < 256) && (next < (reg + RTL2832_I2C_MAX_WRITE - 1)); ++next)
+			{
+				if (c.pending.test(next))
+					last = next;
+				else if ((c.valid.test(next) == false) || c.volatile_regs.test(next))
+					break;
+			}
+
+			int r = write_registers(it->first, (uint8_t)reg, c.regs + reg, (last - reg) + 1);
+			if (r <= 0)
+			{
+				c.valid.reset();	// No longer sure what the device holds
+				c.pending.reset();
+				c.last_pending = -1;
+				return r;
+			}
+
+			for (; reg <= last; ++reg)
+				c.pending.reset(reg);
+		}
+
+		c.last_pending = -1;
+	}
+
+	return SUCCESS;
 }
 
 int tuner_skeleton::i2c_read(uint8_t i2c_addr, uint8_t *buffer, int len)
 {
-	return m_demod->i2c_read(i2c_addr, buffer, len);
+	PREGISTER_CACHE c = register_cache(i2c_addr);
+	if (c == NULL)
+		return m_demod->i2c_read(i2c_addr, buffer, len);
+
+	int r = flush_registers();	// Reads see every write before them
+	if (r <= 0)
+		return r;
+
+	int pointer = c->pointer;
+	c->pointer = -1;
+
+	if ((c->flags & CACHE_READS) && (pointer >= 0))
+	{
+		bool cached = ((pointer + len) <= 256);
+		for (int i = 0; (i < len) && cached; ++i)
+			cached = (c->valid.test(pointer + i) && (c->volatile_regs.test(pointer + i) == false));
+
+		if (cached)
+		{
+			memcpy(buffer, c->regs + pointer, len);
+			return len;
+		}
+
+		uint8_t reg = (uint8_t)pointer;
+		r = m_demod->i2c_write(i2c_addr, &reg, 1);	// Address write was deferred in case the read could be served from the shadow
+		if (r <= 0)
+			return r;
+	}
+
+	r = m_demod->i2c_read(i2c_addr, buffer, len);
+
+	if ((r > 0) && (c->flags & CACHE_READS) && (pointer >= 0))
+	{
+		for (int i = 0; (i < len) && ((pointer + i) < 256); ++i)
+		{
+			if (c->volatile_regs.test(pointer + i))
+				continue;
+
+			c->regs[pointer + i] = buffer[i];
+			c->valid.set(pointer + i);
+		}
+	}
+
+	return r;
 }
 
 int tuner_skeleton::i2c_write(uint8_t i2c_addr, uint8_t *buffer, int len)
 {
-	return m_demod->i2c_write(i2c_addr, buffer, len);
+	PREGISTER_CACHE c = register_cache(i2c_addr);
+	if (c == NULL)
+		return m_demod->i2c_write(i2c_addr, buffer, len);
+
+	if (len < 2)	// Register address only: sets up a read
+	{
+		if ((len == 1) && (c->flags & CACHE_READS))
+		{
+			c->pointer = buffer[0];
+			return len;
+		}
+
+		int r = flush_registers();
+		if (r <= 0)
+			return r;
+
+		return m_demod->i2c_write(i2c_addr, buffer, len);
+	}
+
+	c->pointer = -1;
+
+	int reg = buffer[0];
+	int count = std::min(len - 1, 256 - reg);
+	const uint8_t* data = buffer + 1;
+
+	int first = -1, last = -1;
+	bool any_volatile = false;
+	for (int i = 0; i < count; ++i)
+	{
+		int n = reg + i;
+
+		if (c->volatile_regs.test(n))
+			any_volatile = true;
+		else if (c->valid.test(n) && (c->regs[n] == data[i]))
+			continue;	// Already there (or already queued)
+
+		if (first < 0)
+			first = i;
+		last = i;
+	}
+
+	if (first < 0)
+		return len;
+
+	if ((c->flags & DEFER_WRITES) && (any_volatile == false))
+	{
+		// Bursts go out in ascending order, so only hold writes that keep the order they were made in
+		bool in_order = ((reg + first) > c->last_pending);
+		for (int i = first; (i <= last) && in_order; ++i)
+			in_order = ((c->pending.test(reg + i) == false) || (c->regs[reg + i] == data[i]));
+
+		if (in_order == false)
+		{
+			int r = flush_registers();
+			if (r <= 0)
+				return r;
+		}
+
+		for (int i = first; i <= last; ++i)
+		{
+			int n = reg + i;
+
+			if ((c->valid.test(n) == false) || (c->regs[n] != data[i]))
+			{
+				c->pending.set(n);
+				c->last_pending = std::max(c->last_pending, n);
+			}
+
+			c->regs[n] = data[i];
+			c->valid.set(n);
+		}
+
+		return len;
+	}
+
+	int r = flush_registers();	// Keep the order of writes to volatile registers
+	if (r <= 0)
+		return r;
+
+	r = write_registers(i2c_addr, (uint8_t)(reg + first), data + first, (last - first) + 1);
+	if (r <= 0)
+	{
+		c->valid.reset();
+		return r;
+	}
+
+	for (int i = first; i <= last; ++i)
+	{
+		int n = reg + i;
+
+		c->regs[n] = data[i];
+		if (c->volatile_regs.test(n) == false)
+			c->valid.set(n);
+	}
+
+	return len;
 }
 
 int tuner_skeleton::i2c_write_reg(uint8_t i2c_addr, uint8_t reg, uint8_t val)
 {
-	return m_demod->i2c_write_reg(i2c_addr, reg, val);
+	uint8_t data[2];
+
+	data[0] = reg;
+	data[1] = val;
+
+	return i2c_write(i2c_addr, data, 2);
 }
 
 int tuner_skeleton::i2c_read_reg(uint8_t i2c_addr, uint8_t reg, uint8_t& data)
 {
-	return m_demod->i2c_read_reg(i2c_addr, reg, data);
+	int r = i2c_write(i2c_addr, &reg, 1);
+	if (r <= 0)
+		return r;
+
+	return i2c_read(i2c_addr, &data, 1);
+}
+
+///////////////////////////////////////////////////////////
+
+#define BULK_ENDPOINT				0x81
+#define ASYNC_STOP_TIMEOUT_MS		1000
+
+class usb_transfer_backend : public transfer_backend
+{
+public:
+	usb_transfer_backend(demod* p)
+		: m_demod(p)
+		, m_client(NULL)
+		, m_in_flight(0)
+		, m_stopping(false)
+	{ }
+	~usb_transfer_backend()
+	{ stop_async(); }
+private:
+	demod* m_demod;
+	async_client* m_client;
+	std::vector<struct libusb_transfer*> m_transfers;
+	int m_in_flight;
+	bool m_stopping;
+public:
+	int open()
+	{ return SUCCESS; }
+	void close()
+	{ }
+	bool is_open() const
+	{ return (m_demod->device_handle() != NULL); }
+	int control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeout)
+	{ return libusb_control_transfer(m_demod->device_handle(), request_type, 0, value, index, data, length, timeout); }
+public:
+	int read_samples(uint8_t* buffer, uint32_t buffer_size, int* bytes_read, int timeout)
+	{ return libusb_bulk_transfer(m_demod->device_handle(), BULK_ENDPOINT, buffer, buffer_size, bytes_read, timeout); }
+	int start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size);
+	int handle_events(int timeout_ms);
+	int stop_async();
+	int transfers_in_flight() const
+	{ return m_in_flight; }
+private:
+	static void LIBUSB_CALL _on_transfer(struct libusb_transfer* transfer);
+	void on_transfer(struct libusb_transfer* transfer);
+};
+
+static int transfer_status_to_result(enum libusb_transfer_status status)
+{
+	switch (status)
+	{
+		case LIBUSB_TRANSFER_COMPLETED:	return 0;
+		case LIBUSB_TRANSFER_TIMED_OUT:	return LIBUSB_ERROR_TIMEOUT;
+		case LIBUSB_TRANSFER_CANCELLED:	return LIBUSB_ERROR_INTERRUPTED;
+		case LIBUSB_TRANSFER_STALL:		return LIBUSB_ERROR_PIPE;
+		case LIBUSB_TRANSFER_NO_DEVICE:	return LIBUSB_ERROR_NO_DEVICE;
+		case LIBUSB_TRANSFER_OVERFLOW:	return LIBUSB_ERROR_OVERFLOW;
+		default:						return LIBUSB_ERROR_IO;
+	}
+}
+
+int usb_transfer_backend::start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size)
+{
+	assert(client);
+	assert(m_transfers.empty());
+
+	if (m_demod->device_handle() == NULL)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	m_client = client;
+	m_stopping = false;
+
+	for (uint32_t i = 0; i < transfer_count; ++i)
+	{
+		struct libusb_transfer* transfer = libusb_alloc_transfer(0);
+		if (transfer == NULL)
+		{
+			stop_async();
+			return LIBUSB_ERROR_NO_MEM;
+		}
+
+		m_transfers.push_back(transfer);
+
+		uint8_t* buffer = client->next_transfer_buffer(transfer_size);
+		if (buffer == NULL)
+			continue;
+
+		libusb_fill_bulk_transfer(transfer, m_demod->device_handle(), BULK_ENDPOINT, buffer, transfer_size, _on_transfer, this, 0);	// No timeout: streaming
+
+		int r = m_demod->CHECK_LIBUSB_NEG_RESULT(libusb_submit_transfer(transfer));
+		if (r < 0)
+		{
+			stop_async();
+			return r;
+		}
+
+		++m_in_flight;
+	}
+
+	return SUCCESS;
+}
+
+void LIBUSB_CALL usb_transfer_backend::_on_transfer(struct libusb_transfer* transfer)
+{
+	((usb_transfer_backend*)transfer->user_data)->on_transfer(transfer);
+}
+
+void usb_transfer_backend::on_transfer(struct libusb_transfer* transfer)
+{
+	--m_in_flight;
+
+	if (m_stopping)
+		return;
+
+	uint8_t* next = m_client->on_transfer_complete(transfer->buffer, transfer->actual_length, transfer_status_to_result(transfer->status));
+	if (next == NULL)
+		return;
+
+	transfer->buffer = next;
+
+	if (m_demod->CHECK_LIBUSB_NEG_RESULT(libusb_submit_transfer(transfer)) == 0)
+		++m_in_flight;
+}
+
+int usb_transfer_backend::handle_events(int timeout_ms)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	int r = libusb_handle_events_timeout_completed(NULL, &tv, NULL);
+	if ((r < 0) && (r != LIBUSB_ERROR_INTERRUPTED))
+		return r;
+
+	return m_in_flight;
+}
+
+int usb_transfer_backend::stop_async()
+{
+	m_stopping = true;
+
+	if (m_in_flight > 0)
+	{
+		for (size_t i = 0; i < m_transfers.size(); ++i)
+			libusb_cancel_transfer(m_transfers[i]);	// Fails harmlessly on those not in flight
+
+		for (int waited = 0; (m_in_flight > 0) && (waited < ASYNC_STOP_TIMEOUT_MS); waited += 10)
+			handle_events(10);
+
+		if (m_in_flight > 0)
+			m_demod->log("%i transfer(s) did not retire - leaking them\n", m_in_flight);
+	}
+
+	if (m_in_flight == 0)
+	{
+		for (size_t i = 0; i < m_transfers.size(); ++i)
+			libusb_free_transfer(m_transfers[i]);
+	}
+
+	m_transfers.clear();
+	m_in_flight = 0;
+	m_client = NULL;
+
+	return SUCCESS;
 }
 
 ///////////////////////////////////////////////////////////
@@ -305,8 +722,12 @@ demod::demod()
 	, m_sample_rate(0)
 	, m_current_info(NULL)
 	, m_tuner_was_active(false)
+	, m_i2c_repeater_depth(0)
 {
 	memset(&m_params, 0x00, sizeof(m_params));
+
+	m_usb_backend = new usb_transfer_backend(this);
+	m_backend = m_usb_backend;
 	
 	m_dummy_tuner = new tuner_skeleton(this);
 	m_tuner = m_dummy_tuner;
@@ -319,6 +740,7 @@ demod::~demod()
 	destroy();
 	
 	delete m_dummy_tuner;
+	delete m_usb_backend;
 }
 
 int demod::check_libusb_result(int res, bool zero_okay, const char* function_name /*= NULL*/, int line_number /*= -1*/, const char* line /*= NULL*/)
@@ -452,6 +874,17 @@ int demod::find_device()
 
 	m_devh = devh;
 
+	if (found != &custom)	// Don't store local variable
+		m_current_info = found;
+
+	return init_device(found);
+}
+
+// Everything after the device is open: demod initialisation, then tuner detection
+int demod::init_device(PDEVICE_INFO found)
+{
+	int r;
+
 	RTL2832_NAMESPACE::tuner::CreateTunerFn factory = /*found->factory*/NULL;	// Auto-detect first
 
 	struct _rtl2832_tuner_info* info = NULL;
@@ -543,9 +976,6 @@ int demod::find_device()
 	//else
 	//	log("Device does not have tuner implemented interface\n");
 
-	if (found != &custom)	// Don't store local variable
-		m_current_info = found;
-
 	log("Found RTL2832 device: %s (tuner: %s)\n", found->name, (t ? t->name() : "interface not implemented"));
 	if (m_params.verbose)
 	{
@@ -561,24 +991,49 @@ int demod::find_device()
 	return SUCCESS;
 }
 
+static DEVICE_INFO _backend_device_info = { "(transfer backend)", 0, 0, NULL };
+
+// Used instead of 'find_device' when a substitute transfer backend is active
+int demod::attach_backend()
+{
+	int r = m_backend->open();
+	if (r != SUCCESS)
+	{
+		log("Could not open transfer backend\n");
+		return r;
+	}
+
+	m_sample_rate_range = std::make_pair(DEFAULT_MIN_SAMPLE_RATE, DEFAULT_MAX_SAMPLE_RATE);
+	m_crystal_frequency = (m_params.crystal_frequency ? m_params.crystal_frequency : DEFAULT_CRYSTAL_FREQUENCY);
+
+	m_current_info = &_backend_device_info;
+
+	return init_device(m_current_info);
+}
+
+int demod::control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length)
+{
+	return m_backend->control_transfer(request_type, value, index, data, length, 0);
+}
+
 int demod::read_array(uint8_t block, uint16_t addr, uint8_t *array, uint8_t len)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	uint16_t index = (block << 8);
 
-	return /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_IN, 0, addr, index, array, len, 0));
+	return /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_IN, addr, index, array, len));
 }
 
 int demod::write_array(uint8_t block, uint16_t addr, uint8_t *array, uint8_t len)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	uint16_t index = (block << 8) | 0x10;
 
-	return /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_OUT, 0, addr, index, array, len, 0));
+	return /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_OUT, addr, index, array, len));
 }
 
 int demod::i2c_write(uint8_t i2c_addr, uint8_t *buffer, int len)
@@ -623,14 +1078,14 @@ int demod::i2c_read_reg(uint8_t i2c_addr, uint8_t reg, uint8_t& data)
 
 int demod::read_reg(uint8_t block, uint16_t addr, uint8_t len, uint16_t& reg)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	int r;
 	unsigned char data[2];
 	uint16_t index = (block << 8);
 
-	r = /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_IN, 0, addr, index, data, len, 0));
+	r = /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_IN, addr, index, data, len));
 	
 	reg = (data[1] << 8) | data[0];
 
@@ -639,7 +1094,7 @@ int demod::read_reg(uint8_t block, uint16_t addr, uint8_t len, uint16_t& reg)
 
 int demod::write_reg(uint8_t block, uint16_t addr, uint16_t val, uint8_t len)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	unsigned char data[2];
@@ -653,12 +1108,12 @@ int demod::write_reg(uint8_t block, uint16_t addr, uint16_t val, uint8_t len)
 
 	data[1] = val & 0xff;
 
-	return /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_OUT, 0, addr, index, data, len, 0));
+	return /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_OUT, addr, index, data, len));
 }
 
 int demod::demod_read_reg(uint8_t page, uint8_t addr, uint8_t len, uint16_t& reg)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	int r;
@@ -667,7 +1122,7 @@ int demod::demod_read_reg(uint8_t page, uint8_t addr, uint8_t len, uint16_t& reg
 	uint16_t index = page;
 	addr = (addr << 8) | 0x20;
 
-	r = /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_IN, 0, addr, index, data, len, 0));
+	r = /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_IN, addr, index, data, len));
 
 	reg = (data[1] << 8) | data[0];
 
@@ -676,7 +1131,7 @@ int demod::demod_read_reg(uint8_t page, uint8_t addr, uint8_t len, uint16_t& reg
 
 int demod::demod_write_reg(uint8_t page, uint16_t addr, uint16_t val, uint8_t len)
 {
-	if (m_devh == NULL)
+	if (is_open() == false)
 		return LIBUSB_ERROR_NO_DEVICE;
   
 	int r;
@@ -691,7 +1146,7 @@ int demod::demod_write_reg(uint8_t page, uint16_t addr, uint16_t val, uint8_t le
 
 	data[1] = val & 0xff;
 
-	r = /*CHECK_LIBUSB_RESULT*/(libusb_control_transfer(m_devh, CTRL_OUT, 0, addr, index, data, len, 0));
+	r = /*CHECK_LIBUSB_RESULT*/(control_transfer(CTRL_OUT, addr, index, data, len));
 
 	if (r >= 0)
 	{
@@ -744,6 +1199,17 @@ int demod::set_sample_rate(uint32_t samp_rate, double* real_rate /*= NULL*/)
 
 int demod::set_i2c_repeater(bool on, const char* function_name /*= NULL*/, int line_number /*= -1*/, const char* line /*= NULL*/)
 {
+	if (on)
+	{
+		if (m_i2c_repeater_depth++ > 0)
+			return 1;	// Already open for an outer command
+	}
+	else if (m_i2c_repeater_depth > 0)
+	{
+		if (--m_i2c_repeater_depth > 0)
+			return 1;	// Outer command still using it
+	}
+
 	return /*CHECK_LIBUSB_RESULT*/CHECK_LIBUSB_RESULT_EX(demod_write_reg(1, 0x01, (on ? 0x18 : 0x10), 1), function_name, line_number, line);
 }
 
@@ -808,19 +1274,29 @@ int demod::initialise(PPARAMS params /*= NULL*/)
 	
 	int r;
 
-	if (m_libusb_init_done == false)
+	if (m_backend != m_usb_backend)
 	{
-		r = CHECK_LIBUSB_NEG_RESULT(libusb_init(NULL));
-		if (r < 0)
+		if (is_open())
+			destroy();
+
+		r = attach_backend();
+	}
+	else
+	{
+		if (m_libusb_init_done == false)
 		{
-			log("\tFailed to initialise libusb\n");
-			return r;
+			r = CHECK_LIBUSB_NEG_RESULT(libusb_init(NULL));
+			if (r < 0)
+			{
+				log("\tFailed to initialise libusb\n");
+				return r;
+			}
+			
+			m_libusb_init_done = true;
 		}
-		
-		m_libusb_init_done = true;
-	}
 
-	r = find_device();
+		r = find_device();
+	}
 	if (r != SUCCESS)
 	{
 		destroy();
@@ -871,6 +1347,8 @@ void demod::destroy()
 {
 	write_reg(SYSB, DEMOD_CTL, 0x20, 1);	// Poweroff demodulator and ADCs
 
+	m_i2c_repeater_depth = 0;
+
 	if ((m_tuner) && (m_tuner != m_dummy_tuner))
 	{
 		delete m_tuner;
@@ -893,6 +1371,9 @@ void demod::destroy()
 		m_devh = NULL;
 	}
 
+	if (m_backend != m_usb_backend)
+		m_backend->close();
+
 	if (m_libusb_init_done)
 	{
 		libusb_exit(NULL);
@@ -1020,7 +1501,31 @@ int demod::read_samples(unsigned char* buffer, uint32_t buffer_size, int* bytes_
 	assert(buffer_size > 0);
 	assert(bytes_read);
 	
-	return libusb_bulk_transfer(m_devh, 0x81, buffer, buffer_size, bytes_read, ((timeout < 0) ? m_params.default_timeout : timeout));
+	return m_backend->read_samples(buffer, buffer_size, bytes_read, ((timeout < 0) ? m_params.default_timeout : timeout));
+}
+
+int demod::start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size)
+{
+	assert(client);
+	assert(transfer_count > 0);
+	assert(transfer_size > 0);
+
+	return m_backend->start_async(client, transfer_count, transfer_size);
+}
+
+int demod::handle_async_events(int timeout_ms)
+{
+	return m_backend->handle_events(timeout_ms);
+}
+
+int demod::stop_async()
+{
+	return m_backend->stop_async();
+}
+
+void demod::set_transfer_backend(transfer_backend* backend /*= NULL*/)
+{
+	m_backend = (backend ? backend : m_usb_backend);
 }
 
 }	// namespace rtl2832
@@ -33,6 +33,7 @@ typedef unsigned __int64 uint64_t;
 #include <vector>
 #include <map>
 #include <string>
+#include <bitset>
 
 RTL2832_API extern int get_map_index(int value, const int* map, int pair_count);
 RTL2832_API extern const char* libusb_result_to_string(int res);
@@ -134,6 +135,33 @@ public:
 	virtual const char* name() const=0;
 };
 
+// Receives bulk transfers as they complete when the demod is streaming asynchronously
+class async_client
+{
+public:
+	virtual uint8_t* next_transfer_buffer(uint32_t length)=0;	// NULL: do not submit
+	virtual uint8_t* on_transfer_complete(uint8_t* buffer, int length, int status)=0;	// 'status' is 0 or a libusb error. Returns buffer for resubmission (or NULL to retire the transfer).
+};
+
+// Moves sample data off the device (libusb by default). Another implementation can be substituted, e.g. to drive the source without hardware.
+class RTL2832_API transfer_backend
+{
+public:
+	virtual ~transfer_backend()
+	{ }
+public:
+	virtual int open()=0;	// Called when the demod initialises (the libusb device is found by the demod itself)
+	virtual void close()=0;
+	virtual bool is_open() const=0;
+	virtual int control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeout)=0;
+public:
+	virtual int read_samples(uint8_t* buffer, uint32_t buffer_size, int* bytes_read, int timeout)=0;
+	virtual int start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size)=0;
+	virtual int handle_events(int timeout_ms)=0;	// Completions are delivered on the calling thread. Returns # transfers in flight, or < 0 on error.
+	virtual int stop_async()=0;	// Cancels outstanding transfers and waits for them to retire
+	virtual int transfers_in_flight() const=0;
+};
+
 class RTL2832_API tuner : public i2c_interface, public named_interface
 {
 public:
@@ -183,11 +211,38 @@ public:
 	virtual demod* parent() const=0;
 };
 
+#define RTL2832_I2C_MAX_WRITE	8	// Bytes in one I2C write, including the register address
+
 class RTL2832_API tuner_skeleton : public tuner
 {
 public:
 	tuner_skeleton(demod* p);
 	virtual ~tuner_skeleton();
+public:
+	enum register_cache_flags
+	{
+		CACHE_READS		= 0x01,	// Reads of registers already in the shadow don't touch the device (only if reads return what was written)
+		DEFER_WRITES	= 0x02,	// Writes are held until the next read, volatile write or repeater close, then sent as bursts
+	};
+protected:
+	typedef struct register_cache
+	{
+		uint8_t				regs[256];
+		std::bitset<256>	valid;
+		std::bitset<256>	volatile_regs;	// Never skipped or served from the shadow (status, self-clearing triggers)
+		std::bitset<256>	pending;	// Held back by DEFER_WRITES
+		int					last_pending;	// Highest of those (-1: none)
+		int					pointer;	// Register address for the next read (-1: not known)
+		int					flags;
+	} REGISTER_CACHE, *PREGISTER_CACHE;
+	std::map<uint8_t,REGISTER_CACHE> m_register_cache;	// Shadow of each I2C address the tuner has asked to cache
+protected:
+	void cache_registers(uint8_t i2c_addr, const uint8_t* volatile_regs = NULL, int volatile_count = 0, int flags = 0);
+	PREGISTER_CACHE register_cache(uint8_t i2c_addr);
+	int flush_registers();
+	int write_registers(uint8_t i2c_addr, uint8_t reg, const uint8_t* data, int len);
+public:
+	void invalidate_register_cache();	// The device no longer matches the shadow (e.g. it was reset)
 protected:
 	demod* m_demod;
 	tuner::PARAMS m_params;
@@ -270,7 +325,7 @@ public:
 		, m_line_number(line_number)
 		, m_line(line)
 	{ p->set_i2c_repeater(true, function_name, line_number, line); }
-	~i2c_repeater_scope()
+	~i2c_repeater_scope()	// Can't report a failure: flush deferred writes before leaving the scope to see one
 	{ m_p->set_i2c_repeater(false, m_function_name, m_line_number, m_line); }
 };
 
@@ -338,6 +393,9 @@ protected:
 	double m_sample_rate;
 	uint32_t m_crystal_frequency;
 	bool m_tuner_was_active;	// True if the kernel driver was detached
+	transfer_backend* m_backend;
+	transfer_backend* m_usb_backend;
+	int m_i2c_repeater_depth;	// Nested repeater windows share one on/off pair
 public:
 	int initialise(PPARAMS params = NULL);
 	const char* name() const;
@@ -346,9 +404,16 @@ public:
 	int set_sample_rate(uint32_t samp_rate, double* real_rate = NULL);
 	int set_if(double frequency);
 	int read_samples(unsigned char* buffer, uint32_t buffer_size, int* bytes_read, int timeout = -1);
+	int start_async(async_client* client, uint32_t transfer_count, uint32_t transfer_size);
+	int handle_async_events(int timeout_ms);
+	int stop_async();
+	void set_transfer_backend(transfer_backend* backend = NULL);	// NULL: libusb. Not owned.
 protected:
 	int find_device();
+	int attach_backend();
+	int init_device(PDEVICE_INFO found);
 	int init_demod();
+	int control_transfer(uint8_t request_type, uint16_t value, uint16_t index, uint8_t* data, uint16_t length);
 	int demod_write_reg(uint8_t page, uint16_t addr, uint16_t val, uint8_t len);
 	int demod_read_reg(uint8_t page, uint8_t addr, uint8_t len, uint16_t& reg);
 	int write_reg(uint8_t block, uint16_t addr, uint16_t val, uint8_t len);
@@ -364,6 +429,8 @@ public:
 	int i2c_write(uint8_t i2c_addr, uint8_t *buffer, int len);
 	int i2c_write_reg(uint8_t i2c_addr, uint8_t reg, uint8_t val);
 	int i2c_read_reg(uint8_t i2c_addr, uint8_t reg, uint8_t& data);
+	inline bool i2c_repeater_open() const
+	{ return (m_i2c_repeater_depth > 0); }
 public:
 	int set_gpio_output(uint8_t gpio);
 	int set_gpio_bit(uint8_t gpio, int val);
@@ -376,6 +443,12 @@ public:
 	{ return m_crystal_frequency; }
 	range_t sample_rate_range() const
 	{ return m_sample_rate_range; }
+	inline transfer_backend* active_transfer_backend() const
+	{ return m_backend; }
+	inline bool is_open() const
+	{ return m_backend->is_open(); }
+	inline struct libusb_device_handle* device_handle() const
+	{ return m_devh; }
 protected:
 	enum usb_reg {
 		USB_SYSCTL			= 0x2000,
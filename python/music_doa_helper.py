@@ -45,8 +45,21 @@ def calculate_antenna_array_response(antenna_array, angular_resolution, l):
 	
 	return response
 
+def uniform_linear_spacing(antenna_array):
+	if len(antenna_array) < 2:
+		return None
+	[x0, y0] = antenna_array[0]
+	spacing = antenna_array[1][0] - x0
+	if spacing <= 0:
+		return None
+	for i in range(len(antenna_array)):
+		[x, y] = antenna_array[i]
+		if abs(y - y0) > (spacing * 1e-6) or abs(x - (x0 + i * spacing)) > (spacing * 1e-6):
+			return None
+	return spacing
+
 class music_doa_helper(gr.hier_block2):
-	def __init__(self, m, n, nsamples, angular_resolution, frequency, array_spacing, antenna_array, output_spectrum=False):
+	def __init__(self, m, n, nsamples, angular_resolution, frequency, array_spacing, antenna_array, output_spectrum=False, forgetting_factor=0.0, subspace_tracking=False, root_music=False):
 		
 		self.m = m
 		self.n = n
@@ -58,6 +71,12 @@ class music_doa_helper(gr.hier_block2):
 		if (nsamples % m) != 0:
 			raise Exception("nsamples must be multiple of m")
 		
+		self.ula_spacing = None
+		if root_music:
+			self.ula_spacing = uniform_linear_spacing(self.antenna_array)
+			if self.ula_spacing is None:
+				raise Exception("root-MUSIC needs a uniform linear array along the 0 degree axis")
+		
 		if output_spectrum:
 			output_sig = gr.io_signature3(3, 3, (gr.sizeof_float * n), (gr.sizeof_float * n), (gr.sizeof_float * angular_resolution))
 		else:
@@ -86,7 +105,7 @@ class music_doa_helper(gr.hier_block2):
 		self.array_response = calculate_antenna_array_response(self.antenna_array, self.angular_resolution, self.l)
 		#print "--> Done."
 		#print self.array_response
-		self.impl = baz.music_doa(self.m, self.n, self.nsamples, self.array_response, self.angular_resolution)
+		self.impl = baz.music_doa(self.m, self.n, self.nsamples, self.array_response, self.angular_resolution, forgetting_factor, subspace_tracking, self._ula_spacing())
 		
 		self.connect(self, self.impl)
 		
@@ -101,3 +120,15 @@ class music_doa_helper(gr.hier_block2):
 		self.l = 299792458.0 / frequency
 		self.array_response = calculate_antenna_array_response(self.antenna_array, self.angular_resolution, self.l)
 		self.impl.set_array_response(self.array_response)
+		self.impl.set_ula_spacing(self._ula_spacing())
+	
+	def _ula_spacing(self):
+		if self.ula_spacing is None:
+			return 0.0
+		return self.ula_spacing / self.l
+	
+	def set_forgetting_factor(self, forgetting_factor):
+		self.impl.set_forgetting_factor(forgetting_factor)
+	
+	def set_subspace_tracking(self, subspace_tracking):
+		self.impl.set_subspace_tracking(subspace_tracking)
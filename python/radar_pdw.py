@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+#  radar_pdw.py
+#  
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#  
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#  MA 02110-1301, USA.
+#  
+#  
+
+# Decodes the pulse descriptor PDUs from baz.radar_detector's 'pdw' port
+
+import numpy
+import pmt
+
+PDW_TIME_VALID	= 0x01
+PDW_PLATEAU		= 0x02
+
+# Must match baz_radar_detector::pulse_descriptor (native byte order)
+PDW_DTYPE = numpy.dtype([
+	('toa', numpy.uint64),
+	('time_seconds', numpy.uint64),
+	('time_fractional_seconds', numpy.float64),
+	('width', numpy.uint32),
+	('peak', numpy.float32),
+	('plateau', numpy.float32),
+	('flags', numpy.uint32),
+])
+
+def decode(msg):
+	"""Returns (sample rate, descriptor array) for one PDU"""
+	meta = pmt.car(msg)
+	sample_rate = pmt.to_long(pmt.dict_ref(meta, pmt.intern("sample_rate"), pmt.from_long(0)))
+	data = numpy.array(pmt.u8vector_elements(pmt.cdr(msg)), dtype=numpy.uint8)
+	return (sample_rate, data.view(PDW_DTYPE))
+
+def pri(pdws, sample_rate):
+	"""Pulse repetition intervals (seconds) between consecutive descriptors"""
+	return numpy.diff(pdws['toa'].astype(numpy.int64)) / float(sample_rate)
+
+def pulse_width(pdws, sample_rate):
+	return pdws['width'] / float(sample_rate)
+
+def absolute_time(pdws):
+	"""Leading edge times from rx_time (NaN where the stream had no rx_time yet)"""
+	t = pdws['time_seconds'].astype(numpy.float64) + pdws['time_fractional_seconds']
+	return numpy.where((pdws['flags'] & PDW_TIME_VALID) != 0, t, numpy.nan)
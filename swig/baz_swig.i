@@ -102,6 +102,11 @@
 %include "std_map.i"
 %template() std::map<int,std::string>;
 
+namespace std {
+%template(map_string_string) map<string, string>;
+%template(vector_string) vector<string>;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifdef LIBUSB_FOUND
@@ -127,6 +132,8 @@ public:
 	void set_fir_coefficients(const std::vector</*uint8_t*/int>& coeffs);
 	void set_crystal_frequency(/*uint32_t*/int freq);
 	void set_tuner_name(const char* name);
+	void set_replay(const char* path, bool loop = false);	// "-": stdin
+	void set_replay_pacing(bool on = true);
 public:
 	size_t recv_samples_per_packet() const;
 	uint64_t samples_received() const;
@@ -138,12 +145,22 @@ public:
 	uint32_t read_packet_count() const;
 	uint32_t buffer_overflow_count() const;
 	uint32_t buffer_underrun_count() const;
+	int transfers_in_flight() const;
+	uint32_t short_transfer_count() const;
+	double latency_percentile(double percentile) const;	// ms
+	double latency_max() const;
+	uint64_t latency_count() const;
+	uint32_t replay_overrun_count() const;
+	uint64_t replay_bytes_dropped() const;
+	uint32_t replay_i2c_transfer_count() const;
+	uint32_t replay_i2c_repeater_count() const;
 public:
 	void set_verbose(bool on = true);
 	void set_read_length(/*uint32_t*/int length);
 	void set_buffer_multiplier(/*uint32_t*/int mul);
 	void set_use_buffer(bool use = true);
 	void set_buffer_level(float level);
+	void set_transfer_count(/*uint32_t*/int count);	// 0: synchronous reads
 public:
 	bool relative_gain() const;
 	bool verbose() const;
@@ -151,6 +168,11 @@ public:
 	uint32_t buffer_multiplier() const;
 	bool use_buffer() const;
 	float buffer_level() const;
+	uint32_t transfer_count() const;
+	uint32_t transfer_size() const;
+	std::string replay_path() const;
+	bool replay_loop() const;
+	bool replay_pacing() const;
 public:
 	bool set_sample_rate(double sample_rate);
 	bool set_frequency(double freq);
@@ -160,6 +182,9 @@ public:
 	bool set_gain_mode(const char* mode);
 	void set_relative_gain(bool on = true);
 	int set_auto_gain_mode(bool on = true);
+	void set_remove_dc(bool on = true);
+	bool set_conversion(const char* name);	// NULL/empty: the fastest
+	void set_retune_settle_time(double seconds);
 public:
 	const char* name() const;
 	double sample_rate() const;
@@ -170,6 +195,10 @@ public:
 	int gain_mode() const;
 	std::string gain_mode_string() const;
 	bool auto_gain_mode() const;
+	bool remove_dc() const;
+	const char* conversion() const;
+	std::vector<std::string> conversions() const;
+	double retune_settle_time() const;
 public:	// SWIG get: tuner ranges/values
 	/*RTL2832_NAMESPACE::*//*range_t*/std::pair<double,double> gain_range() const;
 	/*RTL2832_NAMESPACE::*//*values_t*/std::vector<double> gain_values() const;
@@ -345,13 +374,13 @@ class gr_udp_source : public gr::sync_block
 baz_udp_source_sptr 
 baz_make_udp_source (size_t itemsize, const char *host, 
 		    unsigned short port, int payload_size=1472,
-		    bool eof=true, bool wait=true, bool bor=false, bool verbose=false, size_t buf_size = 0, int mode = -1) throw (std::runtime_error);
+		    bool eof=true, bool wait=true, bool bor=false, bool verbose=false, size_t buf_size = 0, int mode = -1, int batch_size = 0, int reorder_window = 0) throw (std::runtime_error);
 
 class baz_udp_source : public gr::sync_block
 {
  protected:
   baz_udp_source (size_t itemsize, const char *host, 
-		 unsigned short port, int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode) throw (std::runtime_error);
+		 unsigned short port, int payload_size, bool eof, bool wait, bool bor, bool verbose, size_t buf_size, int mode, int batch_size, int reorder_window) throw (std::runtime_error);
 
  public:
   ~baz_udp_source ();
@@ -359,6 +388,18 @@ class baz_udp_source : public gr::sync_block
   int payload_size() { return d_payload_size; }
   int get_port();
   void signal_eos();
+  int batch_size() const;
+  uint64_t batch_count() const;
+  uint64_t batch_datagrams() const;
+  uint64_t batch_bytes() const;
+  int batch_max() const;
+  int batch_last() const;
+  double batch_average() const;
+  int reorder_window() const;
+  uint64_t packets_lost() const;
+  uint64_t packets_reordered() const;
+  uint64_t packets_duplicated() const;
+  uint64_t packets_late() const;
 };
 ///////////////////////////////////////////////////////////////////////////////
 /*
@@ -402,14 +443,14 @@ class gr_udp_sink : public gr::sync_block
 baz_udp_sink_sptr 
 baz_make_udp_sink (size_t itemsize, 
 		  const char *host, unsigned short port,
-		  int payload_size=1472, bool eof=true, bool bor=false) throw (std::runtime_error);
+		  int payload_size=1472, bool eof=true, bool bor=false, int batch_size=0) throw (std::runtime_error);
 
 class baz_udp_sink : public gr::sync_block
 {
  protected:
   baz_udp_sink (size_t itemsize, 
 	       const char *host, unsigned short port,
-	       int payload_size, bool eof, bool bor)
+	       int payload_size, bool eof, bool bor, int batch_size)
     throw (std::runtime_error);
 
  public:
@@ -421,6 +462,13 @@ class baz_udp_sink : public gr::sync_block
   void set_borip(bool enable);
   void set_payload_size(int payload_size);
   void set_status_msgq(gr::msg_queue::sptr queue);
+  void add_destination(const char *host, unsigned short port);
+  void remove_destination(const char *host, unsigned short port);
+  void clear_destinations();
+  int destination_count();
+  uint64_t destination_drops();
+  int batch_size() const;
+  bool gso() const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -561,14 +609,20 @@ public:
 
 GR_SWIG_BLOCK_MAGIC(baz,music_doa)
 
-baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const /*array_response_t*/std::vector<std::vector<gr_complex> >& array_response, unsigned int resolution);
+baz_music_doa_sptr baz_make_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const /*array_response_t*/std::vector<std::vector<gr_complex> >& array_response, unsigned int resolution, double forgetting_factor = 0.0, bool subspace_tracking = false, double ula_spacing = 0.0);
 
 class baz_music_doa : public gr::sync_block
 {
 private:
-	baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution);
+	baz_music_doa(unsigned int m, unsigned int n, unsigned int nsamples, const array_response_t& array_response, unsigned int resolution, double forgetting_factor, bool subspace_tracking, double ula_spacing);
 public:
 	void set_array_response(const /*array_response_t*/std::vector<std::vector<gr_complex> >& array_response);
+	void set_forgetting_factor(double forgetting_factor);
+	double forgetting_factor() const;
+	void set_subspace_tracking(bool enable);
+	bool subspace_tracking() const;
+	void set_ula_spacing(double spacing);
+	double ula_spacing() const;
 };
 
 #endif // ARMADILLO_FOUND
@@ -626,11 +680,6 @@ public:
 
 ///////////////////////////////////////////////////////////////////////////////
 
-namespace std {
-%template(map_string_string) map<string, string>;
-%template(vector_string) vector<string>;
-}
-
 %pythoncode %{
 def _baz_burster_config_xform_types(k, v):
 	if k in ['trigger_tags', 'length_tags']:
@@ -744,17 +793,18 @@ public:
 
 GR_SWIG_BLOCK_MAGIC(baz,radar_detector)
 
-baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq);
+baz_radar_detector_sptr baz_make_radar_detector (int sample_rate, gr::msg_queue::sptr msgq, int pdw_batch = 256);
 
 class baz_radar_detector : public gr::block
 {
-	baz_radar_detector (int sample_rate, gr_msg_queue_sptr msgq);  	// private constructor
+	baz_radar_detector (int sample_rate, gr_msg_queue_sptr msgq, int pdw_batch);  	// private constructor
 public:
 	void set_base_level(float level);
 	void set_threshold(float threshold);
 	void set_pulse_plateau(float level);
 	bool set_param(const std::string& param, float value);
 	void skip(int skip);
+	void set_pdw_batch(int batch);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -828,18 +878,24 @@ public:
 
 GR_SWIG_BLOCK_MAGIC(baz,tcp_sink);
 
-baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking = true, bool auto_reconnect = false, bool verbose = false) throw (std::runtime_error);
+baz_tcp_sink_sptr baz_make_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking = true, bool auto_reconnect = false, bool verbose = false, int zerocopy_threshold = 0, int coalesce_size = 0, double coalesce_latency = 0.01, bool server = false, int client_queue_size = 0, bool disconnect_slow = false, bool compact_tags = true) throw (std::runtime_error);
 
 class baz_tcp_sink : public gr::sync_block
 {
 protected:
-	baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose) throw (std::runtime_error);
+	baz_tcp_sink (size_t itemsize, const char *host, unsigned short port, bool blocking, bool auto_reconnect, bool verbose, int zerocopy_threshold, int coalesce_size, double coalesce_latency, bool server, int client_queue_size, bool disconnect_slow, bool compact_tags) throw (std::runtime_error);
 public:
 	~baz_tcp_sink ();
 
 	bool connect( const char *host, unsigned short port );
 	void disconnect();
 	void set_status_msgq(gr::msg_queue::sptr queue);
+	uint64_t zerocopy_completed() const;
+	uint64_t zerocopy_copied() const;
+	int zerocopy_pending() const;
+	int client_count();
+	uint64_t packets_dropped() const;
+	uint64_t clients_evicted() const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -857,6 +913,9 @@ public:
 
 	int get_port();
 	void signal_eos();
+
+	unsigned long long bytes_direct() const;
+	unsigned long long bytes_staged() const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -931,7 +990,24 @@ baz_correlator_sptr baz_make_correlator(
     int sync_length=511,
     int sync_offset=50,
     //sync_dtype='c8',
-    int sync_window_length=50
+    int sync_window_length=50,
+    int fft_threshold=64
+);
+
+%rename(correlator_bank) baz_make_correlator_bank;
+
+baz_correlator_sptr baz_make_correlator_bank(
+    float samp_rate,
+    float symbol_rate,
+    int window_length,
+    float threshold,
+    int width,
+    const std::vector<std::string>& sync_paths,
+    int sync_length=511,
+    int sync_offset=50,
+    int sync_window_length=500,
+    const std::vector<float>& freq_offsets=std::vector<float>(),
+    int fft_threshold=64
 );
 
 class baz_correlator : public gr::block
@@ -943,11 +1019,13 @@ protected:
         int window_length,
         float threshold,
         int width,
-        const char* sync_path,
+        const std::vector<std::string>& sync_paths,
         int sync_length,
         int sync_offset,
         //sync_dtype='c8',
-        int sync_window_length
+        int sync_window_length,
+        const std::vector<float>& freq_offsets,
+        int fft_threshold
 );
 public:
 	~baz_correlator();